@@ -129,6 +129,7 @@ flow_entry_free (flowtable_main_t * fm, flowtable_main_per_cpu_t * fmt,
 
   if (f->app_uri)
     vec_free (f->app_uri);
+  vec_free (f->app_buf);
 
   vec_add1 (fmt->flow_cache, f - fm->flows);
 
@@ -151,8 +151,10 @@ typedef struct flow_entry
   u32 _tsval_offs[FT_ORDER_MAX];
 
   u8 *app_uri;
+  u8 *app_buf;			/* QUIC CRYPTO stream prefix during detection */
   /* Generation ID that must match the session's if this flow is up to date */
   u16 generation;
+  u16 app_parse_offset;		/* HTTP header parse position */
 #if CLIB_DEBUG > 0
   u32 cpu_index;
 #endif
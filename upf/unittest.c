@@ -1,8 +1,14 @@
+#include <math.h>
 #include <vlib/vlib.h>
+#include <vppinfra/random.h>
 
 #include "upf.h"
 #include "upf_ipfilter.h"
 #include "upf_app_db.h"
+#include "upf_app_dpo.h"
+#include "upf_acl_index.h"
+#include "upf_pfcp.h"
+#include "upf_pfcp_server.h"
 
 static int upf_test_do_debug = 0;
 
@@ -167,6 +173,20 @@ ip_app_test_v4 (void)
   UPF_TEST (upf_app_ip_rule_match (app_id_any, &flow, &ip_ue_172_17_0_5),
             "rule match (IPANY): 172.17.0.5:12345 -> 10.10.10.10:80");
 
+  UPF_TEST (clib_bitmap_get (upf_app_ip_candidates (&ip_10_10_10_10), app_id) &&
+            clib_bitmap_get (upf_app_ip_candidates (&ip_10_10_10_10), app_id_any),
+            "candidates 10.10.10.10: IPAPP, IPANY");
+  UPF_TEST (!clib_bitmap_get (upf_app_ip_candidates (&ip_10_20_20_20), app_id) &&
+            clib_bitmap_get (upf_app_ip_candidates (&ip_10_20_20_20), app_id_any),
+            "candidates 10.20.20.20: IPANY");
+
+  upf_app_ip_flow_t af;
+  upf_app_ip_flow_init (&af, &flow);
+  UPF_TEST (upf_app_ip_flow_rule_match (app_id, &af, &ip_ue_172_17_0_5) &&
+            af.looked_up &&
+            upf_app_ip_flow_rule_match (app_id_any, &af, &ip_ue_172_17_0_5),
+            "one candidate lookup for IPAPP and IPANY: 10.10.10.10");
+
   flow.key.ip[FT_REVERSE].ip4.as_u32 = ip_192_168_0_5.ip4.as_u32;
   UPF_TEST (upf_app_ip_rule_match (app_id, &flow, &ip_ue_172_17_0_5),
             "rule match (IPAPP): 172.17.0.5:12345 -> 192.168.0.5:80");
@@ -271,6 +291,772 @@ ip_app_test_v6 (void)
   return res;
 }
 
+/* many rules sharing a server prefix, matched by server port interval */
+static int
+ip_app_test_ports (void)
+{
+  int res = 0;
+  upf_main_t * gtm = &upf_main;
+  u8 * app_name = format (0, "IPPORTS");
+  u32 app_id, i;
+  uword *p;
+
+  ip46_address_t ip_ue_172_17_0_5 = {
+    .ip4.as_u32 = clib_host_to_net_u32(0xac110005),
+  };
+  ip46_address_t ip_10_30_1_1 = {
+    .ip4.as_u32 = clib_host_to_net_u32(0x0a1e0101),
+  };
+  ip46_address_t ip_10_30_2_1 = {
+    .ip4.as_u32 = clib_host_to_net_u32(0x0a1e0201),
+  };
+
+  UPF_TEST (upf_app_add_del (gtm, app_name, 0, 1) == 0, "add app");
+  for (i = 0; i < 200; i++)
+    {
+      char *filter = (char *) format (0, "permit out ip from 10.30.0.0/16 "
+                                      "%u-%u to assigned%c",
+                                      1000 + 10 * i, 1004 + 10 * i, 0);
+      UPF_TEST (test_add_ip_rule (app_name, 3000 + i, filter) == 0,
+                "add ip rule %u", 3000 + i);
+      vec_free (filter);
+    }
+  UPF_TEST (test_add_ip_rule (app_name, 3200,
+                              "permit out ip from 10.30.1.0/24 443 to assigned") == 0,
+            "add ip rule 3200");
+
+  p = hash_get_mem (gtm->upf_app_by_name, app_name);
+  UPF_TEST (!!p, "get app by name");
+  app_id = upf_adf_get_adr_db (p[0]);
+
+  flow_entry_t flow;
+  memset (&flow, 0, sizeof(flow));
+  flow.key.ip[FT_ORIGIN].ip4.as_u32 = ip_ue_172_17_0_5.ip4.as_u32;
+  flow.key.port[FT_ORIGIN] = clib_host_to_net_u16(12345);
+  flow.key.ip[FT_REVERSE].ip4.as_u32 = ip_10_30_1_1.ip4.as_u32;
+
+  flow.key.port[FT_REVERSE] = clib_host_to_net_u16(1004);
+  UPF_TEST (upf_app_ip_rule_match (app_id, &flow, &ip_ue_172_17_0_5),
+            "rule match (IPPORTS): 172.17.0.5:12345 -> 10.30.1.1:1004");
+  flow.key.port[FT_REVERSE] = clib_host_to_net_u16(1005);
+  UPF_TEST (!upf_app_ip_rule_match (app_id, &flow, &ip_ue_172_17_0_5),
+            "rule mismatch (IPPORTS): 172.17.0.5:12345 -> 10.30.1.1:1005");
+  flow.key.port[FT_REVERSE] = clib_host_to_net_u16(443);
+  UPF_TEST (upf_app_ip_rule_match (app_id, &flow, &ip_ue_172_17_0_5),
+            "rule match (IPPORTS): 172.17.0.5:12345 -> 10.30.1.1:443");
+  flow.key.port[FT_REVERSE] = clib_host_to_net_u16(2990);
+  UPF_TEST (upf_app_ip_rule_match (app_id, &flow, &ip_ue_172_17_0_5),
+            "rule match (IPPORTS): 172.17.0.5:12345 -> 10.30.1.1:2990");
+
+  flow.key.ip[FT_REVERSE].ip4.as_u32 = ip_10_30_2_1.ip4.as_u32;
+  flow.key.port[FT_REVERSE] = clib_host_to_net_u16(443);
+  UPF_TEST (!upf_app_ip_rule_match (app_id, &flow, &ip_ue_172_17_0_5),
+            "rule mismatch (IPPORTS): 172.17.0.5:12345 -> 10.30.2.1:443");
+  flow.key.port[FT_REVERSE] = clib_host_to_net_u16(2994);
+  UPF_TEST (upf_app_ip_rule_match (app_id, &flow, &ip_ue_172_17_0_5),
+            "rule match (IPPORTS): 172.17.0.5:12345 -> 10.30.2.1:2994");
+  flow.key.port[FT_REVERSE] = clib_host_to_net_u16(2995);
+  UPF_TEST (!upf_app_ip_rule_match (app_id, &flow, &ip_ue_172_17_0_5),
+            "rule mismatch (IPPORTS): 172.17.0.5:12345 -> 10.30.2.1:2995");
+
+  upf_adf_put_adr_db (app_id);
+  UPF_TEST (upf_app_add_del (gtm, app_name, 0, 0) == 0, "del IPPORTS");
+  vec_free (app_name);
+
+  return res;
+}
+
+static void
+acl_test_random_ip (ip46_address_t * ip, u32 * seed, int is_ip4, u32 spread)
+{
+  u32 r = random_u32 (seed) & spread;
+
+  if (is_ip4)
+    {
+      ip4_address_t ip4 = {
+	.as_u32 = clib_host_to_net_u32 (0x0a000000 | (r & 0xffffff)),
+      };
+
+      ip46_address_set_ip4 (ip, &ip4);
+    }
+  else
+    {
+      ip6_address_t ip6;
+
+      clib_memset (&ip6, 0, sizeof (ip6));
+      ip6.as_u16[0] = clib_host_to_net_u16 (0x2001);
+      ip6.as_u16[1] = clib_host_to_net_u16 (0x0db8);
+      ip6.as_u16[2] = clib_host_to_net_u16 (r >> 8);
+      ip6.as_u8[15] = r & 0xff;
+      ip46_address_set_ip6 (ip, &ip6);
+    }
+}
+
+static void
+acl_test_random_mask (ip46_address_t * mask, u32 * seed, int is_ip4)
+{
+  static const u8 plens4[] = { 0, 8, 24, 30, 32 };
+  static const u8 plens6[] = { 0, 32, 48, 64, 120, 128 };
+
+  clib_memset (mask, 0, sizeof (*mask));
+  if (is_ip4)
+    ip4_address_mask_from_width (&mask->ip4,
+				 plens4[random_u32 (seed) %
+					ARRAY_LEN (plens4)]);
+  else
+    ip6_address_mask_from_width (&mask->ip6,
+				 plens6[random_u32 (seed) %
+					ARRAY_LEN (plens6)]);
+}
+
+static void
+acl_test_random_acl (upf_acl_t * acl, u32 * seed, u32 precedence,
+		     int is_ip4, u32 spread)
+{
+  static const u16 ports[][2] = { {0, 65535}, {80, 80}, {443, 443},
+				  {1000, 2000} };
+  int f;
+
+  clib_memset (acl, 0, sizeof (*acl));
+  acl->is_ip4 = is_ip4;
+  acl->precedence = precedence;
+
+  if (random_u32 (seed) & 1)
+    {
+      acl->match_teid = 1;
+      acl->teid = 1 + (random_u32 (seed) & 3);
+    }
+
+  acl->match_ue_ip = random_u32 (seed) % 3;
+  acl_test_random_ip (&acl->ue_ip, seed, is_ip4, spread);
+
+  if (random_u32 (seed) & 1)
+    {
+      acl->mask.protocol = ~0;
+      acl->match.protocol = (random_u32 (seed) & 1) ?
+	IP_PROTOCOL_TCP : IP_PROTOCOL_UDP;
+    }
+
+  for (f = UPF_ACL_FIELD_SRC; f <= UPF_ACL_FIELD_DST; f++)
+    {
+      u32 p = random_u32 (seed) % ARRAY_LEN (ports);
+
+      acl_test_random_ip (&acl->match.address[f], seed, is_ip4, spread);
+      acl_test_random_mask (&acl->mask.address[f], seed, is_ip4);
+      acl->mask.port[f] = ports[p][0];
+      acl->match.port[f] = ports[p][1];
+    }
+}
+
+static void
+acl_test_random_key (upf_acl_key_t * key, u32 * seed, int is_ip4,
+		     u32 spread)
+{
+  static const u16 ports[] = { 80, 443, 1500, 5000 };
+
+  clib_memset (key, 0, sizeof (*key));
+  acl_test_random_ip (&key->addr[UPF_ACL_FIELD_SRC], seed, is_ip4, spread);
+  acl_test_random_ip (&key->addr[UPF_ACL_FIELD_DST], seed, is_ip4, spread);
+  key->teid = random_u32 (seed) % 5;
+  key->port[UPF_ACL_FIELD_SRC] = ports[random_u32 (seed) % 4];
+  key->port[UPF_ACL_FIELD_DST] = ports[random_u32 (seed) % 4];
+  key->proto = (random_u32 (seed) & 1) ? IP_PROTOCOL_TCP : IP_PROTOCOL_UDP;
+}
+
+/* the compiled ACL index must pick the same ACL as the linear scan */
+static int
+acl_index_test (int is_ip4)
+{
+  int res = 0;
+  u32 seed = 0xdeadbeef;
+  u32 n_rules, i;
+
+  for (n_rules = 1; n_rules <= 256; n_rules <<= 1)
+    {
+      upf_acl_index_t idx = { 0 };
+      upf_acl_t *acls = 0;
+      u32 n_match = 0;
+
+      vec_validate (acls, n_rules - 1);
+      vec_foreach_index (i, acls)
+	acl_test_random_acl (&acls[i], &seed, i, is_ip4, 0x0303);
+      upf_acl_index_build (&idx, acls, is_ip4);
+
+      for (i = 0; i < 10000; i++)
+	{
+	  upf_acl_key_t key;
+	  u32 linear, indexed;
+
+	  acl_test_random_key (&key, &seed, is_ip4, 0x0303);
+	  linear = upf_acl_linear_lookup (acls, &key, 0, 0);
+	  indexed = upf_acl_index_lookup (&idx, acls, &key, 0, 0);
+	  n_match += (linear != ~0);
+	  if (linear != indexed)
+	    {
+	      UPF_TEST (0, "ACL index (%s, %u rules): linear %d, indexed %d",
+			is_ip4 ? "IPv4" : "IPv6", n_rules, linear, indexed);
+	      break;
+	    }
+	}
+      UPF_TEST (i == 10000, "ACL index (%s, %u rules): %u matches",
+		is_ip4 ? "IPv4" : "IPv6", n_rules, n_match);
+
+      upf_acl_index_free (&idx);
+      vec_free (acls);
+    }
+
+  return res;
+}
+
+static void
+qer_test_policer_config (policer_read_response_type_st * p, u32 kbps)
+{
+  sse2_qos_pol_cfg_params_st cfg = {
+    .rate_type = SSE2_QOS_RATE_KBPS,
+    .rnd_type = SSE2_QOS_ROUND_TO_CLOSEST,
+    .rfc = SSE2_QOS_POLICER_TYPE_1R2C,
+    .conform_action = {.action_type = SSE2_QOS_ACTION_TRANSMIT,},
+    .exceed_action = {.action_type = SSE2_QOS_ACTION_DROP,},
+    .violate_action = {.action_type = SSE2_QOS_ACTION_DROP,},
+  };
+
+  cfg.rb.kbps.cir_kbps = kbps;
+  cfg.rb.kbps.cb_bytes = kbps * 100 / 8;
+  sse2_pol_logical_2_physical (&cfg, p);
+}
+
+/* a DL policer of the QER with the rate on every thread, as attached */
+static upf_qer_policer_t *
+qer_test_policer_init (upf_qer_t * qer, u32 kbps)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  upf_main_t *gtm = &upf_main;
+  upf_qer_policer_shard_t *sh;
+  upf_qer_policer_t *pol;
+  u32 i;
+
+  pool_get_aligned_zero (gtm->qer_policers, pol, CLIB_CACHE_LINE_BYTES);
+  qer->policer.value = pol - gtm->qer_policers;
+  qer->gate_status[UPF_UL] = qer->gate_status[UPF_DL] = PFCP_GATE_OPEN;
+
+  pol->policed[UPF_DL] = 1;
+  pol->single_rate[UPF_DL] = 1;
+  vec_validate_aligned (pol->shards, tm->n_vlib_mains - 1,
+			CLIB_CACHE_LINE_BYTES);
+  vec_foreach (sh, pol->shards)
+    qer_test_policer_config (&sh->policer[UPF_DL], kbps);
+
+  vec_validate (gtm->qer_active, tm->n_vlib_mains - 1);
+  for (i = 0; i < tm->n_vlib_mains; i++)
+    vec_validate (gtm->qer_active[i], qer->policer.value / BITS (uword));
+
+  for (i = 0; i < UPF_QER_N_COUNTERS; i++)
+    {
+      vlib_validate_combined_counter (&gtm->qer_counters[i],
+				      qer->policer.value);
+      vlib_zero_combined_counter (&gtm->qer_counters[i], qer->policer.value);
+    }
+
+  return pol;
+}
+
+static void
+qer_test_policer_free (upf_qer_policer_t * pol)
+{
+  vec_free (pol->shards);
+  pool_put (upf_main.qer_policers, pol);
+}
+
+/*
+ * A PDR with a QoS flow MBR below the session AMBR: a packet dropped by
+ * the AMBR must not use up the MBR, and vice versa.
+ */
+static int
+qer_hierarchy_test (void)
+{
+  vlib_main_t *vm = vlib_get_main ();
+  upf_main_t *gtm = &upf_main;
+  policer_read_response_type_st *mbr, *ambr;
+  upf_qer_policer_t *mbr_pol, *ambr_pol;
+  u64 now = 1 << 20, second, mbr_bucket;
+  struct rules r;
+  vlib_buffer_t b;
+  vlib_counter_t c;
+  u32 i, next;
+  int res = 0;
+
+  clib_memset (&r, 0, sizeof (r));
+  vec_validate (r.qer, 1);
+  mbr_pol = qer_test_policer_init (&r.qer[0], 100000);
+  ambr_pol = qer_test_policer_init (&r.qer[1], 80);
+  mbr = &mbr_pol->shards[vm->thread_index].policer[UPF_DL];
+  ambr = &ambr_pol->shards[vm->thread_index].policer[UPF_DL];
+
+  vec_validate (r.pdr, 0);
+  vec_add1 (r.pdr[0].qer_indices, 0);
+  vec_add1 (r.pdr[0].qer_indices, 1);
+
+  clib_memset (&b, 0, sizeof (b));
+  b.current_length = 1000;
+
+  /* drain the AMBR while the time stands still */
+  for (i = 0; i < 1000; i++)
+    {
+      mbr_bucket = mbr->current_bucket;
+      next = process_qers (vm, NULL, &r, &r.pdr[0], &b, 1, 0, now,
+			   UPF_FORWARD_NEXT_IP_INPUT);
+      if (next != UPF_FORWARD_NEXT_IP_INPUT)
+	break;
+    }
+  UPF_TEST (i > 0 && i < 1000 && next == UPF_FORWARD_NEXT_DROP,
+	    "AMBR exhausted after %u packets", i);
+  UPF_TEST (mbr->current_bucket == mbr_bucket,
+	    "packet red at the AMBR does not charge the MBR");
+
+  vlib_get_combined_counter (&gtm->qer_counters[UPF_QER_COUNTER_CONFORM],
+			     r.qer[0].policer.value, &c);
+  UPF_TEST (c.packets == i, "MBR charged for %llu packets", c.packets);
+  vlib_get_combined_counter (&gtm->qer_counters[UPF_QER_COUNTER_VIOLATE],
+			     r.qer[1].policer.value, &c);
+  UPF_TEST (c.packets == 1, "AMBR dropped %llu packets", c.packets);
+
+  /* a second later the AMBR bucket is full again */
+  second = vm->clib_time.clocks_per_second /
+    (1 << POLICER_TICKS_PER_PERIOD_SHIFT);
+  next = process_qers (vm, NULL, &r, &r.pdr[0], &b, 1, 0, now + second,
+		       UPF_FORWARD_NEXT_IP_INPUT);
+  UPF_TEST (next == UPF_FORWARD_NEXT_IP_INPUT &&
+	    ambr->current_bucket < ambr->current_limit,
+	    "AMBR refilled and charged");
+
+  qer_test_policer_free (mbr_pol);
+  qer_test_policer_free (ambr_pol);
+  vec_free (r.pdr[0].qer_indices);
+  vec_free (r.pdr);
+  vec_free (r.qer);
+  return res;
+}
+
+/*
+ * The traffic table of a URR: lookups probe past expired addresses, a
+ * full table refuses inserts and asks for a rebuild early enough, the
+ * rebuild keeps every address and adds the one that found no room.
+ */
+static int
+urr_traffic_table_test (void)
+{
+  upf_urr_traffic_table_t *tt;
+  ip46_address_t addrs[UPF_URR_TRAFFIC_MIN_SLOTS + 1];
+  upf_urr_t urr = { 0 };
+  uword size;
+  int res = 0;
+  u32 i, n_found;
+
+  size = sizeof (*tt) + UPF_URR_TRAFFIC_MIN_SLOTS * sizeof (tt->slots[0]);
+  tt = clib_mem_alloc_aligned (size, CLIB_CACHE_LINE_BYTES);
+  clib_memset (tt, 0, size);
+  tt->mask = UPF_URR_TRAFFIC_MIN_SLOTS - 1;
+
+  for (i = 0; i < ARRAY_LEN (addrs); i++)
+    {
+      ip4_address_t ip4 = {.as_u32 = clib_host_to_net_u32 (0x0a000001 + i) };
+      ip46_address_set_ip4 (&addrs[i], &ip4);
+    }
+
+  for (i = 0; i < UPF_URR_TRAFFIC_MIN_SLOTS; i++)
+    {
+      if (upf_urr_traffic_needs_rebuild (tt))
+	break;
+      UPF_TEST (upf_urr_traffic_insert (tt, &addrs[i], 1.0) != NULL,
+		"insert address %u", i);
+    }
+  UPF_TEST (i == UPF_URR_TRAFFIC_MIN_SLOTS / 2 + 1,
+	    "rebuild requested after %u of %u slots", i,
+	    UPF_URR_TRAFFIC_MIN_SLOTS);
+
+  for (; i < UPF_URR_TRAFFIC_MIN_SLOTS; i++)
+    UPF_TEST (upf_urr_traffic_insert (tt, &addrs[i], 1.0) != NULL,
+	      "insert address %u", i);
+  UPF_TEST (upf_urr_traffic_insert (tt, &addrs[i], 1.0) == NULL,
+	    "full table refuses an insert");
+
+  /* expire every other address the way the PFCP process does */
+  for (i = 0; i < UPF_URR_TRAFFIC_MIN_SLOTS; i += 2)
+    {
+      upf_urr_traffic_find (tt, &addrs[i])->state = UPF_URR_TRAFFIC_DELETED;
+      tt->n_entries--;
+    }
+  for (i = 0, n_found = 0; i < UPF_URR_TRAFFIC_MIN_SLOTS; i++)
+    n_found += upf_urr_traffic_find (tt, &addrs[i]) != NULL;
+  UPF_TEST (n_found == UPF_URR_TRAFFIC_MIN_SLOTS / 2,
+	    "%u addresses left after expiry", n_found);
+  UPF_TEST (upf_urr_traffic_insert (tt, &addrs[0], 2.0) != NULL,
+	    "expired slot reused");
+  UPF_TEST (tt->n_used == UPF_URR_TRAFFIC_MIN_SLOTS,
+	    "reuse does not take a free slot");
+
+  /* another address that found no room, the rebuild must add it */
+  tt->grow = 1;
+  urr.traffic = tt;
+  upf_urr_traffic_rebuild (&urr, &addrs[UPF_URR_TRAFFIC_MIN_SLOTS]);
+  tt = urr.traffic;
+
+  for (i = 0, n_found = 0; i <= UPF_URR_TRAFFIC_MIN_SLOTS; i++)
+    n_found += upf_urr_traffic_find (tt, &addrs[i]) != NULL;
+  UPF_TEST (n_found == tt->n_entries && n_found ==
+	    UPF_URR_TRAFFIC_MIN_SLOTS / 2 + 2,
+	    "rebuild kept %u addresses", n_found);
+  UPF_TEST (upf_urr_traffic_find (tt, &addrs[0])->first_seen == 2.0,
+	    "rebuild kept the times");
+  UPF_TEST (!tt->grow && !upf_urr_traffic_needs_rebuild (tt) &&
+	    tt->n_used == tt->n_entries,
+	    "rebuilt table has room and no deleted slots");
+
+  clib_mem_free (tt);
+  return res;
+}
+
+/* a session with one volume URR on its only PDR */
+static upf_session_t *
+urr_test_session_init (struct rules *r)
+{
+  upf_main_t *gtm = &upf_main;
+  upf_session_t *sx;
+  upf_urr_t *urr;
+
+  pool_get_zero (gtm->sessions, sx);
+  /* URR events for the session are dropped, it is gone by then */
+  sx->cp_seid = ~0ULL;
+
+  clib_memset (r, 0, sizeof (*r));
+  vec_validate (r->urr, 0);
+  urr = &r->urr[0];
+  urr->methods = PFCP_URR_VOLUME;
+  urr->time_of_first_packet = INFINITY;
+  urr->time_of_last_packet = INFINITY;
+  urr->monitoring_time.vlib_time = INFINITY;
+  vec_validate (r->pdr, 0);
+  vec_add1 (r->pdr[0].urr_indices, 0);
+
+  upf_urr_acc_reset (sx, 1);
+  return sx;
+}
+
+static void
+urr_test_session_free (upf_session_t * sx, struct rules *r)
+{
+  upf_main_t *gtm = &upf_main;
+
+  upf_urr_acc_reset (sx, 0);
+  vec_free (r->pdr[0].urr_indices);
+  vec_free (r->pdr);
+  vec_free (r->urr);
+  pool_put (gtm->sessions, sx);
+}
+
+/*
+ * Per frame URR accounting: the packets of a frame are summed up until
+ * one of them could use up the budget of the thread, that packet and
+ * the rest of the frame are accounted one by one.
+ */
+static int
+urr_batch_quota_test (void)
+{
+  vlib_main_t *vm = vlib_get_main ();
+  upf_main_t *gtm = &upf_main;
+  upf_urr_batch_t batch;
+  upf_urr_acc_t *acc;
+  upf_session_t *sx;
+  struct rules r;
+  vlib_buffer_t b;
+  int res = 0;
+  u32 i, next;
+
+  sx = urr_test_session_init (&r);
+  acc = &gtm->session_acc[vm->thread_index][sx - gtm->sessions].urr[0];
+  acc->limit.total = 10000;
+
+  clib_memset (&b, 0, sizeof (b));
+  b.current_length = 1000;
+
+  upf_urr_batch_init (&batch);
+  for (i = 0; i < 9; i++)
+    upf_urr_batch_add (vm, &batch, sx, "test", &r, &r.pdr[0], &b, 1, 0,
+		       UPF_FORWARD_NEXT_IP_INPUT);
+  UPF_TEST (acc->packets[0].total == 0 && batch.n_entries == 1 &&
+	    batch.entries[0].packets == 9,
+	    "packets below the budget are summed up in the frame");
+
+  next = upf_urr_batch_add (vm, &batch, sx, "test", &r, &r.pdr[0], &b, 1, 0,
+			    UPF_FORWARD_NEXT_IP_INPUT);
+  UPF_TEST (next == UPF_FORWARD_NEXT_IP_INPUT &&
+	    acc->packets[0].total == 10 && acc->bytes[0].total == 10000,
+	    "crossing packet accounted right away, %llu bytes",
+	    acc->bytes[0].total);
+  UPF_TEST (acc->reported_seq == acc->merge_seq,
+	    "budget reported on the crossing packet");
+
+  upf_urr_batch_add (vm, &batch, sx, "test", &r, &r.pdr[0], &b, 1, 0,
+		     UPF_FORWARD_NEXT_IP_INPUT);
+  UPF_TEST (acc->packets[0].total == 11 && batch.entries[0].packets == 0,
+	    "rest of the frame accounted packet by packet");
+
+  upf_urr_batch_flush (vm, &batch);
+  UPF_TEST (acc->packets[0].total == 11 && acc->bytes[0].dl == 11000 &&
+	    acc->bytes[0].ul == 0, "flush accounts nothing twice");
+
+  /* the quota is used up, the next frame drops the packets */
+  r.urr[0].status |= URR_OVER_QUOTA;
+  upf_urr_batch_init (&batch);
+  next = upf_urr_batch_add (vm, &batch, sx, "test", &r, &r.pdr[0], &b, 1, 0,
+			    UPF_FORWARD_NEXT_IP_INPUT);
+  upf_urr_batch_flush (vm, &batch);
+  UPF_TEST (next == UPF_FORWARD_NEXT_DROP && acc->packets[0].total == 12,
+	    "packet over quota accounted and dropped");
+
+  urr_test_session_free (sx, &r);
+  return res;
+}
+
+/*
+ * Monitoring Time: a frame keeps the epoch it read at its start, the
+ * usage goes after the Monitoring Time from the first frame that sees
+ * the epoch of the URR on, the merge splits the usage there.
+ */
+static int
+urr_monitoring_epoch_test (void)
+{
+  vlib_main_t *vm = vlib_get_main ();
+  upf_main_t *gtm = &upf_main;
+  upf_urr_batch_t batch;
+  upf_urr_acc_t *acc;
+  upf_session_t *sx;
+  upf_urr_t *urr;
+  struct rules r;
+  vlib_buffer_t b;
+  int res = 0;
+  u32 i, epoch, saved_epoch;
+
+  sx = urr_test_session_init (&r);
+  acc = &gtm->session_acc[vm->thread_index][sx - gtm->sessions].urr[0];
+  urr = &r.urr[0];
+
+  clib_memset (&b, 0, sizeof (b));
+  b.current_length = 1000;
+
+  upf_urr_batch_init (&batch);
+  for (i = 0; i < 3; i++)
+    upf_urr_batch_add (vm, &batch, sx, "test", &r, &r.pdr[0], &b, 1, 0,
+		       UPF_FORWARD_NEXT_IP_INPUT);
+
+  /* the PFCP process reaches the Monitoring Time during the frame */
+  saved_epoch = gtm->monitoring_epoch;
+  epoch = saved_epoch + 1;
+  if (epoch == 0)
+    epoch = 1;
+  urr->monitoring_epoch = epoch;
+  CLIB_MEMORY_STORE_BARRIER ();
+  gtm->monitoring_epoch = epoch;
+
+  for (i = 0; i < 2; i++)
+    upf_urr_batch_add (vm, &batch, sx, "test", &r, &r.pdr[0], &b, 1, 0,
+		       UPF_FORWARD_NEXT_IP_INPUT);
+  upf_urr_batch_flush (vm, &batch);
+  UPF_TEST (acc->bytes[0].total == 5000 && acc->bytes[1].total == 0,
+	    "frame of the epoch flip accounted before the Monitoring Time");
+
+  upf_urr_batch_init (&batch);
+  for (i = 0; i < 4; i++)
+    upf_urr_batch_add (vm, &batch, sx, "test", &r, &r.pdr[0], &b, 1, 0,
+		       UPF_FORWARD_NEXT_IP_INPUT);
+  upf_urr_batch_flush (vm, &batch);
+  UPF_TEST (acc->bytes[0].total == 5000 && acc->bytes[1].total == 4000,
+	    "next frame accounted after the Monitoring Time");
+
+  upf_urr_acc_merge (sx, r.urr);
+  UPF_TEST ((urr->status & URR_AFTER_MONITORING_TIME) &&
+	    urr->usage_before_monitoring_time.volume.bytes.total == 5000 &&
+	    urr->volume.measure.bytes.total == 4000,
+	    "merge splits the usage at the epoch flip, %llu before, "
+	    "%llu after", urr->usage_before_monitoring_time.volume.bytes.total,
+	    urr->volume.measure.bytes.total);
+
+  gtm->monitoring_epoch = saved_epoch;
+  urr_test_session_free (sx, &r);
+  return res;
+}
+
+/*
+ * The verdict cache must not hand out the verdict of another host/URI
+ * with the same hash, nor cache what it cannot compare.
+ */
+static int
+adr_verdict_cache_test (void)
+{
+  upf_adr_verdict_set_t *cache = 0;
+  u8 *a = format (0, "zero-rated.example.com");
+  u8 *b = format (0, "charged.example.net.xx");
+  u8 *l = 0;
+  u64 hash = 0x1234, matched = 0;
+  int res = 0;
+
+  vec_validate_aligned (cache, UPF_ADR_VERDICT_CACHE_SETS - 1,
+			CLIB_CACHE_LINE_BYTES);
+  vec_validate_init_empty (l, UPF_ADR_VERDICT_KEY_BYTES, 'x');
+
+  UPF_TEST (vec_len (a) == vec_len (b), "same length hosts");
+
+  /* both hosts forced into the same hash */
+  upf_adr_verdict_insert (cache, 1, hash, a, vec_len (a), 1);
+  UPF_TEST (!upf_adr_verdict_lookup (cache, 1, hash, b, vec_len (b),
+				     &matched),
+	    "colliding host misses the cache");
+  UPF_TEST (upf_adr_verdict_lookup (cache, 1, hash, a, vec_len (a),
+				    &matched) && matched == 1,
+	    "cached host hits with its own verdict");
+
+  upf_adr_verdict_insert (cache, 1, hash, b, vec_len (b), 2);
+  UPF_TEST (upf_adr_verdict_lookup (cache, 1, hash, a, vec_len (a),
+				    &matched) && matched == 1 &&
+	    upf_adr_verdict_lookup (cache, 1, hash, b, vec_len (b),
+				    &matched) && matched == 2,
+	    "colliding hosts keep their own verdicts");
+  UPF_TEST (!upf_adr_verdict_lookup (cache, 2, hash, a, vec_len (a),
+				     &matched),
+	    "new rules generation misses the cache");
+
+  upf_adr_verdict_insert (cache, 1, hash, l, vec_len (l), 4);
+  UPF_TEST (!upf_adr_verdict_lookup (cache, 1, hash, l, vec_len (l),
+				     &matched),
+	    "URI longer than %u bytes is not cached",
+	    UPF_ADR_VERDICT_KEY_BYTES);
+
+  vec_free (cache);
+  vec_free (a);
+  vec_free (b);
+  vec_free (l);
+  return res;
+}
+
+static u64
+dl_buffer_test_counter (upf_counters_type_t c)
+{
+  return vlib_get_simple_counter (&upf_main.upf_simple_counters[c], 0);
+}
+
+/*
+ * DL buffering: packets of a BUFF FAR are queued up to the limit of the
+ * BAR and reported once, a change of the FAR to FORW releases them and
+ * drops those whose PDR is gone.
+ */
+static int
+dl_buffer_test (void)
+{
+  vlib_main_t *vm = vlib_get_main ();
+  pfcp_server_main_t *psm = &pfcp_server_main;
+  upf_main_t *gtm = &upf_main;
+  u64 buffered, flushed, discarded, session_limit;
+  upf_event_dldr_t *d;
+  upf_session_t *sx;
+  struct rules *active;
+  vlib_frame_t *f;
+  u32 bis[5], si, i, n_reports = 0;
+  int res = 0;
+
+  if (vlib_buffer_alloc (vm, bis, ARRAY_LEN (bis)) != ARRAY_LEN (bis))
+    {
+      UPF_TEST (0, "buffer allocation");
+      return res;
+    }
+
+  pool_get_zero (gtm->sessions, sx);
+  si = sx - gtm->sessions;
+  sx->cp_seid = ~0ULL;
+  /* the report is held back, the PFCP process does not send it */
+  sx->bar.flags = UPF_BAR_PRESENT;
+  sx->bar.suggested_buffering_packets_count = 4;
+  sx->bar.dl_data_notification_delay = 100;
+
+  active = pfcp_get_rules (sx, PFCP_ACTIVE);
+  vec_validate (active->far, 0);
+  active->far[0].id = 1;
+  active->far[0].apply_action = FAR_BUFFER | FAR_NOTIFY_CP;
+  vec_validate (active->pdr, 1);
+  active->pdr[0].id = 1;
+  active->pdr[0].far_id = 1;
+  active->pdr[1].id = 2;
+  active->pdr[1].far_id = 1;
+
+  buffered = dl_buffer_test_counter (UPF_DL_BUFFERED);
+  flushed = dl_buffer_test_counter (UPF_DL_BUFFER_FLUSHED);
+  discarded = dl_buffer_test_counter (UPF_DL_BUFFER_DISCARDED);
+  session_limit = dl_buffer_test_counter (UPF_DL_BUFFER_SESSION_LIMIT);
+
+  /* three packets for the first PDR, two for the second */
+  for (i = 0; i < ARRAY_LEN (bis); i++)
+    {
+      vlib_buffer_t *b = vlib_get_buffer (vm, bis[i]);
+
+      UPF_ENTER_SUBGRAPH (b, si, 1);
+      upf_buffer_opaque (b)->gtpu.pdr_idx = i < 3 ? 0 : 1;
+      b->current_length = sizeof (ip4_header_t);
+      clib_memset (vlib_buffer_get_current (b), 0, b->current_length);
+      *(u8 *) vlib_buffer_get_current (b) = 0x45;
+    }
+
+  f = vlib_get_frame_to_node (vm, upf_dl_buffer_node.index);
+  clib_memcpy_fast (vlib_frame_vector_args (f), bis, sizeof (bis));
+  f->n_vectors = ARRAY_LEN (bis);
+  vlib_put_frame_to_node (vm, upf_dl_buffer_node.index, f);
+  vlib_process_suspend (vm, 10e-3);
+
+  UPF_TEST (sx->dl_buffered == 4 &&
+	    dl_buffer_test_counter (UPF_DL_BUFFERED) == buffered + 4,
+	    "%u packets buffered", sx->dl_buffered);
+  UPF_TEST (dl_buffer_test_counter (UPF_DL_BUFFER_SESSION_LIMIT) ==
+	    session_limit + 1, "packet over the BAR limit dropped");
+
+  pool_foreach (d, psm->delayed_dl_data_reports)
+  {
+    if (d->session_idx == si && d->cp_seid == sx->cp_seid)
+      {
+	UPF_TEST (d->pdr_id == 1, "report for PDR %u", d->pdr_id);
+	n_reports++;
+	pool_put (psm->delayed_dl_data_reports, d);
+      }
+  }
+  UPF_TEST (sx->dl_data_reported && n_reports == 1,
+	    "%u DL Data Reports for the session", n_reports);
+
+  /*
+   * What pfcp_update_apply does when the FAR changes to FORW and the
+   * second PDR is removed. upf-forward does not support the UDP/IPv4
+   * outer header yet, it drops the released packets.
+   */
+  active->far[0].apply_action = FAR_FORWARD;
+  active->far[0].forward.flags = FAR_F_OUTER_HEADER_CREATION;
+  active->far[0].forward.outer_header_creation.description =
+    OUTER_HEADER_CREATION_UDP_IP4;
+  _vec_len (active->pdr) = 1;
+  sx->dl_data_reported = 0;
+  upf_dl_buffer_flush (sx, 0);
+
+  UPF_TEST (dl_buffer_test_counter (UPF_DL_BUFFER_FLUSHED) == flushed + 3 &&
+	    dl_buffer_test_counter (UPF_DL_BUFFER_DISCARDED) ==
+	    discarded + 1, "3 packets released, 1 without PDR discarded");
+  UPF_TEST (sx->dl_buffered == 0 &&
+	    dl_buffer_test_counter (UPF_DL_BUFFERED) == buffered,
+	    "nothing left buffered");
+
+  /* let upf-forward take the released packets before the session goes */
+  vlib_process_suspend (vm, 10e-3);
+
+  vec_free (active->pdr);
+  vec_free (active->far);
+  pool_put (gtm->sessions, sx);
+  return res;
+}
+
 static clib_error_t *
 test_upf_command_fn (vlib_main_t * vm,
 		     unformat_input_t * input, vlib_cli_command_t * cmd)
@@ -278,7 +1064,12 @@ test_upf_command_fn (vlib_main_t * vm,
   if (unformat (input, "debug"))
     upf_test_do_debug = 1;
 
-  if (ip_app_test_v4() == 0 && ip_app_test_v6() == 0)
+  if (ip_app_test_v4() == 0 && ip_app_test_v6() == 0 &&
+      ip_app_test_ports () == 0 &&
+      acl_index_test (1) == 0 && acl_index_test (0) == 0 &&
+      qer_hierarchy_test () == 0 && urr_traffic_table_test () == 0 &&
+      urr_batch_quota_test () == 0 && urr_monitoring_epoch_test () == 0 &&
+      adr_verdict_cache_test () == 0 && dl_buffer_test () == 0)
     return 0;
   else
     return clib_error_return (0, "test failed");
@@ -293,6 +1084,294 @@ VLIB_CLI_COMMAND (test_upf_command, static) =
   };
 /* *INDENT-ON* */
 
+/*
+ * First packet classification cost of the linear ACL scan vs. the
+ * compiled index. Rules model a single UE: UL filters on the UE address
+ * and the bearer TEID with varying remote prefixes and ports.
+ */
+static clib_error_t *
+test_upf_acl_benchmark_command_fn (vlib_main_t * vm,
+				   unformat_input_t * input,
+				   vlib_cli_command_t * cmd)
+{
+  static const u32 sizes[] = { 10, 20, 50, 100, 200, 500, 1000 };
+  u32 n_lookups = 100000;
+  u32 seed = 0x5eed;
+  int is_ip4 = 0;
+  int s;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "ip4"))
+	is_ip4 = 1;
+      else if (unformat (input, "ip6"))
+	is_ip4 = 0;
+      else if (unformat (input, "lookups %u", &n_lookups))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_lookups == 0)
+    return clib_error_return (0, "lookups must be non-zero");
+
+  vlib_cli_output (vm, "%8s %16s %16s", "rules", "linear clk/pkt",
+		   "indexed clk/pkt");
+
+  for (s = 0; s < ARRAY_LEN (sizes); s++)
+    {
+      upf_acl_index_t idx = { 0 };
+      upf_acl_key_t *keys = 0;
+      upf_acl_t *acls = 0;
+      ip46_address_t ue;
+      u64 t0, t_linear, t_indexed;
+      u32 i, sum = 0;
+
+      acl_test_random_ip (&ue, &seed, is_ip4, 0xffffff);
+
+      vec_validate (acls, sizes[s] - 1);
+      vec_foreach_index (i, acls)
+      {
+	upf_acl_t *acl = &acls[i];
+
+	acl_test_random_acl (acl, &seed, i, is_ip4, 0xffffff);
+	acl->match_teid = 1;
+	acl->teid = 1;
+	acl->match_ue_ip = UPF_ACL_UL;
+	acl->ue_ip = ue;
+	clib_memset (&acl->mask.address[UPF_ACL_FIELD_SRC], 0,
+		     sizeof (ip46_address_t));
+      }
+      upf_acl_index_build (&idx, acls, is_ip4);
+
+      vec_validate (keys, n_lookups - 1);
+      vec_foreach_index (i, keys)
+      {
+	upf_acl_key_t *key = &keys[i];
+
+	acl_test_random_key (key, &seed, is_ip4, 0xffffff);
+	key->teid = 1;
+	key->addr[UPF_ACL_FIELD_SRC] = ue;
+	/* hit a configured prefix most of the time */
+	if (random_u32 (&seed) & 3)
+	  key->addr[UPF_ACL_FIELD_DST] =
+	    acls[random_u32 (&seed) % sizes[s]].match.address
+	    [UPF_ACL_FIELD_DST];
+      }
+
+      t0 = clib_cpu_time_now ();
+      vec_foreach_index (i, keys)
+	sum += upf_acl_linear_lookup (acls, &keys[i], 0, 0);
+      t_linear = clib_cpu_time_now () - t0;
+
+      t0 = clib_cpu_time_now ();
+      vec_foreach_index (i, keys)
+	sum -= upf_acl_index_lookup (&idx, acls, &keys[i], 0, 0);
+      t_indexed = clib_cpu_time_now () - t0;
+
+      vlib_cli_output (vm, "%8u %16.1f %16.1f%s", sizes[s],
+		       (f64) t_linear / n_lookups,
+		       (f64) t_indexed / n_lookups,
+		       sum ? " (MISMATCH)" : "");
+
+      upf_acl_index_free (&idx);
+      vec_free (acls);
+      vec_free (keys);
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_upf_acl_benchmark_command, static) =
+  {
+    .path = "test upf acl-benchmark",
+    .short_help = "test upf acl-benchmark [ip4|ip6] [lookups <n>]",
+    .function = test_upf_acl_benchmark_command_fn,
+  };
+/* *INDENT-ON* */
+
+static int
+adr_test_match_handler (unsigned int id, unsigned long long from,
+			unsigned long long to, unsigned int flags, void *ctx)
+{
+  *(u64 *) ctx |= 1ULL << id;
+  return 0;
+}
+
+/* draw a rank in [0, n) from the cumulative Zipf distribution */
+static u32
+adr_test_zipf_sample (f64 * cdf, u32 * seed)
+{
+  f64 r = random_f64 (seed);
+  u32 lo = 0, hi = vec_len (cdf) - 1;
+
+  while (lo < hi)
+    {
+      u32 mid = (lo + hi) / 2;
+
+      if (cdf[mid] < r)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/*
+ * Cost of detecting the application of a flow from its host name, with
+ * and without the per thread verdict cache, for a Zipf distributed host
+ * name workload.
+ */
+static clib_error_t *
+test_upf_adr_cache_benchmark_command_fn (vlib_main_t * vm,
+					 unformat_input_t * input,
+					 vlib_cli_command_t * cmd)
+{
+  u32 n_apps = UPF_ADR_VERDICT_MAX_MATCHES, n_hosts = 100000;
+  u32 n_lookups = 1000000;
+  f64 zipf_s = 1.0, norm = 0;
+  upf_adr_verdict_set_t *cache = 0;
+  hs_compile_error_t *compile_err = NULL;
+  hs_database_t *database = NULL;
+  hs_scratch_t *scratch = NULL;
+  const char **expressions = 0;
+  unsigned int *flags = 0, *ids = 0;
+  u8 **hosts = 0, **regexes = 0;
+  u32 *workload = 0, seed = 0x5eed;
+  u64 t0, t_scan, t_cached, hits = 0, sum = 0;
+  clib_error_t *error = 0;
+  f64 *cdf = 0;
+  u32 i;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "hosts %u", &n_hosts))
+	;
+      else if (unformat (input, "lookups %u", &n_lookups))
+	;
+      else if (unformat (input, "zipf %f", &zipf_s))
+	;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_hosts == 0 || n_lookups == 0)
+    return clib_error_return (0, "hosts and lookups must be non-zero");
+
+  for (i = 0; i < n_apps; i++)
+    {
+      vec_add1 (regexes, format (0, "\\.app%u\\.example\\.com$%c", i, 0));
+      vec_add1 (expressions, (const char *) regexes[i]);
+      vec_add1 (flags, HS_FLAG_SINGLEMATCH);
+      vec_add1 (ids, i);
+    }
+
+  if (hs_compile_multi (expressions, flags, ids, n_apps, HS_MODE_BLOCK,
+			NULL, &database, &compile_err) != HS_SUCCESS)
+    {
+      error = clib_error_return (0, "compile failed: %s",
+				 compile_err->message);
+      hs_free_compile_error (compile_err);
+      goto done;
+    }
+  if (hs_alloc_scratch (database, &scratch) != HS_SUCCESS)
+    {
+      error = clib_error_return (0, "scratch allocation failed");
+      goto done;
+    }
+
+  /* half of the host names belong to no application */
+  for (i = 0; i < n_hosts; i++)
+    vec_add1 (hosts, format (0, "www%u.app%u.example.com", i,
+			     i % (2 * n_apps)));
+
+  vec_validate (cdf, n_hosts - 1);
+  for (i = 0; i < n_hosts; i++)
+    norm += cdf[i] = 1.0 / pow (i + 1, zipf_s);
+  for (i = 0; i < n_hosts; i++)
+    cdf[i] = (i ? cdf[i - 1] : 0) + cdf[i] / norm;
+
+  vec_validate (workload, n_lookups - 1);
+  vec_foreach_index (i, workload)
+    workload[i] = adr_test_zipf_sample (cdf, &seed);
+
+  t0 = clib_cpu_time_now ();
+  vec_foreach_index (i, workload)
+  {
+    u8 *host = hosts[workload[i]];
+    u64 matched = 0;
+
+    hs_scan (database, (const char *) host, vec_len (host), 0, scratch,
+	     adr_test_match_handler, &matched);
+    sum += matched;
+  }
+  t_scan = clib_cpu_time_now () - t0;
+
+  vec_validate_aligned (cache, UPF_ADR_VERDICT_CACHE_SETS - 1,
+			CLIB_CACHE_LINE_BYTES);
+
+  t0 = clib_cpu_time_now ();
+  vec_foreach_index (i, workload)
+  {
+    u8 *host = hosts[workload[i]];
+    u64 hash = upf_adr_verdict_hash (host, vec_len (host));
+    u64 matched = 0;
+
+    if (upf_adr_verdict_lookup (cache, 1, hash, host, vec_len (host),
+				&matched))
+      hits++;
+    else
+      {
+	hs_scan (database, (const char *) host, vec_len (host), 0, scratch,
+		 adr_test_match_handler, &matched);
+	upf_adr_verdict_insert (cache, 1, hash, host, vec_len (host),
+				matched);
+      }
+    sum -= matched;
+  }
+  t_cached = clib_cpu_time_now () - t0;
+
+  vlib_cli_output (vm, "hosts %u, lookups %u, zipf s %.2f, cache %u entries",
+		   n_hosts, n_lookups, zipf_s,
+		   UPF_ADR_VERDICT_CACHE_SETS * UPF_ADR_VERDICT_CACHE_WAYS);
+  vlib_cli_output (vm, "hit rate %.1f%%, scan %.1f clk/lookup, "
+		   "cached %.1f clk/lookup%s",
+		   100.0 * hits / n_lookups, (f64) t_scan / n_lookups,
+		   (f64) t_cached / n_lookups, sum ? " (MISMATCH)" : "");
+
+done:
+  if (scratch)
+    hs_free_scratch (scratch);
+  if (database)
+    hs_free_database (database);
+  vec_foreach_index (i, regexes)
+    vec_free (regexes[i]);
+  vec_foreach_index (i, hosts)
+    vec_free (hosts[i]);
+  vec_free (regexes);
+  vec_free (hosts);
+  vec_free (expressions);
+  vec_free (flags);
+  vec_free (ids);
+  vec_free (cdf);
+  vec_free (workload);
+  vec_free (cache);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_upf_adr_cache_benchmark_command, static) =
+  {
+    .path = "test upf adr-cache-benchmark",
+    .short_help = "test upf adr-cache-benchmark [hosts <n>] [lookups <n>] "
+    "[zipf <s>]",
+    .function = test_upf_adr_cache_benchmark_command_fn,
+  };
+/* *INDENT-ON* */
+
 /*
   TODO: test intersecting rules
   TODO: test reverse flows
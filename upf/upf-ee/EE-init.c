@@ -6,15 +6,7 @@
 #include <stdio.h>
 
 void log_ee(char* j) {
-  clib_warning(j);
-  char* f = "/openair-upf/log_ee.txt";
-  FILE *file = fopen(f, "a");
-  if (file == NULL) {
-    perror("Failed to open file");
-    return;
-  }
-  fprintf(file, "%s\n", j);
-  fclose(file);
+  ee_log_info("%s", j);
 }
 
 static clib_error_t* init_send_report_client(vlib_main_t *vm, vlib_node_runtime_t * rt, vlib_frame_t * f) {
@@ -15,6 +15,7 @@
 #include "types/types.h"
 #include <pthread.h>
 #include "send_data.h"
+#include "ee_log.h"
 #define PORT 8080
 void log_ee(char* j);
 static clib_error_t* init_send_report_client(vlib_main_t *vm, vlib_node_runtime_t * rt, vlib_frame_t * f);
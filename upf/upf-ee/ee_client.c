@@ -16,4 +16,87 @@ VLIB_REGISTER_NODE(send_report_node) = {
         .function = periodic_sending,
         .type = VLIB_NODE_TYPE_PROCESS,
         .name = "periodic-sending-process",
-};
\ No newline at end of file
+};
+static clib_error_t *
+ee_notification_batch_command_fn (vlib_main_t * vm,
+				  unformat_input_t * main_input,
+				  vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  clib_error_t *error = NULL;
+  u32 max_size = ee_batch_max_size;
+  u32 max_delay = ee_batch_max_delay;
+
+  if (!unformat_user (main_input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "max-size %u", &max_size))
+	;
+      else if (unformat (line_input, "max-delay %u", &max_delay))
+	;
+      else if (unformat (line_input, "disable"))
+	max_size = 1;
+      else
+	{
+	  error = unformat_parse_error (line_input);
+	  goto done;
+	}
+    }
+
+  if (max_size == 0)
+    {
+      error = clib_error_return (0, "max-size must be at least 1");
+      goto done;
+    }
+
+  ee_batch_max_size = max_size;
+  ee_batch_max_delay = max_delay;
+
+  /* don't keep notifications queued under the old limits */
+  flush_report_batches (time (NULL), true);
+
+done:
+  unformat_free (line_input);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ee_notification_batch_command, static) =
+{
+  .path = "upf ee notification batch",
+  .short_help =
+  "upf ee notification batch [max-size <n>] [max-delay <seconds>] [disable]"
+  " (max-delay is checked once a second)",
+  .function = ee_notification_batch_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+ee_show_notification_batch_command_fn (vlib_main_t * vm,
+				       unformat_input_t * input,
+				       vlib_cli_command_t * cmd)
+{
+  u32 pending = 0, batches;
+
+  batches = pending_report_batches (&pending);
+
+  vlib_cli_output (vm, "max-size %u max-delay %us%s",
+		   ee_batch_max_size, ee_batch_max_delay,
+		   ee_batch_max_size <= 1 ? " (disabled)" : "");
+  vlib_cli_output (vm, "requests sent: %llu, notifications sent: %llu",
+		   ee_batch_stats.requests, ee_batch_stats.notifications);
+  vlib_cli_output (vm, "pending: %u notifications in %u batches",
+		   pending, batches);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ee_show_notification_batch_command, static) =
+{
+  .path = "show upf ee notification batch",
+  .short_help = "show upf ee notification batch",
+  .function = ee_show_notification_batch_command_fn,
+};
+/* *INDENT-ON* */
@@ -0,0 +1,418 @@
+// Added by: Fatemeh Shafiei Ardestani
+// Date: 2024-08-18.
+//  See Git history for complete list of changes.
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <vlib/vlib.h>
+#include <vlib/unix/unix.h>
+
+#include "ee_log.h"
+
+#define EE_LOG_DEFAULT_PATH "/openair-upf/log_ee.txt"
+
+ee_log_main_t ee_log_main = {
+  .level = EE_LOG_INFO,
+  .max_file_size = 64 << 20,
+  .max_rotations = 4,
+  .flush_interval_ms = 200,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .kick = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t ee_log_once = PTHREAD_ONCE_INIT;
+static __thread ee_log_ring_t *ee_log_thread_ring;
+
+static const char *ee_log_level_names[] = {
+  [EE_LOG_ERR] = "err",
+  [EE_LOG_WARN] = "warn",
+  [EE_LOG_INFO] = "info",
+  [EE_LOG_DEBUG] = "debug",
+};
+
+static u8 *
+format_ee_log_level (u8 * s, va_list * args)
+{
+  u32 level = va_arg (*args, u32);
+
+  if (level < ARRAY_LEN (ee_log_level_names))
+    return format (s, "%s", ee_log_level_names[level]);
+  return format (s, "unknown(%u)", level);
+}
+
+static uword
+unformat_ee_log_level (unformat_input_t * input, va_list * args)
+{
+  u8 *level = va_arg (*args, u8 *);
+
+  for (int i = 0; i < ARRAY_LEN (ee_log_level_names); i++)
+    if (unformat (input, ee_log_level_names[i]))
+      {
+	*level = i;
+	return 1;
+      }
+  return 0;
+}
+
+static void
+ee_log_rotate (ee_log_main_t * lm)
+{
+  u8 *from = 0, *to = 0;
+
+  if (lm->file)
+    fclose (lm->file);
+  lm->file = NULL;
+
+  for (u32 i = lm->max_rotations; i > 0; i--)
+    {
+      vec_reset_length (from);
+      vec_reset_length (to);
+      if (i == 1)
+	from = format (from, "%s%c", lm->path, 0);
+      else
+	from = format (from, "%s.%u%c", lm->path, i - 1, 0);
+      to = format (to, "%s.%u%c", lm->path, i, 0);
+      rename ((char *) from, (char *) to);
+    }
+  if (lm->max_rotations == 0)
+    unlink ((char *) lm->path);
+
+  vec_free (from);
+  vec_free (to);
+  lm->rotations++;
+}
+
+static int
+ee_log_open (ee_log_main_t * lm)
+{
+  struct stat st;
+
+  lm->file = fopen ((char *) lm->path, "a");
+  if (!lm->file)
+    return -1;
+
+  /* let stdio coalesce the records, we flush explicitly */
+  setvbuf (lm->file, NULL, _IOFBF, 64 << 10);
+  lm->file_size = (fstat (fileno (lm->file), &st) == 0) ? st.st_size : 0;
+  return 0;
+}
+
+/* called with lm->lock held */
+static void
+ee_log_drain (ee_log_main_t * lm)
+{
+  u32 n_rings = __atomic_load_n (&lm->n_rings, __ATOMIC_ACQUIRE);
+  u32 drained = 0;
+
+  if (!lm->file && ee_log_open (lm) != 0)
+    {
+      /* nowhere to write to, drop everything to keep the rings moving */
+      for (u32 r = 0; r < n_rings; r++)
+	{
+	  ee_log_ring_t *ring = lm->rings[r];
+	  __atomic_store_n (&ring->tail,
+			    __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE),
+			    __ATOMIC_RELEASE);
+	}
+      return;
+    }
+
+  for (u32 r = 0; r < n_rings; r++)
+    {
+      ee_log_ring_t *ring = lm->rings[r];
+      u32 head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+      u32 tail = ring->tail;
+
+      while (tail != head)
+	{
+	  ee_log_record_t *rec =
+	    &ring->records[tail & (EE_LOG_RING_SIZE - 1)];
+	  time_t sec = (time_t) rec->ts;
+	  struct tm tm;
+	  int n;
+
+	  localtime_r (&sec, &tm);
+	  n = fprintf (lm->file,
+		       "%04d-%02d-%02d %02d:%02d:%02d.%03d %-5s %.*s\n",
+		       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		       tm.tm_hour, tm.tm_min, tm.tm_sec,
+		       (int) ((rec->ts - sec) * 1e3),
+		       ee_log_level_names[rec->level], rec->len, rec->msg);
+	  if (n > 0)
+	    lm->file_size += n;
+	  tail++;
+	  drained++;
+
+	  if (lm->max_file_size && lm->file_size >= lm->max_file_size)
+	    {
+	      ee_log_rotate (lm);
+	      if (ee_log_open (lm) != 0)
+		{
+		  tail = head;
+		  break;
+		}
+	    }
+	}
+      __atomic_store_n (&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+  if (drained && lm->file)
+    {
+      fflush (lm->file);
+      lm->written += drained;
+      lm->flushes++;
+    }
+}
+
+static void *
+ee_log_flusher (void *arg)
+{
+  ee_log_main_t *lm = &ee_log_main;
+
+  pthread_mutex_lock (&lm->lock);
+  while (1)
+    {
+      struct timespec ts;
+
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_sec += lm->flush_interval_ms / 1000;
+      ts.tv_nsec += (lm->flush_interval_ms % 1000) * 1000000;
+      if (ts.tv_nsec >= 1000000000)
+	{
+	  ts.tv_sec++;
+	  ts.tv_nsec -= 1000000000;
+	}
+
+      if (!lm->kicked)
+	pthread_cond_timedwait (&lm->kick, &lm->lock, &ts);
+      lm->kicked = 0;
+
+      ee_log_drain (lm);
+    }
+  pthread_mutex_unlock (&lm->lock);
+  return NULL;
+}
+
+static void
+ee_log_start (void)
+{
+  ee_log_main_t *lm = &ee_log_main;
+
+  if (!lm->path)
+    lm->path = format (0, "%s%c", EE_LOG_DEFAULT_PATH, 0);
+
+  if (pthread_create (&lm->flusher, NULL, ee_log_flusher, NULL) != 0)
+    clib_warning ("[ee_log] failed to start log flusher thread");
+  else
+    pthread_setname_np (lm->flusher, "ee_log");
+}
+
+static ee_log_ring_t *
+ee_log_get_ring (void)
+{
+  ee_log_main_t *lm = &ee_log_main;
+  ee_log_ring_t *ring;
+  u32 idx;
+
+  if (PREDICT_TRUE (ee_log_thread_ring != NULL))
+    return ee_log_thread_ring;
+
+  pthread_once (&ee_log_once, ee_log_start);
+
+  /* slow path, once per thread */
+  pthread_mutex_lock (&lm->lock);
+  idx = lm->n_rings;
+  if (idx < EE_LOG_MAX_THREADS)
+    {
+      ring = clib_mem_alloc_aligned (sizeof (*ring), CLIB_CACHE_LINE_BYTES);
+      clib_memset (ring, 0, sizeof (*ring));
+      lm->rings[idx] = ring;
+      __atomic_store_n (&lm->n_rings, idx + 1, __ATOMIC_RELEASE);
+      ee_log_thread_ring = ring;
+    }
+  pthread_mutex_unlock (&lm->lock);
+
+  return ee_log_thread_ring;
+}
+
+void
+ee_log_write (ee_log_level_t level, const char *fmt, ...)
+{
+  ee_log_main_t *lm = &ee_log_main;
+  ee_log_ring_t *ring;
+  ee_log_record_t *rec;
+  u32 head, tail;
+  va_list va;
+  int n;
+
+  if (level == EE_LOG_ERR)
+    {
+      /* errors still go to the VPP log */
+      char buf[EE_LOG_MSG_MAX];
+
+      va_start (va, fmt);
+      vsnprintf (buf, sizeof (buf), fmt, va);
+      va_end (va);
+      clib_warning ("%s", buf);
+    }
+
+  ring = ee_log_get_ring ();
+  if (PREDICT_FALSE (!ring))
+    return;
+
+  head = ring->head;
+  tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+  if (PREDICT_FALSE (head - tail >= EE_LOG_RING_SIZE))
+    {
+      ring->drops++;
+      return;
+    }
+
+  rec = &ring->records[head & (EE_LOG_RING_SIZE - 1)];
+  rec->ts = unix_time_now ();
+  rec->level = level;
+
+  va_start (va, fmt);
+  n = vsnprintf (rec->msg, EE_LOG_MSG_MAX, fmt, va);
+  va_end (va);
+  if (n < 0)
+    n = 0;
+  rec->len = clib_min (n, EE_LOG_MSG_MAX - 1);
+  /* strip trailing newlines, the flusher adds its own */
+  while (rec->len && rec->msg[rec->len - 1] == '\n')
+    rec->len--;
+
+  __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+
+  /* size based flush: wake the flusher once the ring is half full */
+  if (PREDICT_FALSE (head + 1 - tail >= EE_LOG_RING_SIZE / 2) &&
+      !__atomic_exchange_n (&lm->kicked, 1, __ATOMIC_ACQ_REL))
+    pthread_cond_signal (&lm->kick);
+}
+
+void
+ee_log_flush (void)
+{
+  ee_log_main_t *lm = &ee_log_main;
+
+  pthread_mutex_lock (&lm->lock);
+  ee_log_drain (lm);
+  pthread_mutex_unlock (&lm->lock);
+}
+
+static clib_error_t *
+ee_log_command_fn (vlib_main_t * vm,
+		   unformat_input_t * main_input, vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  ee_log_main_t *lm = &ee_log_main;
+  clib_error_t *error = NULL;
+  u8 *path = 0;
+  u32 max_size_kb = ~0, rotate = ~0, interval = ~0;
+  u8 level = lm->level;
+
+  if (!unformat_user (main_input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "level %U", unformat_ee_log_level, &level))
+	;
+      else if (unformat (line_input, "file %s", &path))
+	;
+      else if (unformat (line_input, "max-size %u", &max_size_kb))
+	;
+      else if (unformat (line_input, "rotate %u", &rotate))
+	;
+      else if (unformat (line_input, "flush-interval %u", &interval))
+	;
+      else
+	{
+	  error = unformat_parse_error (line_input);
+	  goto done;
+	}
+    }
+
+  if (interval == 0)
+    {
+      error = clib_error_return (0, "flush-interval must be non-zero");
+      goto done;
+    }
+
+  pthread_mutex_lock (&lm->lock);
+  ee_log_drain (lm);
+  if (path)
+    {
+      vec_add1 (path, 0);
+      if (lm->file)
+	fclose (lm->file);
+      lm->file = NULL;
+      vec_free (lm->path);
+      lm->path = path;
+      path = 0;
+    }
+  if (max_size_kb != ~0)
+    lm->max_file_size = (u64) max_size_kb << 10;
+  if (rotate != ~0)
+    lm->max_rotations = rotate;
+  if (interval != ~0)
+    lm->flush_interval_ms = interval;
+  pthread_mutex_unlock (&lm->lock);
+
+  lm->level = level;
+
+done:
+  vec_free (path);
+  unformat_free (line_input);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ee_log_command, static) =
+{
+  .path = "upf ee log",
+  .short_help =
+  "upf ee log [level err|warn|info|debug] [file <path>] [max-size <KB>] "
+  "[rotate <count>] [flush-interval <ms>]",
+  .function = ee_log_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+ee_show_log_command_fn (vlib_main_t * vm,
+			unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  ee_log_main_t *lm = &ee_log_main;
+  u32 n_rings = __atomic_load_n (&lm->n_rings, __ATOMIC_ACQUIRE);
+  u64 drops = 0, pending = 0;
+
+  for (u32 r = 0; r < n_rings; r++)
+    {
+      drops += lm->rings[r]->drops;
+      pending += lm->rings[r]->head - lm->rings[r]->tail;
+    }
+
+  vlib_cli_output (vm, "level %U, file %s",
+		   format_ee_log_level, (u32) lm->level,
+		   lm->path ? (char *) lm->path : EE_LOG_DEFAULT_PATH);
+  vlib_cli_output (vm, "max-size %lluKB, rotate %u, flush-interval %ums",
+		   lm->max_file_size >> 10, lm->max_rotations,
+		   lm->flush_interval_ms);
+  vlib_cli_output (vm, "threads %u, written %llu, pending %llu, "
+		   "dropped %llu, flushes %llu, rotations %llu",
+		   n_rings, lm->written, pending, drops, lm->flushes,
+		   lm->rotations);
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (ee_show_log_command, static) =
+{
+  .path = "show upf ee log",
+  .short_help = "show upf ee log",
+  .function = ee_show_log_command_fn,
+};
+/* *INDENT-ON* */
@@ -0,0 +1,101 @@
+// Added by: Fatemeh Shafiei Ardestani
+// Date: 2024-08-18.
+//  See Git history for complete list of changes.
+#ifndef UPG_VPP_EE_LOG_H
+#define UPG_VPP_EE_LOG_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <vlib/vlib.h>
+
+/*
+ * Buffered EE logger.
+ *
+ * Every thread that logs owns a single-producer/single-consumer ring of
+ * fixed size records. Producers only format into their own ring; a
+ * background flusher drains all rings into the log file, either every
+ * flush interval or as soon as a ring crosses half of its capacity.
+ * Records are dropped (and counted) when a ring is full, so logging never
+ * blocks the caller.
+ */
+
+typedef enum
+{
+  EE_LOG_ERR = 0,
+  EE_LOG_WARN,
+  EE_LOG_INFO,
+  EE_LOG_DEBUG,
+} ee_log_level_t;
+
+#define EE_LOG_RING_SIZE    1024	/* records per thread, power of 2 */
+#define EE_LOG_MSG_MAX      232
+#define EE_LOG_MAX_THREADS  256
+
+typedef struct
+{
+  f64 ts;
+  u16 len;
+  u8 level;
+  char msg[EE_LOG_MSG_MAX];
+} ee_log_record_t;
+
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  /* producer side */
+  volatile u32 head;
+  u32 drops;
+
+    CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  /* consumer side */
+  volatile u32 tail;
+
+  ee_log_record_t records[EE_LOG_RING_SIZE];
+} ee_log_ring_t;
+
+typedef struct
+{
+  /* runtime controls */
+  volatile u8 level;
+  u8 *path;
+  u64 max_file_size;
+  u32 max_rotations;
+  u32 flush_interval_ms;
+
+  /* per thread rings */
+  ee_log_ring_t *rings[EE_LOG_MAX_THREADS];
+  volatile u32 n_rings;
+
+  /* flusher */
+  pthread_t flusher;
+  pthread_mutex_t lock;
+  pthread_cond_t kick;
+  volatile u32 kicked;
+  FILE *file;
+  u64 file_size;
+
+  /* stats */
+  u64 written;
+  u64 flushes;
+  u64 rotations;
+} ee_log_main_t;
+
+extern ee_log_main_t ee_log_main;
+
+void ee_log_write (ee_log_level_t level, const char *fmt, ...);
+
+/* level check is a single load, arguments are not evaluated when filtered */
+#define ee_log(_level, _fmt, _args...)					\
+  do {									\
+    if (PREDICT_FALSE ((_level) <= ee_log_main.level))			\
+      ee_log_write ((_level), _fmt, ##_args);				\
+  } while (0)
+
+#define ee_log_err(_fmt, _args...)   ee_log (EE_LOG_ERR, _fmt, ##_args)
+#define ee_log_warn(_fmt, _args...)  ee_log (EE_LOG_WARN, _fmt, ##_args)
+#define ee_log_info(_fmt, _args...)  ee_log (EE_LOG_INFO, _fmt, ##_args)
+#define ee_log_debug(_fmt, _args...) ee_log (EE_LOG_DEBUG, _fmt, ##_args)
+
+void ee_log_flush (void);
+
+#endif //UPG_VPP_EE_LOG_H
@@ -75,10 +75,10 @@ void fillNotificationItemPerPacket(UpfEventSubscription upfSub,cvector_vector_ty
     sh_new_strdup(ue_to_notif);
     shdefault(ue_to_notif, NULL);
     size_t hash_length = shlen(usage_packet_hash);
-    clib_warning("[send_data] fillNotificationItemPerPacket, the hash size is %d",hash_length);
+    ee_log_debug("[send_data] fillNotificationItemPerPacket, the hash size is %zu",hash_length);
     for(size_t i=0;i<hash_length;i++){
       usage_report_per_packet_t* usage_report_per_packet_vector = usage_packet_hash[i].value;
-      clib_warning("[send_data_len] the length of the vector is %d", vec_len(usage_report_per_packet_vector));
+      ee_log_debug("[send_data_len] the length of the vector is %u", vec_len(usage_report_per_packet_vector));
       usage_report_per_packet_t * rep;
       UserDataUsageMeasurements *usage = malloc(sizeof (UserDataUsageMeasurements));
       usage->volumeMeasurement = malloc(sizeof (VolumeMeasurement));
@@ -129,7 +129,7 @@ void fillNotificationItemPerPacket(UpfEventSubscription upfSub,cvector_vector_ty
         strcpy(ue_ip, usage_packet_hash[i].key->src_ip);
       }
 
-      clib_warning("The UE IP is", ue_ip);
+      ee_log_debug("The UE IP is %s", ue_ip);
 
 
 
@@ -138,7 +138,7 @@ void fillNotificationItemPerPacket(UpfEventSubscription upfSub,cvector_vector_ty
 
         item = malloc(sizeof(NotificationItem));
         item->ueIpv4Addr = ue_ip;
-        clib_warning("item->ueIpv4Addr", item->ueIpv4Addr );
+        ee_log_debug("item->ueIpv4Addr %s", item->ueIpv4Addr );
         item->type = USER_DATA_USAGE_TRENDS;
         struct tm* tm = malloc(sizeof(struct tm));
         time_t current_time;
@@ -175,13 +175,13 @@ void fillNotificationItemPerPacket(UpfEventSubscription upfSub,cvector_vector_ty
 }
 void fillNotificationItem(UpfEventSubscription upfSub,cvector_vector_type(NotificationItem **) Notifvec,EventType type) {
   if(type==USER_DATA_USAGE_TRENDS){
-    clib_warning("[EventReport_UDUT] before locking the mutex");
+    ee_log_debug("[EventReport_UDUT] before locking the mutex");
     int iter = 0;
 //    if (pthread_mutex_trylock(&ee_lock) != 0){
 //      return;
 //    }
     while (pthread_mutex_trylock(&ee_lock) != 0) {
-      clib_warning("the mutex is lock sleeping for a 0.01 second");
+      ee_log_debug("the mutex is lock sleeping for a 0.01 second");
       usleep(10000);
       iter += 1;
       if (iter == 3){
@@ -189,14 +189,14 @@ void fillNotificationItem(UpfEventSubscription upfSub,cvector_vector_type(Notifi
       }
     }
 //    pthread_mutex_lock(&ee_lock);
-    clib_warning("[EventReport_UDUT] After locking the mutex");
+    ee_log_debug("[EventReport_UDUT] After locking the mutex");
     if (usage_hash == NULL){
-      clib_warning("[EventReport_UDUT] There is no data to report");
+      ee_log_debug("[EventReport_UDUT] There is no data to report");
       pthread_mutex_unlock(&ee_lock);
       return;
     }
     size_t hash_length = shlen(usage_hash);
-    clib_warning("[send_data] fillNotificationItem, the hash size is %d",hash_length);
+    ee_log_debug("[send_data] fillNotificationItem, the hash size is %zu",hash_length);
     for(size_t i=0;i<hash_length;i++){
       NotificationItem *item = malloc(sizeof(NotificationItem));
       item->type = USER_DATA_USAGE_TRENDS;
@@ -213,25 +213,27 @@ void fillNotificationItem(UpfEventSubscription upfSub,cvector_vector_type(Notifi
       item->supi = NULL;
       item->ueMacAddr = NULL;
       item->ueIpv6Prefix = NULL;
-      clib_warning("assianing the IPadd which is in the item %s", item->ueIpv4Addr);
-      clib_warning("assianing the IPadd which is in the hash %s", usage_hash[i].key);
+      ee_log_debug("assianing the IPadd which is in the item %s", item->ueIpv4Addr);
+      ee_log_debug("assianing the IPadd which is in the hash %s", usage_hash[i].key);
       cvector(UserDataUsageMeasurements *) userDataMeasurements = NULL;
       usage_report_per_flow_t* usage_report_per_flow_vector = usage_hash[i].value;
-      clib_warning("[send_data_len] the length of the vector is %d", vec_len(usage_report_per_flow_vector));
+      ee_log_debug("[send_data_len] the length of the vector is %u", vec_len(usage_report_per_flow_vector));
 //      for (int j = 0; j < vec_len(usage_report_per_flow_vector); j++)
       usage_report_per_flow_t* rep;
 
       vec_foreach(rep, usage_report_per_flow_vector){
         if(rep == NULL){
-          clib_warning("[EventReport_UDUT] There is no data to report, fill notification");
+          ee_log_debug("[EventReport_UDUT] There is no data to report, fill notification");
           continue;
         }
         // TODO: make sure the uplink and downlink are right.
         int volume = rep->src_bytes + rep->dst_bytes;
-        clib_warning("the volume is %d %d %d", volume,rep->src_bytes , rep->dst_bytes);
+        ee_log_debug("the volume is %d %llu %llu", volume,
+                     (unsigned long long) rep->src_bytes,
+                     (unsigned long long) rep->dst_bytes);
         char *totalVolume = malloc(20 + 1);
         sprintf(totalVolume, "%dB", volume);
-        clib_warning("the volume is %d", volume);
+        ee_log_debug("the volume is %d", volume);
         UserDataUsageMeasurements *usage = malloc(sizeof (UserDataUsageMeasurements));
         usage->volumeMeasurement = malloc(sizeof (VolumeMeasurement));
         usage->volumeMeasurement->totalVolume = totalVolume;
@@ -241,16 +243,16 @@ void fillNotificationItem(UpfEventSubscription upfSub,cvector_vector_type(Notifi
         volume = rep->dst_bytes;
         char *dlVolume = malloc(20 + 1);
         sprintf(dlVolume, "%dB", volume);
-        clib_warning("%d%d",volume,rep->dst_bytes);
+        ee_log_debug("%d %llu",volume,(unsigned long long) rep->dst_bytes);
         usage->volumeMeasurement->dlVolume = dlVolume;
-        clib_warning("the dl volume is %s",dlVolume);
+        ee_log_debug("the dl volume is %s",dlVolume);
         volume = rep->src_bytes;
         char *ulVolume = malloc(20 + 1);
         sprintf(ulVolume, "%dB", volume);
-        clib_warning("the ul volume is %s",ulVolume);
+        ee_log_debug("the ul volume is %s",ulVolume);
         usage->volumeMeasurement->ulVolume = ulVolume;
-        clib_warning("the src Ip is %s", rep->src_ip);
-        clib_warning("the Dst Ip is %s", rep->dst_ip);
+        ee_log_debug("the src Ip is %s", rep->src_ip);
+        ee_log_debug("the Dst Ip is %s", rep->dst_ip);
         json_t *obj = json_object();
         json_object_set_new(obj,"SeId", json_integer(rep->seid));
         json_object_set_new(obj,"SrcIp", json_string(rep->src_ip));
@@ -271,16 +273,16 @@ void fillNotificationItem(UpfEventSubscription upfSub,cvector_vector_type(Notifi
         usage->flowInfo->tosTrafficClass = NULL;
         usage->appID = "\0";
         cvector_push_back(userDataMeasurements, usage);
-        clib_warning("[send_data] fillNotificationItem, in the loop 113. %p\n", usage->flowInfo->ethFlowDescription);
+        ee_log_debug("[send_data] fillNotificationItem, in the loop 113. %p\n", usage->flowInfo->ethFlowDescription);
       }
       item->userDataUsageMeasurements = userDataMeasurements;
       cvector_push_back(*Notifvec, item);
-      clib_warning("[send_data] fillNotificationItem, the Noitve_size %d\n", cvector_size(*Notifvec));
+      ee_log_debug("[send_data] fillNotificationItem, the Noitve_size %zu\n", cvector_size(*Notifvec));
 
     }
     pthread_mutex_unlock(&ee_lock);
   }
-  clib_warning("[send_data] fillNotificationItem, end of function");
+  ee_log_debug("[send_data] fillNotificationItem, end of function");
 }
 void create_send_report(UpfEventSubscription upfSub,EventType type){
   if(type == USER_DATA_USAGE_TRENDS){
@@ -299,8 +301,8 @@ void create_send_report(UpfEventSubscription upfSub,EventType type){
       if (!callBack_Report) {
         clib_warning("The json_t object is NULL.\n");
       }
-      char *json_str = json_dumps(callBack_Report, JSON_INDENT(2));
-      send_report (json_str, upfSub, type);
+      queue_report (upfSub.eventNotifyUri, callBack_Report,
+                    upfSub.eventReportingMode.sent_reports);
     }
 //    for (size_t i = 0; i < cvector_size(Notifvec); i++) {
 //      if (Notifvec[i] != NULL) {
@@ -315,6 +317,15 @@ void create_send_report(UpfEventSubscription upfSub,EventType type){
   }
 }
 void send_report(char *json_data,UpfEventSubscription upfSub,EventType type){
+  send_report_to(upfSub.eventNotifyUri, json_data,
+                 upfSub.eventReportingMode.sent_reports, 1);
+}
+/*
+ * Report_number is the number of the (first) report in the request,
+ * Report_count the number of notifications of a batch
+ */
+void send_report_to(const char *uri, char *json_data, int report_num,
+                    int report_count){
   // we Assume that we have the upf raw data hare
   // we call the function that can customized the needed measurements
   CURL *curl;
@@ -323,19 +334,14 @@ void send_report(char *json_data,UpfEventSubscription upfSub,EventType type){
   curl_global_init(CURL_GLOBAL_DEFAULT);
   curl = curl_easy_init();
   if (curl) {
-    int report_num = upfSub.eventReportingMode.sent_reports;
     char report_num_str[10];
     char report_num_head[50] = "Report_number: ";
     snprintf(report_num_str, sizeof(report_num_str), "%d", report_num);
     strcat(report_num_head, report_num_str);
-    curl_easy_setopt(curl, CURLOPT_URL, upfSub.eventNotifyUri);
-    fprintf(stdout,"the URI is %s\n", upfSub.eventNotifyUri);
+    curl_easy_setopt(curl, CURLOPT_URL, uri);
     char c_time[50];
     get_current_time_send(c_time, sizeof(c_time));
     clib_warning("[DSN_Latency]the report number sent and the time is %d, %s ,%s\n", report_num, report_num_str ,c_time);
-//    fprintf(stdout,);
-    fprintf(stdout, "dat: %s\n", json_data);
-    fflush(stdout);
     curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_data);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, -1L); // To set the size dependent to json
@@ -345,6 +351,12 @@ void send_report(char *json_data,UpfEventSubscription upfSub,EventType type){
     headers = curl_slist_append(headers, "Expect:"); // To Disable 100 continue
     headers = curl_slist_append(headers, "Content-Type: application/json");
     headers = curl_slist_append(headers, report_num_head);
+    if (report_count > 1) {
+      char report_count_head[50];
+      snprintf(report_count_head, sizeof(report_count_head),
+               "Report_count: %d", report_count);
+      headers = curl_slist_append(headers, report_count_head);
+    }
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
@@ -361,6 +373,120 @@ void send_report(char *json_data,UpfEventSubscription upfSub,EventType type){
   }
 
 }
+/*
+ * Notification batching: callbacks due for the same notifUri are collected
+ * into one JSON array and POSTed together. A batch is sent as soon as it
+ * holds ee_batch_max_size notifications, or once its oldest notification
+ * has waited ee_batch_max_delay seconds. The delay is checked by the
+ * periodic sending process once a second, so a batch may wait up to a
+ * second longer. A max size of 1 disables batching and keeps the
+ * single-object wire format.
+ */
+u32 ee_batch_max_size = 1;
+u32 ee_batch_max_delay = 0;
+ee_batch_stats_t ee_batch_stats;
+
+typedef struct {
+  json_t *items;
+  time_t first_queued;
+  int first_report_num;   /* Report_number of the first notification */
+} notif_batch_t;
+
+static struct {char* key; notif_batch_t value;} *notif_batches = NULL;
+
+static void flush_batch(const char *uri, notif_batch_t *batch){
+  size_t n = json_array_size(batch->items);
+  json_t *body;
+  char *json_str;
+
+  if (n == 0)
+    return;
+
+  /*
+   * a lone notification is sent as-is, not wrapped in an array, a batch
+   * carries the number of its first report and how many it holds
+   */
+  body = (n == 1) ? json_array_get(batch->items, 0) : batch->items;
+  json_str = json_dumps(body, JSON_INDENT(2));
+  if (json_str) {
+    send_report_to(uri, json_str, batch->first_report_num, (int) n);
+    free(json_str);
+  }
+
+  ee_batch_stats.requests += 1;
+  ee_batch_stats.notifications += n;
+  json_array_clear(batch->items);
+}
+
+void queue_report(const char *uri, json_t *callBack_Report, int report_num){
+  notif_batch_t *batch;
+  ptrdiff_t i;
+
+  if (!uri || !callBack_Report)
+    return;
+
+  if (ee_batch_max_size <= 1) {
+    char *json_str = json_dumps(callBack_Report, JSON_INDENT(2));
+    if (json_str) {
+      send_report_to(uri, json_str, report_num, 1);
+      free(json_str);
+    }
+    json_decref(callBack_Report);
+    ee_batch_stats.requests += 1;
+    ee_batch_stats.notifications += 1;
+    return;
+  }
+
+  if (notif_batches == NULL)
+    sh_new_strdup(notif_batches);
+
+  i = shgeti(notif_batches, uri);
+  if (i < 0) {
+    notif_batch_t nb = { .items = json_array(), .first_queued = 0 };
+    shput(notif_batches, uri, nb);
+    i = shgeti(notif_batches, uri);
+  }
+  batch = &notif_batches[i].value;
+
+  if (json_array_size(batch->items) == 0) {
+    time(&batch->first_queued);
+    batch->first_report_num = report_num;
+  }
+  json_array_append_new(batch->items, callBack_Report);
+
+  if (json_array_size(batch->items) >= ee_batch_max_size)
+    flush_batch(notif_batches[i].key, batch);
+}
+
+void flush_report_batches(time_t now, bool force){
+  size_t n = shlen(notif_batches);
+
+  for (size_t i = 0; i < n; i++) {
+    notif_batch_t *batch = &notif_batches[i].value;
+
+    if (json_array_size(batch->items) == 0)
+      continue;
+    if (force || now - batch->first_queued >= (time_t) ee_batch_max_delay)
+      flush_batch(notif_batches[i].key, batch);
+  }
+}
+
+u32 pending_report_batches(u32 *notifications){
+  size_t n = shlen(notif_batches);
+  u32 batches = 0, pending = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    size_t len = json_array_size(notif_batches[i].value.items);
+    if (len) {
+      batches++;
+      pending += len;
+    }
+  }
+  if (notifications)
+    *notifications = pending;
+  return batches;
+}
+
 //UpfEventSubscription*
 void* EventReport_UDUT() {
     time_t current_time;
@@ -399,6 +525,7 @@ void* EventReport_UDUT() {
 
       }
     }
+    flush_report_batches(current_time, false);
 
   return NULL;
 }
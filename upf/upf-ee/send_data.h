@@ -13,6 +13,7 @@
 #include "types/encoder.h"
 #include "storage/event.h"
 #include "storage/shared_variables.h"
+#include "ee_log.h"
 #include <pthread.h>
 #include <stdio.h>
 #define _GNU_SOURCE
@@ -32,5 +33,19 @@ void fillNotificationItemPerPacket(UpfEventSubscription upfSub,cvector_vector_ty
 void fillNotificationItem(UpfEventSubscription upfSub,cvector_vector_type(NotificationItem **) Notifvec,EventType type);
 void create_send_report(UpfEventSubscription upfSub,EventType type);
 void send_report(char *json_data,UpfEventSubscription upfSub,EventType type);
+void send_report_to(const char *uri, char *json_data, int report_num,
+                    int report_count);
+
+typedef struct {
+  u64 requests;
+  u64 notifications;
+} ee_batch_stats_t;
+
+extern u32 ee_batch_max_size;
+extern u32 ee_batch_max_delay;
+extern ee_batch_stats_t ee_batch_stats;
+void queue_report(const char *uri, json_t *callBack_Report, int report_num);
+void flush_report_batches(time_t now, bool force);
+u32 pending_report_batches(u32 *notifications);
 void* EventReport_UDUT();
 #endif //REST_API_C_SEND_DATA_H
\ No newline at end of file
@@ -530,6 +530,20 @@ upf_init (vlib_main_t * vm)
   vlib_zero_simple_counter (&sm->upf_simple_counters[UPF_##E], 0);
   foreach_upf_counter_name
 #undef _
+
+  vec_validate (sm->session_acc, vlib_get_thread_main ()->n_vlib_mains - 1);
+
+  vec_validate (sm->dl_buffers, vlib_get_thread_main ()->n_vlib_mains - 1);
+  sm->dl_buffer_max = 65536;
+  sm->dl_buffer_session_max = 64;
+
+#define _(E,n) \
+  sm->qer_counters[UPF_QER_COUNTER_##E].name = #n; \
+  sm->qer_counters[UPF_QER_COUNTER_##E].stat_segment_name = "/upf/qer/" #n;
+  foreach_upf_qer_counter_name
+#undef _
+  sm->qer_yellow_dscp = ~0;
+
   sm->node_id.type = NID_FQDN;
   sm->node_id.fqdn = format (0, (char *) "\x03upg");
 
@@ -433,6 +433,88 @@ typedef struct
 #define UPF_ACL_UL 1
 #define UPF_ACL_DL 2
 
+/* flow key as seen by the compiled ACL classifier, ports in host order */
+typedef struct
+{
+  union
+  {
+    struct
+    {
+      ip46_address_t addr[2];
+      u32 teid;
+      u16 port[2];
+      u8 proto;
+    };
+    u64 as_u64[6];
+  };
+} upf_acl_key_t;
+
+/* all ACLs sharing the same field masks */
+typedef struct
+{
+  upf_acl_key_t mask;
+  uword *by_key;		/* masked key -> index into rules */
+  upf_acl_key_t *keys;		/* masked rule values, owned by by_key */
+  u32 **rules;			/* ACL indices per key, ascending */
+  u32 min_rule;			/* lowest ACL index in this tuple */
+} upf_acl_tuple_t;
+
+#define UPF_ACL_TRIE_STRIDE 4
+#define UPF_ACL_TRIE_FANOUT (1 << UPF_ACL_TRIE_STRIDE)
+
+typedef struct
+{
+  u32 child;			/* node index, ~0 if none */
+  u32 rules;			/* bitmap index of prefixes ending here, ~0 if none */
+} upf_acl_trie_slot_t;
+
+typedef struct
+{
+  upf_acl_trie_slot_t slots[UPF_ACL_TRIE_FANOUT];
+} upf_acl_trie_node_t;
+
+/* multi-bit trie over the src or dst prefixes of an ACL vector */
+typedef struct
+{
+  upf_acl_trie_node_t *nodes;	/* nodes[0] is the root */
+  uword **bitmaps;		/* ACL bitmaps referenced by the slots */
+  uword *any;			/* ACLs with a zero length prefix */
+} upf_acl_trie_t;
+
+/* structure of arrays over a small ACL vector, one u32 lane per ACL */
+typedef struct
+{
+  u32 *lanes;			/* one row of n_lanes per field */
+  u32 n_lanes;			/* ACL count padded to full vectors */
+  u64 post_check;		/* ACLs with IP application rules */
+} upf_acl_soa_t;
+
+typedef struct upf_acl_partition_ upf_acl_partition_t;
+
+/* compiled index over a sorted ACL vector */
+typedef struct
+{
+  upf_acl_tuple_t *tuples;	/* ordered by min_rule */
+  upf_acl_trie_t trie[2];	/* src/dst prefix tries, IPv6 only */
+  upf_acl_soa_t soa;		/* small ACL vectors */
+  u32 n_rules;
+  u8 use_trie;
+  u8 use_soa;
+
+  /* per TEID candidate subsets, multi bearer sessions only */
+  upf_acl_partition_t *partitions;
+  uword *partition_by_teid;
+  u32 wildcard_partition;	/* ACLs without TEID match */
+} upf_acl_index_t;
+
+/* ACLs that can match packets received on one TEID */
+struct upf_acl_partition_
+{
+  upf_acl_t *acls;		/* subset in precedence order */
+  u32 *rules;			/* subset position -> ACL index */
+  upf_acl_index_t index;
+};
+
 /* Packet Detection Information */
 typedef struct
 {
@@ -462,6 +544,12 @@ typedef struct
   u16 far_id;
   u16 *urr_ids;
   u32 *qer_ids;
+
+  /* urr_ids and qer_ids resolved into rules->urr and rules->qer indices,
+   * rebuilt whenever the rule set changes. QERs are ordered from the
+   * narrowest (QoS flow MBR) to the widest (session or APN AMBR) scope */
+  u32 *urr_indices;
+  u32 *qer_indices;
 } upf_pdr_t;
 
 /* Forward Action Rules - Forwarding Parameters */
@@ -513,7 +601,11 @@ typedef struct
 #define URR_QUOTA_EXHAUSTED     BIT(0)
 #define URR_THRESHOLD_REACHED   BIT(1)
 #define URR_START_OF_TRAFFIC    BIT(2)
-#define URR_DROP_SESSION        BIT(3)
+#define URR_BUDGET_EXHAUSTED    BIT(4)
+#define URR_STOP_OF_TRAFFIC     BIT(5)
+/* traffic table of the URR, see upf_urr_traffic_table_t */
+#define URR_TRAFFIC_REBUILD     BIT(6)
+#define URR_TRAFFIC_UNLISTED    BIT(7)	/* the table had no room */
 
 typedef enum
 {
@@ -525,7 +617,25 @@ typedef enum
   UPF_FLOWS_NOT_STITCHED_TCP_OPS_TIMESTAMP = 5,
   UPF_FLOWS_NOT_STITCHED_TCP_OPS_SACK_PERMIT = 6,
   UPF_FLOWS_STITCHED_DIRTY_FIFOS = 7,
-  UPF_N_COUNTERS = 8,
+  UPF_TLS_CLIENT_HELLO = 8,
+  UPF_TLS_SNI = 9,
+  UPF_TLS_HELLO_MULTI_RECORD = 10,
+  UPF_TLS_HELLO_NEED_MORE_DATA = 11,
+  UPF_TLS_13 = 12,
+  UPF_TLS_ALPN = 13,
+  UPF_QUIC_INITIAL = 14,
+  UPF_QUIC_SNI = 15,
+  UPF_QUIC_DECRYPT_ERROR = 16,
+  UPF_ADR_CACHE_HIT = 17,
+  UPF_ADR_CACHE_MISS = 18,
+  UPF_DL_BUFFERED = 19,
+  UPF_DL_BUFFER_FLUSHED = 20,
+  UPF_DL_BUFFER_DISCARDED = 21,
+  UPF_DL_BUFFER_SESSION_LIMIT = 22,
+  UPF_DL_BUFFER_GLOBAL_LIMIT = 23,
+  UPF_DL_DATA_REPORTS = 24,
+  UPF_URR_TRAFFIC_TABLE_FULL = 25,
+  UPF_N_COUNTERS = 26,
 } upf_counters_type_t;
 
 #define foreach_upf_counter_name   \
@@ -536,7 +646,25 @@ typedef enum
   _(FLOWS_NOT_STITCHED_MSS_MISMATCH, mss_mismatch, upf) \
   _(FLOWS_NOT_STITCHED_TCP_OPS_TIMESTAMP, tcp_ops_tstamp, upf) \
   _(FLOWS_NOT_STITCHED_TCP_OPS_SACK_PERMIT, tcp_ops_sack_permit, upf) \
-  _(FLOWS_STITCHED_DIRTY_FIFOS, stitched_dirty_fifos, upf)
+  _(FLOWS_STITCHED_DIRTY_FIFOS, stitched_dirty_fifos, upf) \
+  _(TLS_CLIENT_HELLO, tls_client_hello, upf)	\
+  _(TLS_SNI, tls_sni, upf)			\
+  _(TLS_HELLO_MULTI_RECORD, tls_hello_multi_record, upf) \
+  _(TLS_HELLO_NEED_MORE_DATA, tls_hello_need_more_data, upf) \
+  _(TLS_13, tls_13, upf)			\
+  _(TLS_ALPN, tls_alpn, upf)			\
+  _(QUIC_INITIAL, quic_initial, upf)		\
+  _(QUIC_SNI, quic_sni, upf)			\
+  _(QUIC_DECRYPT_ERROR, quic_decrypt_error, upf)	\
+  _(ADR_CACHE_HIT, adr_cache_hit, upf)		\
+  _(ADR_CACHE_MISS, adr_cache_miss, upf)		\
+  _(DL_BUFFERED, dl_buffered, upf)		\
+  _(DL_BUFFER_FLUSHED, dl_buffer_flushed, upf)	\
+  _(DL_BUFFER_DISCARDED, dl_buffer_discarded, upf)	\
+  _(DL_BUFFER_SESSION_LIMIT, dl_buffer_session_limit, upf) \
+  _(DL_BUFFER_GLOBAL_LIMIT, dl_buffer_global_limit, upf) \
+  _(DL_DATA_REPORTS, dl_data_reports, upf)	\
+  _(URR_TRAFFIC_TABLE_FULL, urr_traffic_table_full, upf)
 
 /* TODO: measure if more optimize cache line aware layout
  *       of the counters and quotas has any performance impcat */
@@ -575,15 +703,107 @@ typedef struct
   f64 vlib_time;
 } urr_abs_time_t;
 
+/*
+ * Start and Stop of Traffic detection of a URR tracks the UE addresses
+ * with recent traffic in an open addressing hash table, allocated when
+ * the URR is installed and sized for the UE addresses of its PDRs.
+ * Workers refresh the entry of a known address with one probe sequence
+ * and without locking, only new addresses are inserted under the session
+ * lock. Once half of the slots are taken, the inserting worker asks the
+ * PFCP process to rebuild the table at twice the size with the workers
+ * stopped. Should it fill up before that, the Start of Traffic is still
+ * reported and the PFCP process inserts the address after growing the
+ * table. Addresses idle for UPF_URR_TRAFFIC_TIMEOUT are expired by the
+ * PFCP process from the traffic timer of the URR, which is armed for the
+ * earliest expiry.
+ */
+#define UPF_URR_TRAFFIC_MIN_SLOTS	16	/* power of 2 */
+#define UPF_URR_TRAFFIC_TIMEOUT		60	/* seconds */
+
 typedef struct
 {
-  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
-
   ip46_address_t ip;
-  //TODO: timeout
   f64 first_seen;
+  f64 last_seen;
+  u8 state;
+#define UPF_URR_TRAFFIC_FREE			0
+#define UPF_URR_TRAFFIC_USED			1
+#define UPF_URR_TRAFFIC_DELETED			2	/* probes go on */
 } upf_urr_traffic_t;
 
+typedef struct
+{
+  u32 mask;			/* number of slots - 1 */
+  u32 n_entries;
+  u32 n_used;			/* entries and deleted slots */
+  u8 grow;			/* a rebuild has been requested */
+  upf_urr_traffic_t slots[0];
+} upf_urr_traffic_table_t;
+
+always_inline u32
+upf_urr_traffic_hash (ip46_address_t * ip)
+{
+  return clib_xxhash (ip->as_u64[0] ^ ip->as_u64[1]);
+}
+
+always_inline upf_urr_traffic_t *
+upf_urr_traffic_find (upf_urr_traffic_table_t * tt, ip46_address_t * ip)
+{
+  u32 i = upf_urr_traffic_hash (ip) & tt->mask;
+  u32 n;
+
+  for (n = 0; n <= tt->mask; n++, i = (i + 1) & tt->mask)
+    {
+      upf_urr_traffic_t *t = &tt->slots[i];
+      u8 state = clib_atomic_load_acq_n (&t->state);
+
+      if (state == UPF_URR_TRAFFIC_FREE)
+	break;
+      if (state == UPF_URR_TRAFFIC_USED && ip46_address_is_equal (&t->ip, ip))
+	return t;
+    }
+
+  return NULL;
+}
+
+/*
+ * add an address that is not in the table yet, the caller holds the
+ * session lock or has stopped the workers
+ */
+always_inline upf_urr_traffic_t *
+upf_urr_traffic_insert (upf_urr_traffic_table_t * tt, ip46_address_t * ip,
+			f64 now)
+{
+  u32 i = upf_urr_traffic_hash (ip) & tt->mask;
+  u32 n;
+
+  for (n = 0; n <= tt->mask; n++, i = (i + 1) & tt->mask)
+    {
+      upf_urr_traffic_t *t = &tt->slots[i];
+
+      if (t->state == UPF_URR_TRAFFIC_USED)
+	continue;
+
+      if (t->state == UPF_URR_TRAFFIC_FREE)
+	tt->n_used++;
+      t->ip = *ip;
+      t->first_seen = t->last_seen = now;
+      /* the state makes the slot visible to lockless lookups */
+      clib_atomic_store_rel_n (&t->state, UPF_URR_TRAFFIC_USED);
+      tt->n_entries++;
+      return t;
+    }
+
+  return NULL;
+}
+
+/* time for a bigger table, or a clean one without the deleted slots */
+always_inline int
+upf_urr_traffic_needs_rebuild (upf_urr_traffic_table_t * tt)
+{
+  return 2 * tt->n_used > tt->mask + 1;
+}
+
 /* Usage Reporting Rules */
 typedef struct
 {
@@ -621,6 +841,9 @@ typedef struct
   urr_time_t quota_holding_time;	/* relative duration in seconds */
   urr_time_t quota_validity_time;	/* relative duration in seconds */
   urr_abs_time_t monitoring_time;	/* absolute UTC ts since 1900-01-01 00:00:00 */
+  urr_time_t monitoring_timer;	/* expires at the Monitoring Time */
+  u32 monitoring_epoch;		/* usage is after the Monitoring Time from
+				   this epoch on, 0: not yet reached */
 
   struct
   {
@@ -630,25 +853,134 @@ typedef struct
     urr_measure_t volume;
   } usage_before_monitoring_time;
 
-  /* pool of urr traffic info */
-  upf_urr_traffic_t *traffic;
-  uword *traffic_by_ue;
+  /* UE addresses with traffic, for Start and Stop of Traffic */
+  upf_urr_traffic_table_t *traffic;
   urr_time_t traffic_timer;
 
   pfcp_linked_urr_id_t *linked_urr_ids;
   uword *liusa_bitmap;
 } upf_urr_t;
 
+/*
+ * The PFCP process advances upf_main.monitoring_epoch when the Monitoring
+ * Time of a URR is reached and tags the URR with the new epoch. Workers
+ * read the global epoch once per frame, usage goes to the after Monitoring
+ * Time slot of the accumulators once that epoch reached the one of the
+ * URR. The comparison is wrap safe, 0 is never used as an epoch.
+ */
+always_inline int
+upf_urr_after_monitoring_time (upf_urr_t * urr, u32 epoch)
+{
+  u32 urr_epoch = urr->monitoring_epoch;
+
+  return urr_epoch != 0 && (i32) (epoch - urr_epoch) >= 0;
+}
+
+/*
+ * Usage of one URR measured by one thread. The thread only ever adds to
+ * its counters, the PFCP process merges the increase since its previous
+ * merge into the URR and hands out new volume budgets. Counters and
+ * packet times are kept apart for packets seen before and after the
+ * Monitoring Time.
+ */
+typedef struct
+{
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* written by the thread */
+  urr_counter_t packets[2];
+  urr_counter_t bytes[2];
+  f64 time_of_first_packet[2];
+  f64 time_of_last_packet[2];
+  u32 seen_seq;			/* merge the packet times belong to */
+  u32 reported_seq;		/* merge the budget event was sent for */
+
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+
+  /* written by the PFCP process */
+  urr_counter_t merged_packets[2];
+  urr_counter_t merged_bytes[2];
+  urr_counter_t limit;		/* bytes at which to request a merge */
+  u32 merge_seq;
+} upf_urr_acc_t;
+
+typedef struct
+{
+  f64 last_ul_traffic;
+  upf_urr_acc_t *urr;		/* indexed like the active URRs */
+} upf_session_acc_t;
+
+/*
+ * DL packets buffered by one thread for one session, in arrival order,
+ * with the id of the PDR each of them matched
+ */
+typedef struct
+{
+  u32 *buffers;
+  u16 *pdr_ids;
+} upf_dl_buffer_t;
+
+always_inline void
+upf_dl_buffer_push (upf_dl_buffer_t ** queues, u32 session_index, u32 bi,
+		    u16 pdr_id)
+{
+  upf_dl_buffer_t *q;
+
+  vec_validate (*queues, session_index);
+  q = vec_elt_at_index (*queues, session_index);
+  vec_add1 (q->buffers, bi);
+  vec_add1 (q->pdr_ids, pdr_id);
+}
+
+/* Buffering Action Rule, PFCP allows one per session */
+typedef struct
+{
+  u8 id;
+  u8 flags;
+#define UPF_BAR_PRESENT				BIT(0)
+  u16 suggested_buffering_packets_count;	/* 0: no limit from the CP */
+  u8 dl_data_notification_delay;	/* in 50 ms, 0: report right away */
+} upf_bar_t;
+
 /* QoS Enforcement Rules */
+
+/*
+ * One thread's share of a QER policer. The rates of the shards add up to
+ * the QER's bit rates, the rebalancing process moves the rates towards
+ * the threads that see the traffic. All shards use the scale of the full
+ * rate, so the process can change the token rates and limits of a shard
+ * in use with single stores.
+ */
 typedef struct
 {
-  /* Required for pool_get_aligned  */
+  /* Required for vec_validate_aligned */
   CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
 
   policer_read_response_type_st policer[UPF_DIRECTION_MAX];
+  u64 offered[UPF_DIRECTION_MAX];	/* bytes, written by the thread */
+
+  /* written by the rebalancing process */
+  u64 offered_seen[UPF_DIRECTION_MAX];
+  u64 offered_last[UPF_DIRECTION_MAX];	/* bytes in the last interval */
+  u32 cir_kbps[UPF_DIRECTION_MAX];
+} upf_qer_policer_shard_t;
+
+typedef struct
+{
+  /* Required for pool_get_aligned  */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  upf_qer_policer_shard_t *shards;	/* per thread */
+
+  /* the full QER rates, the shards get a share at the same scale */
+  policer_read_response_type_st rate[UPF_DIRECTION_MAX];
+  u32 cir_kbps[UPF_DIRECTION_MAX];
 
   u64 ref_cnt;
   pfcp_mbr_t mbr;
+  pfcp_gbr_t gbr;
+  u8 policed[UPF_DIRECTION_MAX];	/* MBR set for the direction */
+  u8 single_rate[UPF_DIRECTION_MAX];	/* no GBR below the MBR */
 } upf_qer_policer_t;
 
 typedef struct
@@ -657,13 +989,88 @@ typedef struct
 
   u8 flags;
 #define PFCP_QER_MBR				BIT(0)
+#define PFCP_QER_GBR				BIT(1)
+#define PFCP_QER_CORRELATED			BIT(2)
 
   u8 gate_status[UPF_DIRECTION_MAX];
+#define PFCP_GATE_OPEN				0
 
   pfcp_mbr_t mbr;
+  pfcp_gbr_t gbr;
   clib_bihash_kv_8_8_t policer;
 } upf_qer_t;
 
+/*
+ * Per QER policer counters, indexed by policer. The first three match
+ * the policer_result_e colors.
+ */
+typedef enum
+{
+  UPF_QER_COUNTER_CONFORM = POLICE_CONFORM,
+  UPF_QER_COUNTER_EXCEED = POLICE_EXCEED,
+  UPF_QER_COUNTER_VIOLATE = POLICE_VIOLATE,
+  UPF_QER_COUNTER_GATE_CLOSED,
+  UPF_QER_N_COUNTERS,
+} upf_qer_counter_t;
+
+#define foreach_upf_qer_counter_name		\
+  _(CONFORM, conform)				\
+  _(EXCEED, exceed)				\
+  _(VIOLATE, violate)				\
+  _(GATE_CLOSED, gate_closed)
+
+/*
+ * Token bucket steps of vnet_police_packet (), split so that the QERs of
+ * a PDR can be evaluated as a hierarchy: every level is colored first and
+ * the packet is only charged to the buckets once no level drops it.
+ * Lengths are in bytes, time in policer periods.
+ */
+always_inline void
+upf_policer_refill (policer_read_response_type_st * p, u64 time)
+{
+  u64 n_periods = time - p->last_update_time;
+  u64 tokens;
+
+  /* the time is taken once per frame, only the first packet refills */
+  if (PREDICT_TRUE (n_periods == 0))
+    return;
+
+  p->last_update_time = time;
+
+  tokens = p->current_bucket + n_periods * p->cir_tokens_per_period;
+  p->current_bucket = clib_min (tokens, p->current_limit);
+  tokens = p->extended_bucket + n_periods * p->pir_tokens_per_period;
+  p->extended_bucket = clib_min (tokens, p->extended_limit);
+}
+
+always_inline u8
+upf_policer_color (policer_read_response_type_st * p, u32 len)
+{
+  len <<= p->scale;
+
+  if (p->single_rate)
+    {
+      if (p->current_bucket >= len)
+	return POLICE_CONFORM;
+      return p->extended_bucket >= len ? POLICE_EXCEED : POLICE_VIOLATE;
+    }
+
+  if (p->extended_bucket < len)
+    return POLICE_VIOLATE;
+  return p->current_bucket < len ? POLICE_EXCEED : POLICE_CONFORM;
+}
+
+always_inline void
+upf_policer_charge (policer_read_response_type_st * p, u32 len, u8 color)
+{
+  len <<= p->scale;
+
+  if (color == POLICE_CONFORM)
+    p->current_bucket -= clib_min (len, p->current_bucket);
+  if (color != POLICE_VIOLATE)
+    p->extended_bucket -= clib_min (len, p->extended_bucket);
+}
+
 typedef struct
 {
   ip46_address_t addr;
@@ -671,6 +1078,18 @@ typedef struct
   u32 sw_if_index;
 } ue_ip_t;
 
+/*
+ * Application detection of a rule set. The applications referenced by its
+ * ADR PDRs are scanned with one database that is shared by all rule sets
+ * referencing the same applications. A Hyperscan match id is the position
+ * of the application in the set.
+ */
+typedef struct
+{
+  struct upf_adf_set *set;
+  u32 **pdrs;			/* per match id, ADR PDR indexes into rules->pdr */
+} upf_adr_db_t;
+
 typedef struct
 {
   /* Required for pool_get_aligned  */
@@ -714,6 +1133,10 @@ typedef struct
 
     upf_acl_t *v4_acls;
     upf_acl_t *v6_acls;
+    upf_acl_index_t v4_index;
+    upf_acl_index_t v6_index;
+
+    upf_adr_db_t adr_db;
 
     ue_ip_t *ue_src_ip;
     ue_ip_t *ue_dst_ip;
@@ -726,8 +1149,12 @@ typedef struct
 #define PFCP_ACTIVE  0
 #define PFCP_PENDING 1
 
-  /** FIFO to hold the DL pkts for this session */
-  vlib_buffer_t *dl_fifo;
+  upf_bar_t bar;
+
+  /** DL packets buffered for this session by all threads */
+  u32 dl_buffered;
+  /** DL Data Report sent since the FARs last changed */
+  u8 dl_data_reported;
 
   /* DPO locks */
   u32 dpo_locks;
@@ -743,6 +1170,12 @@ typedef struct
   f64 unix_time_start;
 
   u16 generation;
+  /*
+   * lowest PDR precedence touched by each of the last rule updates,
+   * indexed by the generation the update produced
+   */
+#define UPF_RECLASSIFY_HISTORY 8
+  u32 reclassify_precedence[UPF_RECLASSIFY_HISTORY];
 } upf_session_t;
 
 
@@ -902,9 +1335,23 @@ typedef struct
   //  clib_bihash_8_8_t *session_by_tdf_ue_ip;
   u32 *tdf_ul_table[FIB_PROTOCOL_IP_MAX];
 
+  /* per thread usage, indexed by session */
+  upf_session_acc_t **session_acc;
+  u32 monitoring_epoch;		/* advanced when a Monitoring Time is reached */
+
+  /* per thread buffered DL packets, indexed by session */
+  upf_dl_buffer_t **dl_buffers;
+  u32 dl_buffered;		/* packets buffered by all sessions */
+  u32 dl_buffer_max;		/* global limit */
+  u32 dl_buffer_session_max;	/* limit per session */
+
   /* policer pool, aligned */
   upf_qer_policer_t *qer_policers;
+  uword **qer_active;		/* per thread bitmap, policers with traffic */
+  uword *qer_rebalance;		/* policers to rebalance, main thread */
   clib_bihash_8_8_t qer_by_id;
+  vlib_combined_counter_main_t qer_counters[UPF_QER_N_COUNTERS];
+  u32 qer_yellow_dscp;		/* DSCP for traffic above the GBR, ~0: off */
 
   /* list of remote GTP-U peer ref count used to stack FIB DPO objects */
   upf_peer_t *peers;
@@ -962,6 +1409,9 @@ extern vlib_node_registration_t upf_gtpu4_input_node;
 extern vlib_node_registration_t upf_gtpu6_input_node;
 extern vlib_node_registration_t upf4_encap_node;
 extern vlib_node_registration_t upf6_encap_node;
+extern vlib_node_registration_t upf_ip4_forward_node;
+extern vlib_node_registration_t upf_ip6_forward_node;
+extern vlib_node_registration_t upf_dl_buffer_node;
 
 typedef enum
 {
@@ -969,6 +1419,7 @@ typedef enum
   UPF_FORWARD_NEXT_GTP_IP4_ENCAP,
   UPF_FORWARD_NEXT_GTP_IP6_ENCAP,
   UPF_FORWARD_NEXT_IP_INPUT,
+  UPF_FORWARD_NEXT_BUFFER,
   UPF_FORWARD_N_NEXT,
 } upf_forward_next_t;
 
@@ -1016,6 +1467,9 @@ vnet_upf_nat_pool_add_del (u8 * nwi_name, ip4_address_t start_addr,
 int vnet_upf_ue_ip_pool_add_del (u8 * identity, u8 * nwi_name, int is_add);
 
 void upf_ip_lookup_tx (u32 bi, int is_ip4);
+
+/* must be called with the workers stopped */
+void upf_dl_buffer_flush (upf_session_t * sx, int drop);
 void upf_gtpu_error_ind (vlib_buffer_t * b0, int is_ip4);
 
 static_always_inline void
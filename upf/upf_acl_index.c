@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2020 Travelping GmbH
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vppinfra/error.h>
+#include <vppinfra/hash.h>
+#include <vnet/ip/ip.h>
+
+#include <upf/upf.h>
+#include <upf/upf_acl_index.h>
+
+#if CLIB_DEBUG > 1
+#define upf_debug clib_warning
+#else
+#define upf_debug(...)				\
+  do { } while (0)
+#endif
+
+/*
+ * Turn an ACL into a mask and a masked value over upf_acl_key_t.
+ *
+ * The UE IP match is folded into the src (UL) or dst (DL) prefix. Returns
+ * 0 when the ACL can never match (UE IP and SDF prefix disagree or a port
+ * range is empty), those ACLs are left out of the index.
+ */
+static int
+upf_acl_compile_key (const upf_acl_t * acl, upf_acl_key_t * mask,
+		     upf_acl_key_t * value)
+{
+  int i, f;
+
+  clib_memset (mask, 0, sizeof (*mask));
+  clib_memset (value, 0, sizeof (*value));
+
+  for (f = UPF_ACL_FIELD_SRC; f <= UPF_ACL_FIELD_DST; f++)
+    for (i = 0; i < ARRAY_LEN (mask->addr[f].as_u64); i++)
+      {
+	mask->addr[f].as_u64[i] = acl->mask.address[f].as_u64[i];
+	value->addr[f].as_u64[i] =
+	  acl->match.address[f].as_u64[i] & mask->addr[f].as_u64[i];
+      }
+
+  if (acl->match_ue_ip == UPF_ACL_UL || acl->match_ue_ip == UPF_ACL_DL)
+    {
+      const ip46_address_t *ue_mask =
+	(ip46_address_t *) & ip6_main.fib_masks[acl->is_ip4 ? 32 : 64];
+
+      f = (acl->match_ue_ip == UPF_ACL_UL) ?
+	UPF_ACL_FIELD_SRC : UPF_ACL_FIELD_DST;
+      for (i = 0; i < ARRAY_LEN (mask->addr[f].as_u64); i++)
+	{
+	  u64 m = ue_mask->as_u64[i];
+	  u64 v = acl->ue_ip.as_u64[i] & m;
+
+	  if ((v ^ value->addr[f].as_u64[i]) & m & mask->addr[f].as_u64[i])
+	    return 0;
+
+	  mask->addr[f].as_u64[i] |= m;
+	  value->addr[f].as_u64[i] |= v;
+	}
+    }
+
+  if (acl->match_teid)
+    {
+      mask->teid = ~0;
+      value->teid = acl->teid;
+    }
+
+  mask->proto = acl->mask.protocol;
+  value->proto = acl->match.protocol & acl->mask.protocol;
+
+  /* ranges are verified per candidate, only single ports are hashed */
+  for (f = UPF_ACL_FIELD_SRC; f <= UPF_ACL_FIELD_DST; f++)
+    {
+      if (acl->mask.port[f] > acl->match.port[f])
+	return 0;
+
+      if (acl->mask.port[f] == acl->match.port[f])
+	{
+	  mask->port[f] = 0xffff;
+	  value->port[f] = acl->mask.port[f];
+	}
+    }
+
+  return 1;
+}
+
+/* length of the leading run of one bits, the part usable by the trie */
+static u32
+upf_acl_prefix_len (const ip46_address_t * mask)
+{
+  u32 len = 0;
+
+  while (len < 128 && (mask->as_u8[len >> 3] & (0x80 >> (len & 7))))
+    len++;
+
+  return len;
+}
+
+static u32
+upf_acl_trie_node_add (upf_acl_trie_t * trie)
+{
+  upf_acl_trie_node_t *node;
+
+  vec_add2 (trie->nodes, node, 1);
+  clib_memset (node->slots, 0xff, sizeof (node->slots));
+
+  return node - trie->nodes;
+}
+
+/*
+ * Insert a prefix. The last stride is expanded to all slots covered by
+ * the remaining prefix bits, so a lookup only ever follows one path.
+ */
+static void
+upf_acl_trie_add (upf_acl_trie_t * trie, const ip46_address_t * ip,
+		  u32 plen, u32 rule)
+{
+  u32 depth, rest, node, nibble, first, i;
+
+  if (plen == 0)
+    {
+      trie->any = clib_bitmap_set (trie->any, rule, 1);
+      return;
+    }
+
+  if (vec_len (trie->nodes) == 0)
+    upf_acl_trie_node_add (trie);
+
+  depth = (plen - 1) / UPF_ACL_TRIE_STRIDE;
+  rest = plen - depth * UPF_ACL_TRIE_STRIDE;
+
+  node = 0;
+  for (i = 0; i < depth; i++)
+    {
+      nibble = upf_acl_trie_nibble (ip, i);
+      if (trie->nodes[node].slots[nibble].child == ~0)
+	{
+	  u32 child = upf_acl_trie_node_add (trie);
+	  trie->nodes[node].slots[nibble].child = child;
+	}
+      node = trie->nodes[node].slots[nibble].child;
+    }
+
+  nibble = upf_acl_trie_nibble (ip, depth);
+  first = nibble & ~((1 << (UPF_ACL_TRIE_STRIDE - rest)) - 1);
+  for (i = first; i < first + (1 << (UPF_ACL_TRIE_STRIDE - rest)); i++)
+    {
+      upf_acl_trie_slot_t *slot = &trie->nodes[node].slots[i];
+
+      if (slot->rules == ~0)
+	{
+	  slot->rules = vec_len (trie->bitmaps);
+	  vec_add1 (trie->bitmaps, 0);
+	}
+      trie->bitmaps[slot->rules] =
+	clib_bitmap_set (trie->bitmaps[slot->rules], rule, 1);
+    }
+}
+
+static void
+upf_acl_trie_free (upf_acl_trie_t * trie)
+{
+  uword **b;
+
+  vec_foreach (b, trie->bitmaps) clib_bitmap_free (*b);
+  vec_free (trie->bitmaps);
+  vec_free (trie->nodes);
+  clib_bitmap_free (trie->any);
+}
+
+static void
+upf_acl_index_build_trie (upf_acl_index_t * idx, upf_acl_t * acls)
+{
+  upf_acl_t *acl;
+
+  vec_foreach (acl, acls)
+  {
+    upf_acl_key_t mask, value;
+    int f;
+
+    if (!upf_acl_compile_key (acl, &mask, &value))
+      continue;
+
+    for (f = UPF_ACL_FIELD_SRC; f <= UPF_ACL_FIELD_DST; f++)
+      upf_acl_trie_add (&idx->trie[f], &value.addr[f],
+			upf_acl_prefix_len (&mask.addr[f]), acl - acls);
+  }
+
+  upf_debug ("%u ACLs compiled into %u/%u trie nodes", vec_len (acls),
+	     vec_len (idx->trie[UPF_ACL_FIELD_SRC].nodes),
+	     vec_len (idx->trie[UPF_ACL_FIELD_DST].nodes));
+}
+
+static void
+upf_acl_index_build_soa (upf_acl_index_t * idx, upf_acl_t * acls)
+{
+  upf_acl_soa_t *soa = &idx->soa;
+  upf_acl_t *acl;
+  u32 n, i;
+
+  n = soa->n_lanes = round_pow2 (vec_len (acls), UPF_ACL_SOA_ALIGN);
+  vec_validate_aligned (soa->lanes, UPF_ACL_SOA_N_ROWS * n - 1,
+			CLIB_CACHE_LINE_BYTES);
+
+  /* an empty port range never matches, used for padding and dead ACLs */
+  for (i = 0; i < n; i++)
+    {
+      soa->lanes[UPF_ACL_SOA_PORT_MIN * n + i] = 1;
+      soa->lanes[(UPF_ACL_SOA_PORT_MIN + 1) * n + i] = 1;
+    }
+
+  vec_foreach (acl, acls)
+  {
+    upf_acl_key_t mask, value;
+    u32 l = acl - acls;
+    int f;
+
+    if (!upf_acl_compile_key (acl, &mask, &value))
+      continue;
+
+    for (i = 0; i < 8; i++)
+      {
+	soa->lanes[(UPF_ACL_SOA_ADDR_MASK + i) * n + l] =
+	  ((u32 *) mask.addr)[i];
+	soa->lanes[(UPF_ACL_SOA_ADDR_VALUE + i) * n + l] =
+	  ((u32 *) value.addr)[i];
+      }
+    soa->lanes[UPF_ACL_SOA_TEID_MASK * n + l] = mask.teid;
+    soa->lanes[UPF_ACL_SOA_TEID_VALUE * n + l] = value.teid;
+    soa->lanes[UPF_ACL_SOA_PROTO_MASK * n + l] = mask.proto;
+    soa->lanes[UPF_ACL_SOA_PROTO_VALUE * n + l] = value.proto;
+    for (f = UPF_ACL_FIELD_SRC; f <= UPF_ACL_FIELD_DST; f++)
+      {
+	soa->lanes[(UPF_ACL_SOA_PORT_MIN + f) * n + l] = acl->mask.port[f];
+	soa->lanes[(UPF_ACL_SOA_PORT_MAX + f) * n + l] = acl->match.port[f];
+      }
+
+    if (acl->match_ip_app)
+      soa->post_check |= 1ULL << l;
+  }
+}
+
+void
+upf_acl_index_free (upf_acl_index_t * idx)
+{
+  upf_acl_partition_t *part;
+  upf_acl_tuple_t *t;
+  u32 **r;
+
+  vec_foreach (part, idx->partitions)
+  {
+    upf_acl_index_free (&part->index);
+    vec_free (part->acls);
+    vec_free (part->rules);
+  }
+  vec_free (idx->partitions);
+  hash_free (idx->partition_by_teid);
+
+  vec_foreach (t, idx->tuples)
+  {
+    hash_free (t->by_key);
+    vec_free (t->keys);
+    vec_foreach (r, t->rules) vec_free (*r);
+    vec_free (t->rules);
+  }
+  vec_free (idx->tuples);
+
+  upf_acl_trie_free (&idx->trie[UPF_ACL_FIELD_SRC]);
+  upf_acl_trie_free (&idx->trie[UPF_ACL_FIELD_DST]);
+
+  vec_free (idx->soa.lanes);
+  idx->soa.n_lanes = 0;
+  idx->soa.post_check = 0;
+
+  idx->n_rules = 0;
+  idx->use_trie = 0;
+  idx->use_soa = 0;
+}
+
+static void
+upf_acl_index_build_one (upf_acl_index_t * idx, upf_acl_t * acls,
+			 int is_ip4)
+{
+  upf_acl_tuple_t *t;
+  u32 **tuple_rules = 0;
+  upf_acl_t *acl;
+
+  upf_acl_index_free (idx);
+  idx->n_rules = vec_len (acls);
+
+  if (idx->n_rules == 0)
+    return;
+
+  if (idx->n_rules <= UPF_ACL_SOA_MAX)
+    {
+      idx->use_soa = 1;
+      upf_acl_index_build_soa (idx, acls);
+      return;
+    }
+
+  /*
+   * IPv6 filters mostly differ in prefixes of all kinds of lengths, which
+   * would yield many tuples. Narrow those down by src/dst prefix instead.
+   */
+  if (!is_ip4)
+    {
+      idx->use_trie = 1;
+      upf_acl_index_build_trie (idx, acls);
+      return;
+    }
+
+  /*
+   * Pass one: assign every ACL to the tuple with its mask. ACLs are
+   * visited in vector (precedence) order, so tuples end up ordered by
+   * their lowest ACL index and every per key list is ascending.
+   */
+  vec_foreach (acl, acls)
+  {
+    upf_acl_key_t mask, value;
+
+    if (!upf_acl_compile_key (acl, &mask, &value))
+      continue;
+
+    vec_foreach (t, idx->tuples)
+    {
+      if (memcmp (&t->mask, &mask, sizeof (mask)) == 0)
+	break;
+    }
+
+    if (t == vec_end (idx->tuples))
+      {
+	vec_add2 (idx->tuples, t, 1);
+	t->mask = mask;
+	t->min_rule = acl - acls;
+	vec_add1 (tuple_rules, 0);
+      }
+
+    vec_add1 (t->keys, value);
+    vec_add1 (tuple_rules[t - idx->tuples], acl - acls);
+  }
+
+  /*
+   * Pass two: the key vectors are final now, so the hash can reference
+   * them in place.
+   */
+  vec_foreach (t, idx->tuples)
+  {
+    u32 *rules = tuple_rules[t - idx->tuples];
+    u32 i;
+
+    t->by_key = hash_create_mem (0, sizeof (upf_acl_key_t), sizeof (uword));
+    vec_foreach_index (i, t->keys)
+    {
+      uword *p = hash_get_mem (t->by_key, &t->keys[i]);
+
+      if (p)
+	vec_add1 (t->rules[p[0]], rules[i]);
+      else
+	{
+	  hash_set_mem (t->by_key, &t->keys[i], vec_len (t->rules));
+	  vec_add1 (t->rules, 0);
+	  vec_add1 (t->rules[vec_len (t->rules) - 1], rules[i]);
+	}
+    }
+
+    vec_free (rules);
+  }
+  vec_free (tuple_rules);
+
+  upf_debug ("%u ACLs compiled into %u tuples", vec_len (acls),
+	     vec_len (idx->tuples));
+}
+
+void
+upf_acl_index_build (upf_acl_index_t * idx, upf_acl_t * acls, int is_ip4)
+{
+  upf_acl_partition_t *part;
+  uword *teids;
+  upf_acl_t *acl;
+
+  upf_acl_index_free (idx);
+
+  teids = hash_create (0, sizeof (uword));
+  vec_foreach (acl, acls)
+  {
+    if (acl->match_teid && !hash_get (teids, acl->teid))
+      hash_set (teids, acl->teid, hash_elts (teids));
+  }
+
+  if (hash_elts (teids) < 2)
+    {
+      hash_free (teids);
+      upf_acl_index_build_one (idx, acls, is_ip4);
+      return;
+    }
+
+  /* one partition per TEID, the last one for packets on other TEIDs */
+  idx->n_rules = vec_len (acls);
+  idx->partition_by_teid = teids;
+  idx->wildcard_partition = hash_elts (teids);
+  vec_validate (idx->partitions, idx->wildcard_partition);
+
+  vec_foreach (acl, acls)
+  {
+    if (acl->match_teid)
+      {
+	part = vec_elt_at_index (idx->partitions,
+				 hash_get (teids, acl->teid)[0]);
+	vec_add1 (part->acls, *acl);
+	vec_add1 (part->rules, acl - acls);
+      }
+    else
+      vec_foreach (part, idx->partitions)
+      {
+	vec_add1 (part->acls, *acl);
+	vec_add1 (part->rules, acl - acls);
+      }
+  }
+
+  vec_foreach (part, idx->partitions)
+    upf_acl_index_build_one (&part->index, part->acls, is_ip4);
+
+  upf_debug ("%u ACLs split into %u TEID partitions", vec_len (acls),
+	     vec_len (idx->partitions));
+}
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2020 Travelping GmbH
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __included_upf_acl_index_h__
+#define __included_upf_acl_index_h__
+
+#include <vppinfra/hash.h>
+#include <vnet/ip/ip.h>
+
+#include <upf/upf.h>
+#include <upf/upf_app_db.h>
+
+/*
+ * Compiled PDR SDF filter lookup.
+ *
+ * The ACL vector of a session is sorted by precedence, and the first
+ * matching entry wins. Instead of testing every entry, ACLs are grouped
+ * into tuples of identical field masks (TEID, src/dst prefix incl. the
+ * UE IP, protocol, exact ports). Each tuple is a hash of masked keys, so
+ * a lookup costs one hash probe per tuple. Port ranges and IP application
+ * rules cannot be expressed as masks and are verified on the candidates.
+ * Tuples are ordered by their lowest ACL index which allows stopping as
+ * soon as no tuple can improve on the best match found so far.
+ *
+ * IPv6 ACLs use a stride 4 multi-bit trie per src and dst address
+ * instead. Each trie yields the bitmap of ACLs whose prefix covers the
+ * address, the candidates are the intersection of both and are verified
+ * in ascending order with the full matcher.
+ *
+ * Small ACL vectors (the common 5-50 filter session) skip both and are
+ * matched as a structure of arrays, 8 (AVX2) or 16 (AVX-512) ACLs per
+ * step. Every lane yields one bit, the lowest set bit is the first match.
+ *
+ * Sessions with ACLs for more than one TEID (multiple bearers) are first
+ * split into per TEID partitions. A partition holds the ACLs for its TEID
+ * plus all ACLs without TEID match and has its own index, packets on
+ * unknown TEIDs (or without GTP) use the partition without TEID ACLs.
+ */
+
+/* ACL vectors up to this size use the SoA matcher */
+#define UPF_ACL_SOA_MAX 64
+/* lanes are padded to the widest vector */
+#define UPF_ACL_SOA_ALIGN 16
+
+/* SoA rows, addresses as 4 x u32 per field, pre-masked values */
+enum
+{
+  UPF_ACL_SOA_ADDR_MASK = 0,
+  UPF_ACL_SOA_ADDR_VALUE = 8,
+  UPF_ACL_SOA_TEID_MASK = 16,
+  UPF_ACL_SOA_TEID_VALUE,
+  UPF_ACL_SOA_PROTO_MASK,
+  UPF_ACL_SOA_PROTO_VALUE,
+  UPF_ACL_SOA_PORT_MIN,
+  UPF_ACL_SOA_PORT_MAX = UPF_ACL_SOA_PORT_MIN + 2,
+  UPF_ACL_SOA_N_ROWS = UPF_ACL_SOA_PORT_MAX + 2,
+};
+
+#if defined (CLIB_HAVE_VEC512)
+#define UPF_ACL_SOA_LANES 16
+typedef u32x16 upf_acl_lanes_t;
+#define upf_acl_lanes_bits(v)					\
+  _mm512_test_epi32_mask ((__m512i) (v), (__m512i) (v))
+#elif defined (CLIB_HAVE_VEC256)
+#define UPF_ACL_SOA_LANES 8
+typedef u32x8 upf_acl_lanes_t;
+#define upf_acl_lanes_bits(v) _mm256_movemask_ps ((__m256) (v))
+#else
+#define UPF_ACL_SOA_LANES 8
+#endif
+
+void upf_acl_index_build (upf_acl_index_t * idx, upf_acl_t * acls,
+			  int is_ip4);
+void upf_acl_index_free (upf_acl_index_t * idx);
+
+always_inline void
+upf_acl_key_from_flow (upf_acl_key_t * key, flow_entry_t * flow,
+		       int is_reverse, u32 teid)
+{
+  key->addr[UPF_ACL_FIELD_SRC] = flow->key.ip[FT_ORIGIN ^ is_reverse];
+  key->addr[UPF_ACL_FIELD_DST] = flow->key.ip[FT_REVERSE ^ is_reverse];
+  key->teid = teid;
+  key->port[UPF_ACL_FIELD_SRC] =
+    clib_net_to_host_u16 (flow->key.port[FT_ORIGIN ^ is_reverse]);
+  key->port[UPF_ACL_FIELD_DST] =
+    clib_net_to_host_u16 (flow->key.port[FT_REVERSE ^ is_reverse]);
+  key->as_u64[5] = 0;
+  key->proto = flow->key.proto;
+}
+
+always_inline void
+upf_acl_key_mask (upf_acl_key_t * r, const upf_acl_key_t * key,
+		  const upf_acl_key_t * mask)
+{
+  int i;
+
+  for (i = 0; i < ARRAY_LEN (r->as_u64); i++)
+    r->as_u64[i] = key->as_u64[i] & mask->as_u64[i];
+}
+
+always_inline int
+upf_acl_ports_match (const upf_acl_t * acl, const upf_acl_key_t * key)
+{
+  return (key->port[UPF_ACL_FIELD_SRC] >= acl->mask.port[UPF_ACL_FIELD_SRC]
+	  && key->port[UPF_ACL_FIELD_SRC] <=
+	  acl->match.port[UPF_ACL_FIELD_SRC]
+	  && key->port[UPF_ACL_FIELD_DST] >=
+	  acl->mask.port[UPF_ACL_FIELD_DST]
+	  && key->port[UPF_ACL_FIELD_DST] <=
+	  acl->match.port[UPF_ACL_FIELD_DST]);
+}
+
+always_inline int
+upf_acl_ip_app_match (const upf_acl_t * acl, upf_app_ip_flow_t * af,
+		      struct rules *active)
+{
+  upf_pdr_t *pdr;
+
+  /* FIXME: should be able to handle PDRs w/o UE IP */
+  if (!acl->match_ue_ip)
+    return 0;
+
+  pdr = vec_elt_at_index (active->pdr, acl->pdr_idx);
+  return upf_app_ip_flow_rule_match (pdr->pdi.adr.db_id, af,
+				     (ip46_address_t *) & acl->ue_ip);
+}
+
+always_inline int
+upf_acl_ip46_is_equal_masked (const ip46_address_t * a,
+			      const ip46_address_t * b,
+			      const ip46_address_t * mask)
+{
+  return (((a->as_u64[0] ^ b->as_u64[0]) & mask->as_u64[0]) == 0 &&
+	  ((a->as_u64[1] ^ b->as_u64[1]) & mask->as_u64[1]) == 0);
+}
+
+/* reference matcher, tests a single ACL against a flow key */
+always_inline int
+upf_acl_match_one (const upf_acl_t * acl, const upf_acl_key_t * key,
+		   upf_app_ip_flow_t * af, struct rules *active)
+{
+  const ip46_address_t *ue_mask =
+    (ip46_address_t *) & ip6_main.fib_masks[acl->is_ip4 ? 32 : 64];
+
+  if (acl->match_teid && key->teid != acl->teid)
+    return 0;
+
+  switch (acl->match_ue_ip)
+    {
+    case UPF_ACL_UL:
+      if (!upf_acl_ip46_is_equal_masked (&acl->ue_ip,
+					 &key->addr[UPF_ACL_FIELD_SRC],
+					 ue_mask))
+	return 0;
+      break;
+    case UPF_ACL_DL:
+      if (!upf_acl_ip46_is_equal_masked (&acl->ue_ip,
+					 &key->addr[UPF_ACL_FIELD_DST],
+					 ue_mask))
+	return 0;
+      break;
+    default:
+      break;
+    }
+
+  if (acl->match_ip_app && !upf_acl_ip_app_match (acl, af, active))
+    return 0;
+
+  if ((key->proto & acl->mask.protocol) !=
+      (acl->match.protocol & acl->mask.protocol))
+    return 0;
+
+  if (!upf_acl_ip46_is_equal_masked (&key->addr[UPF_ACL_FIELD_SRC],
+				     &acl->match.address[UPF_ACL_FIELD_SRC],
+				     &acl->mask.address[UPF_ACL_FIELD_SRC])
+      || !upf_acl_ip46_is_equal_masked (&key->addr[UPF_ACL_FIELD_DST],
+					&acl->match.address
+					[UPF_ACL_FIELD_DST],
+					&acl->mask.address
+					[UPF_ACL_FIELD_DST]))
+    return 0;
+
+  return upf_acl_ports_match (acl, key);
+}
+
+/* linear scan, returns the index of the first matching ACL or ~0 */
+always_inline u32
+upf_acl_linear_lookup (upf_acl_t * acls, const upf_acl_key_t * key,
+		       upf_app_ip_flow_t * af, struct rules *active)
+{
+  upf_acl_t *acl;
+
+  vec_foreach (acl, acls)
+  {
+    if (upf_acl_match_one (acl, key, af, active))
+      return acl - acls;
+  }
+
+  return ~0;
+}
+
+always_inline u32
+upf_acl_trie_nibble (const ip46_address_t * ip, u32 depth)
+{
+  return (ip->as_u8[depth >> 1] >> ((~depth & 1) << 2)) & 0xf;
+}
+
+always_inline void
+upf_acl_trie_bitmap_or (uword * bits, uword * bitmap)
+{
+  int i;
+
+  for (i = 0; i < vec_len (bitmap); i++)
+    bits[i] |= bitmap[i];
+}
+
+/* OR the bitmaps of all prefixes covering ip into bits */
+always_inline void
+upf_acl_trie_lookup (upf_acl_trie_t * trie, const ip46_address_t * ip,
+		     uword * bits)
+{
+  upf_acl_trie_node_t *node;
+  u32 depth;
+
+  upf_acl_trie_bitmap_or (bits, trie->any);
+  if (vec_len (trie->nodes) == 0)
+    return;
+
+  node = trie->nodes;
+  for (depth = 0; depth < 128 / UPF_ACL_TRIE_STRIDE; depth++)
+    {
+      upf_acl_trie_slot_t *slot =
+	&node->slots[upf_acl_trie_nibble (ip, depth)];
+
+      if (slot->rules != ~0)
+	upf_acl_trie_bitmap_or (bits, trie->bitmaps[slot->rules]);
+      if (slot->child == ~0)
+	break;
+
+      node = trie->nodes + slot->child;
+    }
+}
+
+always_inline u32
+upf_acl_trie_index_lookup (upf_acl_index_t * idx, upf_acl_t * acls,
+			   const upf_acl_key_t * key, upf_app_ip_flow_t * af,
+			   struct rules *active)
+{
+  u32 n_words = (idx->n_rules + BITS (uword) - 1) / BITS (uword);
+  uword src[n_words], dst[n_words];
+  u32 i;
+
+  clib_memset (src, 0, sizeof (src));
+  clib_memset (dst, 0, sizeof (dst));
+
+  upf_acl_trie_lookup (&idx->trie[UPF_ACL_FIELD_SRC],
+		       &key->addr[UPF_ACL_FIELD_SRC], src);
+  upf_acl_trie_lookup (&idx->trie[UPF_ACL_FIELD_DST],
+		       &key->addr[UPF_ACL_FIELD_DST], dst);
+
+  for (i = 0; i < n_words; i++)
+    {
+      uword m = src[i] & dst[i];
+
+      while (m)
+	{
+	  u32 ri = i * BITS (uword) + count_trailing_zeros (m);
+
+	  if (upf_acl_match_one (vec_elt_at_index (acls, ri), key, af,
+				 active))
+	    return ri;
+	  m &= m - 1;
+	}
+    }
+
+  return ~0;
+}
+
+/* match UPF_ACL_SOA_LANES ACLs starting at base, one bit per ACL */
+always_inline u64
+upf_acl_soa_match (const upf_acl_soa_t * soa, const upf_acl_key_t * key,
+		   u32 base)
+{
+  const u32 *lanes = soa->lanes + base;
+  const u32 *addr = (u32 *) key->addr;
+  u32 n = soa->n_lanes;
+  int i;
+
+#if defined (CLIB_HAVE_VEC512) || defined (CLIB_HAVE_VEC256)
+#define _row(r) (*(upf_acl_lanes_t *) (lanes + (r) * n))
+  upf_acl_lanes_t ok;
+
+  ok = (upf_acl_lanes_t) ((_row (UPF_ACL_SOA_TEID_MASK) & key->teid) ==
+			  _row (UPF_ACL_SOA_TEID_VALUE));
+  ok &= (upf_acl_lanes_t) ((_row (UPF_ACL_SOA_PROTO_MASK) & key->proto) ==
+			   _row (UPF_ACL_SOA_PROTO_VALUE));
+  for (i = 0; i < 8; i++)
+    ok &= (upf_acl_lanes_t) ((_row (UPF_ACL_SOA_ADDR_MASK + i) & addr[i]) ==
+			     _row (UPF_ACL_SOA_ADDR_VALUE + i));
+  for (i = 0; i < 2; i++)
+    ok &= (upf_acl_lanes_t) ((_row (UPF_ACL_SOA_PORT_MIN + i) <=
+			      key->port[i]) &
+			     (_row (UPF_ACL_SOA_PORT_MAX + i) >=
+			      key->port[i]));
+#undef _row
+
+  return upf_acl_lanes_bits (ok);
+#else
+  u64 bits = 0;
+  int j;
+
+  for (j = 0; j < UPF_ACL_SOA_LANES; j++)
+    {
+      const u32 *l = lanes + j;
+      u32 ok;
+
+      ok = ((l[UPF_ACL_SOA_TEID_MASK * n] & key->teid) ==
+	    l[UPF_ACL_SOA_TEID_VALUE * n]);
+      ok &= ((l[UPF_ACL_SOA_PROTO_MASK * n] & key->proto) ==
+	     l[UPF_ACL_SOA_PROTO_VALUE * n]);
+      for (i = 0; i < 8; i++)
+	ok &= ((l[(UPF_ACL_SOA_ADDR_MASK + i) * n] & addr[i]) ==
+	       l[(UPF_ACL_SOA_ADDR_VALUE + i) * n]);
+      for (i = 0; i < 2; i++)
+	ok &= (l[(UPF_ACL_SOA_PORT_MIN + i) * n] <= key->port[i] &&
+	       l[(UPF_ACL_SOA_PORT_MAX + i) * n] >= key->port[i]);
+
+      bits |= (u64) ok << j;
+    }
+
+  return bits;
+#endif
+}
+
+always_inline u32
+upf_acl_soa_lookup (upf_acl_index_t * idx, upf_acl_t * acls,
+		    const upf_acl_key_t * key, upf_app_ip_flow_t * af,
+		    struct rules *active)
+{
+  upf_acl_soa_t *soa = &idx->soa;
+  u32 base;
+
+  for (base = 0; base < soa->n_lanes; base += UPF_ACL_SOA_LANES)
+    {
+      u64 m = upf_acl_soa_match (soa, key, base);
+
+      while (m)
+	{
+	  u32 ri = base + count_trailing_zeros (m);
+
+	  if (!(soa->post_check & (1ULL << ri)) ||
+	      upf_acl_ip_app_match (vec_elt_at_index (acls, ri), af,
+				    active))
+	    return ri;
+	  m &= m - 1;
+	}
+    }
+
+  return ~0;
+}
+
+always_inline u32
+upf_acl_index_lookup_one (upf_acl_index_t * idx, upf_acl_t * acls,
+			  const upf_acl_key_t * key, upf_app_ip_flow_t * af,
+			  struct rules *active)
+{
+  upf_acl_tuple_t *t;
+  u32 best = ~0;
+
+  if (idx->n_rules == 0)
+    return ~0;
+
+  if (idx->use_soa)
+    return upf_acl_soa_lookup (idx, acls, key, af, active);
+
+  if (idx->use_trie)
+    return upf_acl_trie_index_lookup (idx, acls, key, af, active);
+
+  vec_foreach (t, idx->tuples)
+  {
+    upf_acl_key_t masked;
+    uword *p;
+    u32 *ri;
+
+    if (t->min_rule >= best)
+      break;
+
+    upf_acl_key_mask (&masked, key, &t->mask);
+    p = hash_get_mem (t->by_key, &masked);
+    if (!p)
+      continue;
+
+    vec_foreach (ri, t->rules[p[0]])
+    {
+      upf_acl_t *acl;
+
+      if (*ri >= best)
+	break;
+
+      acl = vec_elt_at_index (acls, *ri);
+      if (!upf_acl_ports_match (acl, key))
+	continue;
+      if (acl->match_ip_app && !upf_acl_ip_app_match (acl, af, active))
+	continue;
+
+      best = *ri;
+      break;
+    }
+  }
+
+  return best;
+}
+
+/* indexed lookup, same result as upf_acl_linear_lookup */
+always_inline u32
+upf_acl_index_lookup (upf_acl_index_t * idx, upf_acl_t * acls,
+		      const upf_acl_key_t * key, upf_app_ip_flow_t * af,
+		      struct rules *active)
+{
+  upf_acl_partition_t *part;
+  uword *p;
+  u32 ri;
+
+  if (PREDICT_TRUE (!idx->partitions))
+    return upf_acl_index_lookup_one (idx, acls, key, af, active);
+
+  p = hash_get (idx->partition_by_teid, key->teid);
+  part = vec_elt_at_index (idx->partitions,
+			   p ? p[0] : idx->wildcard_partition);
+
+  ri = upf_acl_index_lookup_one (&part->index, part->acls, key, af,
+				 active);
+  return (ri != ~0) ? part->rules[ri] : ~0;
+}
+
+#endif /* __included_upf_acl_index_h__ */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
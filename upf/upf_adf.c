@@ -40,202 +40,395 @@
   do { } while (0)
 #endif
 
-always_inline adr_result_t
-upf_adr_try_tls (u16 port, u8 * p, u8 ** uri)
+#define adr_counter_inc(_c)					\
+  vlib_increment_simple_counter (&upf_main.upf_simple_counters[_c],	\
+				 vlib_get_thread_index (), 0, 1)
+
+/*
+ * Collect the ClientHello bytes received so far. A handshake message may
+ * be fragmented over several records (RFC 8446, Section 5.1), in that case
+ * the record payloads are copied into *buf, otherwise the message is used
+ * in place. Only whole records and a trailing partial record are used.
+ */
+static adr_result_t
+upf_tls_hello_collect (u8 * p, word len, u8 ** buf, u8 ** msg, word * avail)
 {
-  struct tls_record_hdr *hdr = (struct tls_record_hdr *) p;
-  struct tls_handshake_hdr *hsk = (struct tls_handshake_hdr *) (hdr + 1);
-  struct tls_client_hello_hdr *hlo =
-    (struct tls_client_hello_hdr *) (hsk + 1);
-  u8 *data = (u8 *) (hlo + 1);
-  word frgmt_len, hsk_len, len;
-  uword length = vec_len (p);
-
-  clib_warning ("Length: %d", length);
-  if (length < sizeof (*hdr))
-    return ADR_NEED_MORE_DATA;
-
-  clib_warning ("HDR: %u, v: %u.%u, Len: %d",
-	     hdr->type, hdr->major, hdr->minor,
-	     clib_net_to_host_u16 (hdr->length));
-  if (hdr->type != TLS_HANDSHAKE)
-    return ADR_FAIL;
+  uword left = len;
+  u8 *rec = p;
+  word total = -1;
+  int n_records = 0;
 
-  if (hdr->major != 3 || hdr->minor < 1 || hdr->minor > 3)
-    /* TLS 1.0, 1.1 and 1.2 only (for now)
-     * SSLv2 backward-compatible hello is not supported
-     */
-    return ADR_FAIL;
+  *msg = NULL;
+  *avail = 0;
 
-  length -= sizeof (*hdr);
-  frgmt_len = clib_net_to_host_u16 (hdr->length);
+  while (left >= sizeof (struct tls_record_hdr))
+    {
+      struct tls_record_hdr *hdr = (struct tls_record_hdr *) rec;
+      word frgmt_len, n;
 
-  if (length < frgmt_len)
-    /* TLS fragment is longer that IP payload */
-    return ADR_NEED_MORE_DATA;
+      if (hdr->type != TLS_HANDSHAKE)
+	/* nothing may come between the fragments of the ClientHello */
+	return ADR_FAIL;
 
-  hsk_len = hsk->length[0] << 16 | hsk->length[1] << 8 | hsk->length[2];
-  clib_warning ("TLS Hello: %u, v: Len: %d", hsk->type, hsk_len);
+      /* TLS 1.3 freezes the record version at 3.1 (3.3 for compatibility),
+       * some clients use 3.0 in the first record. SSLv2 hellos are not
+       * supported. */
+      if (hdr->major != 3 || hdr->minor > 3)
+	return ADR_FAIL;
 
-  if (hsk_len + sizeof (*hsk) < frgmt_len)
-    /* Hello is longer that the current fragment */
-    return ADR_NEED_MORE_DATA;
+      frgmt_len = clib_net_to_host_u16 (hdr->length);
+      if (frgmt_len == 0 || frgmt_len > TLS_MAX_RECORD_LEN)
+	return ADR_FAIL;
 
-  if (hsk->type != TLS_CLIENT_HELLO)
-    return ADR_FAIL;
+      n = clib_min (frgmt_len, (word) (left - sizeof (*hdr)));
 
-  clib_warning ("TLS Client Hello: %u.%u", hlo->major, hlo->minor);
-  if (hlo->major != 3 || hlo->minor < 1 || hlo->minor > 3)
-    /* TLS 1.0, 1.1 and 1.2 only (for now) */
-    return ADR_FAIL;
+      if (n_records == 0)
+	{
+	  *msg = rec + sizeof (*hdr);
+	  *avail = n;
+	}
+      else
+	{
+	  if (n_records == 1)
+	    vec_add (*buf, *msg, *avail);
+	  vec_add (*buf, rec + sizeof (*hdr), n);
+	  *msg = *buf;
+	  *avail = vec_len (*buf);
+	}
+      n_records++;
 
-  len = hsk_len - sizeof (*hlo);
+      if (total < 0 && *avail >= sizeof (struct tls_handshake_hdr))
+	{
+	  struct tls_handshake_hdr *hsk = (struct tls_handshake_hdr *) * msg;
 
-  /* Session Id */
-  if (len < *data + 1)
-    return ADR_NEED_MORE_DATA;
+	  total = sizeof (*hsk) +
+	    (hsk->length[0] << 16 | hsk->length[1] << 8 | hsk->length[2]);
+	}
 
-  len -= *data + 1;
-  data += *data + 1;
+      if (n < frgmt_len || (total >= 0 && *avail >= total))
+	break;
 
-  /* Cipher Suites */
-  if (len < clib_net_to_host_unaligned_mem_u16 ((u16 *) data) + 2)
-    return ADR_NEED_MORE_DATA;
+      rec += sizeof (*hdr) + frgmt_len;
+      left -= sizeof (*hdr) + frgmt_len;
+    }
 
-  len -= clib_net_to_host_unaligned_mem_u16 ((u16 *) data) + 2;
-  data += clib_net_to_host_unaligned_mem_u16 ((u16 *) data) + 2;
+  if (n_records > 1)
+    adr_counter_inc (UPF_TLS_HELLO_MULTI_RECORD);
 
-  /* Compression Methods */
-  if (len < *data + 1)
-    return ADR_NEED_MORE_DATA;
+  return n_records ? ADR_OK : ADR_NEED_MORE_DATA;
+}
 
-  len -= *data + 1;
-  data += *data + 1;
+/*
+ * Extract the SNI from a (possibly still incomplete) ClientHello handshake
+ * message, as carried in TLS records or QUIC CRYPTO frames. The extensions
+ * are parsed as far as they have arrived, so detection finishes as soon as
+ * the server_name extension is in, regardless of where large extensions
+ * like PQ key shares are placed.
+ */
+adr_result_t
+upf_adr_parse_client_hello (u16 port, u8 * msg, word avail, u8 ** uri)
+{
+  struct tls_handshake_hdr *hsk;
+  struct tls_client_hello_hdr *hlo;
+  u8 *data, *sni = NULL;
+  word hsk_len, left, ext_left;
+  u16 sni_len = 0;
+  int complete, tls13 = 0, alpn = 0;
+  adr_result_t r;
 
-  /* Extensions */
-  if (len < clib_net_to_host_unaligned_mem_u16 ((u16 *) data) + 2)
-    return ADR_NEED_MORE_DATA;
+  hsk = (struct tls_handshake_hdr *) msg;
+  if (avail < sizeof (*hsk))
+    {
+      r = ADR_NEED_MORE_DATA;
+      goto out;
+    }
 
-  len = clib_net_to_host_unaligned_mem_u16 ((u16 *) data);
-  data += 2;
+  hsk_len = hsk->length[0] << 16 | hsk->length[1] << 8 | hsk->length[2];
+  adf_debug ("TLS Hello: %u, v: Len: %d", hsk->type, hsk_len);
 
-  while (len > 4)
+  if (hsk->type != TLS_CLIENT_HELLO || hsk_len > UPF_ADR_MAX_DATA)
     {
-      u16 ext_type, ext_len, sni_len, name_len;
+      r = ADR_FAIL;
+      goto out;
+    }
 
-      ext_type = clib_net_to_host_unaligned_mem_u16 ((u16 *) data);
-      ext_len = clib_net_to_host_unaligned_mem_u16 ((u16 *) (data + 2));
+  complete = avail >= hsk_len + sizeof (*hsk);
+  left = clib_min (avail, hsk_len + sizeof (*hsk)) - sizeof (*hsk);
+  data = (u8 *) (hsk + 1);
+
+#define tls_need(_n)					\
+  do {							\
+    if (left < (_n))					\
+      {							\
+	r = complete ? ADR_FAIL : ADR_NEED_MORE_DATA;	\
+	goto done;					\
+      }							\
+  } while (0)
+#define tls_skip(_n)					\
+  do {							\
+    left -= (_n);					\
+    data += (_n);					\
+  } while (0)
+
+  tls_need (sizeof (*hlo));
+  hlo = (struct tls_client_hello_hdr *) data;
+  adf_debug ("TLS Client Hello: %u.%u", hlo->major, hlo->minor);
+  /* TLS 1.3 sends 3.3 here and the real version in supported_versions */
+  if (hlo->major != 3 || hlo->minor < 1 || hlo->minor > 3)
+    {
+      r = ADR_FAIL;
+      goto out;
+    }
+  tls_skip (sizeof (*hlo));
 
-      clib_warning ("TLS Hello Extension: %u, %u", ext_type, ext_len);
+  /* Session Id */
+  tls_need (1);
+  tls_need (1 + data[0]);
+  tls_skip (1 + data[0]);
 
-      if (ext_type != TLS_EXT_SNI)
-	goto skip_extension;
+  /* Cipher Suites */
+  tls_need (2);
+  tls_need (2 + clib_net_to_host_unaligned_mem_u16 ((u16 *) data));
+  tls_skip (2 + clib_net_to_host_unaligned_mem_u16 ((u16 *) data));
 
-      if (ext_len < 5 || ext_len + 4 > len)
-	{
-	  clib_warning ("invalid extension len: %u (%u)", ext_len, len);
-	  goto skip_extension;
-	}
+  /* Compression Methods */
+  tls_need (1);
+  tls_need (1 + data[0]);
+  tls_skip (1 + data[0]);
 
-      sni_len = clib_net_to_host_unaligned_mem_u16 ((u16 *) (data + 4));
-      if (sni_len != ext_len - 2)
-	{
-	  clib_warning ("invalid SNI extension len: %u != %u", sni_len,
-		     ext_len - 2);
-	  goto skip_extension;
-	}
+  /* Extensions */
+  tls_need (2);
+  ext_left = clib_net_to_host_unaligned_mem_u16 ((u16 *) data);
+  tls_skip (2);
+  if (complete && ext_left > left)
+    {
+      r = ADR_FAIL;
+      goto out;
+    }
+
+  while (ext_left > 0)
+    {
+      u16 ext_type, ext_len;
+      u8 *ext;
+
+      if (left < 4 || ext_left < 4)
+	break;
+
+      ext_type = clib_net_to_host_unaligned_mem_u16 ((u16 *) data);
+      ext_len = clib_net_to_host_unaligned_mem_u16 ((u16 *) (data + 2));
+      adf_debug ("TLS Hello Extension: %u, %u", ext_type, ext_len);
 
-      if (*(data + 6) != 0)
+      if (ext_len + 4 > ext_left)
 	{
-	  clib_warning ("invalid SNI name type: %u", *(data + 6));
-	  goto skip_extension;
+	  r = ADR_FAIL;
+	  goto out;
 	}
+      if (ext_len + 4 > left)
+	break;
 
-      name_len = clib_net_to_host_unaligned_mem_u16 ((u16 *) (data + 7));
-      if (name_len != sni_len - 3)
+      ext = data + 4;
+      switch (ext_type)
 	{
-	  clib_warning ("invalid server name len: %u != %u", name_len,
-		     sni_len - 3);
-	  goto skip_extension;
+	case TLS_EXT_SNI:
+	  {
+	    u16 list_len, name_len;
+	    u8 *name;
+
+	    if (sni || ext_len < 2)
+	      break;
+
+	    /* ServerNameList, use the first host_name */
+	    list_len = clib_net_to_host_unaligned_mem_u16 ((u16 *) ext);
+	    name = ext + 2;
+	    if (list_len + 2 > ext_len)
+	      break;
+
+	    while (list_len >= 3)
+	      {
+		name_len =
+		  clib_net_to_host_unaligned_mem_u16 ((u16 *) (name + 1));
+		if (name_len + 3 > list_len)
+		  break;
+
+		if (name[0] == TLS_SNI_HOST_NAME && name_len > 0)
+		  {
+		    sni = name + 3;
+		    sni_len = name_len;
+		    break;
+		  }
+		list_len -= name_len + 3;
+		name += name_len + 3;
+	      }
+	    break;
+	  }
+
+	case TLS_EXT_ALPN:
+	  {
+	    u16 list_len;
+
+	    if (ext_len < 3)
+	      break;
+
+	    /* ProtocolNameList */
+	    list_len = clib_net_to_host_unaligned_mem_u16 ((u16 *) ext);
+	    if (list_len + 2 <= ext_len && ext[2] > 0 && ext[2] + 1 <= list_len)
+	      {
+		adf_debug ("TLS ALPN, first protocol len %u", ext[2]);
+		alpn = 1;
+	      }
+	    break;
+	  }
+
+	case TLS_EXT_SUPPORTED_VERSIONS:
+	  {
+	    u8 i;
+
+	    /* ClientHello: u8 length, list of u16 versions */
+	    if (ext_len < 1 || ext[0] + 1 > ext_len)
+	      break;
+	    for (i = 0; i + 1 < ext[0]; i += 2)
+	      if (ext[1 + i] == 3 && ext[2 + i] == 4)
+		tls13 = 1;
+	    break;
+	  }
+
+	default:
+	  break;
 	}
 
+      ext_left -= ext_len + 4;
+      tls_skip (ext_len + 4);
+    }
+
+  /* all extensions seen, or all that have arrived once the SNI is known */
+  if (sni)
+    r = ADR_OK;
+  else
+    r = (complete || ext_left == 0) ? ADR_FAIL : ADR_NEED_MORE_DATA;
+
+#undef tls_need
+#undef tls_skip
+
+done:
+  if (r == ADR_OK)
+    {
       vec_add (*uri, "https://", strlen ("https://"));
-      vec_add (*uri, data + 9, name_len);
+      vec_add (*uri, sni, sni_len);
       if (port != 443)
 	*uri = format (*uri, ":%u", port);
       vec_add1 (*uri, '/');
+      r = ADR_OK;
+    }
 
-      return ADR_OK;
-
-    skip_extension:
-      len -= ext_len + 4;
-      data += ext_len + 4;
+out:
+  switch (r)
+    {
+    case ADR_NEED_MORE_DATA:
+      adr_counter_inc (UPF_TLS_HELLO_NEED_MORE_DATA);
+      break;
+
+    case ADR_OK:
+      adr_counter_inc (UPF_TLS_CLIENT_HELLO);
+      adr_counter_inc (UPF_TLS_SNI);
+      if (tls13)
+	adr_counter_inc (UPF_TLS_13);
+      if (alpn)
+	adr_counter_inc (UPF_TLS_ALPN);
+      break;
+
+    case ADR_FAIL:
+      adr_counter_inc (UPF_TLS_CLIENT_HELLO);
+      break;
     }
 
-  return ADR_FAIL;
+  return r;
 }
 
 always_inline adr_result_t
-upf_adr_try_http (u16 port, u8 * p, u8 ** uri)
+upf_adr_try_tls (u16 port, u8 * p, word len, u8 ** uri)
 {
-  word len = vec_len (p);
-  word uri_len;
-  u8 *eol;
-  u8 *s;
+  u8 *buf = NULL, *msg;
+  word avail;
+  adr_result_t r;
+
+  adf_debug ("Length: %d", len);
+
+  r = upf_tls_hello_collect (p, len, &buf, &msg, &avail);
+  if (r == ADR_OK)
+    r = upf_adr_parse_client_hello (port, msg, avail, uri);
+  else
+    adr_counter_inc (r == ADR_FAIL ? UPF_TLS_CLIENT_HELLO :
+		     UPF_TLS_HELLO_NEED_MORE_DATA);
+
+  vec_free (buf);
+  return r;
+}
+
+/*
+ * Incremental HTTP/1.x request parser. *offset is the stream position of
+ * the first header line that has not been examined yet (0 while the
+ * request line is incomplete), so every callback only looks at the bytes
+ * that arrived since the last one and detection finishes with the segment
+ * that completes the Host header line.
+ */
+always_inline adr_result_t
+upf_adr_try_http (u16 port, u8 * p, word len, u16 * offset, u8 ** uri)
+{
+  u8 *req = p, *target, *eol, *s;
+  word req_len = len, total = len, target_len;
   int r;
 
-  if ((r = is_http_request (&p, &len)) != ADR_OK)
+  if ((r = is_http_request (&req, &req_len)) != ADR_OK)
     return r;
 
-  clib_warning ("p: %*s", len, p);
-  eol = memchr (p, '\n', len);
-  clib_warning ("eol %p", eol);
+  /* the request line is needed for the URI, it is short and rescanned */
+  eol = memchr (req, '\n', clib_min (req_len, UPF_ADR_HTTP_MAX_HEADER));
   if (!eol)
-    /* not EOL found */
-    return ADR_NEED_MORE_DATA;
+    return total < UPF_ADR_HTTP_MAX_HEADER ? ADR_NEED_MORE_DATA : ADR_FAIL;
 
-  s = memchr (p, ' ', eol - p);
-  clib_warning ("s: %p", s);
+  target = req;
+  s = memchr (target, ' ', eol - target);
   if (!s)
     /* HTTP/0.9 - can find the Host Header */
     return ADR_FAIL;
+  target_len = s - target;
 
-  uri_len = s - p;
+  if (eol - s < 9)
+    return ADR_FAIL;
 
   {
-    u64 d0 = *(u64 *) (s + 1);
+    u64 d0 = clib_mem_unaligned (s + 1, u64);
 
-    clib_warning ("d0: 0x%016x, 1.0: 0x%016x, 1.1: 0x%016x", d0,
-	       char_to_u64 ('H', 'T', 'T', 'P', '/', '1', '.', '0'),
-	       char_to_u64 ('H', 'T', 'T', 'P', '/', '1', '.', '1'));
     if (d0 != char_to_u64 ('H', 'T', 'T', 'P', '/', '1', '.', '0') &&
 	d0 != char_to_u64 ('H', 'T', 'T', 'P', '/', '1', '.', '1'))
       /* not HTTP 1.0 or 1.1 compatible */
       return ADR_FAIL;
   }
 
-  s = eol + 1;
-  len -= (eol - p) + 1;
+  if (*offset == 0)
+    *offset = eol + 1 - p;
+
+  s = p + *offset;
+  len -= *offset;
 
   while (len > 0)
     {
-      u64 d0 = *(u64 *) s;
-      uword ll;
+      word ll;
 
       eol = memchr (s, '\n', len);
       if (!eol)
-	return ADR_NEED_MORE_DATA;
+	break;
 
-      clib_warning ("l: %*s", eol - s, s);
+      adf_debug ("l: %*s", eol - s, s);
 
       ll = eol - s;
       if (ll == 0 || (ll == 1 && s[0] == '\r'))
 	/* end of headers */
 	return ADR_FAIL;
 
-      /* upper case 1st 4 characters of header */
-      if ((d0 & char_to_u64 (0xdf, 0xdf, 0xdf, 0xdf, 0xff, 0, 0, 0))
-	  == char_to_u64 ('H', 'O', 'S', 'T', ':', 0, 0, 0))
+      /* case insensitive match of the header name */
+      if (ll >= 5 && (s[0] & 0xdf) == 'H' && (s[1] & 0xdf) == 'O' &&
+	  (s[2] & 0xdf) == 'S' && (s[3] & 0xdf) == 'T' && s[4] == ':')
 	{
 	  s += 5;
 
@@ -256,27 +449,97 @@ upf_adr_try_http (u16 port, u8 * p, u8 ** uri)
 	  vec_add (*uri, s, eol - s + 1);
 	  if (port != 80)
 	    *uri = format (*uri, ":%u", port);
-	  vec_add (*uri, p, uri_len);
+	  vec_add (*uri, target, target_len);
 
 	  return ADR_OK;
 	}
 
       s = eol + 1;
       len -= ll + 1;
+      *offset = s - p;
     }
 
+  /* hard budget for request line and headers */
+  if (total >= UPF_ADR_HTTP_MAX_HEADER)
+    return ADR_FAIL;
+
   return ADR_NEED_MORE_DATA;
 }
 
+/*
+ * see 3GPP TS 23.214 Table 5.2.2-1 for valid ADR combinations
+ */
+static int
+app_pdr_applies (upf_pdr_t * pdr, flow_entry_t * flow,
+		 flow_direction_t direction)
+{
+  if (pdr->pdi.fields & F_PDI_UE_IP_ADDR)
+    {
+      const ip46_address_t *addr;
+
+      addr =
+	&flow->key.ip[direction ^ flow->is_reverse ^
+		      !!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_SD)];
+      adf_debug ("Using %U as UE IP, S/D: %u",
+		 format_ip46_address, addr, IP46_TYPE_ANY,
+		 !!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_SD));
+
+      if (ip46_address_is_ip4 (addr))
+	{
+
+	  if (!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_V4))
+	    {
+	      adf_debug ("skip PDR %u for no UE IPv4 address\n", pdr->id);
+	      return 0;
+	    }
+	  if (!ip4_address_is_equal (&pdr->pdi.ue_addr.ip4, &addr->ip4))
+	    {
+	      adf_debug
+		("skip PDR %u for UE IPv4 mismatch, S/D: %u, %U != %U\n",
+		 pdr->id, !!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_SD),
+		 format_ip4_address, &pdr->pdi.ue_addr.ip4,
+		 format_ip46_address, addr, IP46_TYPE_ANY);
+	      return 0;
+	    }
+	}
+      else
+	{
+	  if (!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_V6))
+	    {
+	      adf_debug ("skip PDR %u for no UE IPv6 address\n", pdr->id);
+	      return 0;
+	    }
+	  if (!ip6_address_is_equal_masked
+	      (&pdr->pdi.ue_addr.ip6, &addr->ip6, &ip6_main.fib_masks[64]))
+	    {
+	      adf_debug
+		("skip PDR %u for UE IPv6 mismatch, S/D: %u, %U != %U\n",
+		 pdr->id, !!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_SD),
+		 format_ip6_address, &pdr->pdi.ue_addr.ip6,
+		 format_ip46_address, addr, IP46_TYPE_ANY);
+	      return 0;
+	    }
+	}
+    }
+
+  if ((pdr->pdi.fields & F_PDI_LOCAL_F_TEID) &&
+      flow_teid (flow, direction) != pdr->pdi.teid.teid)
+    {
+      adf_debug ("skip PDR %u for TEID mismatch\n", pdr->id);
+      return 0;
+    }
+
+  return 1;
+}
+
+/* fallback for rule sets without a merged ADR database */
 static upf_pdr_t *
-app_scan_for_uri (u8 * uri, flow_entry_t * flow, struct rules *active,
-		  flow_direction_t direction, upf_pdr_t * adr)
+app_scan_for_uri_per_pdr (u8 * uri, flow_entry_t * flow,
+			  struct rules *active, flow_direction_t direction,
+			  upf_pdr_t * adr)
 {
   upf_pdr_t *pdr;
 
-  /*
-   * see 3GPP TS 23.214 Table 5.2.2-1 for valid ADR combinations
-   */
   vec_foreach (pdr, active->pdr)
   {
     /* all non ADR pdrs have already been scanned */
@@ -293,61 +556,8 @@ app_scan_for_uri (u8 * uri, flow_entry_t * flow, struct rules *active,
 	continue;
       }
 
-    if (pdr->pdi.fields & F_PDI_UE_IP_ADDR)
-      {
-	const ip46_address_t *addr;
-
-	addr =
-	  &flow->key.ip[direction ^ flow->is_reverse ^
-			!!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_SD)];
-	clib_warning ("Using %U as UE IP, S/D: %u",
-		   format_ip46_address, addr, IP46_TYPE_ANY,
-		   !!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_SD));
-
-	if (ip46_address_is_ip4 (addr))
-	  {
-
-	    if (!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_V4))
-	      {
-		adf_debug ("skip PDR %u for no UE IPv4 address\n", pdr->id);
-		continue;
-	      }
-	    if (!ip4_address_is_equal (&pdr->pdi.ue_addr.ip4, &addr->ip4))
-	      {
-		adf_debug
-		  ("skip PDR %u for UE IPv4 mismatch, S/D: %u, %U != %U\n",
-		   pdr->id, !!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_SD),
-		   format_ip4_address, &pdr->pdi.ue_addr.ip4,
-		   format_ip46_address, addr, IP46_TYPE_ANY);
-		continue;
-	      }
-	  }
-	else
-	  {
-	    if (!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_V6))
-	      {
-		adf_debug ("skip PDR %u for no UE IPv6 address\n", pdr->id);
-		continue;
-	      }
-	    if (!ip6_address_is_equal_masked
-		(&pdr->pdi.ue_addr.ip6, &addr->ip6, &ip6_main.fib_masks[64]))
-	      {
-		adf_debug
-		  ("skip PDR %u for UE IPv6 mismatch, S/D: %u, %U != %U\n",
-		   pdr->id, !!(pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_SD),
-		   format_ip6_address, &pdr->pdi.ue_addr.ip6,
-		   format_ip46_address, addr, IP46_TYPE_ANY);
-		continue;
-	      }
-	  }
-      }
-
-    if ((pdr->pdi.fields & F_PDI_LOCAL_F_TEID) &&
-	flow_teid (flow, direction) != pdr->pdi.teid.teid)
-      {
-	adf_debug ("skip PDR %u for TEID mismatch\n", pdr->id);
-	continue;
-      }
+    if (!app_pdr_applies (pdr, flow, direction))
+      continue;
 
     adf_debug ("Scanning PDR %u (%p), db_id %u\n", pdr->id, pdr,
 	       pdr->pdi.adr.db_id);
@@ -363,8 +573,123 @@ app_scan_for_uri (u8 * uri, flow_entry_t * flow, struct rules *active,
   return adr;
 }
 
+typedef struct
+{
+  struct rules *active;
+  flow_entry_t *flow;
+  flow_direction_t direction;
+  upf_pdr_t *adr;
+  u8 adr_matched;
+  u64 matched;			/* all matched applications, for the cache */
+} app_scan_ctx_t;
+
+static int
+app_scan_event_handler (unsigned int id, unsigned long long from,
+			unsigned long long to, unsigned int flags, void *ctx)
+{
+  app_scan_ctx_t *c = (app_scan_ctx_t *) ctx;
+  upf_pdr_t *pdr;
+  u32 *pdr_idx;
+
+  (void) from;
+  (void) to;
+  (void) flags;
+
+  if (id < UPF_ADR_VERDICT_MAX_MATCHES)
+    c->matched |= 1ULL << id;
+
+  vec_foreach (pdr_idx, vec_elt (c->active->adr_db.pdrs, id))
+  {
+    pdr = vec_elt_at_index (c->active->pdr, *pdr_idx);
+
+    /*
+     * Matches arrive in order of their end offset, not in PDR order. Pick
+     * the same PDR the per PDR scan would: the best precedence wins, a tie
+     * with the ACL result goes to the ADR and a tie between two ADRs goes
+     * to the later PDR.
+     */
+    if (c->adr &&
+	(pdr->precedence > c->adr->precedence ||
+	 (c->adr_matched && pdr->precedence == c->adr->precedence &&
+	  pdr < c->adr)))
+      continue;
+
+    if (!app_pdr_applies (pdr, c->flow, c->direction))
+      continue;
+
+    adf_debug ("Match PDR %u, app %u", pdr->id,
+	       pdr->pdi.adr.application_id);
+    c->adr = pdr;
+    c->adr_matched = 1;
+  }
+
+  return 0;
+}
+
+static upf_pdr_t *
+app_scan_for_uri (u8 * uri, flow_entry_t * flow, struct rules *active,
+		  flow_direction_t direction, upf_pdr_t * adr)
+{
+  upf_adr_db_t *db = &active->adr_db;
+  app_scan_ctx_t ctx = {
+    .active = active,
+    .flow = flow,
+    .direction = direction,
+    .adr = adr,
+  };
+
+  upf_adr_verdict_set_t *cache = NULL;
+  hs_database_t *database = NULL;
+  u64 hash = 0, matched;
+  u32 generation = 0;
+  u32 id;
+
+  if (PREDICT_TRUE (db->set != NULL))
+    {
+      /* the database may be swapped at any time, see upf_adf_set_compile */
+      generation = clib_atomic_load_acq_n (&db->set->generation);
+      database = clib_atomic_load_acq_n (&db->set->database);
+    }
+  if (PREDICT_FALSE (!database))
+    return app_scan_for_uri_per_pdr (uri, flow, active, direction, adr);
+
+  /*
+   * The scan result only depends on the database and the URI, the flow
+   * specific PDR checks are replayed on the cached matches.
+   */
+  if (vec_len (db->pdrs) <= UPF_ADR_VERDICT_MAX_MATCHES)
+    {
+      cache = upf_adr_verdict_get_cache ();
+      hash = upf_adr_verdict_hash (uri, vec_len (uri));
+      if (upf_adr_verdict_lookup (cache, generation, hash, uri,
+				  vec_len (uri), &matched))
+	{
+	  adr_counter_inc (UPF_ADR_CACHE_HIT);
+	  while (matched)
+	    {
+	      id = count_trailing_zeros (matched);
+	      matched = clear_lowest_set_bit (matched);
+	      app_scan_event_handler (id, 0, 0, 0, &ctx);
+	    }
+	  return ctx.adr;
+	}
+      adr_counter_inc (UPF_ADR_CACHE_MISS);
+    }
+
+  /* a single scan over the URI covers every ADR PDR of the session */
+  if (hs_scan (database, (const char *) uri, vec_len (uri), 0,
+	       upf_adf_get_scratch (), app_scan_event_handler, &ctx) != HS_SUCCESS)
+    return adr;
+
+  if (cache)
+    upf_adr_verdict_insert (cache, generation, hash, uri, vec_len (uri),
+			    ctx.matched);
+
+  return ctx.adr;
+}
+
 adr_result_t
-upf_application_detection (vlib_main_t * vm, u8 * p,
+upf_application_detection (vlib_main_t * vm, u8 * p, word len,
 			   flow_entry_t * flow, struct rules *active)
 {
   adr_result_t r;
@@ -402,15 +727,17 @@ upf_application_detection (vlib_main_t * vm, u8 * p,
 
       port =
 	clib_net_to_host_u16 (flow->key.port[FT_REVERSE ^ flow->is_reverse]);
-      clib_warning ("Using port %u, instead of %u", port,
+      adf_debug ("Using port %u, instead of %u", port,
 		 clib_net_to_host_u16 (flow->
 				       key.port[FT_ORIGIN ^ flow->
 						is_reverse]));
 
-      if (*p == TLS_HANDSHAKE)
-	r = upf_adr_try_tls (port, p, &uri);
+      if (flow->key.proto == IP_PROTOCOL_UDP)
+	r = upf_adr_try_quic (port, p, len, &flow->app_buf, &uri);
+      else if (*p == TLS_HANDSHAKE)
+	r = upf_adr_try_tls (port, p, len, &uri);
       else
-	r = upf_adr_try_http (port, p, &uri);
+	r = upf_adr_try_http (port, p, len, &flow->app_parse_offset, &uri);
 
       switch (r)
 	{
@@ -430,7 +757,7 @@ upf_application_detection (vlib_main_t * vm, u8 * p,
   adf_debug ("URI: %v", uri);
 
   origin = app_scan_for_uri (uri, flow, active, FT_ORIGIN, origin);
-  if (origin)
+  if (origin && flow->is_l3_proxy)
     {
       upf_far_t *far;
 
@@ -443,6 +770,9 @@ upf_application_detection (vlib_main_t * vm, u8 * p,
     origin : app_scan_for_uri (uri, flow, active, FT_REVERSE, reverse);
 
 out:
+  /* the buffered CRYPTO data is not needed once detection has finished */
+  vec_free (flow->app_buf);
+
   if (!origin)
     return ADR_FAIL;
 
@@ -451,6 +781,14 @@ out:
   if ((origin->pdi.fields & F_PDI_APPLICATION_ID))
     flow->application_id = origin->pdi.adr.application_id;
 
+  /* flows that are not proxied (QUIC) keep the next nodes from the ACLs */
+  if (!flow->is_l3_proxy)
+    {
+      if (reverse)
+	flow_pdr_id (flow, FT_REVERSE) = reverse->id;
+      goto done;
+    }
+
   /* we are done with scanning for PDRs */
   if (reverse)
     {
@@ -462,6 +800,7 @@ out:
 
   flow_next (flow, FT_ORIGIN) = FT_NEXT_PROXY;
 
+done:
   adf_debug ("New PDR Origin: %p %u, Reverse: %p %u\n",
 	     origin, flow_pdr_id (flow, FT_ORIGIN),
 	     reverse, flow_pdr_id (flow, FT_REVERSE));
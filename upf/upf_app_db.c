@@ -17,10 +17,17 @@
  */
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <vlib/vlib.h>
 #include <vppinfra/types.h>
 #include <vppinfra/vec.h>
 #include <vppinfra/pool.h>
+#include <vppinfra/random.h>
 
 #include "upf/upf_app_db.h"
 #include <upf/upf_pfcp.h>
@@ -35,22 +42,835 @@ typedef struct
 
 static upf_adf_entry_t *upf_adf_db = NULL;
 
+/*
+ * Hyperscan scratch space can only be used by one thread at a time. Every
+ * thread owns a clone of a prototype scratch that the main thread grows
+ * whenever a database is compiled, so any thread can scan any database.
+ */
+static hs_scratch_t *upf_adf_scratch_proto = NULL;
+hs_scratch_t **upf_adf_scratch = NULL;
+
+/* per thread hostname verdict caches and the session database generation */
+upf_adr_verdict_set_t **upf_adr_verdict_caches = NULL;
+uword upf_adr_verdict_seed;
+static u32 upf_adr_db_generation = 0;
+
+/*
+ * Session databases, one per distinct set of applications, looked up by
+ * the sorted vector of application database indexes. Sets are allocated
+ * individually, rule sets and workers hold plain pointers to them.
+ */
+static upf_adf_set_t **upf_adf_sets = NULL;
+static uword *upf_adf_set_by_db_ids = NULL;
+
+static int
+upf_adf_scratch_reserve (hs_database_t * database)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  vlib_main_t *vm = vlib_get_main ();
+  hs_scratch_t **scratch = NULL, **old;
+  size_t old_size = 0, new_size = 0;
+  hs_scratch_t **s;
+  u32 i;
+
+  if (upf_adf_scratch_proto &&
+      hs_scratch_size (upf_adf_scratch_proto, &old_size) != HS_SUCCESS)
+    return -1;
+
+  /* the prototype is never used for scanning, grow it in place */
+  if (hs_alloc_scratch (database, &upf_adf_scratch_proto) != HS_SUCCESS ||
+      hs_scratch_size (upf_adf_scratch_proto, &new_size) != HS_SUCCESS)
+    return -1;
+
+  /* scratch only ever grows, an unchanged size fits the database already */
+  if (new_size == old_size && vec_len (upf_adf_scratch) == tm->n_vlib_mains)
+    return 0;
+
+  vec_validate (scratch, tm->n_vlib_mains - 1);
+  for (i = 0; i < tm->n_vlib_mains; i++)
+    if (hs_clone_scratch (upf_adf_scratch_proto, &scratch[i]) != HS_SUCCESS)
+      {
+	vec_foreach (s, scratch) hs_free_scratch (*s);
+	vec_free (scratch);
+	return -1;
+      }
+
+  vlib_worker_thread_barrier_sync (vm);
+  old = upf_adf_scratch;
+  upf_adf_scratch = scratch;
+  vlib_worker_thread_barrier_release (vm);
+
+  adf_debug ("ADF scratch grown from %u to %u bytes", old_size, new_size);
+
+  vec_foreach (s, old) hs_free_scratch (*s);
+  vec_free (old);
+
+  return 0;
+}
+
+/*
+ * Application and session databases are compiled by a background thread.
+ * Rule changes only mark the database dirty, the compile process collects
+ * them for UPF_ADF_COMPILE_DEBOUNCE seconds (at most
+ * UPF_ADF_COMPILE_MAX_DELAY after the first change) and hands a private
+ * copy of each rule set to the compile thread. Finished databases are
+ * published with an atomic pointer store, the replaced database is freed
+ * once every worker has completed a main loop iteration since the swap.
+ */
+#define UPF_ADF_COMPILE_DEBOUNCE  0.1
+#define UPF_ADF_COMPILE_MAX_DELAY 1.0
+#define UPF_ADF_COMPILE_POLL      0.01
+
+typedef struct
+{
+  u32 db_index;			/* application database or set index */
+  u8 is_set;
+  u32 seq;			/* compile_seq at submit time */
+  regex_t *expressions;
+  unsigned int *flags;
+  unsigned int *ids;
+  u8 *cache_dir;		/* C string, NULL when caching is off */
+  u8 *rules;			/* rule set identity, see below */
+
+  /* written by the compile thread */
+  hs_database_t *database;
+  char error[128];
+  volatile u8 started;
+  volatile u8 done;
+} upf_adf_compile_job_t;
+
+typedef struct
+{
+  hs_database_t *database;
+  u64 *main_loop_count;		/* per thread, at retire time */
+} upf_adf_retired_db_t;
+
+typedef struct
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t kick;
+  upf_adf_compile_job_t **jobs;	/* protected by lock */
+
+  /* main thread only */
+  uword *dirty;			/* bitmap of db indexes to recompile */
+  uword *dirty_sets;		/* bitmap of set indexes to recompile */
+  f64 first_dirty;
+  f64 deadline;
+  u32 seq;
+  upf_adf_retired_db_t *retired;
+  u8 *cache_dir;		/* C string, NULL when caching is off */
+  u8 cache_disabled;
+
+  /* updated by the compile thread */
+  u64 cache_hits;
+  u64 cache_misses;
+  u64 cache_errors;
+} upf_adf_compile_main_t;
+
+#define UPF_ADF_CACHE_DEFAULT_DIR "/var/cache/upf/adf"
+
+static upf_adf_compile_main_t upf_adf_compile_main = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .kick = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * On-disk cache of serialized application and session databases. A file
+ * is named after a hash over the Hyperscan version and the complete rule
+ * set (expressions, flags and ids), so a restart or a re-push of unchanged
+ * PFDs deserializes the database instead of compiling it. The rule set
+ * itself is stored in front of the database and compared on load, a hash
+ * collision only costs a compile. Only the compile thread touches the
+ * cache files.
+ */
+#define UPF_ADF_CACHE_MAGIC   0x55414446	/* "UADF" */
+#define UPF_ADF_CACHE_FORMAT  2
+
+typedef struct
+{
+  u32 magic;
+  u32 format;
+  u64 key;
+  u64 rules_length;
+  u64 length;
+} upf_adf_cache_hdr_t;
+
+static u8 *
+upf_adf_cache_rules (upf_adf_compile_job_t * job)
+{
+  const char *version = hs_version ();
+  u8 *rules = NULL;
+  u32 i, len;
+
+  len = strlen (version);
+  vec_add (rules, &len, sizeof (len));
+  vec_add (rules, version, len);
+
+  vec_foreach_index (i, job->expressions)
+  {
+    len = vec_len (job->expressions[i]);
+    vec_add (rules, &job->ids[i], sizeof (job->ids[i]));
+    vec_add (rules, &job->flags[i], sizeof (job->flags[i]));
+    vec_add (rules, &len, sizeof (len));
+    vec_add (rules, job->expressions[i], len);
+  }
+
+  return rules;
+}
+
+static hs_database_t *
+upf_adf_cache_load (const char *file, u64 key, u8 * rules)
+{
+  hs_database_t *database = NULL;
+  upf_adf_cache_hdr_t hdr;
+  char *bytes = NULL;
+  int fd;
+
+  if ((fd = open (file, O_RDONLY)) < 0)
+    return NULL;
+
+  if (read (fd, &hdr, sizeof (hdr)) != sizeof (hdr) ||
+      hdr.magic != UPF_ADF_CACHE_MAGIC || hdr.format != UPF_ADF_CACHE_FORMAT
+      || hdr.key != key || hdr.rules_length != vec_len (rules))
+    goto done;
+
+  if (!(bytes = malloc (clib_max (hdr.rules_length, hdr.length))))
+    goto done;
+
+  if (read (fd, bytes, hdr.rules_length) != (ssize_t) hdr.rules_length ||
+      memcmp (bytes, rules, hdr.rules_length) != 0)
+    goto done;
+
+  if (read (fd, bytes, hdr.length) != (ssize_t) hdr.length)
+    goto done;
+
+  /* fails on version or platform mismatch, the caller recompiles */
+  if (hs_deserialize_database (bytes, hdr.length, &database) != HS_SUCCESS)
+    database = NULL;
+
+done:
+  free (bytes);
+  close (fd);
+  return database;
+}
+
+static int
+upf_adf_cache_store (const char *file, u64 key, u8 * rules,
+		     hs_database_t * database)
+{
+  upf_adf_cache_hdr_t hdr = {
+    .magic = UPF_ADF_CACHE_MAGIC,
+    .format = UPF_ADF_CACHE_FORMAT,
+    .key = key,
+    .rules_length = vec_len (rules),
+  };
+  char tmp[PATH_MAX];
+  char *bytes = NULL;
+  size_t length;
+  int fd, error = -1;
+
+  if (hs_serialize_database (database, &bytes, &length) != HS_SUCCESS)
+    return -1;
+  hdr.length = length;
+
+  /* write to a private name first, readers only ever see complete files */
+  snprintf (tmp, sizeof (tmp), "%s.%d", file, getpid ());
+  if ((fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    goto done;
+
+  if (write (fd, &hdr, sizeof (hdr)) == sizeof (hdr) &&
+      write (fd, rules, vec_len (rules)) == (ssize_t) vec_len (rules) &&
+      write (fd, bytes, length) == (ssize_t) length)
+    error = 0;
+  close (fd);
+
+  if (error == 0 && rename (tmp, file) != 0)
+    error = -1;
+  if (error)
+    unlink (tmp);
+
+done:
+  free (bytes);
+  return error;
+}
+
+/* mkdir -p */
+static int
+upf_adf_cache_mkdir (u8 * dir)
+{
+  u8 *p;
+
+  for (p = dir + 1; *p; p++)
+    if (*p == '/')
+      {
+	*p = 0;
+	if (mkdir ((char *) dir, 0755) != 0 && errno != EEXIST)
+	  {
+	    *p = '/';
+	    return -1;
+	  }
+	*p = '/';
+      }
+
+  if (mkdir ((char *) dir, 0755) != 0 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+static pthread_once_t upf_adf_compile_once = PTHREAD_ONCE_INIT;
+
+static vlib_node_registration_t upf_adf_compile_process_node;
+
+static void *
+upf_adf_compile_thread (void *arg)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+
+  pthread_mutex_lock (&acm->lock);
+  while (1)
+    {
+      hs_compile_error_t *compile_err = NULL;
+      upf_adf_compile_job_t *job = NULL, **j;
+      char file[PATH_MAX];
+      u64 key = 0;
+
+      vec_foreach (j, acm->jobs)
+	if (!(*j)->started)
+	{
+	  job = *j;
+	  break;
+	}
+
+      if (!job)
+	{
+	  pthread_cond_wait (&acm->kick, &acm->lock);
+	  continue;
+	}
+
+      job->started = 1;
+      pthread_mutex_unlock (&acm->lock);
+
+      if (job->cache_dir)
+	{
+	  key = hash_memory (job->rules, vec_len (job->rules), 0);
+	  snprintf (file, sizeof (file), "%s/%016llx.hsdb",
+		    (char *) job->cache_dir, (unsigned long long) key);
+
+	  if ((job->database = upf_adf_cache_load (file, key, job->rules)))
+	    {
+	      clib_atomic_add_fetch (&acm->cache_hits, 1);
+	      goto done;
+	    }
+	  clib_atomic_add_fetch (&acm->cache_misses, 1);
+	}
+
+      if (hs_compile_multi
+	  ((const char **) job->expressions, job->flags, job->ids,
+	   vec_len (job->expressions), HS_MODE_BLOCK, NULL, &job->database,
+	   &compile_err) != HS_SUCCESS)
+	{
+	  snprintf (job->error, sizeof (job->error), "%s",
+		    compile_err->message);
+	  hs_free_compile_error (compile_err);
+	  job->database = NULL;
+	  goto done;
+	}
+
+      if (job->cache_dir &&
+	  upf_adf_cache_store (file, key, job->rules, job->database) != 0)
+	clib_atomic_add_fetch (&acm->cache_errors, 1);
+
+    done:
+      pthread_mutex_lock (&acm->lock);
+      job->done = 1;
+    }
+  pthread_mutex_unlock (&acm->lock);
+  return NULL;
+}
+
+static void
+upf_adf_compile_start (void)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+
+  if (!acm->cache_dir && !acm->cache_disabled)
+    acm->cache_dir = format (0, "%s%c", UPF_ADF_CACHE_DEFAULT_DIR, 0);
+  if (acm->cache_dir && upf_adf_cache_mkdir (acm->cache_dir) != 0)
+    clib_warning ("ADF database cache %s: %s", acm->cache_dir,
+		  strerror (errno));
+
+  if (pthread_create (&acm->thread, NULL, upf_adf_compile_thread, NULL) != 0)
+    clib_warning ("failed to start ADF compile thread");
+  else
+    pthread_setname_np (acm->thread, "upf_adf_compile");
+}
+
+static void
+upf_adf_compile_job_free (upf_adf_compile_job_t * job)
+{
+  regex_t *regex;
+
+  vec_foreach (regex, job->expressions) vec_free (*regex);
+  vec_free (job->expressions);
+  vec_free (job->flags);
+  vec_free (job->ids);
+  vec_free (job->cache_dir);
+  vec_free (job->rules);
+  clib_mem_free (job);
+}
+
+/* free a database that workers may still be scanning, see above */
+static void
+upf_adf_retire_db (hs_database_t * database)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+  upf_adf_retired_db_t *r;
+  u32 i;
+
+  if (!database)
+    return;
+
+  if (vec_len (vlib_mains) <= 1)
+    {
+      hs_free_database (database);
+      return;
+    }
+
+  vec_add2 (acm->retired, r, 1);
+  r->database = database;
+  r->main_loop_count = NULL;
+  vec_validate (r->main_loop_count, vec_len (vlib_mains) - 1);
+  for (i = 1; i < vec_len (vlib_mains); i++)
+    r->main_loop_count[i] = vlib_mains[i]->main_loop_count;
+
+  vlib_process_signal_event (vlib_get_main (),
+			     upf_adf_compile_process_node.index, 0, 0);
+}
+
+static void
+upf_adf_reclaim_retired (void)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+  int i;
+
+  for (i = vec_len (acm->retired) - 1; i >= 0; i--)
+    {
+      upf_adf_retired_db_t *r = vec_elt_at_index (acm->retired, i);
+      u32 t;
+
+      for (t = 1; t < vec_len (r->main_loop_count); t++)
+	if (vlib_mains[t]->main_loop_count == r->main_loop_count[t])
+	  break;
+      if (t < vec_len (r->main_loop_count))
+	continue;
+
+      hs_free_database (r->database);
+      vec_free (r->main_loop_count);
+      vec_del1 (acm->retired, i);
+    }
+}
+
+/*
+ * Swap the database of a set, takes over rules. The generation identifies
+ * the set together with the rules of its database and keys the verdict
+ * caches. Workers read it before the database, a verdict cached under the
+ * new generation is always one of the new database.
+ */
+static void
+upf_adf_set_install (upf_adf_set_t * set, hs_database_t * database,
+		     u8 * rules)
+{
+  hs_database_t *old = set->database;
+
+  if (++upf_adr_db_generation == 0)
+    ++upf_adr_db_generation;
+
+  clib_atomic_store_rel_n (&set->database, database);
+  clib_atomic_store_rel_n (&set->generation, upf_adr_db_generation);
+  upf_adf_retire_db (old);
+
+  vec_free (set->rules);
+  set->rules = rules;
+}
+
+always_inline int
+upf_adf_compile_is_dirty (upf_adf_compile_main_t * acm)
+{
+  return !clib_bitmap_is_zero (acm->dirty) ||
+    !clib_bitmap_is_zero (acm->dirty_sets);
+}
+
+static void
+upf_adf_compile_schedule (uword ** dirty, u32 index)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+  vlib_main_t *vm = vlib_get_main ();
+  f64 now = vlib_time_now (vm);
+
+  pthread_once (&upf_adf_compile_once, upf_adf_compile_start);
+
+  if (!upf_adf_compile_is_dirty (acm))
+    acm->first_dirty = now;
+  *dirty = clib_bitmap_set (*dirty, index, 1);
+
+  /* every change restarts the debounce window, up to the max delay */
+  acm->deadline = clib_min (now + UPF_ADF_COMPILE_DEBOUNCE,
+			    acm->first_dirty + UPF_ADF_COMPILE_MAX_DELAY);
+
+  vlib_process_signal_event (vm, upf_adf_compile_process_node.index, 0, 0);
+}
+
+static void
+upf_adf_compile_submit (void)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+  upf_adf_compile_job_t **jobs = NULL, **j;
+  uword db_index, set_index;
+
+  clib_bitmap_foreach (db_index, acm->dirty)
+  {
+    upf_adf_entry_t *entry;
+    upf_adf_compile_job_t *job;
+    regex_t *regex;
+
+    if (pool_is_free_index (upf_adf_db, db_index))
+      continue;
+
+    entry = pool_elt_at_index (upf_adf_db, db_index);
+    if (vec_len (entry->expressions) == 0)
+      continue;
+
+    job = clib_mem_alloc (sizeof (*job));
+    clib_memset (job, 0, sizeof (*job));
+    job->db_index = db_index;
+    job->seq = entry->compile_seq;
+    vec_foreach (regex, entry->expressions)
+      vec_add1 (job->expressions, vec_dup (*regex));
+    job->flags = vec_dup (entry->flags);
+    job->ids = vec_dup (entry->ids);
+    if ((job->cache_dir = vec_dup (acm->cache_dir)))
+      job->rules = upf_adf_cache_rules (job);
+
+    vec_add1 (jobs, job);
+  }
+
+  clib_bitmap_zero (acm->dirty);
+
+  clib_bitmap_foreach (set_index, acm->dirty_sets)
+  {
+    upf_adf_compile_job_t *job;
+    upf_adf_set_t *set;
+    u32 *db_id;
+
+    if (pool_is_free_index (upf_adf_sets, set_index))
+      continue;
+
+    set = upf_adf_sets[set_index];
+
+    job = clib_mem_alloc (sizeof (*job));
+    clib_memset (job, 0, sizeof (*job));
+    job->db_index = set_index;
+    job->is_set = 1;
+    job->seq = set->compile_seq;
+
+    /* built from the rules, the application databases may be compiling */
+    vec_foreach (db_id, set->db_ids)
+    {
+      upf_adf_entry_t *entry;
+      regex_t *regex;
+
+      if (pool_is_free_index (upf_adf_db, *db_id))
+	continue;
+
+      entry = pool_elt_at_index (upf_adf_db, *db_id);
+      vec_foreach (regex, entry->expressions)
+      {
+	vec_add1 (job->expressions, vec_dup (*regex));
+	vec_add1 (job->flags, HS_FLAG_SINGLEMATCH);
+	vec_add1 (job->ids, db_id - set->db_ids);
+      }
+    }
+
+    if (vec_len (job->expressions) == 0)
+      {
+	upf_adf_set_install (set, NULL, NULL);
+	upf_adf_compile_job_free (job);
+	continue;
+      }
+
+    /*
+     * Unchanged rules, e.g. a re-push of the same PFDs, keep the database
+     * and the verdicts cached for it.
+     */
+    job->rules = upf_adf_cache_rules (job);
+    if (set->database && vec_is_equal (job->rules, set->rules))
+      {
+	upf_adf_compile_job_free (job);
+	continue;
+      }
+
+    job->cache_dir = vec_dup (acm->cache_dir);
+    vec_add1 (jobs, job);
+  }
+
+  clib_bitmap_zero (acm->dirty_sets);
+
+  if (!jobs)
+    return;
+
+  pthread_mutex_lock (&acm->lock);
+  vec_foreach (j, jobs) vec_add1 (acm->jobs, *j);
+  pthread_cond_signal (&acm->kick);
+  pthread_mutex_unlock (&acm->lock);
+
+  vec_free (jobs);
+}
+
+static void
+upf_adf_compile_publish_set (upf_adf_compile_job_t * job)
+{
+  upf_adf_set_t *set;
+
+  if (pool_is_free_index (upf_adf_sets, job->db_index) ||
+      (set = upf_adf_sets[job->db_index])->compile_seq != job->seq)
+    {
+      /* released or changed again while compiling */
+      if (job->database)
+	hs_free_database (job->database);
+      return;
+    }
+
+  if (!job->database)
+    clib_warning ("ADR session database compile failed: %s, "
+		  "using per PDR scans", job->error);
+  else if (upf_adf_scratch_reserve (job->database) != 0)
+    {
+      clib_warning ("ADR session database: failed to allocate scratch, "
+		    "using per PDR scans");
+      hs_free_database (job->database);
+      job->database = NULL;
+    }
+
+  /* a stale database would miss the changed rules, better scan per PDR */
+  upf_adf_set_install (set, job->database,
+		       job->database ? job->rules : NULL);
+  if (job->database)
+    job->rules = NULL;
+}
+
+static void
+upf_adf_compile_publish (upf_adf_compile_job_t * job)
+{
+  upf_adf_entry_t *entry;
+  hs_database_t *old;
+
+  if (job->is_set)
+    {
+      upf_adf_compile_publish_set (job);
+      return;
+    }
+
+  if (pool_is_free_index (upf_adf_db, job->db_index) ||
+      (entry = pool_elt_at_index (upf_adf_db, job->db_index))->compile_seq
+      != job->seq)
+    {
+      /* the rules changed again while compiling, a newer job follows */
+      if (job->database)
+	hs_free_database (job->database);
+      return;
+    }
+
+  if (!job->database)
+    {
+      clib_warning ("ADF database %u compile failed: %s",
+		    job->db_index, job->error);
+      return;
+    }
+
+  if (upf_adf_scratch_reserve (job->database) != 0)
+    {
+      clib_warning ("ADF database %u: failed to allocate scratch",
+		    job->db_index);
+      hs_free_database (job->database);
+      return;
+    }
+
+  old = entry->database;
+  clib_atomic_store_rel_n (&entry->database, job->database);
+  upf_adf_retire_db (old);
+}
+
+static uword
+upf_adf_compile_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+			 vlib_frame_t * f)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+
+  while (1)
+    {
+      upf_adf_compile_job_t **done = NULL, **j;
+      f64 timeout = 1.0, now;
+      int i;
+
+      now = vlib_time_now (vm);
+      if (upf_adf_compile_is_dirty (acm))
+	timeout = clib_max (acm->deadline - now, 0);
+      if (vec_len (acm->jobs) || vec_len (acm->retired))
+	timeout = clib_min (timeout, UPF_ADF_COMPILE_POLL);
+
+      (void) vlib_process_wait_for_event_or_clock (vm, timeout);
+      vlib_process_get_events (vm, NULL);
+
+      now = vlib_time_now (vm);
+      if (upf_adf_compile_is_dirty (acm) && now >= acm->deadline)
+	upf_adf_compile_submit ();
+
+      pthread_mutex_lock (&acm->lock);
+      for (i = vec_len (acm->jobs) - 1; i >= 0; i--)
+	if (acm->jobs[i]->done)
+	  {
+	    vec_add1 (done, acm->jobs[i]);
+	    vec_delete (acm->jobs, 1, i);
+	  }
+      pthread_mutex_unlock (&acm->lock);
+
+      /* publish in submit order */
+      for (i = vec_len (done) - 1; i >= 0; i--)
+	upf_adf_compile_publish (done[i]);
+      vec_foreach (j, done) upf_adf_compile_job_free (*j);
+      vec_free (done);
+
+      upf_adf_reclaim_retired ();
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (upf_adf_compile_process_node, static) = {
+    .function = upf_adf_compile_process,
+    .type = VLIB_NODE_TYPE_PROCESS,
+    .name = "upf-adf-compile",
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+upf_adr_verdict_cache_init (vlib_main_t * vm)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
+  u32 seed = clib_cpu_time_now ();
+  u32 i;
+
+  /* hosts chosen by the peer should not pile up in one cache set */
+  upf_adr_verdict_seed = ((uword) random_u32 (&seed) << 32) |
+    random_u32 (&seed);
+
+  vec_validate (upf_adr_verdict_caches, tm->n_vlib_mains - 1);
+  vec_foreach_index (i, upf_adr_verdict_caches)
+    vec_validate_aligned (upf_adr_verdict_caches[i],
+			  UPF_ADR_VERDICT_CACHE_SETS - 1,
+			  CLIB_CACHE_LINE_BYTES);
+
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (upf_adr_verdict_cache_init);
+
+/*
+ * Compile the regular expressions of all applications of a set into a
+ * single database in the background. All expressions of one application
+ * share its position in the set as id, so HS_FLAG_SINGLEMATCH reports
+ * every application at most once per scan. Until the database is
+ * published, and without any expressions, sessions fall back to per PDR
+ * scans.
+ */
+static void
+upf_adf_set_compile (upf_adf_set_t * set)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+
+  /* invalidates compiles of the previous rule sets that are still running */
+  set->compile_seq = ++acm->seq;
+  upf_adf_compile_schedule (&acm->dirty_sets, set->index);
+}
+
+/* takes over db_ids */
+static upf_adf_set_t *
+upf_adf_set_get (u32 * db_ids)
+{
+  upf_adf_set_t *set, **setp;
+  uword *p;
+
+  if (!upf_adf_set_by_db_ids)
+    upf_adf_set_by_db_ids = hash_create_vec (0, sizeof (u32), sizeof (uword));
+
+  p = hash_get_mem (upf_adf_set_by_db_ids, db_ids);
+  if (p)
+    {
+      vec_free (db_ids);
+      set = upf_adf_sets[p[0]];
+      set->ref_cnt++;
+      return set;
+    }
+
+  set = clib_mem_alloc_aligned (sizeof (*set), CLIB_CACHE_LINE_BYTES);
+  clib_memset (set, 0, sizeof (*set));
+  set->db_ids = db_ids;
+  set->ref_cnt = 1;
+
+  pool_get (upf_adf_sets, setp);
+  *setp = set;
+  set->index = setp - upf_adf_sets;
+  hash_set_mem (upf_adf_set_by_db_ids, set->db_ids, set->index);
+
+  upf_adf_set_compile (set);
+  return set;
+}
+
+static void
+upf_adf_set_put (upf_adf_set_t * set)
+{
+  if (--set->ref_cnt != 0)
+    return;
+
+  hash_unset_mem (upf_adf_set_by_db_ids, set->db_ids);
+  pool_put_index (upf_adf_sets, set->index);
+
+  /* the rule set referencing it is no longer visible to the workers */
+  upf_adf_retire_db (set->database);
+  vec_free (set->rules);
+  vec_free (set->db_ids);
+  clib_mem_free (set);
+}
+
+/* the rules of an application changed, rebuild every set containing it */
+static void
+upf_adf_sets_update (u32 db_index)
+{
+  upf_adf_set_t **setp;
+
+  pool_foreach (setp, upf_adf_sets)
+    {
+      upf_adf_set_t *set = *setp;
+
+      if (vec_search (set->db_ids, db_index) != ~0)
+	upf_adf_set_compile (set);
+    }
+}
+
 static void
 upf_adf_cleanup_db_entry (upf_adf_entry_t * entry)
 {
   regex_t *regex = NULL;
 
-  upf_app_fib_cleanup (entry);
+  upf_app_fib_cleanup (entry, entry - upf_adf_db);
 
   vec_foreach (regex, entry->expressions)
   {
     vec_free (*regex);
   }
 
-  if (entry->database)
-    hs_free_database (entry->database);
-
-  hs_free_scratch (entry->scratch);
   vec_free (entry->expressions);
   vec_free (entry->acl);
   vec_free (entry->flags);
@@ -65,9 +885,11 @@ upf_adf_remove (u32 db_index)
   upf_adf_entry_t *entry = NULL;
 
   entry = pool_elt_at_index (upf_adf_db, db_index);
+  upf_adf_retire_db (entry->database);
   upf_adf_cleanup_db_entry (entry);
   pool_put (upf_adf_db, entry);
 
+  upf_adf_sets_update (db_index);
   return 0;
 }
 
@@ -77,9 +899,9 @@ upf_adf_create_update_db (upf_adf_app_t * app)
 #if CLIB_DEBUG > 1
   upf_main_t *gtm = &upf_main;
 #endif
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
   upf_adf_entry_t *entry = NULL;
-  hs_compile_error_t *compile_err = NULL;
-  int error = 0;
+  hs_database_t *database;
   u32 index = 0;
   u32 rule_index = 0;
   upf_adr_t *rule = NULL;
@@ -97,7 +919,10 @@ upf_adf_create_update_db (upf_adf_app_t * app)
   if (app->db_index != ~0)
     {
       entry = pool_elt_at_index (upf_adf_db, app->db_index);
+      /* the published database stays in use until its successor is ready */
+      database = entry->database;
       upf_adf_cleanup_db_entry (entry);
+      entry->database = database;
     }
   else
     {
@@ -107,8 +932,6 @@ upf_adf_create_update_db (upf_adf_app_t * app)
 
       memset (entry, 0, sizeof (*entry));
       app->db_index = entry - upf_adf_db;
-      entry->fib_index_ip4 = ~0;
-      entry->fib_index_ip6 = ~0;
     }
 
   /* *INDENT-OFF* */
@@ -137,37 +960,23 @@ upf_adf_create_update_db (upf_adf_app_t * app)
 	 app->flags & UPF_ADR_IP_RULES :
 	 !(app->flags & UPF_ADR_IP_RULES));
 
-  if (entry->database)
-    {
-      hs_free_database (entry->database);
-      entry->database = NULL;
-    }
+  upf_ensure_app_fib_if_needed (entry, app->db_index);
 
-  upf_ensure_app_fib_if_needed (entry);
+  /* invalidates compiles of the previous rule set that are still running */
+  entry->compile_seq = ++acm->seq;
 
-  if (vec_len (entry->expressions) == 0)
-    goto done;
-
-  if (hs_compile_multi
-      ((const char **) entry->expressions, entry->flags, entry->ids,
-       vec_len (entry->expressions), HS_MODE_BLOCK, NULL, &entry->database,
-       &compile_err) != HS_SUCCESS)
-    {
-      adf_debug ("Error: %s", compile_err->message);
-      error = -1;
-      goto done;
-    }
+  upf_adf_sets_update (app->db_index);
 
-  if (hs_alloc_scratch (entry->database, &entry->scratch) != HS_SUCCESS)
+  if (vec_len (entry->expressions) == 0)
     {
-      hs_free_database (entry->database);
-      entry->database = NULL;
-      error = -1;
-      goto done;
+      database = entry->database;
+      clib_atomic_store_rel_n (&entry->database, NULL);
+      upf_adf_retire_db (database);
+      return 0;
     }
 
-done:
-  return error;
+  upf_adf_compile_schedule (&acm->dirty, entry - upf_adf_db);
+  return 0;
 }
 
 static int
@@ -190,6 +999,7 @@ int
 upf_adf_lookup (u32 db_index, u8 * str, uint16_t length, u32 * id)
 {
   upf_adf_entry_t *entry = NULL;
+  hs_database_t *database;
   int ret = 0;
   upf_adf_cb_args_t args = { };
 
@@ -197,13 +1007,14 @@ upf_adf_lookup (u32 db_index, u8 * str, uint16_t length, u32 * id)
     return -1;
 
   entry = pool_elt_at_index (upf_adf_db, db_index);
+  database = clib_atomic_load_acq_n (&entry->database);
 
-  if (!entry->database)
+  if (!database)
     return -1;
 
   ret =
-    hs_scan (entry->database, (const char *) str, length, 0, entry->scratch,
-	     upf_adf_event_handler, (void *) &args);
+    hs_scan (database, (const char *) str, length, 0,
+	     upf_adf_get_scratch (), upf_adf_event_handler, (void *) &args);
   if (ret != HS_SUCCESS)
     return -1;
 
@@ -216,6 +1027,67 @@ upf_adf_lookup (u32 db_index, u8 * str, uint16_t length, u32 * id)
   return 0;
 }
 
+void
+upf_adf_session_db_free (upf_adr_db_t * db)
+{
+  u32 **pdrs;
+
+  if (db->set)
+    upf_adf_set_put (db->set);
+  vec_foreach (pdrs, db->pdrs) vec_free (*pdrs);
+  vec_free (db->pdrs);
+
+  clib_memset (db, 0, sizeof (*db));
+}
+
+static int
+upf_adf_db_id_cmp (void *a, void *b)
+{
+  u32 x = *(u32 *) a, y = *(u32 *) b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ * Attach a rule set to the shared database of the applications referenced
+ * by its ADR PDRs. Only a set no other rule set uses yet gets compiled,
+ * in the background.
+ */
+void
+upf_adf_session_db_build (upf_adr_db_t * db, upf_pdr_t * pdrs)
+{
+  u32 *db_ids = NULL;
+  upf_pdr_t *pdr;
+  u32 i, n;
+
+  upf_adf_session_db_free (db);
+
+  vec_foreach (pdr, pdrs)
+    if ((pdr->pdi.fields & F_PDI_APPLICATION_ID) &&
+	pdr->pdi.adr.db_id != ~0)
+    vec_add1 (db_ids, pdr->pdi.adr.db_id);
+
+  if (!db_ids)
+    return;
+
+  vec_sort_with_function (db_ids, upf_adf_db_id_cmp);
+  for (i = 1, n = 1; i < vec_len (db_ids); i++)
+    if (db_ids[i] != db_ids[n - 1])
+      db_ids[n++] = db_ids[i];
+  _vec_len (db_ids) = n;
+
+  db->set = upf_adf_set_get (db_ids);
+
+  vec_validate (db->pdrs, n - 1);
+  vec_foreach (pdr, pdrs)
+    if ((pdr->pdi.fields & F_PDI_APPLICATION_ID) &&
+	pdr->pdi.adr.db_id != ~0)
+    {
+      i = vec_search (db->set->db_ids, pdr->pdi.adr.db_id);
+      vec_add1 (db->pdrs[i], pdr - pdrs);
+    }
+}
+
 u32
 upf_adf_get_adr_db (u32 application_id)
 {
@@ -338,6 +1210,21 @@ upf_adf_app_add_command_fn (vlib_main_t * vm,
       pdr->pdi.adr.db_id = upf_adf_get_adr_db (p[0]);
     }
 
+  /* the merged session database has to follow the PDR */
+  {
+    struct rules *active = pfcp_get_rules (sess, PFCP_ACTIVE);
+    upf_adr_db_t db = { 0 }, old;
+
+    upf_adf_session_db_build (&db, active->pdr);
+
+    vlib_worker_thread_barrier_sync (vm);
+    old = active->adr_db;
+    active->adr_db = db;
+    vlib_worker_thread_barrier_release (vm);
+
+    upf_adf_session_db_free (&old);
+  }
+
   vlib_cli_output (vm, "ADR DB id: %u", pdr->pdi.adr.db_id);
 
 done:
@@ -420,6 +1307,72 @@ VLIB_CLI_COMMAND (upf_adf_url_test_command, static) =
 };
 /* *INDENT-ON* */
 
+static clib_error_t *
+upf_adf_cache_command_fn (vlib_main_t * vm,
+			  unformat_input_t * input, vlib_cli_command_t * cmd)
+{
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
+  unformat_input_t _line_input, *line_input = &_line_input;
+  clib_error_t *error = NULL;
+  u8 *dir = NULL;
+  int disable = 0;
+
+  /* Get a line of input. */
+  if (!unformat_user (input, unformat_line_input, line_input))
+    return error;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "dir %s", &dir))
+	;
+      else if (unformat (line_input, "disable"))
+	disable = 1;
+      else
+	{
+	  error = clib_error_return (0, "unknown input `%U'",
+				     format_unformat_error, input);
+	  goto done;
+	}
+    }
+
+  if (!dir && !disable)
+    {
+      error = clib_error_return (0, "cache dir or disable needs to be set");
+      goto done;
+    }
+
+  if (dir)
+    {
+      vec_add1 (dir, 0);
+      if (upf_adf_cache_mkdir (dir) != 0)
+	{
+	  error = clib_error_return_unix (0, "mkdir '%s'", dir);
+	  goto done;
+	}
+    }
+
+  /* jobs carry their own copy, the compile thread never reads this one */
+  vec_free (acm->cache_dir);
+  acm->cache_dir = disable ? NULL : dir;
+  acm->cache_disabled = disable;
+  dir = NULL;
+
+done:
+  vec_free (dir);
+  unformat_free (line_input);
+
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (upf_adf_cache_command, static) =
+{
+  .path = "upf adf cache",
+  .short_help = "upf adf cache [dir <path>] [disable]",
+  .function = upf_adf_cache_command_fn,
+};
+/* *INDENT-ON* */
+
 static clib_error_t *
 upf_adf_show_db_command_fn (vlib_main_t * vm,
 			    unformat_input_t * input,
@@ -907,6 +1860,7 @@ static clib_error_t *
 upf_show_apps_command_fn (vlib_main_t * vm,
 			  unformat_input_t * input, vlib_cli_command_t * cmd)
 {
+  upf_adf_compile_main_t *acm = &upf_adf_compile_main;
   upf_main_t *sm = &upf_main;
   u8 *name = NULL;
   u32 index = 0;
@@ -936,6 +1890,36 @@ upf_show_apps_command_fn (vlib_main_t * vm,
       unformat_free (line_input);
     }
 
+  vlib_cli_output (vm, "database cache: %s, hits %llu, misses %llu, "
+		   "write errors %llu",
+		   acm->cache_dir ? (char *) acm->cache_dir :
+		   acm->cache_disabled ? "disabled" : UPF_ADF_CACHE_DEFAULT_DIR,
+		   acm->cache_hits, acm->cache_misses, acm->cache_errors);
+
+  {
+    vlib_simple_counter_main_t *cm = sm->upf_simple_counters;
+    u64 hellos = vlib_get_simple_counter (&cm[UPF_TLS_CLIENT_HELLO], 0);
+    u64 sni = vlib_get_simple_counter (&cm[UPF_TLS_SNI], 0);
+    u64 hits = vlib_get_simple_counter (&cm[UPF_ADR_CACHE_HIT], 0);
+    u64 misses = vlib_get_simple_counter (&cm[UPF_ADR_CACHE_MISS], 0);
+
+    vlib_cli_output (vm, "TLS ClientHello: %llu, SNI %llu (%.1f%%), "
+		     "multi record %llu, TLS 1.3 %llu, ALPN %llu",
+		     hellos, sni, hellos ? 100.0 * sni / hellos : 0.0,
+		     vlib_get_simple_counter (&cm[UPF_TLS_HELLO_MULTI_RECORD],
+					      0),
+		     vlib_get_simple_counter (&cm[UPF_TLS_13], 0),
+		     vlib_get_simple_counter (&cm[UPF_TLS_ALPN], 0));
+    vlib_cli_output (vm, "QUIC Initial: %llu, SNI %llu, decrypt errors %llu",
+		     vlib_get_simple_counter (&cm[UPF_QUIC_INITIAL], 0),
+		     vlib_get_simple_counter (&cm[UPF_QUIC_SNI], 0),
+		     vlib_get_simple_counter (&cm[UPF_QUIC_DECRYPT_ERROR],
+					      0));
+    vlib_cli_output (vm, "verdict cache: hits %llu, misses %llu (%.1f%%)",
+		     hits, misses,
+		     hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+  }
+
   /* *INDENT-OFF* */
   hash_foreach(name, index, sm->upf_app_by_name,
   ({
@@ -1014,13 +1998,30 @@ upf_update_app (upf_main_t * sm, u8 * app_name, u32 num_rules, u32 * ids,
   return 0;
 }
 
+int
+upf_app_ip_flow_rule_match (u32 db_index, upf_app_ip_flow_t * af,
+			    ip46_address_t * assigned)
+{
+  upf_adf_entry_t *entry = pool_elt_at_index (upf_adf_db, db_index);
+
+  if (!entry->app_dpos)
+    return 0;
+
+  if (!af->looked_up)
+    upf_app_ip_flow_lookup (af);
+
+  return clib_bitmap_get (af->apps, db_index) &&
+    upf_app_dpo_match (db_index, entry, af, assigned);
+}
+
 int
 upf_app_ip_rule_match (u32 db_index, flow_entry_t * flow,
 		       ip46_address_t *assigned)
 {
-  upf_adf_entry_t *entry = pool_elt_at_index (upf_adf_db, db_index);
-  return entry->app_dpos &&
-    upf_app_dpo_match (entry, flow, assigned);
+  upf_app_ip_flow_t af;
+
+  upf_app_ip_flow_init (&af, flow);
+  return upf_app_ip_flow_rule_match (db_index, &af, assigned);
 }
 
 /*
@@ -33,6 +33,17 @@
 #define TLS_HANDSHAKE 22
 #define TLS_CLIENT_HELLO 1
 #define TLS_EXT_SNI 0
+#define TLS_EXT_ALPN 16
+#define TLS_EXT_SUPPORTED_VERSIONS 43
+#define TLS_SNI_HOST_NAME 0
+#define TLS_MAX_RECORD_LEN 16384
+
+/* upper bound for the stream prefix buffered for application detection,
+ * one maximum size TLS record */
+#define UPF_ADR_MAX_DATA (TLS_MAX_RECORD_LEN + 5)
+
+/* HTTP request line and headers are given up on after this many bytes */
+#define UPF_ADR_HTTP_MAX_HEADER 8192
 
 CLIB_PACKED (struct tls_record_hdr
 	     {
@@ -57,11 +68,19 @@ CLIB_PACKED (struct tls_client_hello_hdr
 
 typedef struct
 {
-  u32 rule_index;		/* referenced ADR rule index */
+  u32 *rules;			/* ADR rule indices with this src prefix */
   index_t next;			/* link to the next less specific ACL ref */
-  index_t dpoi_index;		/* DPO id */
   u8 src_preflen;		/* src prefix length */
   u8 is_ip4:1;
+
+  /*
+   * The rules of the chain starting at this entry, compiled into disjoint
+   * source (server) port intervals: port_starts is sorted and starts at
+   * 0, port_rules[i] lists the rules (in chain order) whose source port
+   * range covers [port_starts[i], port_starts[i + 1]).
+   */
+  u16 *port_starts;
+  u32 **port_rules;
 } upf_app_dpo_t;
 
 typedef struct
@@ -70,19 +89,142 @@ typedef struct
   acl_rule_t *acl;
   u32 *flags;
   unsigned int *ids;
-  hs_database_t *database;
-  hs_scratch_t *scratch;
+  hs_database_t *database;	/* published by the compile process */
+  u32 compile_seq;		/* rule set generation */
   u32 ref_cnt;
-  u32 fib_index_ip4;		/* IP rule FIB table index (IP4) */
-  u32 fib_index_ip6;		/* IP rule FIB table index (IP6) */
   upf_app_dpo_t *app_dpos;	/* vector of APP DPOs */
 } upf_adf_entry_t;
 
+/*
+ * Merged database of a set of applications, shared by all rule sets with
+ * ADR PDRs for exactly these applications. The expressions of the n-th
+ * application in db_ids are tagged with id n. Rebuilt in the background
+ * whenever one of the applications changes.
+ */
+typedef struct upf_adf_set
+{
+  hs_database_t *database;	/* swapped atomically */
+  u32 generation;		/* changes with the rules of the database */
+  u8 *rules;			/* rule set the database was compiled from */
+  u32 *db_ids;			/* sorted application database indexes */
+  u32 compile_seq;
+  u32 ref_cnt;
+  u32 index;			/* in upf_adf_sets */
+} upf_adf_set_t;
+
+extern hs_scratch_t **upf_adf_scratch;
+
+/* scratch space of the calling thread, large enough for every database */
+always_inline hs_scratch_t *
+upf_adf_get_scratch (void)
+{
+  return vec_elt (upf_adf_scratch, vlib_get_thread_index ());
+}
+
+/*
+ * Per thread cache of session database scan results, keyed by the set
+ * generation and the scanned host/URI. All sessions sharing a set share
+ * its verdicts, they survive anything but a change of its rules. The
+ * cached value is the bitmap of matched applications of the set, sets
+ * with more applications are not cached. The hash is seeded at start and
+ * only picks the cache set, a hit compares the whole host/URI, longer
+ * ones than UPF_ADR_VERDICT_KEY_BYTES are not cached. Cache sets are
+ * small and kept in LRU order.
+ */
+#define UPF_ADR_VERDICT_CACHE_SETS	1024	/* power of 2 */
+#define UPF_ADR_VERDICT_CACHE_WAYS	4
+#define UPF_ADR_VERDICT_MAX_MATCHES	64
+#define UPF_ADR_VERDICT_KEY_BYTES	96
+
+typedef struct
+{
+  u64 hash;
+  u64 matched;			/* bitmap of matched applications */
+  u32 generation;		/* 0 for an unused way */
+  u32 length;
+  u8 key[UPF_ADR_VERDICT_KEY_BYTES];	/* the host/URI */
+} upf_adr_verdict_t;
+
+typedef struct
+{
+  upf_adr_verdict_t ways[UPF_ADR_VERDICT_CACHE_WAYS];
+} upf_adr_verdict_set_t;
+
+extern upf_adr_verdict_set_t **upf_adr_verdict_caches;
+extern uword upf_adr_verdict_seed;
+
+always_inline u64
+upf_adr_verdict_hash (u8 * key, u32 length)
+{
+  return hash_memory (key, length, upf_adr_verdict_seed);
+}
+
+always_inline upf_adr_verdict_set_t *
+upf_adr_verdict_get_cache (void)
+{
+  return vec_elt (upf_adr_verdict_caches, vlib_get_thread_index ());
+}
+
+always_inline int
+upf_adr_verdict_lookup (upf_adr_verdict_set_t * cache, u32 generation,
+			u64 hash, u8 * key, u32 length, u64 * matched)
+{
+  upf_adr_verdict_set_t *set =
+    &cache[hash & (UPF_ADR_VERDICT_CACHE_SETS - 1)];
+  upf_adr_verdict_t hit;
+  int i;
+
+  if (length > UPF_ADR_VERDICT_KEY_BYTES)
+    return 0;
+
+  for (i = 0; i < UPF_ADR_VERDICT_CACHE_WAYS; i++)
+    {
+      upf_adr_verdict_t *v = &set->ways[i];
+
+      if (v->hash != hash || v->generation != generation ||
+	  v->length != length || memcmp (v->key, key, length) != 0)
+	continue;
+
+      /* move to the front */
+      hit = *v;
+      memmove (&set->ways[1], &set->ways[0], i * sizeof (hit));
+      set->ways[0] = hit;
+
+      *matched = hit.matched;
+      return 1;
+    }
+
+  return 0;
+}
+
+always_inline void
+upf_adr_verdict_insert (upf_adr_verdict_set_t * cache, u32 generation,
+			u64 hash, u8 * key, u32 length, u64 matched)
+{
+  upf_adr_verdict_set_t *set =
+    &cache[hash & (UPF_ADR_VERDICT_CACHE_SETS - 1)];
+
+  if (length > UPF_ADR_VERDICT_KEY_BYTES)
+    return;
+
+  /* evict the least recently used way */
+  memmove (&set->ways[1], &set->ways[0],
+	   (UPF_ADR_VERDICT_CACHE_WAYS - 1) * sizeof (set->ways[0]));
+  set->ways[0].hash = hash;
+  set->ways[0].matched = matched;
+  set->ways[0].generation = generation;
+  set->ways[0].length = length;
+  clib_memcpy_fast (set->ways[0].key, key, length);
+}
+
 int upf_adf_lookup (u32 db_index, u8 * str, uint16_t length, u32 * id);
 int upf_app_add_del (upf_main_t * sm, u8 * name, u32 flags, int add);
 int upf_rule_add_del (upf_main_t * sm, u8 * name, u32 id,
 		      int add, u8 * regex, acl_rule_t * acl);
 
+void upf_adf_session_db_build (upf_adr_db_t * db, upf_pdr_t * pdrs);
+void upf_adf_session_db_free (upf_adr_db_t * db);
+
 u32 upf_adf_get_adr_db (u32 application_id);
 void upf_adf_put_adr_db (u32 db_index);
 
@@ -90,9 +232,38 @@ int upf_update_app (upf_main_t * sm, u8 * app_name, u32 num_rules,
 		    u32 * ids, u32 * regex_lengths, u8 ** regexes);
 
 adr_result_t
-upf_application_detection (vlib_main_t * vm, u8 * p,
+upf_application_detection (vlib_main_t * vm, u8 * p, word len,
 			   flow_entry_t * flow, struct rules *active);
 
+adr_result_t upf_adr_parse_client_hello (u16 port, u8 * msg, word avail,
+					 u8 ** uri);
+adr_result_t upf_adr_try_quic (u16 port, u8 * p, word len, u8 ** crypto,
+			       u8 ** uri);
+
+/*
+ * IP rule matching of one flow classification: the applications with a
+ * rule for the server address are looked up once, with the first PDR
+ * that has IP rules, the other PDRs only test their application against
+ * that candidate bitmap.
+ */
+typedef struct
+{
+  flow_entry_t *flow;
+  u32 lpm_index;		/* shared LPM entry of the server address */
+  uword *apps;			/* its candidate db indices */
+  u8 looked_up;
+} upf_app_ip_flow_t;
+
+always_inline void
+upf_app_ip_flow_init (upf_app_ip_flow_t * af, flow_entry_t * flow)
+{
+  af->flow = flow;
+  af->looked_up = 0;
+}
+
+int upf_app_ip_flow_rule_match (u32 db_index, upf_app_ip_flow_t * af,
+				ip46_address_t * assigned);
+
 int
 upf_app_ip_rule_match (u32 db_index, flow_entry_t * flow,
 		       ip46_address_t *assigned);
@@ -39,27 +39,96 @@
 dpo_type_t upf_app_dpo_type;
 static fib_source_t app_fib_source;
 
-static index_t
-upf_app_dpo_lookup (upf_adf_entry_t *appentry, ip46_address_t *addr)
+/*
+ * All server prefixes of all applications' IP rules share one FIB per
+ * address family. The DPO of a prefix points to an LPM entry that lists
+ * every application with a rule covering the prefix, together with that
+ * application's most specific covering app_dpo.
+ */
+typedef struct
+{
+  u32 db_index;			/* application database entry */
+  u32 dpo_index;		/* its most specific app_dpo for the prefix */
+} upf_app_lpm_ref_t;
+
+typedef struct
+{
+  ip46_address_t addr;		/* masked prefix */
+  u8 len;
+  u8 is_ip4;
+  u8 pad[6];
+} upf_app_lpm_key_t;
+
+typedef struct
+{
+  upf_app_lpm_key_t key;
+  u32 n_owners;			/* app_dpos with exactly this prefix */
+  uword *apps;			/* bitmap of candidate db indices */
+  upf_app_lpm_ref_t *refs;	/* sorted by db_index */
+} upf_app_lpm_entry_t;
+
+typedef struct
+{
+  u32 fib_index_ip4;
+  u32 fib_index_ip6;
+  upf_app_lpm_entry_t *entries;	/* pool */
+  mhash_t entry_by_key;
+  u32 n_entries_by_len[2][129];	/* by is_ip4 and prefix length */
+} upf_app_lpm_main_t;
+
+static upf_app_lpm_main_t upf_app_lpm_main;
+
+static upf_app_lpm_entry_t *
+upf_app_lpm_lookup (ip46_address_t *addr)
 {
+  upf_app_lpm_main_t *lm = &upf_app_lpm_main;
   const load_balance_t * lb;
   const dpo_id_t *dpo;
-  index_t lb_index = ip46_address_is_ip4(addr) ?
-    ip4_fib_table_lookup_lb (ip4_fib_get(appentry->fib_index_ip4), &addr->ip4) :
-    ip6_fib_table_fwding_lookup (appentry->fib_index_ip6, &addr->ip6);
+  index_t lb_index;
+
+  if (lm->fib_index_ip4 == ~0)
+    return NULL;
+
+  lb_index = ip46_address_is_ip4(addr) ?
+    ip4_fib_table_lookup_lb (ip4_fib_get(lm->fib_index_ip4), &addr->ip4) :
+    ip6_fib_table_fwding_lookup (lm->fib_index_ip6, &addr->ip6);
   ASSERT (lb_index != INDEX_INVALID);
   lb = load_balance_get (lb_index);
   dpo = load_balance_get_bucket_i (lb, 0);
   if (dpo->dpoi_type != upf_app_dpo_type)
-    return INDEX_INVALID;
+    return NULL;
+
+  upf_debug ("MATCH: %U lpm index %d",
+             format_ip46_address, addr, IP46_TYPE_ANY, dpo->dpoi_index);
+  return pool_elt_at_index (lm->entries, dpo->dpoi_index);
+}
+
+uword *
+upf_app_ip_candidates (ip46_address_t *addr)
+{
+  upf_app_lpm_entry_t *e = upf_app_lpm_lookup (addr);
 
-  clib_warning ("FIB %d MATCH: %U dpo index %d",
-             ip46_address_is_ip4(addr) ?
-             appentry->fib_index_ip4 :
-             appentry->fib_index_ip6,
-             format_ip46_address, addr, IP46_TYPE_ANY,
-             dpo->dpoi_index);
-  return dpo->dpoi_index;
+  return e ? e->apps : NULL;
+}
+
+static upf_app_lpm_ref_t *
+upf_app_lpm_find_ref (upf_app_lpm_entry_t *e, u32 db_index, u32 *pos)
+{
+  u32 lo = 0, hi = vec_len (e->refs);
+
+  while (lo < hi)
+    {
+      u32 mid = (lo + hi) / 2;
+
+      if (e->refs[mid].db_index < db_index)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (pos)
+    *pos = lo;
+  return (lo < vec_len (e->refs) && e->refs[lo].db_index == db_index) ?
+    &e->refs[lo] : NULL;
 }
 
 static int
@@ -100,39 +169,78 @@ acl_rule_port_in_range(u16 port, acl_rule_t * rule, u8 field)
 }
 
 static int
-upf_do_ip_rule_match (upf_adf_entry_t *appentry, ip46_address_t *src, u16 sport, ip46_address_t *dst, u16 dport, ip46_address_t *assigned)
+upf_app_rule_dst_match (acl_rule_t * rule, ip46_address_t *dst,
+                        ip46_address_t *assigned)
+{
+  ipfilter_address_t * dst_rule_addr = &rule->address[IPFILTER_RULE_FIELD_DST];
+  ip46_address_t * dst_match = &dst_rule_addr->address;
+  u8 dst_prefix_len = dst_rule_addr->mask;
+
+  if (acl_addr_is_any(dst_rule_addr))
+    return 1;
+
+  if (acl_addr_is_assigned (dst_rule_addr))
+    {
+      dst_match = assigned;
+      dst_prefix_len = ip46_address_is_ip4(dst) ? 32 : 128;
+    }
+  return ip_equal_with_prefix_len (dst, dst_match, dst_prefix_len);
+}
+
+/* index of the source port interval that contains port */
+static u32
+upf_app_dpo_port_interval (upf_app_dpo_t * app_dpo, u16 port)
+{
+  u32 lo = 0, hi = vec_len (app_dpo->port_starts) - 1;
+
+  while (lo < hi)
+    {
+      u32 mid = (lo + hi + 1) / 2;
+
+      if (app_dpo->port_starts[mid] <= port)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+  return lo;
+}
+
+static int
+upf_do_ip_rule_match (u32 db_index, upf_adf_entry_t *appentry, u32 lpm_index, ip46_address_t *src, u16 sport, ip46_address_t *dst, u16 dport, ip46_address_t *assigned)
 {
   /*
    * IP app rules for server XX are written like this:
    *   from XX to assigned
    * Here XX is src, 'assigned' is dst
-   * src is matched using FIB, then sport is matched against the
-   * port ranges of the entries found
-   * dst and dport are matched by plain comparison
+   * src has been matched using the shared FIB, the entry found names
+   * the applications with a covering rule and their most specific
+   * app_dpo, which carries the rules of all matching src prefixes
+   * indexed by sport interval, so only the rules covering sport are
+   * checked for dport and dst
    */
-  index_t dpo_index = upf_app_dpo_lookup (appentry, src);
-  while (dpo_index != INDEX_INVALID)
+  upf_app_lpm_main_t *lm = &upf_app_lpm_main;
+  upf_app_lpm_entry_t * e;
+  upf_app_lpm_ref_t * ref;
+  upf_app_dpo_t * app_dpo;
+  u32 * rule_index;
+
+  if (lpm_index == ~0)
+    goto mismatch;
+
+  e = pool_elt_at_index (lm->entries, lpm_index);
+  if (!clib_bitmap_get (e->apps, db_index))
+    goto mismatch;
+
+  ref = upf_app_lpm_find_ref (e, db_index, NULL);
+  ASSERT (ref);
+  app_dpo = appentry->app_dpos + ref->dpo_index;
+  vec_foreach (rule_index,
+               app_dpo->port_rules[upf_app_dpo_port_interval (app_dpo, sport)])
     {
-      upf_app_dpo_t * app_dpo = appentry->app_dpos + dpo_index;
-      acl_rule_t * rule = appentry->acl + app_dpo->rule_index;
-      ipfilter_address_t * dst_rule_addr = &rule->address[IPFILTER_RULE_FIELD_DST];
-      ip46_address_t * dst_match = &dst_rule_addr->address;
-      u8 dst_prefix_len = dst_rule_addr->mask;
-      if (!acl_addr_is_any(dst_rule_addr))
-        {
-          if (acl_addr_is_assigned (dst_rule_addr))
-            {
-              dst_match = assigned;
-              dst_prefix_len = ip46_address_is_ip4(dst) ? 32 : 128;
-            }
-          if (!ip_equal_with_prefix_len (dst, dst_match, dst_prefix_len))
-            {
-              dpo_index = app_dpo->next;
-              continue;
-            }
-        }
-      if (acl_rule_port_in_range(sport, rule, IPFILTER_RULE_FIELD_SRC) &&
-	  acl_rule_port_in_range(dport, rule, IPFILTER_RULE_FIELD_DST))
+      acl_rule_t * rule = appentry->acl + *rule_index;
+
+      if (acl_rule_port_in_range(dport, rule, IPFILTER_RULE_FIELD_DST) &&
+          upf_app_rule_dst_match (rule, dst, assigned))
         {
           upf_debug("MATCH: src %U sport %d dst %U dport %d assigned %U",
                     format_ip46_address, src, IP46_TYPE_ANY, sport,
@@ -140,9 +248,9 @@ upf_do_ip_rule_match (upf_adf_entry_t *appentry, ip46_address_t *src, u16 sport,
                     format_ip46_address, assigned, IP46_TYPE_ANY);
           return 1;
         }
-      dpo_index = app_dpo->next;
     }
 
+mismatch:
   upf_debug("MISMATCH: src %U sport %d dst %U dport %d assigned %U",
             format_ip46_address, src, IP46_TYPE_ANY, sport,
             format_ip46_address, dst, IP46_TYPE_ANY, dport,
@@ -150,53 +258,314 @@ upf_do_ip_rule_match (upf_adf_entry_t *appentry, ip46_address_t *src, u16 sport,
   return 0;
 }
 
-static int src_mask_cmp (void *a1, void *a2)
+static int port_cmp (void *a1, void *a2)
+{
+  u16 * p1 = (u16 *)a1, * p2 = (u16 *)a2;
+  return (int) *p1 - (int) *p2;
+}
+
+/*
+ * Compile the chain of less specific entries into disjoint sport
+ * intervals, each listing the rules that cover it. The server port is
+ * the one that differs between the rules of an application.
+ */
+static void
+upf_app_dpo_build_port_index (upf_adf_entry_t * appentry,
+                              upf_app_dpo_t * app_dpo)
 {
-  upf_app_dpo_t * ad1 = (upf_app_dpo_t *)a1, * ad2 = (upf_app_dpo_t *)a2;
-  if (ad1->src_preflen < ad2->src_preflen)
-    return -1;
-  else if (ad1->src_preflen == ad2->src_preflen)
-    return 0;
+  u32 * chain = 0, * rule_index;
+  u16 * bounds = 0;
+  index_t i;
+  u32 n;
+
+  for (i = app_dpo - appentry->app_dpos; i != INDEX_INVALID;
+       i = appentry->app_dpos[i].next)
+    vec_append (chain, appentry->app_dpos[i].rules);
+
+  vec_add1 (bounds, 0);
+  vec_foreach (rule_index, chain)
+    {
+      ipfilter_port_t * port =
+        &appentry->acl[*rule_index].port[IPFILTER_RULE_FIELD_SRC];
+
+      vec_add1 (bounds, port->min);
+      if (port->max < 0xffff)
+        vec_add1 (bounds, port->max + 1);
+    }
+  vec_sort_with_function (bounds, port_cmp);
+
+  for (n = 0; n < vec_len (bounds); n++)
+    if (n == 0 || bounds[n] != bounds[n - 1])
+      vec_add1 (app_dpo->port_starts, bounds[n]);
+
+  /* a rule covers the intervals from the one of its min to its max */
+  vec_validate (app_dpo->port_rules, vec_len (app_dpo->port_starts) - 1);
+  vec_foreach (rule_index, chain)
+    {
+      ipfilter_port_t * port =
+        &appentry->acl[*rule_index].port[IPFILTER_RULE_FIELD_SRC];
+      u32 last = upf_app_dpo_port_interval (app_dpo, port->max);
+
+      for (n = upf_app_dpo_port_interval (app_dpo, port->min); n <= last;
+           n++)
+        vec_add1 (app_dpo->port_rules[n], *rule_index);
+    }
+
+  vec_free (bounds);
+  vec_free (chain);
+}
+
+static void
+upf_app_dpo_free_port_index (upf_app_dpo_t * app_dpo)
+{
+  u32 n;
+
+  for (n = 0; n < vec_len (app_dpo->port_rules); n++)
+    vec_free (app_dpo->port_rules[n]);
+  vec_free (app_dpo->port_rules);
+  vec_free (app_dpo->port_starts);
+  vec_free (app_dpo->rules);
+}
+
+/* the key of the prefix of length len that covers key */
+static void
+upf_app_lpm_key_mask (upf_app_lpm_key_t * key, u8 len,
+                      upf_app_lpm_key_t * masked)
+{
+  clib_memset (masked, 0, sizeof (*masked));
+  masked->len = len;
+  masked->is_ip4 = key->is_ip4;
+
+  if (key->is_ip4)
+    masked->addr.ip4.as_u32 =
+      key->addr.ip4.as_u32 & ip4_main.fib_masks[len];
   else
-    return 1;
+    {
+      masked->addr.ip6.as_u64[0] =
+        key->addr.ip6.as_u64[0] & ip6_main.fib_masks[len].as_u64[0];
+      masked->addr.ip6.as_u64[1] =
+        key->addr.ip6.as_u64[1] & ip6_main.fib_masks[len].as_u64[1];
+    }
+}
+
+static void
+upf_app_rule_key (acl_rule_t * rule, u8 is_ip4, upf_app_lpm_key_t * key)
+{
+  ipfilter_address_t * src = &rule->address[IPFILTER_RULE_FIELD_SRC];
+  upf_app_lpm_key_t addr = {
+    .is_ip4 = is_ip4,
+  };
+
+  if (!acl_addr_is_any (src))
+    addr.addr = src->address;
+  upf_app_lpm_key_mask (&addr, src->mask, key);
 }
 
 static void
-add_app_dpo(upf_adf_entry_t * appentry, acl_rule_t * rule, u8 is_ip4)
+upf_app_dpo_key (upf_adf_entry_t * appentry, upf_app_dpo_t * app_dpo,
+                 upf_app_lpm_key_t * key)
+{
+  upf_app_rule_key (appentry->acl + app_dpo->rules[0], app_dpo->is_ip4, key);
+}
+
+/* the app_dpos of an application by src prefix, while its FIB is built */
+typedef struct
+{
+  mhash_t by_key;
+  uword *lens[2];		/* prefix lengths in use, by is_ip4 */
+} upf_app_dpo_map_t;
+
+/* rules with the same src prefix share one app_dpo */
+static void
+add_app_dpo (upf_adf_entry_t * appentry, upf_app_dpo_map_t * map,
+             acl_rule_t * rule, u8 is_ip4)
 {
   upf_app_dpo_t * app_dpo;
-  vec_add2 (appentry->app_dpos, app_dpo, 1);
-  app_dpo->rule_index = rule - appentry->acl;
-  app_dpo->next = INDEX_INVALID;
-  app_dpo->dpoi_index = INDEX_INVALID;
-  app_dpo->src_preflen = rule->address[IPFILTER_RULE_FIELD_SRC].mask;
-  app_dpo->is_ip4 = is_ip4;
+  upf_app_lpm_key_t key;
+  uword *p;
+
+  upf_app_rule_key (rule, is_ip4, &key);
+  p = mhash_get (&map->by_key, &key);
+  if (p)
+    app_dpo = appentry->app_dpos + p[0];
+  else
+    {
+      vec_add2 (appentry->app_dpos, app_dpo, 1);
+      clib_memset (app_dpo, 0, sizeof (*app_dpo));
+      app_dpo->next = INDEX_INVALID;
+      app_dpo->src_preflen = key.len;
+      app_dpo->is_ip4 = is_ip4;
+      mhash_set (&map->by_key, &key, app_dpo - appentry->app_dpos, NULL);
+      map->lens[is_ip4] = clib_bitmap_set (map->lens[is_ip4], key.len, 1);
+    }
+  vec_add1 (app_dpo->rules, rule - appentry->acl);
+}
+
+/* the app_dpo with the longest prefix of at most max_len covering key */
+static index_t
+upf_app_dpo_map_covering (upf_app_dpo_map_t * map, upf_app_lpm_key_t * key,
+                          int max_len)
+{
+  upf_app_lpm_key_t masked;
+  uword *p;
+  int len;
+
+  for (len = max_len; len >= 0; len--)
+    {
+      if (!clib_bitmap_get (map->lens[key->is_ip4], len))
+        continue;
+      upf_app_lpm_key_mask (key, len, &masked);
+      if ((p = mhash_get (&map->by_key, &masked)))
+        return p[0];
+    }
+  return INDEX_INVALID;
+}
+
+static void
+upf_app_lpm_key_to_prefix (upf_app_lpm_key_t * key, fib_prefix_t * pfx)
+{
+  clib_memset (pfx, 0, sizeof (*pfx));
+  pfx->fp_addr = key->addr;
+  pfx->fp_proto = key->is_ip4 ? FIB_PROTOCOL_IP4 : FIB_PROTOCOL_IP6;
+  pfx->fp_len = key->len;
+}
+
+static void
+upf_app_lpm_set_ref (upf_app_lpm_entry_t * e, u32 db_index, u32 dpo_index)
+{
+  upf_app_lpm_ref_t * ref, new_ref = {
+    .db_index = db_index,
+    .dpo_index = dpo_index,
+  };
+  u32 pos;
+
+  if ((ref = upf_app_lpm_find_ref (e, db_index, &pos)))
+    ref->dpo_index = dpo_index;
+  else
+    vec_insert_elts (e->refs, &new_ref, 1, pos);
+  e->apps = clib_bitmap_set (e->apps, db_index, 1);
+}
+
+static void
+upf_app_lpm_clear_ref (upf_app_lpm_entry_t * e, u32 db_index)
+{
+  u32 pos;
+
+  if (upf_app_lpm_find_ref (e, db_index, &pos))
+    vec_delete (e->refs, 1, pos);
+  e->apps = clib_bitmap_set (e->apps, db_index, 0);
+}
+
+static upf_app_lpm_entry_t *
+upf_app_lpm_get_entry (upf_app_lpm_key_t * key)
+{
+  upf_app_lpm_main_t *lm = &upf_app_lpm_main;
+  upf_app_lpm_entry_t * e, * parent;
+  upf_app_lpm_key_t parent_key;
+  u32 parent_index = ~0;
+  dpo_id_t dpo = DPO_INVALID;
+  fib_prefix_t pfx;
+  uword *p;
+  int len;
+
+  p = mhash_get (&lm->entry_by_key, key);
+  if (p)
+    return pool_elt_at_index (lm->entries, p[0]);
+
+  /*
+   * Applications without a rule for exactly this prefix resolve it like
+   * the most specific existing prefix that covers it
+   */
+  for (len = key->len - 1; len >= 0 && parent_index == ~0; len--)
+    {
+      if (!lm->n_entries_by_len[key->is_ip4][len])
+        continue;
+      upf_app_lpm_key_mask (key, len, &parent_key);
+      if ((p = mhash_get (&lm->entry_by_key, &parent_key)))
+        parent_index = p[0];
+    }
+
+  pool_get_zero (lm->entries, e);
+  if (parent_index != ~0)
+    {
+      /* the pool may have moved */
+      parent = pool_elt_at_index (lm->entries, parent_index);
+      e->refs = vec_dup (parent->refs);
+      e->apps = clib_bitmap_dup (parent->apps);
+    }
+  e->key = *key;
+  mhash_set (&lm->entry_by_key, &e->key, e - lm->entries, NULL);
+  lm->n_entries_by_len[key->is_ip4][key->len]++;
+
+  upf_app_lpm_key_to_prefix (key, &pfx);
+  dpo_set (&dpo,
+           upf_app_dpo_type,
+           fib_proto_to_dpo(pfx.fp_proto),
+           e - lm->entries);
+  fib_table_entry_special_dpo_add (key->is_ip4 ?
+                                   lm->fib_index_ip4 : lm->fib_index_ip6,
+                                   &pfx,
+                                   FIB_SOURCE_SPECIAL,
+                                   FIB_ENTRY_FLAG_EXCLUSIVE |
+                                   FIB_ENTRY_FLAG_LOOSE_URPF_EXEMPT,
+                                   &dpo);
+  return e;
+}
+
+static void
+upf_app_lpm_put_entry (upf_app_lpm_entry_t * e)
+{
+  upf_app_lpm_main_t *lm = &upf_app_lpm_main;
+  fib_prefix_t pfx;
+
+  if (--e->n_owners > 0)
+    return;
+
+  upf_app_lpm_key_to_prefix (&e->key, &pfx);
+  fib_table_entry_special_remove (e->key.is_ip4 ?
+                                  lm->fib_index_ip4 : lm->fib_index_ip6,
+                                  &pfx,
+                                  FIB_SOURCE_SPECIAL);
+  mhash_unset (&lm->entry_by_key, &e->key, NULL);
+  lm->n_entries_by_len[e->key.is_ip4][e->key.len]--;
+  vec_free (e->refs);
+  clib_bitmap_free (e->apps);
+  pool_put (lm->entries, e);
+}
+
+static void
+upf_app_lpm_init (void)
+{
+  upf_app_lpm_main_t *lm = &upf_app_lpm_main;
+
+  if (lm->fib_index_ip4 != ~0)
+    return;
+
+  lm->fib_index_ip4 =
+    fib_table_find_or_create_and_lock (FIB_PROTOCOL_IP4,
+                                       FIB_TABLE_ID_START,
+                                       app_fib_source);
+  lm->fib_index_ip6 =
+    fib_table_find_or_create_and_lock (FIB_PROTOCOL_IP6,
+                                       FIB_TABLE_ID_START,
+                                       app_fib_source);
 }
 
 void
-upf_ensure_app_fib_if_needed (upf_adf_entry_t *appentry)
+upf_ensure_app_fib_if_needed (upf_adf_entry_t *appentry, u32 db_index)
 {
+  upf_app_lpm_main_t *lm = &upf_app_lpm_main;
+  vlib_main_t *vm = vlib_get_main ();
+  upf_app_dpo_map_t map = { 0 };
+  upf_app_lpm_entry_t * e;
   acl_rule_t * rule;
   upf_app_dpo_t * app_dpo;
-  /* upf_main_t * gtm = &upf_main; */
-  static int next_table_id = FIB_TABLE_ID_START; /* FIXME */
-  /* u32 table_id; */
 
   if (!appentry->acl || appentry->app_dpos)
     return;
 
-  /* table_id = FIB_TABLE_ID_START + (app - gtm->upf_apps); */
-  if (appentry->fib_index_ip4 == ~0)
-    {
-      appentry->fib_index_ip4 =
-        fib_table_find_or_create_and_lock (FIB_PROTOCOL_IP4,
-                                           next_table_id++,
-                                           app_fib_source);
-      appentry->fib_index_ip6 =
-        fib_table_find_or_create_and_lock (FIB_PROTOCOL_IP6,
-                                           next_table_id++,
-                                           app_fib_source);
-    }
+  upf_app_lpm_init ();
+  mhash_init (&map.by_key, sizeof (uword), sizeof (upf_app_lpm_key_t));
 
   vec_foreach (rule, appentry->acl)
   {
@@ -227,113 +596,116 @@ upf_ensure_app_fib_if_needed (upf_adf_entry_t *appentry)
     else
       has_ip6 = 1;
     if (has_ip4)
-      add_app_dpo(appentry, rule, 1);
+      add_app_dpo (appentry, &map, rule, 1);
     if (has_ip6)
-      add_app_dpo(appentry, rule, 0);
+      add_app_dpo (appentry, &map, rule, 0);
   }
 
-  /* shorter prefixes should go first */
-  vec_sort_with_function (appentry->app_dpos, src_mask_cmp);
+  /* link every app_dpo to the most specific one with a shorter prefix */
   vec_foreach (app_dpo, appentry->app_dpos)
   {
-    dpo_id_t dpo = DPO_INVALID;
-    fib_prefix_t pfx;
-    /*
-     * At this point, all of the app_dpos that have been already added
-     * to the FIB table have either shorter or same IP prefix length
-     * as this app_dpo. So, if we find another entry that intersects
-     * with the this app_dpo, we link it from this one, as the FIB
-     * table can yield just one match per address
-     */
-    rule = appentry->acl + app_dpo->rule_index;
-    app_dpo->next = upf_app_dpo_lookup (appentry, &rule->address[IPFILTER_RULE_FIELD_SRC].address);
-    if (acl_addr_is_any(&rule->address[IPFILTER_RULE_FIELD_SRC]))
-      {
-        pfx.fp_addr.as_u64[0] = 0;
-        pfx.fp_addr.as_u64[1] = 0;
-      }
-    else
-      {
-        pfx.fp_addr.as_u64[0] = rule->address[IPFILTER_RULE_FIELD_SRC].address.as_u64[0];
-        pfx.fp_addr.as_u64[1] = rule->address[IPFILTER_RULE_FIELD_SRC].address.as_u64[1];
-      }
-    pfx.fp_proto = app_dpo->is_ip4 ? FIB_PROTOCOL_IP4 : FIB_PROTOCOL_IP6;
-    pfx.fp_len = app_dpo->src_preflen;
-    clib_warning ("add pfx: FIB %d is_ip4 %d fp_len %d IP %U dpo_index %d",
-               app_dpo->is_ip4 ?
-               appentry->fib_index_ip4 : appentry->fib_index_ip6,
-               app_dpo->is_ip4, pfx.fp_len,
-               format_ip46_address, &pfx.fp_addr, IP46_TYPE_ANY,
-               app_dpo - appentry->app_dpos);
-    dpo_set (&dpo,
-             upf_app_dpo_type,
-             fib_proto_to_dpo(pfx.fp_proto),
-             app_dpo - appentry->app_dpos);
-    app_dpo->dpoi_index = dpo.dpoi_index;
-    fib_table_entry_special_dpo_add (app_dpo->is_ip4 ?
-                                     appentry->fib_index_ip4 :
-                                     appentry->fib_index_ip6,
-                                     &pfx,
-                                     FIB_SOURCE_SPECIAL,
-                                     FIB_ENTRY_FLAG_EXCLUSIVE |
-                                     FIB_ENTRY_FLAG_LOOSE_URPF_EXEMPT,
-                                     &dpo);
+    upf_app_lpm_key_t key;
+
+    upf_app_dpo_key (appentry, app_dpo, &key);
+    app_dpo->next = upf_app_dpo_map_covering (&map, &key, key.len - 1);
   }
+
+  /*
+   * the next links are final now, every app_dpo gets a FIB entry of its
+   * own and is the one that entry refers to for this app
+   */
+  vec_foreach (app_dpo, appentry->app_dpos)
+    upf_app_dpo_build_port_index (appentry, app_dpo);
+
+  /* publish the app in the shared LPM */
+  vlib_worker_thread_barrier_sync (vm);
+
+  vec_foreach (app_dpo, appentry->app_dpos)
+  {
+    upf_app_lpm_key_t key;
+
+    upf_app_dpo_key (appentry, app_dpo, &key);
+    e = upf_app_lpm_get_entry (&key);
+    e->n_owners++;
+  }
+
+  pool_foreach (e, lm->entries)
+    {
+      index_t best = upf_app_dpo_map_covering (&map, &e->key, e->key.len);
+
+      if (best != INDEX_INVALID)
+        upf_app_lpm_set_ref (e, db_index, best);
+    }
+
+  vlib_worker_thread_barrier_release (vm);
+
+  mhash_free (&map.by_key);
+  clib_bitmap_free (map.lens[0]);
+  clib_bitmap_free (map.lens[1]);
 }
 
 void
-upf_app_fib_cleanup (upf_adf_entry_t *appentry)
+upf_app_fib_cleanup (upf_adf_entry_t *appentry, u32 db_index)
 {
+  upf_app_lpm_main_t *lm = &upf_app_lpm_main;
+  vlib_main_t *vm = vlib_get_main ();
+  upf_app_lpm_entry_t * e;
   upf_app_dpo_t * app_dpo;
 
   if (!appentry->app_dpos)
     return;
 
+  vlib_worker_thread_barrier_sync (vm);
+
+  pool_foreach (e, lm->entries)
+    {
+      upf_app_lpm_clear_ref (e, db_index);
+    }
+
   vec_foreach (app_dpo, appentry->app_dpos)
   {
-    acl_rule_t * rule = appentry->acl + app_dpo->rule_index;
-    fib_prefix_t pfx;
-    if (acl_addr_is_any(&rule->address[IPFILTER_RULE_FIELD_SRC]))
-      {
-        pfx.fp_addr.as_u64[0] = 0;
-        pfx.fp_addr.as_u64[1] = 0;
-      }
-    else
-      {
-        pfx.fp_addr.as_u64[0] = rule->address[IPFILTER_RULE_FIELD_SRC].address.as_u64[0];
-        pfx.fp_addr.as_u64[1] = rule->address[IPFILTER_RULE_FIELD_SRC].address.as_u64[1];
-      }
-    pfx.fp_proto = app_dpo->is_ip4 ? FIB_PROTOCOL_IP4 : FIB_PROTOCOL_IP6;
-    pfx.fp_len = app_dpo->src_preflen;
-    clib_warning ("del pfx: is_ip4 %d fp_len %d IP %U",
-               app_dpo->is_ip4, pfx.fp_len,
-               format_ip46_address, &pfx.fp_addr, IP46_TYPE_ANY);
-    fib_table_entry_special_remove (app_dpo->is_ip4 ?
-                                    appentry->fib_index_ip4 :
-                                    appentry->fib_index_ip6,
-                                    &pfx,
-                                    FIB_SOURCE_SPECIAL);
+    upf_app_lpm_key_t key;
+    uword *p;
+
+    upf_app_dpo_key (appentry, app_dpo, &key);
+    p = mhash_get (&lm->entry_by_key, &key);
+    ASSERT (p);
+    if (p)
+      upf_app_lpm_put_entry (pool_elt_at_index (lm->entries, p[0]));
+    upf_app_dpo_free_port_index (app_dpo);
   }
 
-  /*
-    FIXME: this crashes due to extra entries in the DPOs:
-    fib_table_unlock (appentry->fib_index_ip4, FIB_PROTOCOL_IP4, app_fib_source);
-    fib_table_unlock (appentry->fib_index_ip6, FIB_PROTOCOL_IP6, app_fib_source);
-    appentry->fib_index_ip4 = ~0;
-    appentry->fib_index_ip6 = ~0;
-  */
   vec_free (appentry->app_dpos);
 
+  vlib_worker_thread_barrier_release (vm);
+
   appentry->app_dpos = 0;
 }
 
-u8 upf_app_dpo_match(upf_adf_entry_t *appentry,
-                     flow_entry_t *flow,
+void
+upf_app_ip_flow_lookup (upf_app_ip_flow_t *af)
+{
+  upf_app_lpm_main_t *lm = &upf_app_lpm_main;
+  flow_entry_t *flow = af->flow;
+  upf_app_lpm_entry_t * e;
+
+  e = upf_app_lpm_lookup (&flow->key.ip[FT_REVERSE ^ flow->is_reverse]);
+  af->lpm_index = e ? e - lm->entries : ~0;
+  af->apps = e ? e->apps : NULL;
+  af->looked_up = 1;
+}
+
+u8 upf_app_dpo_match(u32 db_index,
+                     upf_adf_entry_t *appentry,
+                     upf_app_ip_flow_t *af,
                      ip46_address_t *assigned)
 {
-  if (appentry->fib_index_ip4 == ~0)
-    return 0;
-  return upf_do_ip_rule_match (appentry,
+  flow_entry_t *flow = af->flow;
+
+  if (!af->looked_up)
+    upf_app_ip_flow_lookup (af);
+
+  return upf_do_ip_rule_match (db_index, appentry, af->lpm_index,
                                &flow->key.ip[FT_REVERSE ^ flow->is_reverse],
                                clib_net_to_host_u16(flow->key.port[FT_REVERSE ^ flow->is_reverse]),
                                &flow->key.ip[FT_ORIGIN ^ flow->is_reverse],
@@ -412,6 +784,11 @@ upf_app_dpo_module_init (vlib_main_t * vm)
   upf_app_dpo_type = dpo_register_new_type (&upf_app_dpo_vft,
 					    upf_app_dpo_nodes);
 
+  upf_app_lpm_main.fib_index_ip4 = ~0;
+  upf_app_lpm_main.fib_index_ip6 = ~0;
+  mhash_init (&upf_app_lpm_main.entry_by_key, sizeof (uword),
+	      sizeof (upf_app_lpm_key_t));
+
   return (NULL);
 }
 
@@ -21,14 +21,23 @@
 #include "upf_app_db.h"
 
 void
-upf_ensure_app_fib_if_needed (upf_adf_entry_t *appentry);
+upf_ensure_app_fib_if_needed (upf_adf_entry_t *appentry, u32 db_index);
 
 void
-upf_app_fib_cleanup (upf_adf_entry_t *appentry);
+upf_app_fib_cleanup (upf_adf_entry_t *appentry, u32 db_index);
+
+/* bitmap of the db indices with an IP rule for the server address */
+uword *
+upf_app_ip_candidates (ip46_address_t *addr);
+
+/* look up the candidates of the server address of af->flow */
+void
+upf_app_ip_flow_lookup (upf_app_ip_flow_t *af);
 
 u8
-upf_app_dpo_match (upf_adf_entry_t *appentry,
-                   flow_entry_t *flow,
+upf_app_dpo_match (u32 db_index,
+                   upf_adf_entry_t *appentry,
+                   upf_app_ip_flow_t *af,
                    ip46_address_t *assigned);
 
 #endif /* __included_upf_ip_rules_h__ */
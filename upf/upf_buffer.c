@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2020 Travelping GmbH
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * DL data buffering for FARs with the BUFF apply action (TS 29.244,
+ * clause 5.9).
+ *
+ * upf-forward hands packets of buffering FARs to upf-dl-buffer, which
+ * queues them per thread and session. The queues are only touched by
+ * their thread, the PFCP process takes them over with the workers
+ * stopped when the FARs of the session change, and feeds the packets
+ * through upf-forward again so that the new FARs apply to them.
+ */
+
+#include <vppinfra/error.h>
+#include <vnet/vnet.h>
+#include <vnet/ip/ip.h>
+
+#include <upf/upf.h>
+#include <upf/upf_pfcp.h>
+#include <upf/upf_pfcp_server.h>
+
+#if CLIB_DEBUG > 1
+#define upf_debug clib_warning
+#else
+#define upf_debug(...)				\
+  do { } while (0)
+#endif
+
+#define foreach_upf_dl_buffer_error				\
+  _(BUFFERED, "packets buffered")				\
+  _(NO_PDR, "no PDR for the packet")				\
+  _(SESSION_LIMIT, "session buffer limit reached")		\
+  _(GLOBAL_LIMIT, "global buffer limit reached")
+
+static char *upf_dl_buffer_error_strings[] = {
+#define _(sym,string) string,
+  foreach_upf_dl_buffer_error
+#undef _
+};
+
+typedef enum
+{
+#define _(sym,str) UPF_DL_BUFFER_ERROR_##sym,
+  foreach_upf_dl_buffer_error
+#undef _
+    UPF_DL_BUFFER_N_ERROR,
+} upf_dl_buffer_error_t;
+
+typedef enum
+{
+  UPF_DL_BUFFER_NEXT_DROP,
+  UPF_DL_BUFFER_N_NEXT,
+} upf_dl_buffer_next_t;
+
+typedef struct
+{
+  u32 session_index;
+  u32 pdr_id;
+  u32 buffered;
+} upf_dl_buffer_trace_t;
+
+static u8 *
+format_upf_dl_buffer_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  upf_dl_buffer_trace_t *t = va_arg (*args, upf_dl_buffer_trace_t *);
+
+  return format (s, "upf_session%d pdr %d, %u packets buffered",
+		 t->session_index, t->pdr_id, t->buffered);
+}
+
+/* limit of the session, the Suggested Buffering Packets Count of its BAR */
+static_always_inline u32
+upf_dl_buffer_session_limit (upf_session_t * sx)
+{
+  upf_main_t *gtm = &upf_main;
+
+  if ((sx->bar.flags & UPF_BAR_PRESENT) &&
+      sx->bar.suggested_buffering_packets_count != 0)
+    return clib_min (sx->bar.suggested_buffering_packets_count,
+		     gtm->dl_buffer_session_max);
+
+  return gtm->dl_buffer_session_max;
+}
+
+VLIB_NODE_FN (upf_dl_buffer_node) (vlib_main_t * vm,
+				   vlib_node_runtime_t * node,
+				   vlib_frame_t * from_frame)
+{
+  u32 thread_index = vm->thread_index;
+  upf_main_t *gtm = &upf_main;
+  upf_dl_buffer_t **queues = vec_elt_at_index (gtm->dl_buffers, thread_index);
+  vlib_simple_counter_main_t *cm = gtm->upf_simple_counters;
+  u32 drops[VLIB_FRAME_SIZE];
+  u32 n_drops = 0, n_buffered = 0;
+  u32 n_left_from, *from;
+
+  from = vlib_frame_vector_args (from_frame);
+  n_left_from = from_frame->n_vectors;
+
+  while (n_left_from > 0)
+    {
+      u32 bi = from[0];
+      vlib_buffer_t *b = vlib_get_buffer (vm, bi);
+      u32 sidx = upf_buffer_opaque (b)->gtpu.session_index;
+      upf_session_t *sx = pool_elt_at_index (gtm->sessions, sidx);
+      struct rules *active = pfcp_get_rules (sx, PFCP_ACTIVE);
+      u32 error = UPF_DL_BUFFER_ERROR_BUFFERED;
+      upf_pdr_t *pdr = NULL;
+      upf_far_t *far = NULL;
+
+      from += 1;
+      n_left_from -= 1;
+
+      if (PREDICT_TRUE (upf_buffer_opaque (b)->gtpu.pdr_idx != ~0))
+	{
+	  pdr = vec_elt_at_index (active->pdr,
+				  upf_buffer_opaque (b)->gtpu.pdr_idx);
+	  far = pfcp_get_far_by_id (active, pdr->far_id);
+	}
+
+      if (PREDICT_FALSE (!pdr || !far))
+	{
+	  error = UPF_DL_BUFFER_ERROR_NO_PDR;
+	  goto drop;
+	}
+
+      if (clib_atomic_fetch_add (&sx->dl_buffered, 1) >=
+	  upf_dl_buffer_session_limit (sx))
+	{
+	  clib_atomic_fetch_sub (&sx->dl_buffered, 1);
+	  vlib_increment_simple_counter (&cm[UPF_DL_BUFFER_SESSION_LIMIT],
+					 thread_index, 0, 1);
+	  error = UPF_DL_BUFFER_ERROR_SESSION_LIMIT;
+	  goto drop;
+	}
+
+      if (clib_atomic_fetch_add (&gtm->dl_buffered, 1) >= gtm->dl_buffer_max)
+	{
+	  clib_atomic_fetch_sub (&gtm->dl_buffered, 1);
+	  clib_atomic_fetch_sub (&sx->dl_buffered, 1);
+	  vlib_increment_simple_counter (&cm[UPF_DL_BUFFER_GLOBAL_LIMIT],
+					 thread_index, 0, 1);
+	  error = UPF_DL_BUFFER_ERROR_GLOBAL_LIMIT;
+	  goto drop;
+	}
+
+      upf_dl_buffer_push (queues, sidx, bi, pdr->id);
+      n_buffered++;
+
+      /* the first buffered packet is reported, once until the FARs change */
+      if ((far->apply_action & FAR_NOTIFY_CP) && !sx->dl_data_reported &&
+	  clib_atomic_bool_cmp_and_swap (&sx->dl_data_reported, 0, 1))
+	upf_pfcp_server_dl_data_report (sidx, sx->cp_seid, pdr->id);
+
+      if (PREDICT_FALSE (b->flags & VLIB_BUFFER_IS_TRACED))
+	{
+	  upf_dl_buffer_trace_t *tr =
+	    vlib_add_trace (vm, node, b, sizeof (*tr));
+	  tr->session_index = sidx;
+	  tr->pdr_id = pdr->id;
+	  tr->buffered = sx->dl_buffered;
+	}
+      continue;
+
+    drop:
+      b->error = node->errors[error];
+      drops[n_drops++] = bi;
+    }
+
+  if (n_buffered)
+    {
+      vlib_increment_simple_counter (&cm[UPF_DL_BUFFERED], thread_index, 0,
+				     n_buffered);
+      vlib_node_increment_counter (vm, node->node_index,
+				   UPF_DL_BUFFER_ERROR_BUFFERED, n_buffered);
+    }
+
+  if (n_drops)
+    vlib_buffer_enqueue_to_single_next (vm, node, drops,
+					UPF_DL_BUFFER_NEXT_DROP, n_drops);
+
+  return from_frame->n_vectors;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (upf_dl_buffer_node) = {
+  .name = "upf-dl-buffer",
+  .vector_size = sizeof (u32),
+  .format_trace = format_upf_dl_buffer_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+  .n_errors = ARRAY_LEN(upf_dl_buffer_error_strings),
+  .error_strings = upf_dl_buffer_error_strings,
+  .n_next_nodes = UPF_DL_BUFFER_N_NEXT,
+  .next_nodes = {
+    [UPF_DL_BUFFER_NEXT_DROP] = "error-drop",
+  },
+};
+/* *INDENT-ON* */
+
+#ifndef CLIB_MARCH_VARIANT
+/*
+ * Release the packets buffered for a session. Unless they are dropped
+ * they go through upf-forward again, where the current FAR of their PDR
+ * forwards, drops or buffers them anew. Packets are flushed thread by
+ * thread, which keeps the order of every flow.
+ */
+void
+upf_dl_buffer_flush (upf_session_t * sx, int drop)
+{
+  vlib_main_t *vm = vlib_get_main ();
+  upf_main_t *gtm = &upf_main;
+  struct rules *active = pfcp_get_rules (sx, PFCP_ACTIVE);
+  vlib_simple_counter_main_t *cm = gtm->upf_simple_counters;
+  u32 si = sx - gtm->sessions;
+  vlib_frame_t *frames[2] = { 0 };
+  u32 node_index[2] = {
+    upf_ip6_forward_node.index,
+    upf_ip4_forward_node.index,
+  };
+  u32 n_flushed = 0, n_dropped = 0;
+  upf_dl_buffer_t **queues;
+
+  ASSERT (vlib_get_thread_index () == 0);
+
+  if (sx->dl_buffered == 0)
+    return;
+
+  vec_foreach (queues, gtm->dl_buffers)
+  {
+    upf_dl_buffer_t *q;
+    u32 i;
+
+    if (si >= vec_len (*queues))
+      continue;
+
+    q = vec_elt_at_index (*queues, si);
+    vec_foreach_index (i, q->buffers)
+    {
+      u32 bi = q->buffers[i];
+      vlib_buffer_t *b = vlib_get_buffer (vm, bi);
+      upf_pdr_t *pdr = NULL;
+      int is_ip4;
+      u32 *to_next;
+
+      if (!drop)
+	pdr = pfcp_get_pdr_by_id (active, q->pdr_ids[i]);
+
+      if (!pdr)
+	{
+	  vlib_buffer_free_one (vm, bi);
+	  n_dropped++;
+	  continue;
+	}
+
+      /* the rules have changed since the packet was classified */
+      upf_buffer_opaque (b)->gtpu.pdr_idx = pdr - active->pdr;
+
+      is_ip4 = (*(u8 *) vlib_buffer_get_current (b) & 0xf0) == 0x40;
+      if (!frames[is_ip4])
+	frames[is_ip4] = vlib_get_frame_to_node (vm, node_index[is_ip4]);
+
+      to_next = vlib_frame_vector_args (frames[is_ip4]);
+      to_next[frames[is_ip4]->n_vectors++] = bi;
+      n_flushed++;
+
+      if (frames[is_ip4]->n_vectors == VLIB_FRAME_SIZE)
+	{
+	  vlib_put_frame_to_node (vm, node_index[is_ip4], frames[is_ip4]);
+	  frames[is_ip4] = NULL;
+	}
+    }
+
+    vec_free (q->buffers);
+    vec_free (q->pdr_ids);
+  }
+
+  for (int i = 0; i < ARRAY_LEN (frames); i++)
+    if (frames[i])
+      vlib_put_frame_to_node (vm, node_index[i], frames[i]);
+
+  upf_debug ("session 0x%016" PRIx64 ": %u DL packets flushed, %u dropped",
+	     sx->cp_seid, n_flushed, n_dropped);
+
+  clib_atomic_fetch_sub (&gtm->dl_buffered, sx->dl_buffered);
+  vlib_decrement_simple_counter (&cm[UPF_DL_BUFFERED], 0, 0,
+				 sx->dl_buffered);
+  vlib_increment_simple_counter (&cm[UPF_DL_BUFFER_FLUSHED], 0, 0,
+				 n_flushed);
+  vlib_increment_simple_counter (&cm[UPF_DL_BUFFER_DISCARDED], 0, 0,
+				 n_dropped);
+  sx->dl_buffered = 0;
+}
+#endif /* CLIB_MARCH_VARIANT */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
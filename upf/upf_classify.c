@@ -24,6 +24,7 @@
 #include <vnet/vnet.h>
 #include <vnet/ip/ip.h>
 #include <vnet/ip/ip46_address.h>
+#include <vnet/udp/udp_packet.h>
 #include <vnet/fib/ip4_fib.h>
 #include <vnet/fib/ip6_fib.h>
 #include <vnet/ethernet/ethernet.h>
@@ -33,6 +34,7 @@
 #include <upf/upf_pfcp.h>
 #include <upf/upf_proxy.h>
 #include <upf/upf_app_dpo.h>
+#include <upf/upf_acl_index.h>
 
 #if CLIB_DEBUG > 1
 #define upf_debug clib_warning
@@ -102,119 +104,24 @@ format_upf_classify_trace (u8 * s, va_list * args)
   return s;
 }
 
-always_inline uword
-ip46_address_is_equal_masked (const ip46_address_t * a,
-			      const ip46_address_t * b,
-			      const ip46_address_t * mask)
-{
-  int i;
-  for (i = 0; i < ARRAY_LEN (a->as_u64); i++)
-    {
-      u64 a_masked, b_masked;
-      a_masked = a->as_u64[i] & mask->as_u64[i];
-      b_masked = b->as_u64[i] & mask->as_u64[i];
-
-      if (a_masked != b_masked)
-	return 0;
-    }
-  return 1;
-}
-
-always_inline int
-acl_ip46_is_equal_masked (const ip46_address_t * ip, upf_acl_t * acl,
-			  int field)
-{
-  return ip46_address_is_equal_masked (ip, &acl->match.address[field],
-				       &acl->mask.address[field]);
-}
-
-always_inline int
-acl_port_in_range (const u16 port, upf_acl_t * acl, int field)
+/* find ACL with the highest precedence that matches this flow */
+always_inline upf_acl_t *
+upf_acl_classify_lookup (u32 teid, flow_entry_t * flow, int is_reverse,
+			 struct rules *active, u8 is_ip4)
 {
-  return (port >= acl->mask.port[field] && port <= acl->match.port[field]);
-}
-
-always_inline int
-upf_acl_classify_one (vlib_main_t * vm, u32 teid,
-		      flow_entry_t * flow, int is_reverse,
-		      u8 is_ip4, upf_acl_t * acl,
-                      struct rules *active)
-{
-  u32 pf_len = is_ip4 ? 32 : 64;
-
-  if (!!is_ip4 != !!acl->is_ip4)
-    return 0;
-
-  clib_warning ("TEID %08x, Match %u, ACL %08x\n",
-	     teid, acl->match_teid, acl->teid);
-  if (acl->match_teid && teid != acl->teid)
-    return 0;
-
-  switch (acl->match_ue_ip)
-    {
-    case UPF_ACL_UL:
-      clib_warning ("UL: UE %U, Src: %U\n",
-		 format_ip46_address, &acl->ue_ip, IP46_TYPE_ANY,
-		 format_ip46_address, &flow->key.ip[FT_ORIGIN ^ is_reverse],
-		 IP46_TYPE_ANY);
-      if (!ip46_address_is_equal_masked
-	  (&acl->ue_ip, &flow->key.ip[FT_ORIGIN ^ is_reverse],
-	   (ip46_address_t *) & ip6_main.fib_masks[pf_len]))
-	return 0;
-      break;
-    case UPF_ACL_DL:
-      clib_warning ("DL: UE %U, Dst: %U\n",
-		 format_ip46_address, &acl->ue_ip, IP46_TYPE_ANY,
-		 format_ip46_address, &flow->key.ip[FT_REVERSE ^ is_reverse],
-		 IP46_TYPE_ANY);
-      if (!ip46_address_is_equal_masked
-	  (&acl->ue_ip, &flow->key.ip[FT_REVERSE ^ is_reverse],
-	   (ip46_address_t *) & ip6_main.fib_masks[pf_len]))
-	return 0;
-      break;
-    default:
-      break;
-    }
-
-  if (acl->match_ip_app)
-    {
-      upf_pdr_t *pdr;
-
-      /* FIXME: should be able to handle PDRs w/o UE IP */
-      if (!acl->match_ue_ip)
-        return 0;
-
-      pdr = vec_elt_at_index (active->pdr, acl->pdr_idx);
-      upf_debug("IP app db_id %d", pdr->pdi.adr.db_id);
-      if (!upf_app_ip_rule_match(pdr->pdi.adr.db_id,
-                                 flow,
-                                 &acl->ue_ip))
-        return 0;
-    }
-
-  clib_warning ("Protocol: 0x%04x/0x%04x, 0x%04x\n",
-	     acl->match.protocol, acl->mask.protocol, flow->key.proto);
-
-  if ((flow->key.proto & acl->mask.protocol) !=
-      (acl->match.protocol & acl->mask.protocol))
-    return 0;
-
-  if (!acl_ip46_is_equal_masked (&flow->key.ip[FT_ORIGIN ^ is_reverse],
-				 acl, UPF_ACL_FIELD_SRC)
-      || !acl_ip46_is_equal_masked (&flow->key.ip[FT_REVERSE ^ is_reverse],
-				    acl, UPF_ACL_FIELD_DST))
-    return 0;
-
-  if (!acl_port_in_range
-      (clib_net_to_host_u16 (flow->key.port[FT_ORIGIN ^ is_reverse]), acl,
-       UPF_ACL_FIELD_SRC)
-      ||
-      !acl_port_in_range (clib_net_to_host_u16
-			  (flow->key.port[FT_REVERSE ^ is_reverse]), acl,
-			  UPF_ACL_FIELD_DST))
-    return 0;
-
-  return 1;
+  upf_acl_index_t *idx = is_ip4 ? &active->v4_index : &active->v6_index;
+  upf_acl_t *acl_vec = is_ip4 ? active->v4_acls : active->v6_acls;
+  upf_app_ip_flow_t af;
+  upf_acl_key_t key;
+  u32 i;
+
+  upf_acl_key_from_flow (&key, flow, is_reverse, teid);
+  /* the IP rule candidates are shared by all PDRs checked for the flow */
+  upf_app_ip_flow_init (&af, flow);
+  i = upf_acl_index_lookup (idx, acl_vec, &key, &af, active);
+
+  upf_debug ("TEID %08x, ACLs %u, match %d\n", teid, vec_len (acl_vec), i);
+  return (i != ~0) ? vec_elt_at_index (acl_vec, i) : NULL;
 }
 
 always_inline u32
@@ -222,7 +129,7 @@ upf_acl_classify_forward (vlib_main_t * vm, u32 teid, flow_entry_t * flow,
 			  struct rules *active, u8 is_ip4, u32 * pdr_idx)
 {
   u32 next = UPF_CLASSIFY_NEXT_DROP;
-  upf_acl_t *acl, *acl_vec;
+  upf_acl_t *acl;
   /*
    * If the proxy was used before session modification,
    * we must either continue using it or drop the traffic
@@ -258,64 +165,57 @@ upf_acl_classify_forward (vlib_main_t * vm, u32 teid, flow_entry_t * flow,
       next = UPF_CLASSIFY_NEXT_DROP;
     }
 
-  acl_vec = is_ip4 ? active->v4_acls : active->v6_acls;
-  clib_warning ("TEID %08x, ACLs %p (%u)\n", teid, acl_vec, vec_len (acl_vec));
-
-  /* find ACL with the highest precedence that matches this flow */
-  vec_foreach (acl, acl_vec)
-  {
-    if (upf_acl_classify_one
-	(vm, teid, flow, FT_ORIGIN ^ flow->is_reverse, is_ip4, acl, active))
-      {
-	upf_pdr_t *pdr;
-
-	pdr = vec_elt_at_index (active->pdr, acl->pdr_idx);
-	flow_pdr_id (flow, FT_ORIGIN) = pdr->id;
-
-	/* FIXME: the following needs more testing for the reclassify case */
-	if (!flow->is_l3_proxy || acl->precedence <= active->proxy_precedence)
-	  {
-	    upf_far_t *far;
-
-	    if (pdr_idx)
-	      *pdr_idx = acl->pdr_idx;
-
-	    far = pfcp_get_far_by_id (active, pdr->far_id);
-	    if (flow->key.proto == IP_PROTOCOL_TCP &&
-		far && far->forward.flags & FAR_F_REDIRECT_INFORMATION)
-	      {
-		flow->is_l3_proxy = 1;
-		flow->is_redirect = 1;
-		flow_next (flow, FT_ORIGIN) = FT_NEXT_PROXY;
-		flow_next (flow, FT_REVERSE) = FT_NEXT_CLASSIFY;
-		flow_pdr_id (flow, FT_REVERSE) = pdr->id;
-		next = UPF_CLASSIFY_NEXT_PROXY;
-	      }
-	    else if (reclassifying_proxy_flow)
-	      {
-		/* can't undo proxying that was already there */
-		flow->is_l3_proxy = 1;
-		flow_next (flow, FT_ORIGIN) = FT_NEXT_PROXY;
-		flow_next (flow, FT_REVERSE) = FT_NEXT_CLASSIFY;
-		next = UPF_CLASSIFY_NEXT_PROXY;
-	      }
-	    else
-	      {
-		flow->is_l3_proxy = 0;
-		flow_next (flow, FT_ORIGIN) = FT_NEXT_PROCESS;
-		flow_next (flow, FT_REVERSE) = FT_NEXT_CLASSIFY;
-		next = UPF_CLASSIFY_NEXT_PROCESS;
-	      }
-
-	    if (pdr->pdi.fields & F_PDI_APPLICATION_ID)
-	      flow->application_id = pdr->pdi.adr.application_id;
-	  }
-
-	clib_warning ("match PDR: %u, Proxy: %d, Redirect: %d\n",
-		   acl->pdr_idx, flow->is_l3_proxy, flow->is_redirect);
-	break;
-      }
-  }
+  acl = upf_acl_classify_lookup (teid, flow, FT_ORIGIN ^ flow->is_reverse,
+				 active, is_ip4);
+  if (acl)
+    {
+      upf_pdr_t *pdr;
+
+      pdr = vec_elt_at_index (active->pdr, acl->pdr_idx);
+      flow_pdr_id (flow, FT_ORIGIN) = pdr->id;
+
+      /* FIXME: the following needs more testing for the reclassify case */
+      if (!flow->is_l3_proxy || acl->precedence <= active->proxy_precedence)
+	{
+	  upf_far_t *far;
+
+	  if (pdr_idx)
+	    *pdr_idx = acl->pdr_idx;
+
+	  far = pfcp_get_far_by_id (active, pdr->far_id);
+	  if (flow->key.proto == IP_PROTOCOL_TCP &&
+	      far && far->forward.flags & FAR_F_REDIRECT_INFORMATION)
+	    {
+	      flow->is_l3_proxy = 1;
+	      flow->is_redirect = 1;
+	      flow_next (flow, FT_ORIGIN) = FT_NEXT_PROXY;
+	      flow_next (flow, FT_REVERSE) = FT_NEXT_CLASSIFY;
+	      flow_pdr_id (flow, FT_REVERSE) = pdr->id;
+	      next = UPF_CLASSIFY_NEXT_PROXY;
+	    }
+	  else if (reclassifying_proxy_flow)
+	    {
+	      /* can't undo proxying that was already there */
+	      flow->is_l3_proxy = 1;
+	      flow_next (flow, FT_ORIGIN) = FT_NEXT_PROXY;
+	      flow_next (flow, FT_REVERSE) = FT_NEXT_CLASSIFY;
+	      next = UPF_CLASSIFY_NEXT_PROXY;
+	    }
+	  else
+	    {
+	      flow->is_l3_proxy = 0;
+	      flow_next (flow, FT_ORIGIN) = FT_NEXT_PROCESS;
+	      flow_next (flow, FT_REVERSE) = FT_NEXT_CLASSIFY;
+	      next = UPF_CLASSIFY_NEXT_PROCESS;
+	    }
+
+	  if (pdr->pdi.fields & F_PDI_APPLICATION_ID)
+	    flow->application_id = pdr->pdi.adr.application_id;
+	}
+
+      upf_debug ("match PDR: %u, Proxy: %d, Redirect: %d\n",
+		 acl->pdr_idx, flow->is_l3_proxy, flow->is_redirect);
+    }
 
   return next;
 }
@@ -326,44 +226,37 @@ upf_acl_classify_proxied (vlib_main_t * vm, u32 teid, flow_entry_t * flow,
 			  struct rules *active, u8 is_ip4, u32 * pdr_idx)
 {
   u32 next = UPF_CLASSIFY_NEXT_DROP;
-  upf_acl_t *acl, *acl_vec;
+  upf_acl_t *acl;
 
   if (teid)
     flow_teid (flow, FT_REVERSE) = teid;
   else
     teid = flow_teid (flow, FT_REVERSE);
 
-  acl_vec = is_ip4 ? active->v4_acls : active->v6_acls;
-  clib_warning ("TEID %08x, ACLs %p (%u)\n", teid, acl_vec, vec_len (acl_vec));
-
-  /* find ACL with the highest precedence that matches this flow */
-  vec_foreach (acl, acl_vec)
-  {
-    if (upf_acl_classify_one
-	(vm, teid, flow, FT_REVERSE ^ flow->is_reverse, is_ip4, acl, active))
-      {
-	upf_pdr_t *pdr;
-	pdr = vec_elt_at_index (active->pdr, acl->pdr_idx);
+  acl = upf_acl_classify_lookup (teid, flow, FT_REVERSE ^ flow->is_reverse,
+				 active, is_ip4);
+  if (acl)
+    {
+      upf_pdr_t *pdr;
+      pdr = vec_elt_at_index (active->pdr, acl->pdr_idx);
 
-	if (pdr_idx)
-	  *pdr_idx = acl->pdr_idx;
-	next = UPF_CLASSIFY_NEXT_FORWARD;
+      if (pdr_idx)
+	*pdr_idx = acl->pdr_idx;
+      next = UPF_CLASSIFY_NEXT_FORWARD;
 
-	if (flow_pdr_id (flow, FT_REVERSE) == ~0)
-	  {
+      if (flow_pdr_id (flow, FT_REVERSE) == ~0)
+	{
 
-	    /* load the best matching ACL into the flow */
-	    flow_pdr_id (flow, FT_REVERSE) = pdr->id;
-	  }
+	  /* load the best matching ACL into the flow */
+	  flow_pdr_id (flow, FT_REVERSE) = pdr->id;
+	}
 
-	if (pdr->pdi.fields & F_PDI_APPLICATION_ID)
-	  flow->application_id = pdr->pdi.adr.application_id;
+      if (pdr->pdi.fields & F_PDI_APPLICATION_ID)
+	flow->application_id = pdr->pdi.adr.application_id;
 
-	clib_warning ("match PDR: %u, Proxy: %d, Redirect: %d\n",
-		   acl->pdr_idx, flow->is_l3_proxy, flow->is_redirect);
-	break;
-      }
-  }
+      upf_debug ("match PDR: %u, Proxy: %d, Redirect: %d\n",
+		 acl->pdr_idx, flow->is_l3_proxy, flow->is_redirect);
+    }
 
   return next;
 }
@@ -373,49 +266,42 @@ upf_acl_classify_return (vlib_main_t * vm, u32 teid, flow_entry_t * flow,
 			 struct rules *active, u8 is_ip4, u32 * pdr_idx)
 {
   u32 next = UPF_CLASSIFY_NEXT_DROP;
-  upf_acl_t *acl, *acl_vec;
+  upf_acl_t *acl;
 
   if (teid)
     flow_teid (flow, FT_REVERSE) = teid;
   else
     teid = flow_teid (flow, FT_REVERSE);
 
-  acl_vec = is_ip4 ? active->v4_acls : active->v6_acls;
-  clib_warning ("TEID %08x, ACLs %p (%u)\n", teid, acl_vec, vec_len (acl_vec));
-
-  /* find ACL with the highest precedence that matches this flow */
-  vec_foreach (acl, acl_vec)
-  {
-    if (upf_acl_classify_one
-	(vm, teid, flow, FT_REVERSE ^ flow->is_reverse, is_ip4, acl, active))
-      {
-	upf_pdr_t *pdr;
-
-	pdr = vec_elt_at_index (active->pdr, acl->pdr_idx);
-
-	if (pdr_idx)
-	  *pdr_idx = acl->pdr_idx;
-	flow_pdr_id (flow, FT_REVERSE) = pdr->id;
-
-	if (flow->is_l3_proxy)
-	  {
-	    flow_next (flow, FT_REVERSE) = FT_NEXT_PROXY;
-	    next = UPF_CLASSIFY_NEXT_PROXY;
-	  }
-	else
-	  {
-	    flow_next (flow, FT_REVERSE) = FT_NEXT_PROCESS;
-	    next = UPF_CLASSIFY_NEXT_PROCESS;
-	  }
-
-	if (pdr->pdi.fields & F_PDI_APPLICATION_ID)
-	  flow->application_id = pdr->pdi.adr.application_id;
-
-	clib_warning ("match PDR: %u, Proxy: %d, Redirect: %d\n",
-		   acl->pdr_idx, flow->is_l3_proxy, flow->is_redirect);
-	break;
-      }
-  }
+  acl = upf_acl_classify_lookup (teid, flow, FT_REVERSE ^ flow->is_reverse,
+				 active, is_ip4);
+  if (acl)
+    {
+      upf_pdr_t *pdr;
+
+      pdr = vec_elt_at_index (active->pdr, acl->pdr_idx);
+
+      if (pdr_idx)
+	*pdr_idx = acl->pdr_idx;
+      flow_pdr_id (flow, FT_REVERSE) = pdr->id;
+
+      if (flow->is_l3_proxy)
+	{
+	  flow_next (flow, FT_REVERSE) = FT_NEXT_PROXY;
+	  next = UPF_CLASSIFY_NEXT_PROXY;
+	}
+      else
+	{
+	  flow_next (flow, FT_REVERSE) = FT_NEXT_PROCESS;
+	  next = UPF_CLASSIFY_NEXT_PROCESS;
+	}
+
+      if (pdr->pdi.fields & F_PDI_APPLICATION_ID)
+	flow->application_id = pdr->pdi.adr.application_id;
+
+      upf_debug ("match PDR: %u, Proxy: %d, Redirect: %d\n",
+		 acl->pdr_idx, flow->is_l3_proxy, flow->is_redirect);
+    }
 
   return next;
 }
@@ -430,7 +316,7 @@ upf_classify_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
   vnet_interface_main_t *im = &vnm->interface_main;
   flowtable_main_t *fm = &flowtable_main;
 
-  clib_warning("[FATEMEH] Got packet: %d", 10000005);
+  upf_debug ("[FATEMEH] Got packet: %d", 10000005);
 
   from = vlib_frame_vector_args (from_frame);
   n_left_from = from_frame->n_vectors;
@@ -480,7 +366,7 @@ upf_classify_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
 
 	  next = UPF_CLASSIFY_NEXT_PROCESS;
 
-	  clib_warning ("flow: %p (%u): %U\n",
+	  upf_debug ("flow: %p (%u): %U\n",
 		     fm->flows + upf_buffer_opaque (b)->gtpu.flow_id,
 		     upf_buffer_opaque (b)->gtpu.flow_id,
 		     format_flow_key,
@@ -498,7 +384,7 @@ upf_classify_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
 	   * app detection just once
 	   */
 	  reclassify_proxy_flow = flow->is_l3_proxy;
-	  clib_warning ("is_rev %u, dir %s\n", is_reverse,
+	  upf_debug ("is_rev %u, dir %s\n", is_reverse,
 		     direction == FT_ORIGIN ? "FT_ORIGIN" : "FT_REVERSE");
 
 	  if (flow_next (flow, direction) != FT_NEXT_CLASSIFY)
@@ -554,15 +440,49 @@ upf_classify_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
 	  if (flow->app_detection_done)
 	    {
 	      /* try to reclassify the app based on the saved URI, if any */
-	      clib_warning ("re-run app detection (reverse)");
-	      ar = upf_application_detection (vm, 0, flow, active);
+	      upf_debug ("re-run app detection (reverse)");
+	      ar = upf_application_detection (vm, 0, 0, flow, active);
 	      ASSERT (ar == ADR_OK);
 	      upf_buffer_opaque (b)->gtpu.pdr_idx =
 		flow_pdr_idx (flow, direction, active);
 	    }
+	  else if (direction == FT_ORIGIN &&
+		   flow->key.proto == IP_PROTOCOL_UDP &&
+		   flow_next (flow, FT_ORIGIN) != FT_NEXT_DROP &&
+		   active->adr_db.set != NULL)
+	    {
+	      /* look for the SNI in QUIC Initial packets, UDP flows are
+	       * not proxied, so the datagrams are inspected in place */
+	      u8 *ip = vlib_buffer_get_current (b) +
+		upf_buffer_opaque (b)->gtpu.data_offset;
+	      word hdr_len = is_ip4 ? ip4_header_bytes ((ip4_header_t *) ip) :
+		sizeof (ip6_header_t);
+	      udp_header_t *udp = (udp_header_t *) (ip + hdr_len);
+	      word plen = (word) b->current_length -
+		upf_buffer_opaque (b)->gtpu.data_offset - hdr_len;
+
+	      /* the UDP header must be in the buffer before its length is read */
+	      if (plen >= (word) sizeof (*udp))
+		plen = clib_min (plen,
+				 (word) clib_net_to_host_u16 (udp->length)) -
+		  (word) sizeof (*udp);
+	      else
+		plen = 0;
 
+	      if (plen > 0)
+		{
+		  ar = upf_application_detection (vm, (u8 *) (udp + 1), plen,
+						  flow, active);
+		  if (ar == ADR_NEED_MORE_DATA)
+		    /* the rest of the ClientHello is in the next Initial */
+		    flow_next (flow, FT_ORIGIN) = FT_NEXT_CLASSIFY;
+		  else if (ar == ADR_OK)
+		    upf_buffer_opaque (b)->gtpu.pdr_idx =
+		      flow_pdr_idx (flow, direction, active);
+		}
+	    }
 
-	  clib_warning ("Next: %u", next);
+	  upf_debug ("Next: %u", next);
 	  ASSERT (flow_next (flow, FT_ORIGIN) != FT_NEXT_PROXY
 		  || flow_pdr_id (flow, FT_ORIGIN) != ~0);
 	  ASSERT (flow_next (flow, FT_REVERSE) != FT_NEXT_PROXY
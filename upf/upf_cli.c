@@ -1103,6 +1103,7 @@ upf_show_session_command_fn (vlib_main_t * vm,
 	  goto done;
 	}
 
+      upf_urr_acc_merge (sess, pfcp_get_rules (sess, PFCP_ACTIVE)->urr);
       vlib_cli_output (vm, "%U", format_pfcp_session, sess, PFCP_ACTIVE,
 		       debug);
     }
@@ -1110,6 +1111,7 @@ upf_show_session_command_fn (vlib_main_t * vm,
     {
       pool_foreach (sess, gtm->sessions)
       {
+	upf_urr_acc_merge (sess, pfcp_get_rules (sess, PFCP_ACTIVE)->urr);
 	vlib_cli_output (vm, "%U", format_pfcp_session, sess, PFCP_ACTIVE,
 			 debug);
       }
@@ -1477,6 +1479,188 @@ VLIB_CLI_COMMAND (upf_show_proxy_session_command, static) =
 };
 /* *INDENT-ON* */
 
+static clib_error_t *
+upf_qer_set_command_fn (vlib_main_t * vm,
+			unformat_input_t * main_input,
+			vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  upf_main_t *gtm = &upf_main;
+  clib_error_t *error = NULL;
+  u32 dscp = gtm->qer_yellow_dscp;
+
+  if (!unformat_user (main_input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "yellow-dscp %u", &dscp))
+	{
+	  if (dscp > 63)
+	    {
+	      error = clib_error_return (0, "invalid DSCP %u", dscp);
+	      goto done;
+	    }
+	}
+      else if (unformat (line_input, "yellow-dscp disable"))
+	dscp = ~0;
+      else
+	{
+	  error = unformat_parse_error (line_input);
+	  goto done;
+	}
+    }
+
+  gtm->qer_yellow_dscp = dscp;
+
+done:
+  unformat_free (line_input);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (upf_qer_set_command, static) =
+{
+  .path = "set upf qer",
+  .short_help = "set upf qer [yellow-dscp <0-63>|disable]",
+  .function = upf_qer_set_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+upf_show_qer_command_fn (vlib_main_t * vm,
+			 unformat_input_t * main_input,
+			 vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  upf_main_t *gtm = &upf_main;
+  clib_error_t *error = NULL;
+  upf_qer_policer_t *pol;
+  u8 verbose = 0;
+
+  if (unformat_user (main_input, unformat_line_input, line_input))
+    {
+      while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+	{
+	  if (unformat (line_input, "verbose"))
+	    verbose = 1;
+	  else
+	    {
+	      error = unformat_parse_error (line_input);
+	      unformat_free (line_input);
+	      goto done;
+	    }
+	}
+
+      unformat_free (line_input);
+    }
+
+  if (gtm->qer_yellow_dscp != ~0)
+    vlib_cli_output (vm, "Yellow DSCP: %u", gtm->qer_yellow_dscp);
+  else
+    vlib_cli_output (vm, "Yellow DSCP: disabled");
+
+  pool_foreach (pol, gtm->qer_policers)
+  {
+    vlib_cli_output (vm, "MBR: UL %llu kbps, DL %llu kbps, "
+		     "GBR: UL %llu kbps, DL %llu kbps\n  Policer: %U",
+		     pol->mbr.ul, pol->mbr.dl, pol->gbr.ul, pol->gbr.dl,
+		     format_upf_qer_policer, pol - gtm->qer_policers,
+		     verbose);
+  }
+
+done:
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (upf_show_qer_command, static) =
+{
+  .path = "show upf qer",
+  .short_help = "show upf qer [verbose]",
+  .function = upf_show_qer_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+upf_buffer_set_command_fn (vlib_main_t * vm,
+			   unformat_input_t * main_input,
+			   vlib_cli_command_t * cmd)
+{
+  unformat_input_t _line_input, *line_input = &_line_input;
+  upf_main_t *gtm = &upf_main;
+  clib_error_t *error = NULL;
+  u32 max = gtm->dl_buffer_max;
+  u32 session_max = gtm->dl_buffer_session_max;
+
+  if (!unformat_user (main_input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "max %u", &max))
+	;
+      else if (unformat (line_input, "session-max %u", &session_max))
+	;
+      else
+	{
+	  error = unformat_parse_error (line_input);
+	  goto done;
+	}
+    }
+
+  /* lowered limits only apply to packets buffered from now on */
+  gtm->dl_buffer_max = max;
+  gtm->dl_buffer_session_max = session_max;
+
+done:
+  unformat_free (line_input);
+  return error;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (upf_buffer_set_command, static) =
+{
+  .path = "set upf buffer",
+  .short_help = "set upf buffer [max <packets>] [session-max <packets>]",
+  .function = upf_buffer_set_command_fn,
+};
+/* *INDENT-ON* */
+
+static clib_error_t *
+upf_show_buffer_command_fn (vlib_main_t * vm,
+			    unformat_input_t * main_input,
+			    vlib_cli_command_t * cmd)
+{
+  upf_main_t *gtm = &upf_main;
+  vlib_simple_counter_main_t *cm = gtm->upf_simple_counters;
+
+  vlib_cli_output (vm, "Buffered DL packets: %u (max %u, per session %u)",
+		   gtm->dl_buffered, gtm->dl_buffer_max,
+		   gtm->dl_buffer_session_max);
+  vlib_cli_output (vm, "Flushed: %llu, Discarded: %llu",
+		   vlib_get_simple_counter (&cm[UPF_DL_BUFFER_FLUSHED], 0),
+		   vlib_get_simple_counter (&cm[UPF_DL_BUFFER_DISCARDED], 0));
+  vlib_cli_output (vm, "Dropped: %llu at session limit, %llu at global limit",
+		   vlib_get_simple_counter (&cm[UPF_DL_BUFFER_SESSION_LIMIT],
+					    0),
+		   vlib_get_simple_counter (&cm[UPF_DL_BUFFER_GLOBAL_LIMIT],
+					    0));
+  vlib_cli_output (vm, "DL Data Reports: %llu",
+		   vlib_get_simple_counter (&cm[UPF_DL_DATA_REPORTS], 0));
+
+  return NULL;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (upf_show_buffer_command, static) =
+{
+  .path = "show upf buffer",
+  .short_help = "show upf buffer",
+  .function = upf_show_buffer_command_fn,
+};
+/* *INDENT-ON* */
+
 /*
  * fd.io coding-style-patch-verification: ON
  *
@@ -80,7 +80,7 @@ format_get_flowinfo (u8 * s, va_list * args)
 always_inline u32
 load_gtpu_flow_info (flowtable_main_t * fm, vlib_buffer_t * b,
 		     flow_entry_t * flow, struct rules *r, uword is_reverse,
-		     u16 generation)
+		     upf_session_t * sx)
 {
   flow_direction_t direction =
     flow->is_reverse == is_reverse ? FT_ORIGIN : FT_REVERSE;
@@ -88,12 +88,19 @@ load_gtpu_flow_info (flowtable_main_t * fm, vlib_buffer_t * b,
   upf_buffer_opaque (b)->gtpu.is_reverse = is_reverse;
   upf_buffer_opaque (b)->gtpu.flow_id = flow - fm->flows;
 
-  if (flow->generation != generation)
+  if (flow->generation != sx->generation &&
+      !upf_flow_needs_reclassify (sx, flow, r))
+    {
+      /* the rule update did not touch the PDRs this flow depends on */
+      flow->generation = sx->generation;
+    }
+
+  if (flow->generation != sx->generation)
     {
       flow_debug ("Flow has an old generation ID: %U", format_flow_key,
 		  &flow->key);
       flow->application_id = ~0;
-      flow->generation = generation;
+      flow->generation = sx->generation;
       flow_pdr_id (flow, FT_ORIGIN) = ~0;
       flow_pdr_id (flow, FT_REVERSE) = ~0;
       flow_next (flow, FT_ORIGIN) = FT_NEXT_CLASSIFY;
@@ -246,7 +253,7 @@ upf_flow_process (vlib_main_t * vm, vlib_node_runtime_t * node,
 					   &created0);
 	  flow_idx1 =
 	    flowtable_entry_lookup_create (fm, fmt, &kv1, current_time,
-					   is_reverse1, sx0->generation,
+					   is_reverse1, sx1->generation,
 					   &created1);
 
 	  if (PREDICT_FALSE (~0 == flow_idx0 || ~0 == flow_idx1))
@@ -286,11 +293,9 @@ upf_flow_process (vlib_main_t * vm, vlib_node_runtime_t * node,
 
 	  /* fill buffer with flow data */
 	  next0 =
-	    load_gtpu_flow_info (fm, b0, flow0, active0, is_reverse0,
-				 sx0->generation);
+	    load_gtpu_flow_info (fm, b0, flow0, active0, is_reverse0, sx0);
 	  next1 =
-	    load_gtpu_flow_info (fm, b1, flow1, active1, is_reverse1,
-				 sx1->generation);
+	    load_gtpu_flow_info (fm, b1, flow1, active1, is_reverse1, sx1);
 
 	  /* flowtable counters */
 	  CPT_THRU += 2;
@@ -466,8 +471,7 @@ upf_flow_process (vlib_main_t * vm, vlib_node_runtime_t * node,
 
 	  /* fill opaque buffer with flow data */
 	  next0 =
-	    load_gtpu_flow_info (fm, b0, flow, active0, is_reverse,
-				 sx0->generation);
+	    load_gtpu_flow_info (fm, b0, flow, active0, is_reverse, sx0);
 	  flow_debug ("flow next: %u, origin: %u, reverse: %u", next0,
 		      flow_next (flow, FT_ORIGIN), flow_next (flow,
 							      FT_REVERSE));
@@ -103,11 +103,18 @@ upf_forward (vlib_main_t * vm, vlib_node_runtime_t * node,
   u32 thread_index = vlib_get_thread_index ();
   u32 stats_sw_if_index, stats_n_packets, stats_n_bytes;
   u32 sw_if_index = 0;
+  u64 time_in_policer_periods;
   u32 next = 0;
   upf_session_t *sess = NULL;
   u32 sidx = 0;
   u32 len;
   struct rules *active;
+  upf_urr_batch_t urr_batch;
+
+  /* policer buckets are refilled once per frame */
+  time_in_policer_periods =
+    clib_cpu_time_now () >> POLICER_TICKS_PER_PERIOD_SHIFT;
+  upf_urr_batch_init (&urr_batch);
 
   next_index = node->cached_next_index;
   stats_sw_if_index = node->runtime_data[0];
@@ -155,19 +162,19 @@ upf_forward (vlib_main_t * vm, vlib_node_runtime_t * node,
 
 	  if (is_ip4)
 	    {
-	      clib_warning ("IP hdr: %U", format_ip4_header,
+	      upf_debug ("IP hdr: %U", format_ip4_header,
 			 vlib_buffer_get_current (b), b->current_length);
 	    }
 	  else
 	    {
-	      clib_warning ("IP hdr: %U", format_ip6_header,
+	      upf_debug ("IP hdr: %U", format_ip6_header,
 			 vlib_buffer_get_current (b), b->current_length);
 	    }
 
 	  if (PREDICT_FALSE (!pdr) || PREDICT_FALSE (!far))
 	    goto stats;
 
-	  clib_warning ("PDR: %u, FAR: %u", pdr->id, far->id);
+	  upf_debug ("PDR: %u, FAR: %u", pdr->id, far->id);
 
 	  if (PREDICT_TRUE (far->apply_action & FAR_FORWARD))
 	    {
@@ -224,8 +231,9 @@ upf_forward (vlib_main_t * vm, vlib_node_runtime_t * node,
 	    }
 	  else if (far->apply_action & FAR_BUFFER)
 	    {
-	      next = UPF_FORWARD_NEXT_DROP;
-	      // error = UPF_FORWARD_ERROR_NOT_YET;
+	      /* usage and QoS apply when the packet leaves the buffer */
+	      next = UPF_FORWARD_NEXT_BUFFER;
+	      goto trace;
 	    }
 	  else
 	    {
@@ -237,11 +245,12 @@ upf_forward (vlib_main_t * vm, vlib_node_runtime_t * node,
 #define IS_UL(_pdr, _far)						\
 	  ((_pdr)->pdi.src_intf == SRC_INTF_ACCESS || (_far)->forward.dst_intf == DST_INTF_CORE)
 
-	  clib_warning ("pdr: %d, far: %d\n", pdr->id, far->id);
 	  next = process_qers (vm, sess, active, pdr, b,
-			       IS_DL (pdr, far), IS_UL (pdr, far), next);
-	  next = process_urrs (vm, sess, node_name, active, pdr, b,
-			       IS_DL (pdr, far), IS_UL (pdr, far), next);
+			       IS_DL (pdr, far), IS_UL (pdr, far),
+			       time_in_policer_periods, next);
+	  next = upf_urr_batch_add (vm, &urr_batch, sess, node_name, active,
+				    pdr, b, IS_DL (pdr, far), IS_UL (pdr, far),
+				    next);
 
 #undef IS_DL
 #undef IS_UL
@@ -291,6 +300,8 @@ upf_forward (vlib_main_t * vm, vlib_node_runtime_t * node,
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
     }
 
+  upf_urr_batch_flush (vm, &urr_batch);
+
   return from_frame->n_vectors;
 }
 
@@ -323,7 +334,8 @@ VLIB_REGISTER_NODE (upf_ip4_forward_node) = {
     [UPF_FORWARD_NEXT_DROP]          = "error-drop",
     [UPF_FORWARD_NEXT_GTP_IP4_ENCAP] = "upf4-encap",
     [UPF_FORWARD_NEXT_GTP_IP6_ENCAP] = "upf6-encap",
-    [UPF_FORWARD_NEXT_IP_INPUT]      = "ip4-input"
+    [UPF_FORWARD_NEXT_IP_INPUT]      = "ip4-input",
+    [UPF_FORWARD_NEXT_BUFFER]        = "upf-dl-buffer",
   },
 };
 /* *INDENT-ON* */
@@ -341,7 +353,8 @@ VLIB_REGISTER_NODE (upf_ip6_forward_node) = {
     [UPF_FORWARD_NEXT_DROP]          = "error-drop",
     [UPF_FORWARD_NEXT_GTP_IP4_ENCAP] = "upf4-encap",
     [UPF_FORWARD_NEXT_GTP_IP6_ENCAP] = "upf6-encap",
-    [UPF_FORWARD_NEXT_IP_INPUT]      = "ip6-input"
+    [UPF_FORWARD_NEXT_IP_INPUT]      = "ip6-input",
+    [UPF_FORWARD_NEXT_BUFFER]        = "upf-dl-buffer",
   },
 };
 /* *INDENT-ON* */
@@ -42,6 +42,7 @@
 #include "pfcp.h"
 #include "upf.h"
 #include "upf_app_db.h"
+#include "upf_acl_index.h"
 #include "upf_pfcp.h"
 #include "upf_pfcp_api.h"
 #include "upf_pfcp_server.h"
@@ -536,6 +537,7 @@ pfcp_create_session (upf_node_assoc_t * assoc,
   sx->unix_time_start = psm->now;
 
   clib_spinlock_init (&sx->lock);
+  upf_urr_acc_reset (sx, 0);
 
   //TODO sx->up_f_seid = sx - gtm->sessions;
   node_assoc_attach_session (assoc, sx);
@@ -728,6 +730,8 @@ pfcp_free_pdr (upf_pdr_t * pdr)
   vec_free (pdr->pdi.acl);
   vec_free (pdr->urr_ids);
   vec_free (pdr->qer_ids);
+  vec_free (pdr->urr_indices);
+  vec_free (pdr->qer_indices);
 }
 
 int
@@ -751,6 +755,9 @@ pfcp_make_pending_pdr (upf_session_t * sx)
 	pdr->pdi.acl = vec_dup (vec_elt (active->pdr, i).pdi.acl);
 	pdr->urr_ids = vec_dup (vec_elt (active->pdr, i).urr_ids);
 	pdr->qer_ids = vec_dup (vec_elt (active->pdr, i).qer_ids);
+	/* resolved again when the pending rules are applied */
+	pdr->urr_indices = NULL;
+	pdr->qer_indices = NULL;
       }
     }
 
@@ -805,15 +812,8 @@ pfcp_make_pending_far (upf_session_t * sx)
 static inline void
 pfcp_free_urr (upf_urr_t * urr)
 {
-  upf_urr_traffic_t *tt;
-
-  pool_foreach (tt, urr->traffic)
-  {
-    hash_unset_mem_free (&urr->traffic_by_ue, &tt->ip);
-  }
-
-  pool_free (urr->traffic);
-  hash_free (urr->traffic_by_ue);
+  if (urr->traffic)
+    clib_mem_free (urr->traffic);
   vec_free (urr->linked_urr_ids);
   clib_bitmap_free (urr->liusa_bitmap);
 }
@@ -837,7 +837,6 @@ pfcp_make_pending_urr (upf_session_t * sx)
       {
 	urr->update_flags = 0;
 	urr->traffic = NULL;
-	urr->traffic_by_ue = NULL;
 	urr->linked_urr_ids = vec_dup (urr->linked_urr_ids);
 	urr->liusa_bitmap = NULL;
 	memset (&urr->volume.measure, 0, sizeof (urr->volume.measure));
@@ -849,52 +848,209 @@ pfcp_make_pending_urr (upf_session_t * sx)
   return 0;
 }
 
-static upf_qer_policer_t *
-init_qer_policer (upf_qer_t * qer)
+/* committed and excess burst, in milliseconds of the rate */
+#define UPF_QER_BURST_MS 100
+
+/* smallest burst of a shard, one packet has to fit */
+#define UPF_QER_MIN_BURST 3000
+
+/*
+ * Compute the physical policer of one direction at the full QER rates.
+ * With a GBR below the MBR it is a two rate three color policer, traffic
+ * up to the GBR is green, up to the MBR yellow and above red, otherwise a
+ * single rate policer at the MBR. Rates are in kbps.
+ */
+static int
+upf_qer_policer_rate (upf_qer_policer_t * pol, int dir, u32 cir_kbps,
+		      u32 pir_kbps)
 {
   sse2_qos_pol_cfg_params_st cfg = {
     .rate_type = SSE2_QOS_RATE_KBPS,
     .rnd_type = SSE2_QOS_ROUND_TO_CLOSEST,
-    .rfc = SSE2_QOS_POLICER_TYPE_1R2C,
     .color_aware = 0,
     .conform_action = {.action_type = SSE2_QOS_ACTION_TRANSMIT,},
-    .exceed_action = {.action_type = SSE2_QOS_ACTION_DROP,},
+    .exceed_action = {.action_type = SSE2_QOS_ACTION_TRANSMIT,},
     .violate_action = {.action_type = SSE2_QOS_ACTION_DROP,},
   };
+
+  cir_kbps = clib_max (cir_kbps, 1);
+  cfg.rb.kbps.cir_kbps = cir_kbps;
+  cfg.rb.kbps.cb_bytes = (u64) cir_kbps * UPF_QER_BURST_MS / 8;
+  if (pol->single_rate[dir])
+    {
+      cfg.rfc = SSE2_QOS_POLICER_TYPE_1R2C;
+      cfg.exceed_action.action_type = SSE2_QOS_ACTION_DROP;
+    }
+  else
+    {
+      pir_kbps = clib_max (pir_kbps, cir_kbps);
+      cfg.rfc = SSE2_QOS_POLICER_TYPE_2R3C_RFC_2698;
+      cfg.rb.kbps.eir_kbps = pir_kbps;
+      cfg.rb.kbps.eb_bytes = (u64) pir_kbps * UPF_QER_BURST_MS / 8;
+    }
+
+  if (sse2_pol_logical_2_physical (&cfg, &pol->rate[dir]) != 0)
+    {
+      clib_warning ("QER policer: invalid rate %u/%u kbps", cir_kbps,
+		    pir_kbps);
+      return -1;
+    }
+
+  pol->cir_kbps[dir] = cir_kbps;
+  return 0;
+}
+
+always_inline u32
+upf_qer_share_tokens (u32 tokens, f64 share)
+{
+  return tokens ? clib_max ((u32) (tokens * share), 1) : 0;
+}
+
+always_inline u32
+upf_qer_share_limit (u32 limit, u32 scale, f64 share)
+{
+  u64 min = clib_min ((u64) UPF_QER_MIN_BURST << scale, limit);
+
+  return clib_max ((u64) (limit * share), min);
+}
+
+/*
+ * Give one direction of a shard a share of the policer rates. The scale
+ * never changes, every field is consistent on its own, so the thread can
+ * keep using the policer while the rates and limits are replaced one by
+ * one. The buckets adapt on its next refill.
+ */
+static void
+upf_qer_shard_set_rate (upf_qer_policer_t * pol,
+			upf_qer_policer_shard_t * sh, int dir, f64 share)
+{
+  policer_read_response_type_st *r = &pol->rate[dir];
+  policer_read_response_type_st *p = &sh->policer[dir];
+
+  clib_atomic_store_relax_n (&p->cir_tokens_per_period,
+			     upf_qer_share_tokens (r->cir_tokens_per_period,
+						   share));
+  clib_atomic_store_relax_n (&p->pir_tokens_per_period,
+			     upf_qer_share_tokens (r->pir_tokens_per_period,
+						   share));
+  clib_atomic_store_relax_n (&p->current_limit,
+			     upf_qer_share_limit (r->current_limit, r->scale,
+						  share));
+  clib_atomic_store_relax_n (&p->extended_limit,
+			     upf_qer_share_limit (r->extended_limit,
+						  r->scale, share));
+
+  sh->cir_kbps[dir] = pol->cir_kbps[dir] * share;
+}
+
+/*
+ * (re)configure all shards of a policer with an equal share of the rates,
+ * must be called with the workers stopped
+ */
+static void
+upf_qer_policer_config (upf_qer_policer_t * pol, upf_qer_t * qer)
+{
+  u32 n_shards, dir;
+  u64 mbr[UPF_DIRECTION_MAX], gbr[UPF_DIRECTION_MAX];
+  upf_qer_policer_shard_t *sh;
+
+  pol->mbr = qer->mbr;
+  pol->gbr = (qer->flags & PFCP_QER_GBR) ? qer->gbr : (pfcp_gbr_t) { };
+
+  mbr[UPF_UL] = (qer->flags & PFCP_QER_MBR) ? qer->mbr.ul : 0;
+  mbr[UPF_DL] = (qer->flags & PFCP_QER_MBR) ? qer->mbr.dl : 0;
+  gbr[UPF_UL] = pol->gbr.ul;
+  gbr[UPF_DL] = pol->gbr.dl;
+
+  n_shards = vec_len (pol->shards);
+  for (dir = 0; dir < UPF_DIRECTION_MAX; dir++)
+    {
+      u64 cir;
+
+      /* an MBR of zero does not limit the direction */
+      pol->policed[dir] = mbr[dir] != 0;
+      pol->single_rate[dir] = gbr[dir] == 0 || gbr[dir] >= mbr[dir];
+      if (!pol->policed[dir])
+	continue;
+
+      cir = pol->single_rate[dir] ? mbr[dir] : gbr[dir];
+      if (upf_qer_policer_rate (pol, dir, clib_min (cir, ~0U),
+				clib_min (mbr[dir], ~0U)) != 0)
+	continue;
+
+      vec_foreach (sh, pol->shards)
+      {
+	policer_read_response_type_st *p = &sh->policer[dir];
+
+	*p = pol->rate[dir];
+	upf_qer_shard_set_rate (pol, sh, dir, 1.0 / n_shards);
+	p->current_bucket = p->current_limit;
+	p->extended_bucket = p->extended_limit;
+      }
+    }
+}
+
+static upf_qer_policer_t *
+init_qer_policer (upf_qer_t * qer)
+{
+  vlib_thread_main_t *tm = vlib_get_thread_main ();
   upf_main_t *gtm = &upf_main;
   upf_qer_policer_t *pol;
+  u32 i;
 
   pool_get_aligned_zero (gtm->qer_policers, pol, CLIB_CACHE_LINE_BYTES);
   qer->policer.value = pol - gtm->qer_policers;
 
-  cfg.rb.kbps.cir_kbps = qer->mbr.ul;
-  sse2_pol_logical_2_physical (&cfg, &pol->policer[UPF_UL]);
+  vec_validate_aligned (pol->shards, tm->n_vlib_mains - 1,
+			CLIB_CACHE_LINE_BYTES);
+  upf_qer_policer_config (pol, qer);
+
+  /* the workers are stopped, the bitmaps can grow */
+  vec_validate (gtm->qer_active, tm->n_vlib_mains - 1);
+  for (i = 0; i < tm->n_vlib_mains; i++)
+    vec_validate (gtm->qer_active[i], qer->policer.value / BITS (uword));
+  vec_validate (gtm->qer_rebalance, qer->policer.value / BITS (uword));
 
-  cfg.rb.kbps.cir_kbps = qer->mbr.dl;
-  sse2_pol_logical_2_physical (&cfg, &pol->policer[UPF_DL]);
+  for (i = 0; i < UPF_QER_N_COUNTERS; i++)
+    {
+      vlib_validate_combined_counter (&gtm->qer_counters[i],
+				      qer->policer.value);
+      vlib_zero_combined_counter (&gtm->qer_counters[i], qer->policer.value);
+    }
 
   clib_bihash_add_del_8_8 (&gtm->qer_by_id, &qer->policer, 1 /* is_add */ );
 
   return pol;
 }
 
+/* must be called with the workers stopped */
 static void
 attach_qer_policer (upf_qer_t * qer)
 {
   upf_main_t *gtm = &upf_main;
   upf_qer_policer_t *pol;
 
-  if (qer->policer.key == ~0 || !(qer->flags & PFCP_QER_MBR))
+  if (qer->policer.key == ~0)
     return;
 
   if (clib_bihash_search_inline_8_8 (&gtm->qer_by_id, &qer->policer))
     pol = init_qer_policer (qer);
   else
-    pol = pool_elt_at_index (gtm->qer_policers, qer->policer.value);
+    {
+      pfcp_gbr_t gbr = (qer->flags & PFCP_QER_GBR) ?
+	qer->gbr : (pfcp_gbr_t) { };
+      pfcp_mbr_t mbr = (qer->flags & PFCP_QER_MBR) ?
+	qer->mbr : (pfcp_mbr_t) { };
 
-  clib_atomic_fetch_add (&pol->ref_cnt, 1);
+      pol = pool_elt_at_index (gtm->qer_policers, qer->policer.value);
+
+      /* a modified QER, or a QER correlated with others, sets the rates */
+      if (memcmp (&pol->mbr, &mbr, sizeof (mbr)) ||
+	  memcmp (&pol->gbr, &gbr, sizeof (gbr)))
+	upf_qer_policer_config (pol, qer);
+    }
 
-  //sse2_pol_logical_2_physical(&qer->cfg, pol);
+  clib_atomic_fetch_add (&pol->ref_cnt, 1);
 }
 
 static void
@@ -911,10 +1067,127 @@ detach_qer_policer (upf_qer_t * qer)
     {
       clib_bihash_add_del_8_8 (&gtm->qer_by_id, &qer->policer,
 			       0 /* is_add */ );
+      vec_free (pol->shards);
       pool_put (gtm->qer_policers, pol);
     }
 }
 
+/*
+ * Share of the rates an idle thread keeps, so that new traffic on it is
+ * not dropped until the next run. The policer can exceed its rates by
+ * that much for one interval when traffic moves to an idle thread.
+ */
+#define UPF_QER_IDLE_SHARE (1.0 / 64)
+
+static void
+upf_qer_rebalance_policer (upf_qer_policer_t * pol)
+{
+  u32 n_shards = vec_len (pol->shards);
+  upf_qer_policer_shard_t *sh;
+  int dir;
+
+  for (dir = 0; dir < UPF_DIRECTION_MAX; dir++)
+    {
+      u64 total = 0, floor;
+      u32 n_active = 0;
+
+      if (!pol->policed[dir])
+	continue;
+
+      vec_foreach (sh, pol->shards)
+      {
+	u64 now = sh->offered[dir];
+
+	sh->offered_last[dir] = now - sh->offered_seen[dir];
+	sh->offered_seen[dir] = now;
+	total += sh->offered_last[dir];
+	n_active += sh->offered_last[dir] != 0;
+      }
+
+      if (total == 0)
+	continue;
+
+      /* keeps a thread with little traffic from starving, sums up to 1 */
+      floor = total * UPF_QER_IDLE_SHARE / n_shards;
+
+      vec_foreach (sh, pol->shards)
+      {
+	f64 share;
+	u32 cir;
+
+	if (sh->offered_last[dir] != 0)
+	  share = (f64) (sh->offered_last[dir] + floor) /
+	    (f64) (total + n_active * floor);
+	else
+	  share = UPF_QER_IDLE_SHARE / n_shards;
+
+	/* leave the policer alone unless the rate moves noticeably */
+	cir = pol->cir_kbps[dir] * share;
+	if (clib_abs ((i64) cir - (i64) sh->cir_kbps[dir]) <
+	    (i64) (sh->cir_kbps[dir] / 8))
+	  continue;
+
+	upf_qer_shard_set_rate (pol, sh, dir, share);
+      }
+    }
+}
+
+/*
+ * Move the policer rates towards the threads that see the traffic. Only
+ * the policers the threads flagged since the previous run are visited.
+ * The rates are split between the threads that saw traffic in proportion
+ * to the bytes offered to them, so a single thread can use all of it.
+ */
+static void
+upf_qer_rebalance (void)
+{
+  upf_main_t *gtm = &upf_main;
+  uword **active, policer_index;
+  u32 i;
+
+  if (vec_len (gtm->qer_active) < 2)
+    return;
+
+  vec_foreach (active, gtm->qer_active)
+    for (i = 0; i < vec_len (*active); i++)
+      if ((*active)[i])
+	gtm->qer_rebalance[i] |= clib_atomic_swap_acq_n (&(*active)[i], 0);
+
+  clib_bitmap_foreach (policer_index, gtm->qer_rebalance)
+  {
+    if (!pool_is_free_index (gtm->qer_policers, policer_index))
+      upf_qer_rebalance_policer (pool_elt_at_index (gtm->qer_policers,
+						    policer_index));
+  }
+
+  clib_bitmap_zero (gtm->qer_rebalance);
+}
+
+#define UPF_QER_REBALANCE_INTERVAL 0.1
+
+static uword
+upf_qer_rebalance_process (vlib_main_t * vm, vlib_node_runtime_t * rt,
+			   vlib_frame_t * f)
+{
+  while (1)
+    {
+      vlib_process_wait_for_event_or_clock (vm, UPF_QER_REBALANCE_INTERVAL);
+      vlib_process_get_events (vm, NULL);
+
+      upf_qer_rebalance ();
+    }
+
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_REGISTER_NODE (upf_qer_rebalance_process_node, static) = {
+    .function = upf_qer_rebalance_process,
+    .type = VLIB_NODE_TYPE_PROCESS,
+    .name = "upf-qer-rebalance",
+};
+/* *INDENT-ON* */
+
 static inline void
 pfcp_free_qer (upf_qer_t * qer)
 {
@@ -979,6 +1252,9 @@ pfcp_free_rules (upf_session_t * sx, int rule)
   vec_free (rules->v6_teid);
   vec_free (rules->v4_acls);
   vec_free (rules->v6_acls);
+  upf_acl_index_free (&rules->v4_index);
+  upf_acl_index_free (&rules->v6_index);
+  upf_adf_session_db_free (&rules->adr_db);
 
   memset (rules, 0, sizeof (*rules));
 }
@@ -1008,8 +1284,6 @@ pfcp_disable_session (upf_session_t * sx)
 
   node_assoc_detach_session (sx);
 
-  //TODO: free DL fifo...
-
   //gtm->session_index_by_sw_if_index[sx->sw_if_index] = ~0;
 
   /* stop all timers */
@@ -1020,6 +1294,7 @@ pfcp_disable_session (upf_session_t * sx)
     upf_pfcp_session_stop_urr_time (&urr->time_quota, now);
     upf_pfcp_session_stop_urr_time (&urr->quota_validity_time, now);
     upf_pfcp_session_stop_urr_time (&urr->traffic_timer, now);
+    upf_pfcp_session_stop_urr_time (&urr->monitoring_timer, now);
   }
   upf_pfcp_session_stop_up_inactivity_timer (&active->inactivity_timer);
 
@@ -1051,6 +1326,8 @@ pfcp_free_session (upf_session_t * sx)
 
   vlib_worker_thread_barrier_sync (vm);
 
+  upf_dl_buffer_flush (sx, 1);
+
   for (size_t i = 0; i < ARRAY_LEN (sx->rules); i++)
     pfcp_free_rules (sx, i);
 
@@ -1060,6 +1337,7 @@ pfcp_free_session (upf_session_t * sx)
     upf_delete_nat_binding (sx);
 
   clib_spinlock_free (&sx->lock);
+  upf_urr_acc_reset (sx, 0);
   pool_put (gtm->sessions, sx);
 
   vlib_worker_thread_barrier_release (vm);
@@ -1174,6 +1452,13 @@ v6_teid_cmp (const void *a0, const void *b0)
 static int
 upf_acl_cmp (const void *a, const void *b)
 {
+  const upf_acl_t *acl_a = a;
+  const upf_acl_t *acl_b = b;
+
+  /* the classifier relies on this order, lowest precedence value first */
+  if (acl_a->precedence != acl_b->precedence)
+    return acl_a->precedence < acl_b->precedence ? -1 : 1;
+
   return memcmp (a, b, offsetof (upf_acl_t, pdr_idx));
 }
 
@@ -1746,129 +2031,450 @@ upf_ip_lookup_tx (u32 bi, int is_ip4)
   vlib_put_frame_to_node (vm, node_index, f);
 }
 
-int
-pfcp_update_apply (upf_session_t * sx)
+/* whether two versions of a PDR classify every flow the same way */
+static int
+pfcp_pdr_classify_equal (struct rules *ra, upf_pdr_t * a,
+			 struct rules *rb, upf_pdr_t * b)
 {
-  struct rules *pending = pfcp_get_rules (sx, PFCP_PENDING);
-  struct rules *active = pfcp_get_rules (sx, PFCP_ACTIVE);
-  int pending_pdr, pending_far, pending_urr, pending_qer;
-  pfcp_server_main_t *psm = &pfcp_server_main;
-  vlib_main_t *vm = vlib_get_main ();
-  upf_main_t *gtm = &upf_main;
-  u32 si = sx - gtm->sessions;
-  f64 now = psm->now;
-  upf_urr_t *urr;
+  upf_far_t *far_a, *far_b;
 
-  if (!pending->pdr && !pending->far && !pending->urr && !pending->qer)
+  if (a->precedence != b->precedence || a->far_id != b->far_id ||
+      a->pdi.fields != b->pdi.fields || a->pdi.src_intf != b->pdi.src_intf
+      || a->pdi.nwi_index != b->pdi.nwi_index)
     return 0;
 
-  pending_pdr = !!pending->pdr;
-  pending_far = !!pending->far;
-  pending_urr = !!pending->urr;
-  pending_qer = !!pending->qer;
-
-  vlib_worker_thread_barrier_sync (vm);
-
-  if (pending_pdr)
-    {
-      if (build_pfcp_rules (sx) != 0)
-	{
-	  vlib_worker_thread_barrier_release (vm);
-	  return -1;
-	}
-    }
-  else
-    {
-      pending->pdr = active->pdr;
+  if ((a->pdi.fields & F_PDI_LOCAL_F_TEID) &&
+      memcmp (&a->pdi.teid, &b->pdi.teid, sizeof (a->pdi.teid)) != 0)
+    return 0;
 
-      pending->proxy_precedence = active->proxy_precedence;
-      pending->proxy_pdr_idx = active->proxy_pdr_idx;
+  if ((a->pdi.fields & F_PDI_UE_IP_ADDR) &&
+      memcmp (&a->pdi.ue_addr, &b->pdi.ue_addr, sizeof (a->pdi.ue_addr)) != 0)
+    return 0;
 
-      pending->ue_src_ip = active->ue_src_ip;
-      active->ue_src_ip = NULL;
+  if ((a->pdi.fields & F_PDI_SDF_FILTER) &&
+      (vec_len (a->pdi.acl) != vec_len (b->pdi.acl) ||
+       memcmp (a->pdi.acl, b->pdi.acl,
+	       vec_len (a->pdi.acl) * sizeof (a->pdi.acl[0])) != 0))
+    return 0;
 
-      pending->ue_dst_ip = active->ue_dst_ip;
-      active->ue_dst_ip = NULL;
+  if ((a->pdi.fields & F_PDI_APPLICATION_ID) &&
+      (a->pdi.adr.application_id != b->pdi.adr.application_id ||
+       a->pdi.adr.db_id != b->pdi.adr.db_id))
+    return 0;
 
-      pending->v4_teid = active->v4_teid;
-      active->v4_teid = NULL;
-      pending->v6_teid = active->v6_teid;
-      active->v6_teid = NULL;
+  /* classification turns redirecting FARs into proxied flows */
+  far_a = pfcp_get_far_by_id (ra, a->far_id);
+  far_b = pfcp_get_far_by_id (rb, b->far_id);
+  if (!far_a != !far_b)
+    return 0;
+  if (far_a && ((far_a->forward.flags ^ far_b->forward.flags) &
+		FAR_F_REDIRECT_INFORMATION))
+    return 0;
 
-      pending->v4_acls = active->v4_acls;
-      active->v4_acls = NULL;
-      pending->v6_acls = active->v6_acls;
-      active->v6_acls = NULL;
+  return 1;
+}
 
-      pending->flags = active->flags;
-    }
+/*
+ * Lowest precedence among the PDRs that were added, removed or modified
+ * by this update, ~0 if none. Changes to PDRs with application detection
+ * or to the proxy decision affect flows regardless of precedence, they
+ * yield 0 which forces all flows to be classified again.
+ */
+static u32
+pfcp_reclassify_precedence (struct rules *old, struct rules *new)
+{
+  upf_pdr_t *a = old->pdr, *b = new->pdr;
+  u32 old_proxy, new_proxy;
+  u32 threshold = ~0;
+  u32 i = 0, j = 0;
+
+  old_proxy = (old->proxy_pdr_idx < vec_len (a)) ?
+    a[old->proxy_pdr_idx].id : ~0;
+  new_proxy = (new->proxy_pdr_idx < vec_len (b)) ?
+    b[new->proxy_pdr_idx].id : ~0;
+  if (old_proxy != new_proxy ||
+      (old_proxy != ~0 && old->proxy_precedence != new->proxy_precedence))
+    return 0;
 
-  if (pending_far)
+  while (i < vec_len (a) || j < vec_len (b))
     {
-      upf_far_t *far;
+      upf_pdr_t *changed[2] = { 0, 0 };
+      int k;
 
-      vec_foreach (far, pending->far)
-	if (far->forward.outer_header_creation.description != 0)
+      if (j >= vec_len (b) || (i < vec_len (a) && a[i].id < b[j].id))
+	changed[0] = &a[i++];
+      else if (i >= vec_len (a) || b[j].id < a[i].id)
+	changed[1] = &b[j++];
+      else
 	{
-	  far->forward.peer_idx = peer_addr_ref (&far->forward);
-
-	  if (far->forward.outer_header_creation.description
-	      & OUTER_HEADER_CREATION_GTP_IP4)
-	    {
-	      rules_add_v4_teid (pending,
-				 &far->forward.outer_header_creation.ip.ip4,
-				 far->forward.outer_header_creation.teid,
-				 far->id);
-	    }
-	  else if (far->forward.outer_header_creation.description
-		   & OUTER_HEADER_CREATION_GTP_IP6)
+	  if (!pfcp_pdr_classify_equal (old, &a[i], new, &b[j]))
 	    {
-	      rules_add_v6_teid (pending,
-				 &far->forward.outer_header_creation.ip.ip6,
-				 far->forward.outer_header_creation.teid,
-				 far->id);
+	      changed[0] = &a[i];
+	      changed[1] = &b[j];
 	    }
+	  i++;
+	  j++;
+	}
+
+      for (k = 0; k < 2; k++)
+	{
+	  if (!changed[k])
+	    continue;
+	  if (changed[k]->pdi.fields & F_PDI_APPLICATION_ID)
+	    return 0;
+	  threshold = clib_min (threshold, changed[k]->precedence);
 	}
     }
-  else
-    pending->far = active->far;
 
-  if (pending_urr)
-    build_urr_link_map (sx);
-  else
-    pending->urr = active->urr;
+  return threshold;
+}
 
-  if (pending_qer)
+/*
+ * Policing scope of a QER, QERs shared with other sessions through a
+ * correlation id (APN-AMBR) are the widest, then QERs applied to more
+ * PDRs (session AMBR) and finally higher rates.
+ */
+static u64
+pfcp_qer_scope (upf_qer_t * qer, u32 n_pdrs)
+{
+  u64 mbr = (qer->flags & PFCP_QER_MBR) ?
+    clib_max (qer->mbr.ul, qer->mbr.dl) : ~0ULL;
+
+  return ((u64) ! !(qer->flags & PFCP_QER_CORRELATED) << 63 |
+	  (u64) clib_min (n_pdrs, 0x7fffffff) << 32 |
+	  clib_min (mbr, 0xffffffff));
+}
+
+/*
+ * resolve the URR and QER ids of the PDRs into rule vector indices, the
+ * QERs of a PDR are ordered by scope so that the policers form a
+ * hierarchy with the QoS flow MBR at the bottom
+ */
+static void
+pfcp_resolve_pdr_rules (struct rules *r)
+{
+  u64 *scope = 0;
+  upf_pdr_t *pdr;
+  u32 i, j;
+
+  vec_foreach (pdr, r->pdr)
+  {
+    u16 *urr_id;
+    u32 *qer_id;
+
+    vec_reset_length (pdr->urr_indices);
+    vec_foreach (urr_id, pdr->urr_ids)
     {
-      upf_qer_t *qer;
+      upf_urr_t *urr = pfcp_get_urr_by_id (r, *urr_id);
 
-      vec_foreach (qer, pending->qer)
-      {
-	attach_qer_policer (qer);
-      }
+      if (urr)
+	vec_add1 (pdr->urr_indices, urr - r->urr);
     }
-  else
-    pending->qer = active->qer;
 
-  if (pending_pdr)
+    vec_reset_length (pdr->qer_indices);
+    vec_foreach (qer_id, pdr->qer_ids)
     {
-      sx->flags |= PFCP_UPDATING;
+      upf_qer_t *qer = pfcp_get_qer_by_id (r, *qer_id);
 
-      /* update UE addresses and TEIDs */
-      vec_diff (pending->ue_dst_ip, active->ue_dst_ip, ip46_address_fib_cmp,
-		pfcp_add_del_ue_ip, sx);
-      vec_diff (pending->v4_teid, active->v4_teid, v4_teid_cmp,
-		pfcp_add_del_v4_teid, sx);
-      vec_diff (pending->v6_teid, active->v6_teid, v6_teid_cmp,
-		pfcp_add_del_v6_teid, sx);
+      if (qer)
+	vec_add1 (pdr->qer_indices, qer - r->qer);
+    }
+  }
 
-      clib_warning ("v4 TEIDs %u\n", pending->v4_teid);
-      clib_warning ("v6 TEIDs %u\n", pending->v6_teid);
-      clib_warning ("UE Src IPs %u\n", pending->ue_src_ip);
-      clib_warning ("v4 ACLs %u\n", pending->v4_acls);
-      clib_warning ("v6 ACLs %u\n", pending->v6_acls);
+  if (vec_len (r->qer) < 2)
+    return;
 
-      vec_diff (pending->ue_src_ip, active->ue_src_ip, ip46_address_fib_cmp,
+  /* count the PDRs using each QER */
+  vec_validate (scope, vec_len (r->qer) - 1);
+  vec_foreach (pdr, r->pdr)
+  {
+    vec_foreach_index (i, pdr->qer_indices)
+      scope[pdr->qer_indices[i]]++;
+  }
+  vec_foreach_index (i, scope)
+    scope[i] = pfcp_qer_scope (vec_elt_at_index (r->qer, i), scope[i]);
+
+  /* only a handful of QERs per PDR, insertion sort */
+  vec_foreach (pdr, r->pdr)
+  {
+    for (i = 1; i < vec_len (pdr->qer_indices); i++)
+      {
+	u32 qi = pdr->qer_indices[i];
+
+	for (j = i; j > 0 && scope[pdr->qer_indices[j - 1]] > scope[qi]; j--)
+	  pdr->qer_indices[j] = pdr->qer_indices[j - 1];
+	pdr->qer_indices[j] = qi;
+      }
+  }
+
+  vec_free (scope);
+}
+
+static upf_urr_traffic_table_t *
+upf_urr_traffic_alloc (u32 n_slots)
+{
+  upf_urr_traffic_table_t *tt;
+  uword size = sizeof (*tt) + n_slots * sizeof (tt->slots[0]);
+
+  tt = clib_mem_alloc_aligned (size, CLIB_CACHE_LINE_BYTES);
+  clib_memset (tt, 0, size);
+  tt->mask = n_slots - 1;
+
+  return tt;
+}
+
+/*
+ * Rebuild the traffic table of a URR at a size that keeps it at most half
+ * full, dropping the deleted slots, and add an address that found no room
+ * in it.
+ */
+void
+upf_urr_traffic_rebuild (upf_urr_t * urr, ip46_address_t * unlisted)
+{
+  vlib_main_t *vm = vlib_get_main ();
+  upf_urr_traffic_table_t *old, *tt;
+  upf_urr_traffic_t *t, *n;
+  u32 n_slots;
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  old = urr->traffic;
+  if (!old)
+    goto out;
+
+  for (n_slots = old->mask + 1; 2 * (old->n_entries + 1) > n_slots;)
+    n_slots *= 2;
+  tt = upf_urr_traffic_alloc (n_slots);
+
+  for (t = old->slots; t <= old->slots + old->mask; t++)
+    if (t->state == UPF_URR_TRAFFIC_USED)
+      {
+	n = upf_urr_traffic_insert (tt, &t->ip, t->first_seen);
+	n->last_seen = t->last_seen;
+      }
+
+  if (unlisted && !upf_urr_traffic_find (tt, unlisted))
+    upf_urr_traffic_insert (tt, unlisted, vlib_time_now (vm));
+
+  urr->traffic = tt;
+  clib_mem_free (old);
+
+out:
+  vlib_worker_thread_barrier_release (vm);
+}
+
+/* initial traffic table size of a URR, from the UE addresses of its PDRs */
+static u32
+pfcp_urr_traffic_slots (struct rules *rules, upf_urr_t * urr)
+{
+  u32 n_addrs = 0;
+  upf_pdr_t *pdr;
+
+  vec_foreach (pdr, rules->pdr)
+  {
+    if (!(pdr->pdi.fields & F_PDI_UE_IP_ADDR) ||
+	vec_search (pdr->urr_indices, urr - rules->urr) == ~0)
+      continue;
+
+    if (pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_V4)
+      n_addrs++;
+    /* temporary addresses of the prefix come and go */
+    if (pdr->pdi.ue_addr.flags & IE_UE_IP_ADDRESS_V6)
+      n_addrs += 4;
+  }
+
+  return max_pow2 (clib_max (2 * n_addrs, UPF_URR_TRAFFIC_MIN_SLOTS));
+}
+
+/*
+ * Hand the traffic tables of the URRs over to their new version and
+ * allocate or free them for added or removed Start and Stop of Traffic
+ * triggers. Must be called with the workers stopped.
+ */
+static void
+pfcp_update_urr_traffic (struct rules *old, struct rules *new)
+{
+  upf_urr_t *urr;
+
+  vec_foreach (urr, new->urr)
+  {
+    upf_urr_t *old_urr = pfcp_get_urr_by_id (old, urr->id);
+
+    if (old_urr && old_urr->traffic)
+      {
+	urr->traffic = old_urr->traffic;
+	old_urr->traffic = NULL;
+      }
+
+    if (!(urr->triggers & (REPORTING_TRIGGER_START_OF_TRAFFIC |
+			   REPORTING_TRIGGER_STOP_OF_TRAFFIC)))
+      {
+	if (urr->traffic)
+	  clib_mem_free (urr->traffic);
+	urr->traffic = NULL;
+      }
+    else if (!urr->traffic)
+      urr->traffic = upf_urr_traffic_alloc (pfcp_urr_traffic_slots (new, urr));
+  }
+}
+
+/* whether any FAR got a different apply action */
+static int
+pfcp_far_actions_changed (struct rules *new, struct rules *old)
+{
+  upf_far_t *far;
+
+  vec_foreach (far, new->far)
+  {
+    upf_far_t *old_far = pfcp_get_far_by_id (old, far->id);
+
+    if (!old_far || old_far->apply_action != far->apply_action)
+      return 1;
+  }
+
+  return vec_len (new->far) != vec_len (old->far);
+}
+
+int
+pfcp_update_apply (upf_session_t * sx)
+{
+  struct rules *pending = pfcp_get_rules (sx, PFCP_PENDING);
+  struct rules *active = pfcp_get_rules (sx, PFCP_ACTIVE);
+  int pending_pdr, pending_far, pending_urr, pending_qer;
+  pfcp_server_main_t *psm = &pfcp_server_main;
+  vlib_main_t *vm = vlib_get_main ();
+  upf_main_t *gtm = &upf_main;
+  u32 si = sx - gtm->sessions;
+  f64 now = psm->now;
+  u32 reclassify_precedence = ~0;
+  upf_urr_t *urr;
+
+  if (!pending->pdr && !pending->far && !pending->urr && !pending->qer)
+    return 0;
+
+  pending_pdr = !!pending->pdr;
+  pending_far = !!pending->far;
+  pending_urr = !!pending->urr;
+  pending_qer = !!pending->qer;
+
+  /*
+   * the pending rules are not visible to the workers yet, attach them to
+   * their application database before stopping them
+   */
+  if (pending_pdr)
+    upf_adf_session_db_build (&pending->adr_db, pending->pdr);
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  if (pending_pdr)
+    {
+      if (build_pfcp_rules (sx) != 0)
+	{
+	  vlib_worker_thread_barrier_release (vm);
+	  return -1;
+	}
+    }
+  else
+    {
+      pending->pdr = active->pdr;
+
+      pending->proxy_precedence = active->proxy_precedence;
+      pending->proxy_pdr_idx = active->proxy_pdr_idx;
+
+      pending->ue_src_ip = active->ue_src_ip;
+      active->ue_src_ip = NULL;
+
+      pending->ue_dst_ip = active->ue_dst_ip;
+      active->ue_dst_ip = NULL;
+
+      pending->v4_teid = active->v4_teid;
+      active->v4_teid = NULL;
+      pending->v6_teid = active->v6_teid;
+      active->v6_teid = NULL;
+
+      pending->v4_acls = active->v4_acls;
+      active->v4_acls = NULL;
+      pending->v6_acls = active->v6_acls;
+      active->v6_acls = NULL;
+
+      /* hand over the compiled indexes, nothing may stay shared */
+      pending->v4_index = active->v4_index;
+      clib_memset (&active->v4_index, 0, sizeof (active->v4_index));
+      pending->v6_index = active->v6_index;
+      clib_memset (&active->v6_index, 0, sizeof (active->v6_index));
+
+      pending->adr_db = active->adr_db;
+      clib_memset (&active->adr_db, 0, sizeof (active->adr_db));
+
+      pending->flags = active->flags;
+    }
+
+  if (pending_far)
+    {
+      upf_far_t *far;
+
+      vec_foreach (far, pending->far)
+	if (far->forward.outer_header_creation.description != 0)
+	{
+	  far->forward.peer_idx = peer_addr_ref (&far->forward);
+
+	  if (far->forward.outer_header_creation.description
+	      & OUTER_HEADER_CREATION_GTP_IP4)
+	    {
+	      rules_add_v4_teid (pending,
+				 &far->forward.outer_header_creation.ip.ip4,
+				 far->forward.outer_header_creation.teid,
+				 far->id);
+	    }
+	  else if (far->forward.outer_header_creation.description
+		   & OUTER_HEADER_CREATION_GTP_IP6)
+	    {
+	      rules_add_v6_teid (pending,
+				 &far->forward.outer_header_creation.ip.ip6,
+				 far->forward.outer_header_creation.teid,
+				 far->id);
+	    }
+	}
+    }
+  else
+    pending->far = active->far;
+
+  if (pending_urr)
+    build_urr_link_map (sx);
+  else
+    pending->urr = active->urr;
+
+  if (pending_qer)
+    {
+      upf_qer_t *qer;
+
+      vec_foreach (qer, pending->qer)
+      {
+	attach_qer_policer (qer);
+      }
+    }
+  else
+    pending->qer = active->qer;
+
+  if (pending_pdr)
+    {
+      sx->flags |= PFCP_UPDATING;
+
+      /* update UE addresses and TEIDs */
+      vec_diff (pending->ue_dst_ip, active->ue_dst_ip, ip46_address_fib_cmp,
+		pfcp_add_del_ue_ip, sx);
+      vec_diff (pending->v4_teid, active->v4_teid, v4_teid_cmp,
+		pfcp_add_del_v4_teid, sx);
+      vec_diff (pending->v6_teid, active->v6_teid, v6_teid_cmp,
+		pfcp_add_del_v6_teid, sx);
+
+      clib_warning ("v4 TEIDs %u\n", pending->v4_teid);
+      clib_warning ("v6 TEIDs %u\n", pending->v6_teid);
+      clib_warning ("UE Src IPs %u\n", pending->ue_src_ip);
+      clib_warning ("v4 ACLs %u\n", pending->v4_acls);
+      clib_warning ("v6 ACLs %u\n", pending->v6_acls);
+
+      vec_diff (pending->ue_src_ip, active->ue_src_ip, ip46_address_fib_cmp,
 		pfcp_add_del_ue_ip, sx);
 
       /* has PDRs but no TEIDs or UE IPs, add to global wildcard TDF table */
@@ -1876,12 +2482,46 @@ pfcp_update_apply (upf_session_t * sx)
 		pfcp_add_del_v4_tdf, sx);
       vec_diff (pending->v6_acls, active->v6_acls, upf_acl_cmp,
 		pfcp_add_del_v6_tdf, sx);
+
+      /* vec_diff has put the ACLs into their final order */
+      upf_acl_index_build (&pending->v4_index, pending->v4_acls, 1);
+      upf_acl_index_build (&pending->v6_index, pending->v6_acls, 0);
+    }
+
+  if (pending_pdr || pending_far)
+    reclassify_precedence = pfcp_reclassify_precedence (active, pending);
+
+  /*
+   * URR and QER positions change with any of the three rule sets, when
+   * the PDRs are unchanged they are shared with the active rules, which
+   * is fine as the workers are stopped
+   */
+  if (pending_pdr || pending_urr || pending_qer)
+    pfcp_resolve_pdr_rules (pending);
+
+  /* all usage measured so far belongs to the current URRs */
+  upf_urr_acc_merge (sx, active->urr);
+  if (pending_urr)
+    {
+      upf_urr_acc_reset (sx, vec_len (pending->urr));
+      pfcp_update_urr_traffic (active, pending);
     }
 
   /* flip the switch */
   sx->active ^= PFCP_PENDING;
   sx->flags &= ~PFCP_UPDATING;
 
+  /*
+   * flows catch up with the new generation on their next packet, only
+   * PDR and FAR changes can change their classification
+   */
+  if (pending_pdr || pending_far)
+    {
+      sx->generation++;
+      sx->reclassify_precedence[sx->generation % UPF_RECLASSIFY_HISTORY] =
+	reclassify_precedence;
+    }
+
   pending = pfcp_get_rules (sx, PFCP_PENDING);
   active = pfcp_get_rules (sx, PFCP_ACTIVE);
 
@@ -1890,6 +2530,13 @@ pfcp_update_apply (upf_session_t * sx)
   upf_pfcp_session_start_up_inactivity_timer (si, sx->last_ul_traffic,
 					      &active->inactivity_timer);
 
+  /* buffered DL data is released when the buffering FARs are changed */
+  if (pending_far && pfcp_far_actions_changed (active, pending))
+    {
+      sx->dl_data_reported = 0;
+      upf_dl_buffer_flush (sx, 0);
+    }
+
   if (pending_far)
     {
       upf_far_t *far;
@@ -1964,6 +2611,13 @@ pfcp_update_apply (upf_session_t * sx)
 					      !!(urr->triggers &
 						 REPORTING_TRIGGER_QUOTA_VALIDITY_TIME));
       }
+    if (urr->update_flags & PFCP_URR_UPDATE_MONITORING_TIME)
+      {
+	/* expire at the Monitoring Time itself, also when it has passed */
+	urr->monitoring_timer.period = 1;
+	urr->monitoring_timer.base = urr->monitoring_time.unix_time - 1;
+	upf_pfcp_session_start_stop_urr_time (si, &urr->monitoring_timer, 1);
+      }
   }
 
   if (!pending_pdr)
@@ -1988,15 +2642,11 @@ pfcp_update_apply (upf_session_t * sx)
 	    upf_pfcp_session_stop_urr_time (&urr->time_quota, now);
 	    upf_pfcp_session_stop_urr_time (&urr->quota_validity_time, now);
 	    upf_pfcp_session_stop_urr_time (&urr->traffic_timer, now);
+	    upf_pfcp_session_stop_urr_time (&urr->monitoring_timer, now);
 
 	    continue;
 	  }
 
-	new_urr->traffic = urr->traffic;
-	new_urr->traffic_by_ue = urr->traffic_by_ue;
-	urr->traffic = NULL;
-	urr->traffic_by_ue = NULL;
-
 	if ((new_urr->methods & PFCP_URR_VOLUME))
 	  {
 	    urr_volume_t *old_volume = &urr->volume;
@@ -2025,59 +2675,293 @@ pfcp_update_apply (upf_session_t * sx)
       }
 
       clib_spinlock_unlock (&sx->lock);
+
+      /* hand out budgets for the combined usage */
+      upf_urr_acc_merge (sx, active->urr);
     }
   else
     pending->urr = NULL;
   if (!pending_qer)
     pending->qer = NULL;
 
-  return 0;
-}
+  return 0;
+}
+
+void
+pfcp_update_finish (upf_session_t * sx)
+{
+  pfcp_free_rules (sx, PFCP_PENDING);
+}
+
+/******************** PFCP Session functions **********************/
+
+/**
+ * @brief Function to return session info entry address.
+ *
+ */
+upf_session_t *
+pfcp_lookup (uint64_t sess_id)
+{
+  upf_main_t *gtm = &upf_main;
+  uword *p;
+
+  p = hash_get (gtm->session_by_id, sess_id);
+  if (!p)
+    return NULL;
+
+  return pool_elt_at_index (gtm->sessions, p[0]);
+}
+
+/**
+ * @brief Size the per thread usage accumulators of a session for n_urrs
+ * URRs and zero them. Must be called with the workers stopped.
+ */
+void
+upf_urr_acc_reset (upf_session_t * sx, u32 n_urrs)
+{
+  upf_main_t *gtm = &upf_main;
+  u32 si = sx - gtm->sessions;
+  upf_session_acc_t *sa;
+  upf_urr_acc_t *acc;
+  u32 t;
+
+  vec_foreach_index (t, gtm->session_acc)
+  {
+    vec_validate (gtm->session_acc[t], si);
+    sa = vec_elt_at_index (gtm->session_acc[t], si);
+
+    if (n_urrs == 0)
+      {
+	sa->last_ul_traffic = 0;
+	vec_free (sa->urr);
+	continue;
+      }
+
+    vec_reset_length (sa->urr);
+    vec_validate_aligned (sa->urr, n_urrs - 1, CLIB_CACHE_LINE_BYTES);
+    clib_memset (sa->urr, 0, vec_len (sa->urr) * sizeof (sa->urr[0]));
+    vec_foreach (acc, sa->urr)
+    {
+      acc->limit.ul = acc->limit.dl = acc->limit.total = ~0ULL;
+      acc->merge_seq = 1;
+    }
+  }
+}
+
+static void
+urr_counter_merge (urr_counter_t * sum, const volatile urr_counter_t * live,
+		   urr_counter_t * merged)
+{
+  urr_counter_t now = {
+    .ul = live->ul,
+    .dl = live->dl,
+    .total = live->total,
+  };
+
+  sum->ul += now.ul - merged->ul;
+  sum->dl += now.dl - merged->dl;
+  sum->total += now.total - merged->total;
+  *merged = now;
+}
+
+static void
+urr_counter_add (urr_counter_t * dst, const urr_counter_t * src)
+{
+  dst->ul += src->ul;
+  dst->dl += src->dl;
+  dst->total += src->total;
+}
+
+/* bytes left until the threshold or the quota of a direction is reached */
+static u64
+urr_volume_remaining (u64 bytes, u64 consumed, u64 threshold, u64 quota)
+{
+  u64 rem = ~0ULL;
+
+  if (threshold != 0 && bytes < threshold)
+    rem = threshold - bytes;
+  if (quota != 0 && consumed < quota)
+    rem = clib_min (rem, quota - consumed);
+
+  return rem;
+}
+
+static u64
+urr_volume_limit (u64 base, u64 rem, u32 n_threads)
+{
+  u64 budget;
+
+  if (rem == ~0ULL)
+    return ~0ULL;
+
+  budget = rem / n_threads;
+  return budget > ~0ULL - base ? ~0ULL : base + budget;
+}
+
+/**
+ * @brief Merge the usage the threads measured since the previous merge
+ * into the URRs of a session and hand out new volume budgets.
+ *
+ * Only called by the PFCP process. The threads never reset their
+ * counters, the increase is taken against the values seen by the
+ * previous merge, so no lock is needed. Every thread gets an equal
+ * share of the volume left until the nearest threshold or quota, it
+ * asks for a merge once its share is used up.
+ */
+void
+upf_urr_acc_merge (upf_session_t * sx, upf_urr_t * urrs)
+{
+  upf_main_t *gtm = &upf_main;
+  u32 si = sx - gtm->sessions;
+  u32 n_threads = vec_len (gtm->session_acc);
+  upf_session_acc_t *sa;
+  upf_urr_t *urr;
+  u32 t;
+
+  for (t = 0; t < n_threads; t++)
+    {
+      sa = vec_elt_at_index (gtm->session_acc[t], si);
+      sx->last_ul_traffic = clib_max (sx->last_ul_traffic,
+				      sa->last_ul_traffic);
+    }
+
+  vec_foreach (urr, urrs)
+  {
+    u32 idx = urr - urrs;
+    urr_counter_t packets[2] = { }, bytes[2] = { };
+    f64 first[2] = { INFINITY, INFINITY };
+    f64 last[2] = { 0, 0 };
+    urr_measure_t *m = &urr->volume.measure;
+    urr_counter_t rem;
+    int b;
+
+    for (t = 0; t < n_threads; t++)
+      {
+	upf_urr_acc_t *acc;
+
+	sa = vec_elt_at_index (gtm->session_acc[t], si);
+	if (idx >= vec_len (sa->urr))
+	  continue;
+	acc = vec_elt_at_index (sa->urr, idx);
+
+	for (b = 0; b < 2; b++)
+	  {
+	    u64 seen = packets[b].total;
 
-void
-pfcp_update_finish (upf_session_t * sx)
-{
-  pfcp_free_rules (sx, PFCP_PENDING);
-}
+	    urr_counter_merge (&packets[b], &acc->packets[b],
+			       &acc->merged_packets[b]);
+	    urr_counter_merge (&bytes[b], &acc->bytes[b],
+			       &acc->merged_bytes[b]);
+	    if (packets[b].total == seen)
+	      continue;
 
-/******************** PFCP Session functions **********************/
+	    first[b] = clib_min (first[b], acc->time_of_first_packet[b]);
+	    last[b] = clib_max (last[b], acc->time_of_last_packet[b]);
+	  }
+      }
 
-/**
- * @brief Function to return session info entry address.
- *
- */
-upf_session_t *
-pfcp_lookup (uint64_t sess_id)
-{
-  upf_main_t *gtm = &upf_main;
-  uword *p;
+    /* after usage left over from a reported split is not split again */
+    if (packets[1].total != 0 && urr->monitoring_epoch != 0 &&
+	!(urr->status & URR_AFTER_MONITORING_TIME))
+      {
+	/* first usage after the Monitoring Time, split the measurement */
+	if ((urr->methods & PFCP_URR_VOLUME))
+	  {
+	    urr_counter_add (&m->packets, &packets[0]);
+	    urr_counter_add (&m->bytes, &bytes[0]);
+	    urr_counter_add (&m->consumed, &bytes[0]);
+	  }
+	if (packets[0].total != 0)
+	  {
+	    if (urr->time_of_first_packet == INFINITY)
+	      urr->time_of_first_packet = clib_min (first[0], last[0]);
+	    urr->time_of_last_packet = last[0];
+	  }
 
-  p = hash_get (gtm->session_by_id, sess_id);
-  if (!p)
-    return NULL;
+	urr->usage_before_monitoring_time.volume = *m;
+	memset (&m->packets, 0, sizeof (m->packets));
+	memset (&m->bytes, 0, sizeof (m->bytes));
 
-  return pool_elt_at_index (gtm->sessions, p[0]);
-}
+	urr->usage_before_monitoring_time.start_time = urr->start_time;
+	urr->usage_before_monitoring_time.time_of_first_packet =
+	  urr->time_of_first_packet;
+	urr->usage_before_monitoring_time.time_of_last_packet =
+	  urr->time_of_last_packet;
+	urr->start_time = urr->monitoring_time.unix_time;
+	urr->time_of_first_packet = INFINITY;
+	urr->time_of_last_packet = INFINITY;
+	urr->monitoring_time.vlib_time = INFINITY;
+	urr->status |= URR_AFTER_MONITORING_TIME;
+      }
+    else
+      {
+	/* no split pending, the threads' view of the time is irrelevant */
+	urr_counter_add (&packets[1], &packets[0]);
+	urr_counter_add (&bytes[1], &bytes[0]);
+	first[1] = clib_min (first[1], first[0]);
+	last[1] = clib_max (last[1], last[0]);
+      }
 
-static int
-urr_increment_and_check_counter (u64 * packets, u64 * bytes, u64 * consumed,
-				 u64 threshold, u64 quota, u64 n_bytes)
-{
-  int r = URR_OK;
+    if (packets[1].total != 0)
+      {
+	if ((urr->methods & PFCP_URR_VOLUME))
+	  {
+	    urr_counter_add (&m->packets, &packets[1]);
+	    urr_counter_add (&m->bytes, &bytes[1]);
+	    urr_counter_add (&m->consumed, &bytes[1]);
+	  }
+	if (urr->time_of_first_packet == INFINITY)
+	  urr->time_of_first_packet = clib_min (first[1], last[1]);
+	urr->time_of_last_packet = last[1];
+      }
 
-  if (quota != 0 &&
-      PREDICT_FALSE (*consumed < quota && *consumed + n_bytes >= quota))
-    r |= URR_QUOTA_EXHAUSTED;
-  *consumed += n_bytes;
+    if (!(urr->methods & PFCP_URR_VOLUME))
+      rem.ul = rem.dl = rem.total = ~0ULL;
+    else
+      {
+#define urr_remaining(V, D)						\
+	  urr_volume_remaining (V.measure.bytes.D, V.measure.consumed.D,	\
+				V.threshold.D, V.quota.D)
+
+	rem.ul = urr_remaining (urr->volume, ul);
+	rem.dl = urr_remaining (urr->volume, dl);
+	rem.total = urr_remaining (urr->volume, total);
+
+#undef urr_remaining
+
+	if ((urr->volume.quota.ul != 0 &&
+	     m->consumed.ul >= urr->volume.quota.ul) ||
+	    (urr->volume.quota.dl != 0 &&
+	     m->consumed.dl >= urr->volume.quota.dl) ||
+	    (urr->volume.quota.total != 0 &&
+	     m->consumed.total >= urr->volume.quota.total))
+	  urr->status |= URR_OVER_QUOTA;
+      }
+
+    for (t = 0; t < n_threads; t++)
+      {
+	upf_urr_acc_t *acc;
+
+	sa = vec_elt_at_index (gtm->session_acc[t], si);
+	if (idx >= vec_len (sa->urr))
+	  continue;
+	acc = vec_elt_at_index (sa->urr, idx);
 
-  if (threshold != 0 &&
-      PREDICT_FALSE (*bytes < threshold && *bytes + n_bytes >= threshold))
-    r |= URR_THRESHOLD_REACHED;
-  *bytes += n_bytes;
+#define urr_limit(D)							\
+	  urr_volume_limit (acc->merged_bytes[0].D + acc->merged_bytes[1].D, \
+			    rem.D, n_threads)
 
-  *packets += 1;
+	acc->limit.ul = urr_limit (ul);
+	acc->limit.dl = urr_limit (dl);
+	acc->limit.total = urr_limit (total);
 
-  return r;
+#undef urr_limit
+
+	/* publish the limits before the threads see the new merge */
+	CLIB_MEMORY_STORE_BARRIER ();
+	acc->merge_seq++;
+      }
+  }
 }
 
 #ifdef UPF_TRAFFIC_LOG
@@ -2201,131 +3085,163 @@ display_packet_for_urr (vlib_main_t * vm, vlib_buffer_t * b,
 
 #endif
 
-u32
-process_urrs (vlib_main_t * vm, upf_session_t * sess,
-	      const char *node_name,
-	      struct rules *active,
-	      upf_pdr_t * pdr, vlib_buffer_t * b,
-	      u8 is_dl, u8 is_ul, u32 next)
+always_inline void
+urr_acc_add (urr_counter_t * c, u64 n, u8 is_ul, u8 is_dl)
 {
-  upf_urr_traffic_t tt = {.ip = ip46_address_initializer };
-  upf_event_urr_data_t *uev = NULL;
-  f64 now = vlib_time_now (vm);
-  upf_main_t *gtm = &upf_main;
-  upf_event_urr_hdr_t *ueh;
-  u8 status = URR_OK;
-  u16 *urr_id;
+  if (is_ul)
+    c->ul += n;
+  if (is_dl)
+    c->dl += n;
+  c->total += n;
+}
 
-  clib_warning ("DL: %d, UL: %d\n", is_dl, is_ul);
+always_inline int
+urr_acc_over_budget (upf_urr_acc_t * acc)
+{
+  return (acc->bytes[0].ul + acc->bytes[1].ul >= acc->limit.ul ||
+	  acc->bytes[0].dl + acc->bytes[1].dl >= acc->limit.dl ||
+	  acc->bytes[0].total + acc->bytes[1].total >= acc->limit.total);
+}
 
-  clib_spinlock_lock (&sess->lock);
+/* bytes the thread can still account before it has used up its budget */
+always_inline u64
+urr_acc_headroom (upf_urr_acc_t * acc)
+{
+  u64 headroom = ~0ULL;
 
-  if (is_ul)
-    sess->last_ul_traffic = now;
+#define _(d)								\
+  do {									\
+    u64 used = acc->bytes[0].d + acc->bytes[1].d;			\
+    headroom = clib_min (headroom,					\
+			 used < acc->limit.d ? acc->limit.d - used : 0); \
+  } while (0)
 
-  vec_foreach (urr_id, pdr->urr_ids)
-  {
-    upf_urr_t *urr = pfcp_get_urr_by_id (active, *urr_id);
-    int r = URR_OK;
+  _(ul);
+  _(dl);
+  _(total);
+#undef _
 
-    if (!urr)
-      continue;
+  return headroom;
+}
 
-#if CLIB_DEBUG > 2
-    f64 unow = unix_time_now ();
-    upf_debug
-      ("Monitoring Time: %12.4f - %12.4f : %12.4f Unix: %U - %U : %12.4f",
-       urr->monitoring_time.vlib_time, now,
-       urr->monitoring_time.vlib_time - now, format_time_float, NULL,
-       urr->monitoring_time.unix_time, format_time_float, NULL, unow,
-       urr->monitoring_time.unix_time - unow);
-#endif
+/*
+ * Account packets to the usage of a URR measured by this thread and
+ * return the resulting URR_* status. epoch is the Monitoring Time epoch
+ * the thread read at the start of the frame.
+ */
+static_always_inline u8
+upf_urr_account (upf_urr_t * urr, upf_urr_acc_t * acc, u32 n_packets,
+		 u64 n_bytes, u8 is_dl, u8 is_ul, f64 now, u32 epoch)
+{
+  int after = upf_urr_after_monitoring_time (urr, epoch);
 
-    if (urr->monitoring_time.vlib_time < now)
-      {
-	if ((urr->status & URR_AFTER_MONITORING_TIME))
-	  {
-	    clib_warning ("Possible control plane bug:"
-			  " dropping the session 0x%016" PRIx64
-			  " instead of enqueueing 2nd Monitoring Time split",
-			  sess->cp_seid);
-	    status |= URR_DROP_SESSION;
-	    break;
-	  }
+  if (PREDICT_FALSE (acc->seen_seq != acc->merge_seq))
+    {
+      /* the previous usage has been merged, start over */
+      acc->seen_seq = acc->merge_seq;
+      acc->time_of_first_packet[0] = INFINITY;
+      acc->time_of_first_packet[1] = INFINITY;
+    }
+  if (acc->time_of_first_packet[after] == INFINITY)
+    acc->time_of_first_packet[after] = now;
+  acc->time_of_last_packet[after] = now;
 
-	urr->usage_before_monitoring_time.volume = urr->volume.measure;
-	memset (&urr->volume.measure.packets, 0,
-		sizeof (urr->volume.measure.packets));
-	memset (&urr->volume.measure.bytes, 0,
-		sizeof (urr->volume.measure.bytes));
+  urr_acc_add (&acc->packets[after], n_packets, is_ul, is_dl);
+  urr_acc_add (&acc->bytes[after], n_bytes, is_ul, is_dl);
 
-	urr->usage_before_monitoring_time.start_time = urr->start_time;
-	urr->usage_before_monitoring_time.time_of_first_packet =
-	  urr->time_of_first_packet;
-	urr->usage_before_monitoring_time.time_of_last_packet =
-	  urr->time_of_last_packet;
-	urr->start_time = urr->monitoring_time.unix_time;
-	urr->time_of_first_packet = now;
-	urr->monitoring_time.vlib_time = INFINITY;
-	urr->status |= URR_AFTER_MONITORING_TIME;
-      }
+  if ((urr->methods & PFCP_URR_VOLUME) &&
+      PREDICT_FALSE (urr_acc_over_budget (acc)) &&
+      acc->reported_seq != acc->merge_seq)
+    {
+      /* this thread's share is used up, have the usage merged */
+      acc->reported_seq = acc->merge_seq;
+      return URR_BUDGET_EXHAUSTED;
+    }
 
-    if (urr->time_of_first_packet == INFINITY)
-      urr->time_of_first_packet = now;
-    urr->time_of_last_packet = now;
+  return URR_OK;
+}
 
-    if ((urr->methods & PFCP_URR_VOLUME))
-      {
-	uword len = vlib_buffer_length_in_chain (vm, b);
+static void
+upf_urr_send_event (upf_session_t * sess, upf_event_urr_data_t * uev,
+		    u8 status, ip46_address_t * ue)
+{
+  upf_main_t *gtm = &upf_main;
+  upf_event_urr_hdr_t *ueh;
+
+  vec_validate_ha (uev, 0, sizeof (upf_event_urr_hdr_t), 0);
+  ueh =
+    (upf_event_urr_hdr_t *) vec_header (uev, sizeof (upf_event_urr_hdr_t));
+  ueh->session_idx = (uword) (sess - gtm->sessions);
+  ueh->cp_seid = sess->cp_seid;
+  ueh->ue = *ue;
+  ueh->status = status;
+
+  upf_debug ("sending URR event on %wd\n", (uword) ueh->session_idx);
+  upf_pfcp_server_session_usage_report (uev);
+}
 
-#define urr_incr_and_check(V, D, L)					\
-	  urr_increment_and_check_counter(&V.measure.packets.D,		\
-					  &V.measure.bytes.D,		\
-					  &V.measure.consumed.D,	\
-					  V.threshold.D,		\
-					  V.quota.D,			\
-					  (L))
+static_always_inline u32
+upf_process_urrs (vlib_main_t * vm, upf_session_t * sess,
+		  const char *node_name, struct rules *active,
+		  upf_pdr_t * pdr, vlib_buffer_t * b,
+		  u8 is_dl, u8 is_ul, u32 next, u32 epoch)
+{
+  ip46_address_t ue = ip46_address_initializer;
+  upf_event_urr_data_t *uev = NULL;
+  f64 now = vlib_time_now (vm);
+  upf_main_t *gtm = &upf_main;
+  upf_session_acc_t *sa;
+  u8 status = URR_OK;
+  uword len;
+  u32 *urr_idx;
+
+  /* usage is accounted per thread, the PFCP process merges it */
+  sa = vec_elt_at_index (gtm->session_acc[vm->thread_index],
+			 sess - gtm->sessions);
+  len = vlib_buffer_length_in_chain (vm, b);
+
+  if (is_ul)
+    sa->last_ul_traffic = now;
 
-	if (is_ul)
-	  r |= urr_incr_and_check (urr->volume, ul, len);
-	if (is_dl)
-	  r |= urr_incr_and_check (urr->volume, dl, len);
+  vec_foreach (urr_idx, pdr->urr_indices)
+  {
+    upf_urr_t *urr = vec_elt_at_index (active->urr, *urr_idx);
+    upf_urr_acc_t *acc = vec_elt_at_index (sa->urr, *urr_idx);
 
-	r |= urr_incr_and_check (urr->volume, total, len);
+    status |= upf_urr_account (urr, acc, 1, len, is_dl, is_ul, now, epoch);
 
 #ifdef UPF_TRAFFIC_LOG
+    if ((urr->methods & PFCP_URR_VOLUME))
+      {
 	ip4_header_t *iph =
 	  (ip4_header_t *) (b->data + vnet_buffer (b)->l3_hdr_offset);
-	display_packet_for_urr (vm, b, node_name, *urr_id,
+	int after = upf_urr_after_monitoring_time (urr, epoch);
+
+	display_packet_for_urr (vm, b, node_name, urr->id,
 				is_ul, is_dl,
-				urr->volume.measure.bytes.ul,
-				urr->volume.measure.bytes.dl,
-				urr->volume.measure.bytes.total,
+				acc->bytes[after].ul,
+				acc->bytes[after].dl,
+				acc->bytes[after].total,
 				len,
 				(iph->ip_version_and_header_length & 0xF0) ==
 				0x40);
-#endif
-
-	if (PREDICT_FALSE (r & URR_QUOTA_EXHAUSTED))
-	  urr->status |= URR_OVER_QUOTA;
       }
+#endif
 
-    if ((urr->methods & PFCP_URR_EVENT) &&
-	(urr->triggers & REPORTING_TRIGGER_START_OF_TRAFFIC))
+    if ((urr->methods & PFCP_URR_EVENT) && urr->traffic)
       {
 	ip4_header_t *iph =
 	  (ip4_header_t *) (b->data + vnet_buffer (b)->l3_hdr_offset);
-	upf_urr_traffic_t *t = NULL;
+	upf_urr_traffic_t *t;
 
-	if (ip46_address_is_zero (&tt.ip))
+	if (ip46_address_is_zero (&ue))
 	  {
-	    // calculate session key based on PDI and check session table....
 	    if ((iph->ip_version_and_header_length & 0xF0) == 0x40)
 	      {
 		if (is_dl)
-		  ip46_address_set_ip4 (&tt.ip, &iph->dst_address);
+		  ip46_address_set_ip4 (&ue, &iph->dst_address);
 		if (is_ul)
-		  ip46_address_set_ip4 (&tt.ip, &iph->src_address);
+		  ip46_address_set_ip4 (&ue, &iph->src_address);
 	      }
 	    else
 	      {
@@ -2335,142 +3251,381 @@ process_urrs (vlib_main_t * vm, upf_session_t * sess,
 		ASSERT ((iph->ip_version_and_header_length & 0xF0) == 0x60);
 
 		if (is_dl)
-		  ip46_address_set_ip6 (&tt.ip, &ip6->dst_address);
+		  ip46_address_set_ip6 (&ue, &ip6->dst_address);
 		if (is_ul)
-		  ip46_address_set_ip6 (&tt.ip, &ip6->src_address);
+		  ip46_address_set_ip6 (&ue, &ip6->src_address);
 	      }
-	  }
-
-	clib_warning ("Start Of Traffic UE IP: %U, Pool: %p, Hash: %p\n",
-		   format_ip46_address, &tt.ip, IP46_TYPE_ANY,
-		   urr->traffic, urr->traffic_by_ue);
-
-	if (urr->traffic_by_ue)
-	  {
-	    uword *p;
-
-	    ASSERT (urr->traffic != NULL);
 
-	    p = hash_get_mem (urr->traffic_by_ue, &tt.ip);
-	    if (p)
-	      t = pool_elt_at_index (urr->traffic, p[0]);
+	    if (PREDICT_FALSE (ip46_address_is_zero (&ue)))
+	      goto next_urr;
 	  }
 
-	if (!t)
+	t = upf_urr_traffic_find (urr->traffic, &ue);
+	if (PREDICT_TRUE (t != NULL))
+	  t->last_seen = now;
+	else
 	  {
 	    upf_event_urr_data_t ev = {
 	      .urr_id = urr->id,
 	      .trigger = URR_START_OF_TRAFFIC
 	    };
 
-	    /* no traffic for this UE */
-	    if (!urr->traffic_by_ue)
-	      urr->traffic_by_ue =
-		hash_create_mem (0, sizeof (ip46_address_t), sizeof (uword));
-
-	    pool_get (urr->traffic, t);
-	    *t = tt;
-	    t->first_seen = now;
-	    hash_set_mem_alloc (&urr->traffic_by_ue, &t->ip,
-				t - urr->traffic);
-
-	    vec_add1_ha (uev, ev, sizeof (upf_event_urr_hdr_t), 0);
-	    status |= URR_START_OF_TRAFFIC;
-	  }
-	else if (t && t->first_seen + 10 < now)
-	  {
-	    upf_event_urr_data_t *ev;
+	    /* new UE addresses are inserted one thread at a time */
+	    clib_spinlock_lock (&sess->lock);
 
-	    /* crude 10 second timeout */
+	    if (!upf_urr_traffic_find (urr->traffic, &ue))
+	      {
+		upf_urr_traffic_table_t *tt = urr->traffic;
+
+		if (!upf_urr_traffic_insert (tt, &ue, now))
+		  {
+		    /* reported anyway, the PFCP process adds it */
+		    ev.trigger |= URR_TRAFFIC_UNLISTED;
+		    vlib_increment_simple_counter
+		      (&gtm->upf_simple_counters[UPF_URR_TRAFFIC_TABLE_FULL],
+		       vm->thread_index, 0, 1);
+		  }
+		if (!tt->grow && upf_urr_traffic_needs_rebuild (tt))
+		  {
+		    tt->grow = 1;
+		    ev.trigger |= URR_TRAFFIC_REBUILD;
+		  }
+
+		upf_debug ("Start Of Traffic UE IP: %U",
+			   format_ip46_address, &ue, IP46_TYPE_ANY);
+		vec_add1_ha (uev, ev, sizeof (upf_event_urr_hdr_t), 0);
+		status |= URR_START_OF_TRAFFIC;
+	      }
 
-	    t->first_seen = now;
-	    vec_add2_ha (uev, ev, 1, sizeof (upf_event_urr_hdr_t), 0);
-	    ev->urr_id = urr->id;
-	    ev->trigger = URR_START_OF_TRAFFIC;
-	    status |= URR_START_OF_TRAFFIC;
+	    clib_spinlock_unlock (&sess->lock);
 	  }
-	// TODO: trafic was expired, rearm and send report
       }
 
+  next_urr:
     if (PREDICT_FALSE (urr->status & URR_OVER_QUOTA))
       next = UPF_FORWARD_NEXT_DROP;
-
-    status |= r;
   }
 
-  clib_spinlock_unlock (&sess->lock);
+  if (PREDICT_FALSE (status != URR_OK))
+    upf_urr_send_event (sess, uev, status, &ue);
+
+  return next;
+}
+
+u32
+process_urrs (vlib_main_t * vm, upf_session_t * sess,
+	      const char *node_name,
+	      struct rules *active,
+	      upf_pdr_t * pdr, vlib_buffer_t * b,
+	      u8 is_dl, u8 is_ul, u32 next)
+{
+  return upf_process_urrs (vm, sess, node_name, active, pdr, b, is_dl, is_ul,
+			   next, upf_main.monitoring_epoch);
+}
+
+/*
+ * Per frame URR accounting: the packets of a PDR and direction are summed
+ * up and accounted once, when the frame is done. An entry accounts its
+ * packets one by one when Start or Stop of Traffic has to see every UE
+ * address, and from the packet on that could use up the budget of one of
+ * its URRs, so that the budget is reported on the packet that crosses it.
+ */
+
+static void
+upf_urr_batch_flush_entry (vlib_main_t * vm, upf_urr_batch_t * batch,
+			   upf_urr_batch_entry_t * e)
+{
+  upf_main_t *gtm = &upf_main;
+  ip46_address_t ue = ip46_address_initializer;
+  f64 now = vlib_time_now (vm);
+  upf_session_acc_t *sa;
+  u8 status = URR_OK;
+  u32 *urr_idx;
+
+  if (e->packets == 0)
+    return;
+
+  sa = vec_elt_at_index (gtm->session_acc[vm->thread_index],
+			 e->sess - gtm->sessions);
+
+  if (e->is_ul)
+    sa->last_ul_traffic = now;
+
+  vec_foreach (urr_idx, e->pdr->urr_indices)
+  {
+    upf_urr_t *urr = vec_elt_at_index (e->active->urr, *urr_idx);
+    upf_urr_acc_t *acc = vec_elt_at_index (sa->urr, *urr_idx);
+
+    status |= upf_urr_account (urr, acc, e->packets, e->bytes,
+			       e->is_dl, e->is_ul, now,
+			       batch->monitoring_epoch);
+  }
 
   if (PREDICT_FALSE (status != URR_OK))
+    upf_urr_send_event (e->sess, NULL, status, &ue);
+
+  e->packets = 0;
+  e->bytes = 0;
+}
+
+void
+upf_urr_batch_flush (vlib_main_t * vm, upf_urr_batch_t * batch)
+{
+  u32 i;
+
+  for (i = 0; i < batch->n_entries; i++)
+    upf_urr_batch_flush_entry (vm, batch, &batch->entries[i]);
+
+  batch->n_entries = 0;
+  batch->last = 0;
+}
+
+upf_urr_batch_entry_t *
+upf_urr_batch_get (vlib_main_t * vm, upf_urr_batch_t * batch,
+		   upf_session_t * sess, struct rules *active,
+		   upf_pdr_t * pdr, u8 is_dl, u8 is_ul)
+{
+  upf_main_t *gtm = &upf_main;
+  upf_urr_batch_entry_t *e;
+  upf_session_acc_t *sa;
+  u32 *urr_idx;
+  u32 i;
+
+  for (i = 0; i < batch->n_entries; i++)
     {
-      vec_validate_ha (uev, 0, sizeof (upf_event_urr_hdr_t), 0);
-      ueh =
-	(upf_event_urr_hdr_t *) vec_header (uev,
-					    sizeof (upf_event_urr_hdr_t));
-      ueh->session_idx = (uword) (sess - gtm->sessions);
-      ueh->cp_seid = sess->cp_seid;
-      ueh->ue = tt.ip;
-      ueh->status = status;
+      e = &batch->entries[i];
+      if (e->pdr == pdr && e->is_dl == is_dl && e->is_ul == is_ul)
+	{
+	  batch->last = i;
+	  return e;
+	}
+    }
+
+  if (batch->n_entries == UPF_URR_BATCH_SIZE)
+    upf_urr_batch_flush (vm, batch);
+
+  i = batch->n_entries++;
+  batch->last = i;
+  e = &batch->entries[i];
+
+  e->sess = sess;
+  e->active = active;
+  e->pdr = pdr;
+  e->packets = 0;
+  e->bytes = 0;
+  e->headroom = ~0ULL;
+  e->is_dl = is_dl;
+  e->is_ul = is_ul;
+  e->flags = 0;
+
+  sa = vec_elt_at_index (gtm->session_acc[vm->thread_index],
+			 sess - gtm->sessions);
+
+  vec_foreach (urr_idx, pdr->urr_indices)
+  {
+    upf_urr_t *urr = vec_elt_at_index (active->urr, *urr_idx);
+    upf_urr_acc_t *acc = vec_elt_at_index (sa->urr, *urr_idx);
 
-      clib_warning ("sending URR event on %wd\n", (uword) ueh->session_idx);
-      upf_pfcp_server_session_usage_report (uev);
+    if (urr->traffic)
+      e->flags |= UPF_URR_BATCH_SLOW;
+    if (urr->status & URR_OVER_QUOTA)
+      e->flags |= UPF_URR_BATCH_OVER_QUOTA;
+
+    /* once reported, the budget does not matter until the next merge */
+    if ((urr->methods & PFCP_URR_VOLUME) &&
+	acc->reported_seq != acc->merge_seq)
+      e->headroom = clib_min (e->headroom, urr_acc_headroom (acc));
+  }
+
+  return e;
+}
+
+u32
+upf_urr_batch_cross (vlib_main_t * vm, upf_urr_batch_t * batch,
+		     upf_urr_batch_entry_t * e, const char *node_name,
+		     vlib_buffer_t * b, u32 next)
+{
+  upf_urr_batch_flush_entry (vm, batch, e);
+  e->flags |= UPF_URR_BATCH_SLOW;
+
+  return upf_process_urrs (vm, e->sess, node_name, e->active, e->pdr, b,
+			   e->is_dl, e->is_ul, next, batch->monitoring_epoch);
+}
+
+/* remark traffic above the GBR of a QER */
+static_always_inline void
+upf_qer_remark_dscp (vlib_buffer_t * b, u8 dscp)
+{
+  ip4_header_t *ip4 =
+    (ip4_header_t *) (b->data + vnet_buffer (b)->l3_hdr_offset);
+
+  if ((ip4->ip_version_and_header_length & 0xF0) == 0x40)
+    {
+      ip4_header_set_dscp (ip4, dscp);
+      ip4->checksum = ip4_header_checksum (ip4);
     }
+  else
+    ip6_set_dscp_network_order ((ip6_header_t *) ip4, dscp);
+}
 
-  return next;
+/* policers of one PDR evaluated before any of them is charged */
+#define UPF_QER_MAX_LEVELS 8
+
+/* flag a policer with traffic for the next rebalancing run */
+static_always_inline void
+upf_qer_mark_active (upf_main_t * gtm, u32 thread_index, u32 policer_index)
+{
+  uword *w = vec_elt_at_index (gtm->qer_active[thread_index],
+			       policer_index / BITS (uword));
+  uword mask = (uword) 1 << (policer_index % BITS (uword));
+
+  if (PREDICT_FALSE (!(*w & mask)))
+    clib_atomic_fetch_or (w, mask);
 }
 
+/*
+ * Apply the QERs of a PDR to a packet. The QERs are ordered from the QoS
+ * flow up to the session and APN AMBR, a packet has to be accepted by
+ * every level and is only charged to the buckets once it is, so traffic
+ * dropped by the AMBR does not use up the MBR of its flow and vice
+ * versa. The color of the packet is the worst color of all levels.
+ */
 u32
 process_qers (vlib_main_t * vm, upf_session_t * sess,
 	      struct rules *r,
 	      upf_pdr_t * pdr, vlib_buffer_t * b,
-	      u8 is_dl, u8 is_ul, u32 next)
+	      u8 is_dl, u8 is_ul, u64 time_in_policer_periods, u32 next)
 {
+  policer_read_response_type_st *level[UPF_QER_MAX_LEVELS];
+  u32 level_policer[UPF_QER_MAX_LEVELS];
+  u8 level_color[UPF_QER_MAX_LEVELS];
   u8 direction = is_dl ? UPF_DL : UPF_UL;
+  u32 thread_index = vm->thread_index;
   upf_main_t *gtm = &upf_main;
-  u64 time_in_policer_periods;
-  u32 *qer_id;
-  u32 len;
-
-  clib_warning ("DL: %d, UL: %d\n", is_dl, is_ul);
+  u8 color = POLICE_CONFORM;
+  u32 n_levels = 0;
+  u32 *qer_idx;
+  u32 len, i;
 
   /* must be UL or DL, not both and not none */
   if ((is_ul + is_dl) != 1)
     return next;
 
-  time_in_policer_periods =
-    clib_cpu_time_now () >> POLICER_TICKS_PER_PERIOD_SHIFT;
-
   len = vlib_buffer_length_in_chain (vm, b);
 
-  vec_foreach (qer_id, pdr->qer_ids)
+  vec_foreach (qer_idx, pdr->qer_indices)
   {
-    upf_qer_t *qer = pfcp_get_qer_by_id (r, *qer_id);
+    upf_qer_t *qer = vec_elt_at_index (r->qer, *qer_idx);
+    policer_read_response_type_st *p;
+    upf_qer_policer_shard_t *shard;
     upf_qer_policer_t *pol;
-    u32 col __attribute__((unused));
+    u8 col;
 
-    if (!qer)
+    if (qer->policer.value == ~0)
       continue;
 
-    if (!(qer->flags & PFCP_QER_MBR))
+    pol = pool_elt_at_index (gtm->qer_policers, qer->policer.value);
+
+    if (qer->gate_status[direction] != PFCP_GATE_OPEN)
+      {
+	vlib_increment_combined_counter
+	  (&gtm->qer_counters[UPF_QER_COUNTER_GATE_CLOSED], thread_index,
+	   qer->policer.value, 1, len);
+	return UPF_FORWARD_NEXT_DROP;
+      }
+
+    if (!pol->policed[direction])
       continue;
 
-    if (qer->gate_status[direction])
+    shard = vec_elt_at_index (pol->shards, thread_index);
+    shard->offered[direction] += len;
+    upf_qer_mark_active (gtm, thread_index, qer->policer.value);
+
+    p = &shard->policer[direction];
+    upf_policer_refill (p, time_in_policer_periods);
+    col = upf_policer_color (p, len);
+    /* a single rate policer has no yellow, its exceed means above the MBR */
+    if (pol->single_rate[direction] && col == POLICE_EXCEED)
+      col = POLICE_VIOLATE;
+
+    if (col == POLICE_VIOLATE)
       {
-	next = UPF_FORWARD_NEXT_DROP;
-	break;
+	vlib_increment_combined_counter
+	  (&gtm->qer_counters[UPF_QER_COUNTER_VIOLATE], thread_index,
+	   qer->policer.value, 1, len);
+	return UPF_FORWARD_NEXT_DROP;
       }
 
-    pol = pool_elt_at_index (gtm->qer_policers, qer->policer.value);
-    col =
-      vnet_police_packet (&pol->policer[direction], len, POLICE_CONFORM,
-			  time_in_policer_periods);
-    clib_warning ("QER color: %d\n", col);
+    if (PREDICT_FALSE (n_levels == UPF_QER_MAX_LEVELS))
+      {
+	/* deeper than any sane hierarchy, charge right away */
+	upf_policer_charge (p, len, col);
+	vlib_increment_combined_counter (&gtm->qer_counters[col],
+					 thread_index, qer->policer.value,
+					 1, len);
+      }
+    else
+      {
+	level[n_levels] = p;
+	level_policer[n_levels] = qer->policer.value;
+	level_color[n_levels] = col;
+	n_levels++;
+      }
+
+    color = clib_max (color, col);
   }
 
+  for (i = 0; i < n_levels; i++)
+    {
+      upf_policer_charge (level[i], len, level_color[i]);
+      vlib_increment_combined_counter (&gtm->qer_counters[level_color[i]],
+				       thread_index, level_policer[i], 1,
+				       len);
+    }
+
+  if (color == POLICE_EXCEED && gtm->qer_yellow_dscp != ~0)
+    upf_qer_remark_dscp (b, gtm->qer_yellow_dscp);
+
   return next;
 }
 
+u8 *
+format_upf_qer_policer (u8 * s, va_list * args)
+{
+  u32 policer_index = va_arg (*args, u32);
+  int verbose = va_arg (*args, int);
+  upf_main_t *gtm = &upf_main;
+  upf_qer_policer_t *pol;
+  u32 indent = format_get_indent (s);
+  vlib_counter_t c;
+  int i;
+
+  pol = pool_elt_at_index (gtm->qer_policers, policer_index);
+  s = format (s, "%u, refs %llu\n", policer_index, pol->ref_cnt);
+
+  for (i = 0; i < UPF_QER_N_COUNTERS; i++)
+    {
+      vlib_get_combined_counter (&gtm->qer_counters[i], policer_index, &c);
+      s = format (s, "%U%-12s %llu packets, %llu bytes\n",
+		  format_white_space, indent + 2,
+		  gtm->qer_counters[i].name, c.packets, c.bytes);
+    }
+
+  if (verbose)
+    {
+      upf_qer_policer_shard_t *sh;
 
+      vec_foreach (sh, pol->shards)
+      {
+	s = format (s, "%Uthread %u: UL %u kbps, DL %u kbps\n",
+		    format_white_space, indent + 2, sh - pol->shards,
+		    pol->policed[UPF_UL] ? sh->cir_kbps[UPF_UL] : 0,
+		    pol->policed[UPF_DL] ? sh->cir_kbps[UPF_DL] : 0);
+      }
+    }
 
+  return s;
+}
 
 static const char *apply_action_flags[] = {
   "DROP",
@@ -2666,6 +3821,14 @@ format_pfcp_session (u8 * s, va_list * args)
 	      rules->inactivity_timer.period,
 	      vlib_time_now (gtm->vlib_main) - sx->last_ul_traffic,
 	      rules->inactivity_timer.handle);
+  if (sx->bar.flags & UPF_BAR_PRESENT)
+    s = format (s, "  BAR: %u, Suggested Buffering Packets Count: %u, "
+		"DL Data Notification Delay: %u ms\n",
+		sx->bar.id, sx->bar.suggested_buffering_packets_count,
+		sx->bar.dl_data_notification_delay * 50);
+  if (sx->dl_buffered != 0)
+    s = format (s, "  DL Buffered: %u packets%s\n", sx->dl_buffered,
+		sx->dl_data_reported ? ", reported" : "");
 
   if (gtm->pfcp_spec_version == 16)
     {
@@ -2839,6 +4002,9 @@ format_pfcp_session (u8 * s, va_list * args)
 		    format_urr_time, &urr->time_quota,
 		    format_urr_time, &urr->time_threshold);
       }
+    if (urr->monitoring_epoch != 0)
+      s = format (s, "  Monitoring Time reached in epoch %u\n",
+		  urr->monitoring_epoch);
     if (urr->monitoring_time.vlib_time != INFINITY)
       {
 	f64 now = unix_time_now ();
@@ -2890,19 +4056,23 @@ format_pfcp_session (u8 * s, va_list * args)
 	f64 now = vlib_time_now (vm);
 	upf_urr_traffic_t *tt;
 
-	s = format (s, "  Start Of Traffic UE IPs: %u, now: %U\n"
+	s = format (s, "  Start Of Traffic UE IPs: %u of %u slots, now: %U\n"
 		    "    Timer: %U\n",
-		    pool_elts (urr->traffic),
+		    urr->traffic->n_entries, urr->traffic->mask + 1,
 		    format_vlib_time, vm, now,
 		    format_urr_time, &urr->traffic_timer);
 
-	pool_foreach (tt, urr->traffic)
-	{
-	  s = format (s, "%U @ %U [%U]\n",
-		      format_ip46_address, &tt->ip, IP46_TYPE_ANY,
-		      format_vlib_time, vm, tt->first_seen,
-		      format_vlib_time, vm, now - tt->first_seen);
-	}
+	for (tt = urr->traffic->slots;
+	     tt <= urr->traffic->slots + urr->traffic->mask; tt++)
+	  {
+	    if (tt->state != UPF_URR_TRAFFIC_USED)
+	      continue;
+
+	    s = format (s, "%U @ %U, idle %.3f secs\n",
+			format_ip46_address, &tt->ip, IP46_TYPE_ANY,
+			format_vlib_time, vm, tt->first_seen,
+			now - tt->last_seen);
+	  }
       }
   }
   vec_foreach (qer, rules->qer)
@@ -2916,6 +4086,15 @@ format_pfcp_session (u8 * s, va_list * args)
 		  format_flags, (u64)qer->gate_status[UPF_UL], qer_gate_status_flags,
 		  qer->gate_status[UPF_DL],
 		  format_flags, (u64)qer->gate_status[UPF_DL], qer_gate_status_flags);
+      if (qer->flags & PFCP_QER_MBR)
+	s = format (s, "  MBR: UL %llu kbps, DL %llu kbps\n",
+		    qer->mbr.ul, qer->mbr.dl);
+      if (qer->flags & PFCP_QER_GBR)
+	s = format (s, "  GBR: UL %llu kbps, DL %llu kbps\n",
+		    qer->gbr.ul, qer->gbr.dl);
+      if (qer->policer.value != ~0)
+	s = format (s, "  Policer: %U", format_upf_qer_policer,
+		    qer->policer.value, 0);
       /* *INDENT-ON* */
   }
   return s;
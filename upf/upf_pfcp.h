@@ -70,6 +70,9 @@ pfcp_get_rules (upf_session_t * sx, int rules)
 
 void vlib_free_combined_counter (vlib_combined_counter_main_t * cm);
 
+void upf_urr_acc_reset (upf_session_t * sx, u32 n_urrs);
+void upf_urr_acc_merge (upf_session_t * sx, upf_urr_t * urrs);
+
 u32 process_urrs (vlib_main_t * vm, upf_session_t * sess,
 		  const char *node_name,
 		  struct rules *active,
@@ -78,13 +81,91 @@ u32 process_urrs (vlib_main_t * vm, upf_session_t * sess,
 u32 process_qers (vlib_main_t * vm, upf_session_t * sess,
 		  struct rules *r,
 		  upf_pdr_t * pdr, vlib_buffer_t * b,
-		  u8 is_dl, u8 is_ul, u32 next);
+		  u8 is_dl, u8 is_ul, u64 time_in_policer_periods, u32 next);
+
+/* URR usage of the packets of one frame, summed up per PDR and direction */
+#define UPF_URR_BATCH_SIZE 8
+
+typedef struct
+{
+  upf_session_t *sess;
+  struct rules *active;
+  upf_pdr_t *pdr;
+  u64 bytes;
+  u64 headroom;			/* bytes until a URR reaches its budget */
+  u32 packets;
+  u8 is_dl;
+  u8 is_ul;
+  u8 flags;
+#define UPF_URR_BATCH_SLOW		BIT(0)	/* account packet by packet */
+#define UPF_URR_BATCH_OVER_QUOTA	BIT(1)
+} upf_urr_batch_entry_t;
+
+typedef struct
+{
+  upf_urr_batch_entry_t entries[UPF_URR_BATCH_SIZE];
+  u32 n_entries;
+  u32 last;			/* entry of the previous packet */
+  u32 monitoring_epoch;		/* as read at the start of the frame */
+} upf_urr_batch_t;
+
+upf_urr_batch_entry_t *upf_urr_batch_get (vlib_main_t * vm,
+					  upf_urr_batch_t * batch,
+					  upf_session_t * sess,
+					  struct rules *active,
+					  upf_pdr_t * pdr, u8 is_dl, u8 is_ul);
+u32 upf_urr_batch_cross (vlib_main_t * vm, upf_urr_batch_t * batch,
+			 upf_urr_batch_entry_t * e, const char *node_name,
+			 vlib_buffer_t * b, u32 next);
+void upf_urr_batch_flush (vlib_main_t * vm, upf_urr_batch_t * batch);
+
+always_inline void
+upf_urr_batch_init (upf_urr_batch_t * batch)
+{
+  batch->n_entries = 0;
+  batch->last = 0;
+  /* the only Monitoring Time check of the frame */
+  batch->monitoring_epoch = upf_main.monitoring_epoch;
+}
+
+/*
+ * Add a packet to the URR usage of the frame, process_urrs for frames.
+ * The usage is accounted by upf_urr_batch_flush at the end of the frame.
+ */
+always_inline u32
+upf_urr_batch_add (vlib_main_t * vm, upf_urr_batch_t * batch,
+		   upf_session_t * sess, const char *node_name,
+		   struct rules *active, upf_pdr_t * pdr, vlib_buffer_t * b,
+		   u8 is_dl, u8 is_ul, u32 next)
+{
+  upf_urr_batch_entry_t *e = &batch->entries[batch->last];
+  u32 len;
+
+  if (PREDICT_FALSE (batch->n_entries == 0 || e->pdr != pdr ||
+		     e->is_dl != is_dl || e->is_ul != is_ul))
+    e = upf_urr_batch_get (vm, batch, sess, active, pdr, is_dl, is_ul);
+
+  if (PREDICT_FALSE (e->flags & UPF_URR_BATCH_SLOW))
+    return upf_urr_batch_cross (vm, batch, e, node_name, b, next);
+
+  len = vlib_buffer_length_in_chain (vm, b);
+  if (PREDICT_FALSE (e->bytes + len >= e->headroom))
+    return upf_urr_batch_cross (vm, batch, e, node_name, b, next);
+
+  e->packets++;
+  e->bytes += len;
+
+  return (e->flags & UPF_URR_BATCH_OVER_QUOTA) ?
+    UPF_FORWARD_NEXT_DROP : next;
+}
 
 void upf_pfcp_error_report (upf_session_t * sx, gtp_error_ind_t * error);
+void upf_urr_traffic_rebuild (upf_urr_t * urr, ip46_address_t * unlisted);
 
 /* format functions */
 u8 *format_pfcp_node_association (u8 * s, va_list * args);
 u8 *format_upf_far (u8 * s, va_list * args);
+u8 *format_upf_qer_policer (u8 * s, va_list * args);
 u8 *format_pfcp_session (u8 * s, va_list * args);
 u8 *format_pfcp_endpoint_key (u8 * s, va_list * args);
 u8 *format_network_instance_index (u8 * s, va_list * args);
@@ -159,6 +240,50 @@ flow_pdr_idx (flow_entry_t * flow, flow_direction_t direction,
   return pdr ? pdr - r->pdr : ~0;
 }
 
+/*
+ * A flow classified under an older generation only has to be classified
+ * again when a rule update may have changed its first matching PDR. That
+ * is the case if a touched PDR has the same or a higher priority than the
+ * PDR the flow matched, or if the update is too old to be known.
+ */
+always_inline int
+upf_flow_needs_reclassify (upf_session_t * sx, flow_entry_t * flow,
+			   struct rules *r)
+{
+  u16 age = sx->generation - flow->generation;
+  u32 threshold = ~0;
+  flow_direction_t d;
+  u16 g;
+
+  if (age > UPF_RECLASSIFY_HISTORY)
+    return 1;
+
+  for (g = flow->generation + 1; age--; g++)
+    threshold = clib_min (threshold, sx->reclassify_precedence
+			  [g % UPF_RECLASSIFY_HISTORY]);
+
+  if (threshold == ~0)
+    return 0;
+
+  for (d = FT_ORIGIN; d < FT_ORDER_MAX; d++)
+    {
+      upf_pdr_t *pdr;
+
+      if (flow_next (flow, d) == FT_NEXT_CLASSIFY)
+	continue;
+
+      /* no match so far, a new PDR might match now */
+      if (flow_pdr_id (flow, d) == ~0)
+	return 1;
+
+      pdr = pfcp_get_pdr_by_id (r, flow_pdr_id (flow, d));
+      if (!pdr || pdr->precedence >= threshold)
+	return 1;
+    }
+
+  return 0;
+}
+
 #endif /* _UPF_PFCP_H_ */
 
 /*
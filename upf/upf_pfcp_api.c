@@ -58,7 +58,6 @@
 #endif
 
 #define API_VERSION      1
-#define TRAFFIC_TIMER_PERIOD 60
 
 extern char *vpe_version_string;
 
@@ -1757,11 +1756,11 @@ handle_create_urr (upf_session_t * sx, pfcp_create_urr_t * create_urr,
     create->measurement_period.handle =
       create->time_threshold.handle =
       create->time_quota.handle = create->quota_validity_time.handle =
-      create->traffic_timer.handle = ~0;
+      create->traffic_timer.handle = create->monitoring_timer.handle = ~0;
     create->monitoring_time.vlib_time = INFINITY;
     create->time_of_first_packet = INFINITY;
     create->time_of_last_packet = INFINITY;
-    create->traffic_timer.period = TRAFFIC_TIMER_PERIOD;
+    create->traffic_timer.period = UPF_URR_TRAFFIC_TIMEOUT;
     create->traffic_timer.base = now;
 
     create->id = urr->urr_id;
@@ -2035,6 +2034,8 @@ handle_create_qer (upf_session_t * sx, pfcp_create_qer_t * create_qer,
       OPT (qer, CREATE_QER_QER_CORRELATION_ID, qer_correlation_id,
 	   (u64) (sx - gtm->sessions) << 32 | create->id);
     create->policer.value = ~0;
+    if (ISSET_BIT (qer->grp.fields, CREATE_QER_QER_CORRELATION_ID))
+      create->flags |= PFCP_QER_CORRELATED;
 
     create->gate_status[UPF_UL] = qer->gate_status.ul;
     create->gate_status[UPF_DL] = qer->gate_status.dl;
@@ -2045,7 +2046,12 @@ handle_create_qer (upf_session_t * sx, pfcp_create_qer_t * create_qer,
 	create->mbr = qer->mbr;
       }
 
-    //TODO: gbr;
+    if (ISSET_BIT (qer->grp.fields, CREATE_QER_GBR))
+      {
+	create->flags |= PFCP_QER_GBR;
+	create->gbr = qer->gbr;
+      }
+
     //TODO: packet_rate;
     //TODO: dl_flow_level_marking;
     //TODO: qos_flow_identifier;
@@ -2081,9 +2087,16 @@ handle_update_qer (upf_session_t * sx, pfcp_update_qer_t * update_qer,
 	goto out_error;
       }
 
-    update->policer.key =
-      (ISSET_BIT (qer->grp.fields, UPDATE_QER_QER_CORRELATION_ID)) ?
-      qer->qer_correlation_id : (u64) (sx - gtm->sessions) << 32 | update->id;
+    if (ISSET_BIT (qer->grp.fields, UPDATE_QER_QER_CORRELATION_ID))
+      {
+	update->flags |= PFCP_QER_CORRELATED;
+	update->policer.key = qer->qer_correlation_id;
+      }
+    else
+      {
+	update->flags &= ~PFCP_QER_CORRELATED;
+	update->policer.key = (u64) (sx - gtm->sessions) << 32 | update->id;
+      }
     update->policer.value = ~0;
 
     if (ISSET_BIT (qer->grp.fields, UPDATE_QER_GATE_STATUS))
@@ -2098,7 +2111,12 @@ handle_update_qer (upf_session_t * sx, pfcp_update_qer_t * update_qer,
 	update->mbr = qer->mbr;
       }
 
-    //TODO: gbr;
+    if (ISSET_BIT (qer->grp.fields, UPDATE_QER_GBR))
+      {
+	update->flags |= PFCP_QER_GBR;
+	update->gbr = qer->gbr;
+      }
+
     //TODO: packet_rate;
     //TODO: dl_flow_level_marking;
     //TODO: qos_flow_identifier;
@@ -2151,6 +2169,133 @@ out_error:
 
 #undef qer_error
 
+#define bar_error(r, bar, fmt, ...)					\
+  do {									\
+    tp_session_error_report ((r), "BAR ID %u, " fmt, (bar)->bar_id, ## __VA_ARGS__); \
+    response->failed_rule_id.id = bar->bar_id;				\
+  } while (0)
+
+/*
+ * PFCP allows only one BAR per session, it is not part of the rule sets
+ * and takes effect right away
+ */
+static int
+handle_create_bar (upf_session_t * sx, pfcp_create_bar_t * create_bar,
+		   pfcp_session_procedure_response_t * response)
+{
+  pfcp_create_bar_t *bar;
+
+  if (vec_len (create_bar) == 0)
+    return 0;
+
+  bar = vec_elt_at_index (create_bar, 0);
+  if (vec_len (create_bar) > 1 || (sx->bar.flags & UPF_BAR_PRESENT))
+    {
+      bar_error (response, bar, "only one BAR per session");
+      goto out_error;
+    }
+
+  sx->bar.id = bar->bar_id;
+  sx->bar.flags = UPF_BAR_PRESENT;
+  sx->bar.suggested_buffering_packets_count =
+    ISSET_BIT (bar->grp.fields,
+	       CREATE_BAR_SUGGESTED_BUFFERING_PACKETS_COUNT) ?
+    bar->suggested_buffering_packets_count : 0;
+  sx->bar.dl_data_notification_delay =
+    ISSET_BIT (bar->grp.fields,
+	       CREATE_BAR_DOWNLINK_DATA_NOTIFICATION_DELAY) ?
+    bar->downlink_data_notification_delay : 0;
+
+  return 0;
+
+out_error:
+  response->cause = PFCP_CAUSE_RULE_CREATION_MODIFICATION_FAILURE;
+
+  SET_BIT (response->grp.fields, SESSION_PROCEDURE_RESPONSE_FAILED_RULE_ID);
+  response->failed_rule_id.type = FAILED_RULE_TYPE_BAR;
+
+  return -1;
+}
+
+static int
+handle_update_bar (upf_session_t * sx, pfcp_update_bar_request_t * update_bar,
+		   pfcp_session_procedure_response_t * response)
+{
+  pfcp_update_bar_request_t *bar;
+
+  vec_foreach (bar, update_bar)
+  {
+    if (!(sx->bar.flags & UPF_BAR_PRESENT) || sx->bar.id != bar->bar_id)
+      {
+	bar_error (response, bar, "not found");
+	goto out_error;
+      }
+
+    if (ISSET_BIT (bar->grp.fields,
+		   UPDATE_BAR_REQUEST_SUGGESTED_BUFFERING_PACKETS_COUNT))
+      sx->bar.suggested_buffering_packets_count =
+	bar->suggested_buffering_packets_count;
+    if (ISSET_BIT (bar->grp.fields,
+		   UPDATE_BAR_REQUEST_DOWNLINK_DATA_NOTIFICATION_DELAY))
+      sx->bar.dl_data_notification_delay =
+	bar->downlink_data_notification_delay;
+  }
+
+  return 0;
+
+out_error:
+  response->cause = PFCP_CAUSE_RULE_CREATION_MODIFICATION_FAILURE;
+
+  SET_BIT (response->grp.fields, SESSION_PROCEDURE_RESPONSE_FAILED_RULE_ID);
+  response->failed_rule_id.type = FAILED_RULE_TYPE_BAR;
+
+  return -1;
+}
+
+static int
+handle_remove_bar (upf_session_t * sx, pfcp_remove_bar_t * remove_bar,
+		   pfcp_session_procedure_response_t * response)
+{
+  pfcp_remove_bar_t *bar;
+
+  vec_foreach (bar, remove_bar)
+  {
+    if (!(sx->bar.flags & UPF_BAR_PRESENT) || sx->bar.id != bar->bar_id)
+      {
+	bar_error (response, bar, "unable to remove");
+	goto out_error;
+      }
+
+    clib_memset (&sx->bar, 0, sizeof (sx->bar));
+  }
+
+  return 0;
+
+out_error:
+  response->cause = PFCP_CAUSE_RULE_CREATION_MODIFICATION_FAILURE;
+
+  SET_BIT (response->grp.fields, SESSION_PROCEDURE_RESPONSE_FAILED_RULE_ID);
+  response->failed_rule_id.type = FAILED_RULE_TYPE_BAR;
+
+  return -1;
+}
+
+#undef bar_error
+
+/* drop the DL data buffered for a session, on request of the CP */
+static void
+pfcp_discard_buffered_data (upf_session_t * sx)
+{
+  vlib_main_t *vm = vlib_get_main ();
+
+  if (sx->dl_buffered == 0)
+    return;
+
+  vlib_worker_thread_barrier_sync (vm);
+  upf_dl_buffer_flush (sx, 1);
+  vlib_worker_thread_barrier_release (vm);
+}
+
 static pfcp_usage_report_t *
 init_usage_report (upf_urr_t * urr, u32 trigger,
 		   pfcp_usage_report_t ** report)
@@ -2185,16 +2330,14 @@ report_usage_ev (upf_session_t * sess, ip46_address_t * ue, upf_urr_t * urr,
 
   ASSERT (report);
 
-  clib_spinlock_lock (&sess->lock);
-
   volume = urr->volume;
   memset (&urr->volume.measure.packets, 0,
 	  sizeof (urr->volume.measure.packets));
   memset (&urr->volume.measure.bytes, 0, sizeof (urr->volume.measure.bytes));
 
+  /* Monitoring Time reached, but no usage after it merged yet */
   if (!(urr->status & URR_AFTER_MONITORING_TIME) &&
-      urr->monitoring_time.vlib_time != INFINITY &&
-      urr->monitoring_time.unix_time < now)
+      urr->monitoring_epoch != 0)
     {
       urr->usage_before_monitoring_time.volume = volume.measure;
       memset (&volume.measure.packets, 0, sizeof (volume.measure.packets));
@@ -2212,8 +2355,6 @@ report_usage_ev (upf_session_t * sess, ip46_address_t * ue, upf_urr_t * urr,
       urr->status |= URR_AFTER_MONITORING_TIME;
     }
 
-  clib_spinlock_unlock (&sess->lock);
-
   if (urr->status & URR_AFTER_MONITORING_TIME)
     {
       r =
@@ -2368,6 +2509,7 @@ report_usage_ev (upf_session_t * sess, ip46_address_t * ue, upf_urr_t * urr,
   /* SET_BIT(r->grp.fields, USAGE_REPORT_USAGE_INFORMATION); */
 
   urr->status &= ~URR_AFTER_MONITORING_TIME;
+  urr->monitoring_epoch = 0;
   urr->start_time += duration;
   if (urr->time_threshold.base)
     urr->time_threshold.base = urr->start_time;
@@ -2387,6 +2529,8 @@ upf_usage_report_build (upf_session_t * sx,
   clib_warning ("Usage Report:\n  LIUSA %U\n",
 	     format_bitmap_hex, report->liusa_bitmap);
 
+  upf_urr_acc_merge (sx, urr);
+
   vec_foreach_index (idx, report->events)
   {
     upf_usage_report_ev_t *r = vec_elt_at_index (report->events, idx);
@@ -2520,6 +2664,9 @@ handle_session_establishment_request (pfcp_msg_t * msg,
   if ((r = handle_create_urr (sess, req->create_urr, now, resp)) != 0)
     goto out_send_resp;
 
+  if ((r = handle_create_bar (sess, req->create_bar, resp)) != 0)
+    goto out_send_resp;
+
   r = pfcp_update_apply (sess);
   clib_warning ("Apply: %d\n", r);
 
@@ -2652,12 +2799,29 @@ handle_session_modification_request (pfcp_msg_t * msg,
       if ((r = handle_remove_qer (sess, req->remove_qer, now, resp)) != 0)
 	goto out_send_resp;
 
+      if ((r = handle_remove_bar (sess, req->remove_bar, resp)) != 0)
+	goto out_send_resp;
+
+      if ((r = handle_create_bar (sess, req->create_bar, resp)) != 0)
+	goto out_send_resp;
+
+      if ((r = handle_update_bar (sess, req->update_bar, resp)) != 0)
+	goto out_send_resp;
+
+      /* dropped before the new FARs could release the buffered data */
+      if (ISSET_BIT
+	  (req->grp.fields, SESSION_MODIFICATION_REQUEST_PFCPSMREQ_FLAGS)
+	  && req->pfcpsmreq_flags & PFCPSMREQ_DROBU)
+	pfcp_discard_buffered_data (sess);
+
       if ((r = pfcp_update_apply (sess)) != 0)
 	goto out_update_finish;
-
-      /* TODO: perhaps only increase it on PDR updates */
-      sess->generation++;
     }
+  else
+    if (ISSET_BIT
+	(req->grp.fields, SESSION_MODIFICATION_REQUEST_PFCPSMREQ_FLAGS)
+	&& req->pfcpsmreq_flags & PFCPSMREQ_DROBU)
+    pfcp_discard_buffered_data (sess);
 
   active = pfcp_get_rules (sess, PFCP_ACTIVE);
   upf_usage_report_init (&report, vec_len (active->urr));
@@ -2790,7 +2954,33 @@ handle_session_report_request (pfcp_msg_t * msg, pfcp_decoded_msg_t * dmsg)
 static int
 handle_session_report_response (pfcp_msg_t * msg, pfcp_decoded_msg_t * dmsg)
 {
-  return -1;
+  pfcp_session_report_response_t *resp = &dmsg->session_report_response;
+  pfcp_update_bar_response_t *bar;
+  upf_session_t *sess;
+
+  if (!(sess = pfcp_lookup (dmsg->seid)))
+    return -1;
+
+  vec_foreach (bar, resp->update_bar)
+  {
+    if (!(sess->bar.flags & UPF_BAR_PRESENT) || sess->bar.id != bar->bar_id)
+      continue;
+
+    if (ISSET_BIT (bar->grp.fields,
+		   UPDATE_BAR_RESPONSE_SUGGESTED_BUFFERING_PACKETS_COUNT))
+      sess->bar.suggested_buffering_packets_count =
+	bar->suggested_buffering_packets_count;
+    if (ISSET_BIT (bar->grp.fields,
+		   UPDATE_BAR_RESPONSE_DOWNLINK_DATA_NOTIFICATION_DELAY))
+      sess->bar.dl_data_notification_delay =
+	bar->downlink_data_notification_delay;
+  }
+
+  if (ISSET_BIT (resp->grp.fields, SESSION_REPORT_RESPONSE_PFCPSRRSP_FLAGS) &&
+      resp->pfcpsrrsp_flags & PFCPSRRSP_DROBU)
+    pfcp_discard_buffered_data (sess);
+
+  return 0;
 }
 
 void
@@ -581,6 +581,78 @@ upf_pfcp_session_up_deletion_report (upf_session_t * sx)
   pfcp_free_dmsg_contents (&dmsg);
 }
 
+/* TS 29.244 clause 5.2.4.1: first DL packet buffered with NOCP set */
+static void
+upf_pfcp_session_dl_data_report (upf_session_t * sx, u16 pdr_id)
+{
+  pfcp_decoded_msg_t dmsg = {
+    .type = PFCP_SESSION_REPORT_REQUEST
+  };
+  pfcp_session_report_request_t *req = &dmsg.session_report_request;
+  upf_main_t *gtm = &upf_main;
+
+  memset (req, 0, sizeof (*req));
+  SET_BIT (req->grp.fields, SESSION_REPORT_REQUEST_REPORT_TYPE);
+  req->report_type = REPORT_TYPE_DLDR;
+
+  SET_BIT (req->grp.fields, SESSION_REPORT_REQUEST_DOWNLINK_DATA_REPORT);
+  SET_BIT (req->downlink_data_report.grp.fields,
+	   DOWNLINK_DATA_REPORT_PDR_ID);
+  vec_add1 (req->downlink_data_report.pdr_id, pdr_id);
+
+  vlib_increment_simple_counter (&gtm->upf_simple_counters
+				 [UPF_DL_DATA_REPORTS],
+				 vlib_get_thread_index (), 0, 1);
+
+  upf_pfcp_server_send_session_request (sx, &dmsg);
+  pfcp_free_dmsg_contents (&dmsg);
+}
+
+/*
+ * Hold a DL Data Report back for the DL Data Notification Delay of the
+ * BAR (TS 29.244 clause 8.2.28), in 50 ms steps on the timer wheel
+ */
+static void
+upf_pfcp_session_delay_dl_data_report (upf_session_t * sx,
+				       upf_event_dldr_t * ev)
+{
+  pfcp_server_main_t *psm = &pfcp_server_main;
+  upf_event_dldr_t *d;
+  i64 interval;
+
+  pool_get (psm->delayed_dl_data_reports, d);
+  *d = *ev;
+
+  interval = sx->bar.dl_data_notification_delay * 50e-3 *
+    psm->timer.ticks_per_second;
+  interval = clib_max (interval, 1);
+  TW (tw_timer_start) (&psm->timer,
+		       ((0x80 | PFCP_SERVER_DL_DATA_REPORT) << 24) |
+		       (d - psm->delayed_dl_data_reports), 0, interval);
+}
+
+static void
+upf_pfcp_session_delayed_dl_data_report (u32 index)
+{
+  pfcp_server_main_t *psm = &pfcp_server_main;
+  upf_main_t *gtm = &upf_main;
+  upf_event_dldr_t *d;
+  upf_session_t *sx = 0;
+
+  if (pool_is_free_index (psm->delayed_dl_data_reports, index))
+    return;
+  d = pool_elt_at_index (psm->delayed_dl_data_reports, index);
+
+  if (!pool_is_free_index (gtm->sessions, d->session_idx))
+    sx = pool_elt_at_index (gtm->sessions, d->session_idx);
+
+  /* the session could have been replaced while the report was held */
+  if (sx && sx->cp_seid == d->cp_seid)
+    upf_pfcp_session_dl_data_report (sx, d->pdr_id);
+
+  pool_put (psm->delayed_dl_data_reports, d);
+}
+
 static void
 upf_pfcp_session_usage_report (upf_session_t * sx, ip46_address_t * ue,
 			       upf_event_urr_data_t * uev, f64 now)
@@ -609,6 +681,9 @@ upf_pfcp_session_usage_report (upf_session_t * sx, ip46_address_t * ue,
   SET_BIT (req->grp.fields, SESSION_REPORT_REQUEST_REPORT_TYPE);
   req->report_type = REPORT_TYPE_USAR;
 
+  /* thresholds and quotas are checked against the merged usage */
+  upf_urr_acc_merge (sx, active->urr);
+
   SET_BIT (req->grp.fields, SESSION_REPORT_REQUEST_USAGE_REPORT);
 
   upf_usage_report_init (&report, vec_len (active->urr));
@@ -619,17 +694,41 @@ upf_pfcp_session_usage_report (upf_session_t * sx, ip46_address_t * ue,
     if (!urr)
       continue;
 
-    if (ev->trigger & URR_START_OF_TRAFFIC)
+    if ((ev->trigger & URR_TRAFFIC_UNLISTED) && urr->traffic)
+      {
+	/* another packet of the address can have got it reported */
+	if (upf_urr_traffic_find (urr->traffic, ue))
+	  continue;
+	upf_urr_traffic_rebuild (urr, ue);
+      }
+    else if ((ev->trigger & URR_TRAFFIC_REBUILD) && urr->traffic &&
+	     urr->traffic->grow)
+      upf_urr_traffic_rebuild (urr, NULL);
+
+    if ((ev->trigger & URR_START_OF_TRAFFIC) &&
+	(urr->triggers & REPORTING_TRIGGER_START_OF_TRAFFIC))
       {
 	upf_usage_report_trigger (&report, urr - active->urr,
 				  USAGE_REPORT_TRIGGER_START_OF_TRAFFIC,
 				  urr->liusa_bitmap, now);
 	send = 1;
+      }
 
-	if (urr->traffic_timer.handle == ~0)
-	  {
-	    upf_pfcp_session_start_stop_urr_time (si, &urr->traffic_timer, 1);
-	  }
+    if ((ev->trigger & URR_STOP_OF_TRAFFIC) &&
+	(urr->triggers & REPORTING_TRIGGER_STOP_OF_TRAFFIC))
+      {
+	upf_usage_report_trigger (&report, urr - active->urr,
+				  USAGE_REPORT_TRIGGER_STOP_OF_TRAFFIC,
+				  urr->liusa_bitmap, now);
+	send = 1;
+      }
+
+    /* a new UE address expires no earlier than a timeout from now */
+    if ((ev->trigger & URR_START_OF_TRAFFIC) &&
+	urr->traffic_timer.handle == ~0)
+      {
+	urr->traffic_timer.base = now;
+	upf_pfcp_session_start_stop_urr_time (si, &urr->traffic_timer, 1);
       }
   }
 
@@ -675,6 +774,81 @@ upf_pfcp_session_usage_report (upf_session_t * sx, ip46_address_t * ue,
   upf_usage_report_free (&report);
 }
 
+/*
+ * Expire the UE addresses of a URR without traffic for the timeout,
+ * report their Stop of Traffic and rearm the timer for the earliest
+ * expiry of the remaining ones. Workers only ever move that expiry
+ * later, so the timer never fires too late.
+ */
+static void
+upf_pfcp_session_traffic_expire (upf_session_t * sx, upf_urr_t * urr,
+				 f64 now)
+{
+  upf_main_t *gtm = &upf_main;
+  u32 si = sx - gtm->sessions;
+  upf_urr_traffic_table_t *tt = urr->traffic;
+  ip46_address_t *stopped = NULL, *ip;
+  f64 vnow = vlib_time_now (gtm->vlib_main);
+  f64 oldest = INFINITY;
+  u32 i;
+
+  upf_pfcp_session_stop_urr_time (&urr->traffic_timer, now);
+
+  if (!tt)
+    return;
+
+  clib_spinlock_lock (&sx->lock);
+
+  for (i = 0; i <= tt->mask; i++)
+    {
+      upf_urr_traffic_t *t = &tt->slots[i];
+
+      if (t->state != UPF_URR_TRAFFIC_USED)
+	continue;
+
+      if (t->last_seen + UPF_URR_TRAFFIC_TIMEOUT <= vnow)
+	{
+	  vec_add1 (stopped, t->ip);
+	  /* lookups probe on, the slot is reused by the next insert */
+	  clib_atomic_store_rel_n (&t->state, UPF_URR_TRAFFIC_DELETED);
+	  tt->n_entries--;
+	}
+      else
+	oldest = clib_min (oldest, t->last_seen);
+    }
+
+  clib_spinlock_unlock (&sx->lock);
+
+  /* packet times are vlib time, the timers run on unix time */
+  if (oldest != INFINITY)
+    {
+      urr->traffic_timer.base = now - (vnow - oldest);
+      urr->traffic_timer.period = UPF_URR_TRAFFIC_TIMEOUT;
+      upf_pfcp_session_start_stop_urr_time (si, &urr->traffic_timer, 1);
+    }
+
+  if (!(urr->triggers & REPORTING_TRIGGER_STOP_OF_TRAFFIC))
+    goto out;
+
+  vec_foreach (ip, stopped)
+  {
+    upf_event_urr_data_t *uev = NULL;
+    upf_event_urr_data_t ev = {
+      .urr_id = urr->id,
+      .trigger = URR_STOP_OF_TRAFFIC,
+    };
+
+    upf_debug ("Stop Of Traffic UE IP: %U", format_ip46_address, ip,
+	       IP46_TYPE_ANY);
+    vec_add1 (uev, ev);
+    upf_pfcp_session_usage_report (sx, ip, uev, now);
+    vec_free (uev);
+  }
+
+out:
+  vec_free (stopped);
+}
+
 // FATEMEH: this is to send packet and its header
 void
 // change to get the header and send that
@@ -843,6 +1017,26 @@ upf_pfcp_session_start_stop_urr_time (u32 si, urr_time_t * t, u8 start_it)
     }
 }
 
+/*
+ * Have the workers account the usage of a URR after its Monitoring Time.
+ * The URR is tagged with the next epoch before that is published, a
+ * thread switches to the after slot of its accumulators with the first
+ * frame that sees the new epoch. The usage is split when it is merged.
+ */
+static void
+upf_urr_monitoring_time_reached (upf_urr_t * urr)
+{
+  upf_main_t *gtm = &upf_main;
+  u32 epoch = gtm->monitoring_epoch + 1;
+
+  if (PREDICT_FALSE (epoch == 0))
+    epoch = 1;
+
+  urr->monitoring_epoch = epoch;
+  CLIB_MEMORY_STORE_BARRIER ();
+  gtm->monitoring_epoch = epoch;
+}
+
 static void
 upf_pfcp_session_urr_timer (upf_session_t * sx, f64 now)
 {
@@ -854,6 +1048,7 @@ upf_pfcp_session_urr_timer (upf_session_t * sx, f64 now)
   u32 si = sx - gtm->sessions;
   upf_usage_report_t report;
   struct rules *active;
+  int drop = 0;
   u32 idx;
 
 #if CLIB_DEBUG > 1
@@ -861,6 +1056,7 @@ upf_pfcp_session_urr_timer (upf_session_t * sx, f64 now)
 #endif
 
   active = pfcp_get_rules (sx, PFCP_ACTIVE);
+  upf_urr_acc_merge (sx, active->urr);
 
   clib_warning ("upf_pfcp_session_urr_timer (%p, 0x%016" PRIx64 " @ %u, %.4f)\n"
 	     "  UP Inactivity Timer: %u secs, inactive %12.4f secs (0x%08x)",
@@ -1022,26 +1218,26 @@ upf_pfcp_session_urr_timer (upf_session_t * sx, f64 now)
 
     if (urr_check (urr->traffic_timer, now))
       {
-	upf_urr_traffic_t **expired = NULL;
-	upf_urr_traffic_t *tt = NULL;
-
 	urr_check_late (urr->traffic_timer, now);
+	upf_pfcp_session_traffic_expire (sx, urr, now);
+      }
 
-	pool_foreach (tt, urr->traffic)
-	{
-	  if (tt->first_seen + 60 < now)
-	    vec_add1 (expired, tt);
-	};
+    if (urr_check (urr->monitoring_timer, now))
+      {
+	urr_check_late (urr->monitoring_timer, now);
+	upf_pfcp_session_stop_urr_time (&urr->monitoring_timer, now);
+	urr->monitoring_timer.period = 0;
 
-	for (int i = 0; i < vec_len (expired); i++)
+	if (urr->status & URR_AFTER_MONITORING_TIME)
 	  {
-	    hash_unset_mem_free (&urr->traffic_by_ue, &expired[i]->ip);
-	    pool_put (urr->traffic, expired[i]);
+	    clib_warning ("Possible control plane bug:"
+			  " dropping the session 0x%016" PRIx64
+			  " instead of enqueueing 2nd Monitoring Time split",
+			  sx->cp_seid);
+	    drop = 1;
 	  }
-	vec_free (expired);
-
-	if (pool_elts (urr->traffic) != 0)
-	  upf_pfcp_session_start_stop_urr_time (si, &urr->traffic_timer, 1);
+	else
+	  upf_urr_monitoring_time_reached (urr);
       }
 
 #undef urr_check
@@ -1061,6 +1257,17 @@ upf_pfcp_session_urr_timer (upf_session_t * sx, f64 now)
       }
   }
 
+  if (PREDICT_FALSE (drop))
+    {
+      pfcp_free_dmsg_contents (&dmsg);
+      upf_usage_report_free (&report);
+
+      upf_pfcp_session_up_deletion_report (sx);
+      pfcp_disable_session (sx);
+      pfcp_free_session (sx);
+      return;
+    }
+
   if (req->report_type != 0)
     {
       upf_usage_report_build (sx, NULL, active->urr, now, &report,
@@ -1088,7 +1295,7 @@ upf_validate_session_timer (upf_session_t * sx)
   vec_foreach (urr, r->urr)
   {
     if (!urr_check (urr->measurement_period, now) &&
-	!(urr->monitoring_time.vlib_time != INFINITY) &&
+	!urr_check (urr->monitoring_timer, now) &&
 	!urr_check (urr->time_threshold, now) &&
 	!urr_check (urr->time_quota, now))
       continue;
@@ -1112,7 +1319,7 @@ upf_validate_session_timer (upf_session_t * sx)
   vec_foreach (urr, r->urr)
   {
     if (!urr_check (urr->measurement_period, now) &&
-	!urr_check (urr->monitoring_time, now) &&
+	!urr_check (urr->monitoring_timer, now) &&
 	!urr_check (urr->time_threshold, now) &&
 	!urr_check (urr->time_quota, now))
       continue;
@@ -1336,28 +1543,11 @@ static uword
 		if (!sx || sx->cp_seid != ueh->cp_seid)
 		  goto next_ev_urr;
 
-		if (!(ueh->status & URR_DROP_SESSION))
-		  {
-		    upf_debug
-		      ("URR Event on Session Idx: %wd, %p, UE: %U, Events: %u\n",
-		       ueh->session_idx, sx, format_ip46_address, &ueh->ue,
-		       IP46_TYPE_ANY, vec_len (uev));
-		    upf_pfcp_session_usage_report (sx, &ueh->ue, uev,
-						   psm->now);
-		  }
-		else
-		  {
-		    /*
-		     * The session has a fatal reporting issue such as
-		     * multiple Monitoring Time splits being queued
-		     */
-		    upf_debug
-		      ("URR Event on Session Idx: DROP: %wd, %p\n",
-		       ueh->session_idx, sx);
-		    upf_pfcp_session_up_deletion_report (sx);
-		    pfcp_disable_session (sx);
-		    pfcp_free_session (sx);
-		  }
+		upf_debug
+		  ("URR Event on Session Idx: %wd, %p, UE: %U, Events: %u\n",
+		   ueh->session_idx, sx, format_ip46_address, &ueh->ue,
+		   IP46_TYPE_ANY, vec_len (uev));
+		upf_pfcp_session_usage_report (sx, &ueh->ue, uev, psm->now);
 
 	      next_ev_urr:
 		vec_free_h (uev, sizeof (upf_event_urr_hdr_t));
@@ -1388,6 +1578,30 @@ static uword
       }
       break;
     }
+	case EVENT_DLDR:
+	  {
+	    for (int i = 0; i < vec_len (event_data); i++)
+	      {
+		upf_event_dldr_t *ev = (upf_event_dldr_t *) event_data[i];
+		upf_session_t *sx = 0;
+
+		if (!pool_is_free_index (gtm->sessions, ev->session_idx))
+		  sx = pool_elt_at_index (gtm->sessions, ev->session_idx);
+
+		/* the session could have been replaced in the meantime */
+		if (sx && sx->cp_seid == ev->cp_seid)
+		  {
+		    if (sx->bar.dl_data_notification_delay != 0)
+		      upf_pfcp_session_delay_dl_data_report (sx, ev);
+		    else
+		      upf_pfcp_session_dl_data_report (sx, ev->pdr_id);
+		  }
+
+		clib_mem_free (ev);
+	      }
+	    break;
+	  }
+
 	default:
 	  clib_warning ("event %ld, %p. ", event_type, event_data[0]);
 	  break;
@@ -1442,6 +1656,11 @@ static uword
 	      response_expired (psm->expired[i] & 0x00FFFFFF);
 	      break;
 
+	    case 0x80 | PFCP_SERVER_DL_DATA_REPORT:
+	      upf_pfcp_session_delayed_dl_data_report
+		(psm->expired[i] & 0x00FFFFFF);
+	      break;
+
 	    default:
 	      clib_warning ("timeout for unknown id: %u", psm->expired[i] >> 24);
 	      break;
@@ -1501,6 +1720,22 @@ void upf_pfcp_server_session_usage_report (upf_event_urr_data_t * uev)
 				(uword) uev);
 }
 
+void
+upf_pfcp_server_dl_data_report (u32 session_idx, u64 cp_seid, u16 pdr_id)
+{
+  pfcp_server_main_t *psm = &pfcp_server_main;
+  vlib_main_t *vm = psm->vlib_main;
+  upf_event_dldr_t *ev;
+
+  ev = clib_mem_alloc (sizeof (*ev));
+  ev->session_idx = session_idx;
+  ev->cp_seid = cp_seid;
+  ev->pdr_id = pdr_id;
+
+  vlib_process_signal_event_mt (vm, pfcp_api_process_node.index, EVENT_DLDR,
+				(uword) ev);
+}
+
 void upf_pfcp_server_fatemeh_packet_report(void * uev)
 {
   pfcp_server_main_t *psm = &pfcp_server_main;
@@ -31,6 +31,7 @@
 #define PFCP_SERVER_HB_TIMER 0
 #define PFCP_SERVER_T1       1
 #define PFCP_SERVER_RESPONSE 2
+#define PFCP_SERVER_DL_DATA_REPORT 3
 
 extern vlib_node_registration_t pfcp_api_process_node;
 
@@ -40,6 +41,7 @@ typedef enum
   EVENT_TX,
   EVENT_URR,
   EVENT_PACK,
+  EVENT_DLDR,
 } pfcp_process_event_t;
 
 typedef struct
@@ -91,6 +93,13 @@ typedef struct
   u8 *node_id;
 } pfcp_node_t;
 
+typedef struct
+{
+  uword session_idx;
+  u64 cp_seid;
+  u16 pdr_id;
+} upf_event_dldr_t;
+
 typedef struct
 {
   u32 seq_no;
@@ -111,6 +120,9 @@ typedef struct
 
   uword *free_msgs_by_node;
   u32 *expired;
+
+  /* DL Data Reports held back by the DL Data Notification Delay of a BAR */
+  upf_event_dldr_t *delayed_dl_data_reports;
 } pfcp_server_main_t;
 
 typedef struct
@@ -151,6 +163,8 @@ void upf_pfcp_session_up_deletion_report (upf_session_t * sx);
 
 void upf_pfcp_server_fatemeh_packet_report(void * uev);
 void upf_pfcp_server_session_usage_report (upf_event_urr_data_t * uev);
+void upf_pfcp_server_dl_data_report (u32 session_idx, u64 cp_seid,
+				     u16 pdr_id);
 void upf_pfcp_fatemeh_traffic_report (upf_session_t * sx, uword sIdx, flowtable_main_t * fm, u8 * p0, vlib_buffer_t * b0);
 clib_error_t *pfcp_server_main_init (vlib_main_t * vm);
 
@@ -49,7 +49,7 @@ void prepare_ee_data(flow_entry_t *flows){
   sh_new_strdup(usage_hash);
   shdefault(usage_hash, NULL);
     for(u32 i=0; i < num; i++){
-//      clib_warning("in the for the i is %d", i);
+//      ee_log_debug("in the for the i is %d", i);
       flow = pool_elt_at_index (flows, i);
       if (flow->stats[0].pkts!=0 || flow->stats[1].pkts!=0){
         usage_report_per_flow_t *new_data = malloc(sizeof(usage_report_per_flow_t));
@@ -86,58 +86,58 @@ void prepare_ee_data(flow_entry_t *flows){
 
         }
 
-        clib_warning("[1|flow_info] ip[1].  %s", new_data->src_ip);
-        clib_warning("[1|flow_info] ip[0].  %s", new_data->dst_ip);
-        clib_warning("[3| flow_info] port[0] %u", key.port[0]);
-        clib_warning("[4| flow_info] port[1] %u", key.port[1]);
-        clib_warning("[5| flow_info] portocol %u", key.proto);
-        clib_warning("[6| flow_info] stst 0 pkts %d", flow->stats[0].pkts);
-        clib_warning("[7| flow_info] stst 0 bytes %d", flow->stats[0].bytes);
-        clib_warning("[8| flow_info] stst 1 pkts %d", flow->stats[1].pkts);
-        clib_warning("[9| flow_info] stst 1 bytes %d", flow->stats[1].bytes);
+        ee_log_debug("[1|flow_info] ip[1].  %s", new_data->src_ip);
+        ee_log_debug("[1|flow_info] ip[0].  %s", new_data->dst_ip);
+        ee_log_debug("[3| flow_info] port[0] %u", key.port[0]);
+        ee_log_debug("[4| flow_info] port[1] %u", key.port[1]);
+        ee_log_debug("[5| flow_info] portocol %u", key.proto);
+        ee_log_debug("[6| flow_info] stst 0 pkts %llu", (unsigned long long) flow->stats[0].pkts);
+        ee_log_debug("[7| flow_info] stst 0 bytes %llu", (unsigned long long) flow->stats[0].bytes);
+        ee_log_debug("[8| flow_info] stst 1 pkts %llu", (unsigned long long) flow->stats[1].pkts);
+        ee_log_debug("[9| flow_info] stst 1 bytes %llu", (unsigned long long) flow->stats[1].bytes);
 
         new_data->seid = key.seid;
-        clib_warning("line 99 of prepare ee data");
+        ee_log_debug("line 99 of prepare ee data");
         new_data->src_port = key.port[1];
-        clib_warning("line 101 of prepare ee data");
+        ee_log_debug("line 101 of prepare ee data");
         new_data->dst_port = key.port[0];
-        clib_warning("line 103 of prepare ee data");
+        ee_log_debug("line 103 of prepare ee data");
         new_data->proto = key.proto;
-        clib_warning("line 105 of prepare ee data");
+        ee_log_debug("line 105 of prepare ee data");
         new_data->src_pkts = flow->stats[1].pkts;
-        clib_warning("line 107 of prepare ee data");
+        ee_log_debug("line 107 of prepare ee data");
         new_data->src_bytes = flow->stats[1].bytes;
-        clib_warning("line 109 of prepare ee data");
+        ee_log_debug("line 109 of prepare ee data");
         new_data->dst_pkts = flow->stats[0].pkts;
-        clib_warning("line 111 of prepare ee data");
+        ee_log_debug("line 111 of prepare ee data");
         new_data->dst_bytes = flow->stats[0].bytes;
-        clib_warning("line 113 of prepare ee data");
+        ee_log_debug("line 113 of prepare ee data");
         size_t hash_length = shlen(usage_hash);
-        clib_warning("line 115 of prepare ee data the hash size is %d",hash_length );
+        ee_log_debug("line 115 of prepare ee data the hash size is %zu",hash_length );
         usage_report_per_flow_t* usage_report_per_flow_vector = shget(usage_hash, new_data->src_ip);
-        clib_warning("line 117 of prepare ee data");
+        ee_log_debug("line 117 of prepare ee data");
 
         if(usage_report_per_flow_vector == NULL){
 
-          clib_warning("1'in the if of prepare ee data");
+          ee_log_debug("1'in the if of prepare ee data");
           usage_report_per_flow_vector = NULL;
           vec_add1(usage_report_per_flow_vector,*new_data);
-          clib_warning("2'in the if of prepare ee data");
+          ee_log_debug("2'in the if of prepare ee data");
         }
         else{
-          clib_warning("1'in the else of prepare ee data");
+          ee_log_debug("1'in the else of prepare ee data");
           vec_add1(usage_report_per_flow_vector,*new_data);
           shdel(usage_hash, new_data->src_ip);
-          clib_warning("2'in the else of prepare ee data");
+          ee_log_debug("2'in the else of prepare ee data");
         }
         hash_length = shlen(usage_hash);
-        clib_warning("[CRASH] before add, the hash size is %d",hash_length);
+        ee_log_debug("[CRASH] before add, the hash size is %zu",hash_length);
         shput(usage_hash, new_data->src_ip, usage_report_per_flow_vector);
         hash_length = shlen(usage_hash);
-        clib_warning("[CRASH] AFTER adding.the hash size is %d", hash_length);
+        ee_log_debug("[CRASH] AFTER adding.the hash size is %zu", hash_length);
       }
     }
-  clib_warning("end of prepare ee data");
+  ee_log_debug("end of prepare ee data");
 
   pthread_mutex_unlock(&ee_lock);
   return;
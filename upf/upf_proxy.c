@@ -777,24 +777,33 @@ proxy_add_segment_callback (u32 client_index, u64 segment_handle)
   return 0;
 }
 
+/*
+ * Nothing is dequeued until app detection has finished, so rx_buf mirrors
+ * the head of the rx fifo and only the newly arrived bytes are copied.
+ */
 static int
 proxy_rx_request (upf_proxy_session_t * ps)
 {
-  u32 max_dequeue;
+  u32 max_dequeue, have;
   int n_read;
 
   clib_warning ("psidx %d", proxy_session_index (ps));
 
-  max_dequeue = clib_min (svm_fifo_max_dequeue_cons (ps->rx_fifo), 4096);
+  max_dequeue = clib_min (svm_fifo_max_dequeue_cons (ps->rx_fifo),
+			  UPF_ADR_MAX_DATA);
   if (PREDICT_FALSE (max_dequeue == 0))
     return -1;
 
+  have = vec_len (ps->rx_buf);
+  if (max_dequeue <= have)
+    return 0;
+
   vec_validate (ps->rx_buf, max_dequeue);
-  n_read = app_recv_stream_raw (ps->rx_fifo, ps->rx_buf,
-				max_dequeue, 0, 1 /* peek */ );
-  ASSERT (n_read == max_dequeue);
+  n_read = svm_fifo_peek (ps->rx_fifo, have, max_dequeue - have,
+			  ps->rx_buf + have);
+  ASSERT (n_read == max_dequeue - have);
 
-  _vec_len (ps->rx_buf) = n_read;
+  _vec_len (ps->rx_buf) = have + clib_max (n_read, 0);
   return 0;
 }
 
@@ -921,15 +930,17 @@ proxy_rx_callback_static (session_t * s, upf_proxy_session_t * ps)
 
   /* proceed with app detection (a) */
   clib_warning ("proxy: %v", ps->rx_buf);
-  r = upf_application_detection (gtm->vlib_main, ps->rx_buf, flow, active);
+  r = upf_application_detection (gtm->vlib_main, ps->rx_buf,
+				 vec_len (ps->rx_buf), flow, active);
   clib_warning ("r: %d", r);
   switch (r)
     {
     case ADR_NEED_MORE_DATA:
       clib_warning ("ADR_NEED_MORE_DATA");
 
-      /* abort ADR scan after 4k of data */
-      if (svm_fifo_max_dequeue_cons (ps->rx_fifo) < 4096)
+      /* abort ADR scan after one full TLS record or a full rx fifo */
+      if (svm_fifo_max_dequeue_cons (ps->rx_fifo) < UPF_ADR_MAX_DATA &&
+	  svm_fifo_max_enqueue_prod (ps->rx_fifo) > 0)
 	break;
 
       /* FALL-THRU */
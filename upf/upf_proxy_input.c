@@ -305,9 +305,14 @@ upf_proxy_input (vlib_main_t * vm, vlib_node_runtime_t * node,
   u32 thread_index = vlib_get_thread_index ();
   u32 stats_sw_if_index, stats_n_packets, stats_n_bytes;
   u32 sw_if_index = 0;
+  u64 time_in_policer_periods;
   u32 next = 0;
   u32 len;
 
+  /* policer buckets are refilled once per frame */
+  time_in_policer_periods =
+    clib_cpu_time_now () >> POLICER_TICKS_PER_PERIOD_SHIFT;
+
   next_index = node->cached_next_index;
   stats_sw_if_index = node->runtime_data[0];
   stats_n_packets = stats_n_bytes = 0;
@@ -470,7 +475,8 @@ upf_proxy_input (vlib_main_t * vm, vlib_node_runtime_t * node,
 
 	      clib_warning ("pdr: %d, far: %d\n", pdr->id, far->id);
 	      next = process_qers (vm, sess, active, pdr, b,
-				   IS_DL (pdr, far), IS_UL (pdr, far), next);
+				   IS_DL (pdr, far), IS_UL (pdr, far),
+				   time_in_policer_periods, next);
 	      next = process_urrs (vm, sess, node_name, active, pdr, b,
 				   IS_DL (pdr, far), IS_UL (pdr, far), next);
 
@@ -0,0 +1,471 @@
+/*
+ * upf_quic.c - SNI detection in QUIC Initial packets
+ *
+ * Copyright (c) 2021 Travelping GmbH
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The ClientHello of a QUIC connection is carried in CRYPTO frames of the
+ * client Initial packets. Initial packets are protected with keys derived
+ * from the Destination Connection ID only (RFC 9001, Section 5.2), so an
+ * on-path observer can remove the packet protection and recover the SNI.
+ *
+ * The CRYPTO stream prefix is kept in a per-flow buffer until the
+ * server_name extension is complete. Frames within a packet may come in any
+ * order; across datagrams only data that extends the contiguous prefix is
+ * kept.
+ */
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <vppinfra/error.h>
+#include <vnet/vnet.h>
+
+#include <upf/upf.h>
+#include <upf/upf_app_db.h>
+
+#if CLIB_DEBUG > 1
+#define upf_debug clib_warning
+#else
+#define upf_debug(...)				\
+  do { } while (0)
+#endif
+
+#define QUIC_VERSION_1		0x00000001
+#define QUIC_VERSION_2		0x6b3343cf
+
+#define QUIC_HDR_FORM_LONG	0x80
+#define QUIC_HDR_FIXED_BIT	0x40
+
+#define QUIC_MAX_CID_LEN	20
+#define QUIC_MAX_HDR_LEN	512
+#define QUIC_HP_SAMPLE_LEN	16
+#define QUIC_AEAD_TAG_LEN	16
+#define QUIC_KEY_LEN		16
+#define QUIC_IV_LEN		12
+#define QUIC_SECRET_LEN		32
+
+#define QUIC_FRAME_PADDING		0x00
+#define QUIC_FRAME_PING			0x01
+#define QUIC_FRAME_ACK			0x02
+#define QUIC_FRAME_ACK_ECN		0x03
+#define QUIC_FRAME_CRYPTO		0x06
+#define QUIC_FRAME_CONNECTION_CLOSE	0x1c
+
+/* upper bound for the CRYPTO frames of one packet that are reordered */
+#define QUIC_MAX_CRYPTO_FRAMES	64
+
+#define quic_counter_inc(_c)					\
+  vlib_increment_simple_counter (&upf_main.upf_simple_counters[_c],	\
+				 vlib_get_thread_index (), 0, 1)
+
+typedef struct
+{
+  u32 version;
+  u8 initial_type;		/* long header packet type of Initial */
+  u8 salt[20];
+  const char *key_label;
+  const char *iv_label;
+  const char *hp_label;
+} quic_version_t;
+
+static const quic_version_t quic_versions[] = {
+  {
+   .version = QUIC_VERSION_1,
+   .initial_type = 0,
+   .salt = {0x38, 0x76, 0x2c, 0xf7, 0xf5, 0x59, 0x34, 0xb3, 0x4d, 0x17,
+	    0x9a, 0xe6, 0xa4, 0xc8, 0x0c, 0xad, 0xcc, 0xbb, 0x7f, 0x0a},
+   .key_label = "quic key",
+   .iv_label = "quic iv",
+   .hp_label = "quic hp",
+   },
+  {
+   .version = QUIC_VERSION_2,
+   .initial_type = 1,
+   .salt = {0x0d, 0xed, 0xe3, 0xde, 0xf7, 0x00, 0xa6, 0xdb, 0x81, 0x93,
+	    0x81, 0xbe, 0x6e, 0x26, 0x9d, 0xcb, 0xf9, 0xbd, 0x2e, 0xd9},
+   .key_label = "quicv2 key",
+   .iv_label = "quicv2 iv",
+   .hp_label = "quicv2 hp",
+   },
+};
+
+typedef struct
+{
+  u8 key[QUIC_KEY_LEN];
+  u8 iv[QUIC_IV_LEN];
+  u8 hp[QUIC_KEY_LEN];
+} quic_keys_t;
+
+typedef struct
+{
+  u64 offset;
+  u64 length;
+  u8 *data;
+} quic_crypto_frame_t;
+
+/* RFC 9000, Section 16: variable-length integer encoding */
+static_always_inline int
+quic_get_varint (u8 ** p, u8 * end, u64 * v)
+{
+  u8 *d = *p;
+  int len, i;
+
+  if (d >= end)
+    return -1;
+
+  len = 1 << (d[0] >> 6);
+  if (end - d < len)
+    return -1;
+
+  *v = d[0] & 0x3f;
+  for (i = 1; i < len; i++)
+    *v = (*v << 8) | d[i];
+
+  *p = d + len;
+  return 0;
+}
+
+/* RFC 8446, Section 7.1: HKDF-Expand-Label with an empty context */
+static int
+quic_hkdf_expand_label (const u8 * secret, const char *label,
+			u8 * out, int out_len)
+{
+  u8 info[2 + 1 + 255 + 1];
+  u8 t[QUIC_SECRET_LEN];
+  unsigned int t_len = sizeof (t);
+  int label_len = strlen (label);
+  int n = 0;
+
+  ASSERT (out_len <= QUIC_SECRET_LEN);
+
+  info[n++] = out_len >> 8;
+  info[n++] = out_len & 0xff;
+  info[n++] = 6 + label_len;
+  clib_memcpy_fast (info + n, "tls13 ", 6);
+  n += 6;
+  clib_memcpy_fast (info + n, label, label_len);
+  n += label_len;
+  info[n++] = 0;
+  /* single block is enough for SHA-256 output lengths */
+  info[n++] = 1;
+
+  if (!HMAC (EVP_sha256 (), secret, QUIC_SECRET_LEN, info, n, t, &t_len))
+    return -1;
+
+  clib_memcpy_fast (out, t, out_len);
+  return 0;
+}
+
+static int
+quic_derive_client_keys (const quic_version_t * qv, u8 * dcid, u8 dcid_len,
+			 quic_keys_t * keys)
+{
+  u8 initial_secret[QUIC_SECRET_LEN];
+  u8 client_secret[QUIC_SECRET_LEN];
+  unsigned int len = sizeof (initial_secret);
+
+  /* HKDF-Extract (salt, DCID) */
+  if (!HMAC (EVP_sha256 (), qv->salt, sizeof (qv->salt), dcid, dcid_len,
+	     initial_secret, &len))
+    return -1;
+
+  if (quic_hkdf_expand_label (initial_secret, "client in", client_secret,
+			      QUIC_SECRET_LEN) ||
+      quic_hkdf_expand_label (client_secret, qv->key_label, keys->key,
+			      QUIC_KEY_LEN) ||
+      quic_hkdf_expand_label (client_secret, qv->iv_label, keys->iv,
+			      QUIC_IV_LEN) ||
+      quic_hkdf_expand_label (client_secret, qv->hp_label, keys->hp,
+			      QUIC_KEY_LEN))
+    return -1;
+
+  return 0;
+}
+
+static int
+quic_hp_mask (const u8 * hp, const u8 * sample, u8 * mask)
+{
+  EVP_CIPHER_CTX *ctx;
+  int len, ok;
+
+  if (!(ctx = EVP_CIPHER_CTX_new ()))
+    return -1;
+
+  ok = EVP_EncryptInit_ex (ctx, EVP_aes_128_ecb (), NULL, hp, NULL) &&
+    EVP_CIPHER_CTX_set_padding (ctx, 0) &&
+    EVP_EncryptUpdate (ctx, mask, &len, sample, QUIC_HP_SAMPLE_LEN);
+
+  EVP_CIPHER_CTX_free (ctx);
+  return ok ? 0 : -1;
+}
+
+static int
+quic_aead_decrypt (const quic_keys_t * keys, u64 pn,
+		   const u8 * aad, int aad_len,
+		   const u8 * in, int in_len, u8 * out)
+{
+  EVP_CIPHER_CTX *ctx;
+  u8 nonce[QUIC_IV_LEN];
+  int i, len, ok;
+
+  if (in_len < QUIC_AEAD_TAG_LEN)
+    return -1;
+  in_len -= QUIC_AEAD_TAG_LEN;
+
+  clib_memcpy_fast (nonce, keys->iv, sizeof (nonce));
+  for (i = 0; i < 8; i++)
+    nonce[QUIC_IV_LEN - 1 - i] ^= (pn >> (8 * i)) & 0xff;
+
+  if (!(ctx = EVP_CIPHER_CTX_new ()))
+    return -1;
+
+  ok = EVP_DecryptInit_ex (ctx, EVP_aes_128_gcm (), NULL, NULL, NULL) &&
+    EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_SET_IVLEN, QUIC_IV_LEN, NULL) &&
+    EVP_DecryptInit_ex (ctx, NULL, NULL, keys->key, nonce) &&
+    EVP_DecryptUpdate (ctx, NULL, &len, aad, aad_len) &&
+    EVP_DecryptUpdate (ctx, out, &len, in, in_len) &&
+    EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_GCM_SET_TAG, QUIC_AEAD_TAG_LEN,
+			 (void *) (in + in_len)) &&
+    EVP_DecryptFinal_ex (ctx, out + len, &len) > 0;
+
+  EVP_CIPHER_CTX_free (ctx);
+  return ok ? in_len : -1;
+}
+
+/*
+ * Walk the frames of a decrypted Initial packet and add the CRYPTO data
+ * to the contiguous stream prefix in *crypto.
+ */
+static adr_result_t
+quic_collect_crypto (u8 * p, word len, u8 ** crypto)
+{
+  quic_crypto_frame_t frames[QUIC_MAX_CRYPTO_FRAMES];
+  u8 *end = p + len;
+  int n_frames = 0, progress, i;
+  u64 type, v, n;
+
+  while (p < end)
+    {
+      if (quic_get_varint (&p, end, &type))
+	return ADR_FAIL;
+
+      switch (type)
+	{
+	case QUIC_FRAME_PADDING:
+	case QUIC_FRAME_PING:
+	  break;
+
+	case QUIC_FRAME_ACK:
+	case QUIC_FRAME_ACK_ECN:
+	  /* largest acknowledged, delay, range count, first range */
+	  if (quic_get_varint (&p, end, &v) ||
+	      quic_get_varint (&p, end, &v) ||
+	      quic_get_varint (&p, end, &n) || quic_get_varint (&p, end, &v))
+	    return ADR_FAIL;
+	  /* gap and length per range, ECN counts */
+	  n = 2 * n + (type == QUIC_FRAME_ACK_ECN ? 3 : 0);
+	  while (n--)
+	    if (quic_get_varint (&p, end, &v))
+	      return ADR_FAIL;
+	  break;
+
+	case QUIC_FRAME_CONNECTION_CLOSE:
+	  return ADR_FAIL;
+
+	case QUIC_FRAME_CRYPTO:
+	  if (n_frames == QUIC_MAX_CRYPTO_FRAMES)
+	    return ADR_FAIL;
+	  if (quic_get_varint (&p, end, &frames[n_frames].offset) ||
+	      quic_get_varint (&p, end, &frames[n_frames].length) ||
+	      frames[n_frames].length > end - p)
+	    return ADR_FAIL;
+	  frames[n_frames].data = p;
+	  p += frames[n_frames].length;
+	  n_frames++;
+	  break;
+
+	default:
+	  /* no other frame types are permitted in Initial packets */
+	  upf_debug ("unexpected QUIC frame type 0x%llx", type);
+	  return ADR_FAIL;
+	}
+    }
+
+  /* merge everything that extends the contiguous prefix, frames may be
+   * reordered within the packet */
+  do
+    {
+      progress = 0;
+      for (i = 0; i < n_frames; i++)
+	{
+	  quic_crypto_frame_t *f = &frames[i];
+	  u64 have = vec_len (*crypto);
+	  u64 f_end = f->offset + f->length;
+
+	  if (f->offset > have || f_end <= have)
+	    continue;
+
+	  if (f_end > UPF_ADR_MAX_DATA)
+	    return ADR_FAIL;
+
+	  vec_add (*crypto, f->data + (have - f->offset), f_end - have);
+	  progress = 1;
+	}
+    }
+  while (progress);
+
+  return ADR_OK;
+}
+
+/*
+ * Decrypt the client Initial packet at p and collect its CRYPTO data.
+ * Returns the size of the QUIC packet on success, 0 if the packet is not
+ * a client Initial or -1 on a protection error.
+ */
+static word
+quic_process_initial (u8 * p, word len, u8 ** crypto)
+{
+  const quic_version_t *qv = NULL;
+  u8 hdr[QUIC_MAX_HDR_LEN];
+  u8 mask[QUIC_HP_SAMPLE_LEN];
+  u8 *d = p, *end = p + len, *dcid, *plain = NULL;
+  u8 dcid_len, scid_len, pn_len;
+  quic_keys_t keys;
+  u64 token_len, length, pn = 0;
+  word pn_offset, pkt_len;
+  u32 version;
+  int i, plain_len;
+  adr_result_t r;
+
+  if (len < 7 || (d[0] & (QUIC_HDR_FORM_LONG | QUIC_HDR_FIXED_BIT)) !=
+      (QUIC_HDR_FORM_LONG | QUIC_HDR_FIXED_BIT))
+    return 0;
+
+  version = clib_net_to_host_unaligned_mem_u32 ((u32 *) (d + 1));
+  for (i = 0; i < ARRAY_LEN (quic_versions); i++)
+    if (quic_versions[i].version == version)
+      qv = &quic_versions[i];
+  if (!qv || ((d[0] >> 4) & 0x3) != qv->initial_type)
+    return 0;
+  d += 5;
+
+  dcid_len = *d++;
+  if (dcid_len > QUIC_MAX_CID_LEN || end - d < dcid_len + 1)
+    return 0;
+  dcid = d;
+  d += dcid_len;
+
+  scid_len = *d++;
+  if (scid_len > QUIC_MAX_CID_LEN || end - d < scid_len)
+    return 0;
+  d += scid_len;
+
+  if (quic_get_varint (&d, end, &token_len) || token_len > end - d)
+    return 0;
+  d += token_len;
+
+  if (quic_get_varint (&d, end, &length) || length > end - d ||
+      length < 4 + QUIC_HP_SAMPLE_LEN)
+    return 0;
+
+  pn_offset = d - p;
+  pkt_len = pn_offset + length;
+  if (pn_offset + 4 > sizeof (hdr))
+    return 0;
+
+  quic_counter_inc (UPF_QUIC_INITIAL);
+
+  if (quic_derive_client_keys (qv, dcid, dcid_len, &keys) ||
+      quic_hp_mask (keys.hp, p + pn_offset + 4, mask))
+    goto error;
+
+  /* remove header protection on a copy, the packet is forwarded as is */
+  clib_memcpy_fast (hdr, p, pn_offset + 4);
+  hdr[0] ^= mask[0] & 0x0f;
+  pn_len = (hdr[0] & 0x03) + 1;
+  for (i = 0; i < pn_len; i++)
+    {
+      hdr[pn_offset + i] ^= mask[1 + i];
+      pn = (pn << 8) | hdr[pn_offset + i];
+    }
+
+  vec_validate (plain, length);
+  plain_len = quic_aead_decrypt (&keys, pn, hdr, pn_offset + pn_len,
+				 p + pn_offset + pn_len, length - pn_len,
+				 plain);
+  if (plain_len < 0)
+    {
+      vec_free (plain);
+      goto error;
+    }
+
+  r = quic_collect_crypto (plain, plain_len, crypto);
+  vec_free (plain);
+
+  return r == ADR_OK ? pkt_len : -1;
+
+error:
+  quic_counter_inc (UPF_QUIC_DECRYPT_ERROR);
+  return -1;
+}
+
+adr_result_t
+upf_adr_try_quic (u16 port, u8 * p, word len, u8 ** crypto, u8 ** uri)
+{
+  word pkt_len;
+  int n_initial = 0;
+  adr_result_t r;
+
+  /* a datagram may carry several coalesced QUIC packets */
+  while (len > 0)
+    {
+      pkt_len = quic_process_initial (p, len, crypto);
+      if (pkt_len < 0)
+	return ADR_FAIL;
+      if (pkt_len == 0)
+	break;
+
+      n_initial++;
+      p += pkt_len;
+      len -= pkt_len;
+    }
+
+  /* not a client Initial, e.g. a short header packet of a flow that
+   * started before the PDRs were installed */
+  if (!n_initial)
+    return ADR_FAIL;
+
+  if (vec_len (*crypto) == 0)
+    return ADR_NEED_MORE_DATA;
+
+  r = upf_adr_parse_client_hello (port, *crypto, vec_len (*crypto), uri);
+  if (r == ADR_OK)
+    quic_counter_inc (UPF_QUIC_SNI);
+  else if (r == ADR_NEED_MORE_DATA && vec_len (*crypto) >= UPF_ADR_MAX_DATA)
+    r = ADR_FAIL;
+
+  upf_debug ("QUIC CRYPTO: %u bytes, result %d", vec_len (*crypto), r);
+  return r;
+}
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */